@@ -67,10 +67,16 @@ const QString SettingsNames::netOnline = QStringLiteral("ONLINE");
 const QString SettingsNames::obsImapStartOffline = QStringLiteral("imap.offline");
 const QString SettingsNames::obsImapSslPemCertificate = QStringLiteral("imap.ssl.pemCertificate");
 const QString SettingsNames::imapSslPemPubKey = QStringLiteral("imap.ssl.pemPubKey");
+const QString SettingsNames::imapSslPersistSession = QStringLiteral("imap.ssl.persistSession");
 const QString SettingsNames::imapBlacklistedCapabilities = QStringLiteral("imap.capabilities.blacklist");
+const QString SettingsNames::imapCompressionLevel = QStringLiteral("imap.compress.level");
 const QString SettingsNames::imapUseSystemProxy = QStringLiteral("imap.proxy.system");
 const QString SettingsNames::imapNeedsNetwork = QStringLiteral("imap.needsNetwork");
 const QString SettingsNames::imapNumberRefreshInterval = QStringLiteral("imap.numberRefreshInterval");
+const QString SettingsNames::imapBackgroundSyncConnections = QStringLiteral("imap.backgroundSync.connections");
+const QString SettingsNames::imapBackgroundSyncMailboxes = QStringLiteral("imap.backgroundSync.mailboxes");
+const QString SettingsNames::imapListRecursive = QStringLiteral("imap.list.recursive");
+const QString SettingsNames::imapThreadingLocal = QStringLiteral("imap.threading.local");
 const QString SettingsNames::imapAccountIcon = QStringLiteral("imap.accountIcon");
 const QString SettingsNames::imapArchiveFolderName = QStringLiteral("imap.archiveFolderName");
 const QString SettingsNames::imapDefaultArchiveFolderName = QStringLiteral("Archive");
@@ -83,6 +89,7 @@ const QString SettingsNames::cacheOfflineNone = QStringLiteral("memory");
 const QString SettingsNames::cacheOfflineXDays = QStringLiteral("days");
 const QString SettingsNames::cacheOfflineAll = QStringLiteral("all");
 const QString SettingsNames::cacheOfflineNumberDaysKey = QStringLiteral("offline.cache.numDays");
+const QString SettingsNames::cacheOfflinePrefetchKey = QStringLiteral("offline.cache.prefetch");
 const QString SettingsNames::watchedFoldersKey = QStringLiteral("watchFolders");
 const QString SettingsNames::watchOnlyInbox = QStringLiteral("INBOX");
 const QString SettingsNames::watchSubscribed = QStringLiteral("subscribed");
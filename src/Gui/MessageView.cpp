@@ -23,6 +23,7 @@
 */
 
 #include <QKeyEvent>
+#include <QLabel>
 #include <QMenu>
 #include <QSettings>
 #include <QStackedLayout>
@@ -124,6 +125,11 @@ MessageView::MessageView(QWidget *parent, QSettings *settings, Plugins::PluginMa
     connect(externalElements, &ExternalElementsWidget::loadingEnabled, this, &MessageView::enableExternalData);
     fullMsgLayout->addWidget(externalElements, 1);
 
+    m_unavailableLabel = new QLabel(tr("The contents of this message are not available offline."), m_messageWidget);
+    m_unavailableLabel->setAlignment(Qt::AlignCenter);
+    m_unavailableLabel->hide();
+    fullMsgLayout->addWidget(m_unavailableLabel, 1);
+
     // put the actual messages into an extra horizontal view
     // this allows us easy usage of the trailing stretch and also to indent the message a bit
     m_msgLayout = new QHBoxLayout;
@@ -163,6 +169,7 @@ void MessageView::unsetPreviousMessage()
         delete w;
     }
     m_envelope->setMessage(QModelIndex());
+    m_unavailableLabel->hide();
     delete messageModel;
     messageModel = nullptr;
 }
@@ -213,19 +220,32 @@ void MessageView::setMessage(const QModelIndex &index)
     // by explicitly requesting the data
     message.data(Imap::Mailbox::RolePartData);
 
-    if (!message.data(Imap::Mailbox::RoleIsFetched).toBool()) {
+    if (!message.data(Imap::Mailbox::RoleMessageHasBodyStructure).toBool()) {
         // This happens when the message placeholder is already available in the GUI, but the actual message data haven't been
         // loaded yet. This is especially common with the threading model, but also with bigger unsynced mailboxes.
         // Note that the data might be already available in the cache, it's just that it isn't in the mailbox tree yet.
-        m_waitingMessageConns.emplace_back(
-                    connect(messageModel, &QAbstractItemModel::dataChanged, this, [this](const QModelIndex &topLeft){
-            if (topLeft.data(Imap::Mailbox::RoleIsFetched).toBool()) {
+        // The message might also be shown in the list already while its BODYSTRUCTURE is still on its way.
+        auto checkBodyStructure = [this](){
+            if (message.data(Imap::Mailbox::RoleMessageHasBodyStructure).toBool()) {
                 // OK, message is fully fetched now
                 showMessageNow();
+            } else if (message.data(Imap::Mailbox::RoleMessageBodyStructureUnavailable).toBool()) {
+                // Offline, and the structure was never cached. Keep waiting for the network to come back, though.
+                showMessageUnavailable();
             }
-        }));
-        m_loadingSpinner->setText(tr("Waiting\nfor\nMessage..."));
-        m_loadingSpinner->start();
+        };
+        m_waitingMessageConns.emplace_back(connect(messageModel, &QAbstractItemModel::dataChanged, this, checkBodyStructure));
+        if (m_netWatcher) {
+            // Going online doesn't touch the message, so ask for the structure again
+            m_waitingMessageConns.emplace_back(connect(m_netWatcher.data(), &Imap::Mailbox::NetworkWatcher::effectiveNetworkPolicyChanged,
+                                                       this, checkBodyStructure));
+        }
+        if (message.data(Imap::Mailbox::RoleMessageBodyStructureUnavailable).toBool()) {
+            showMessageUnavailable();
+        } else {
+            m_loadingSpinner->setText(tr("Waiting\nfor\nMessage..."));
+            m_loadingSpinner->start();
+        }
     } else {
         showMessageNow();
     }
@@ -234,7 +254,7 @@ void MessageView::setMessage(const QModelIndex &index)
 /** @short Implementation of the "hey, let's really display the message, its BODYSTRUCTURE is available now" */
 void MessageView::showMessageNow()
 {
-    Q_ASSERT(message.data(Imap::Mailbox::RoleIsFetched).toBool());
+    Q_ASSERT(message.data(Imap::Mailbox::RoleMessageHasBodyStructure).toBool());
 
     clearWaitingConns();
 
@@ -248,6 +268,7 @@ void MessageView::showMessageNow()
 
     m_loadingItems.clear();
     m_loadingSpinner->stop();
+    m_unavailableLabel->hide();
 
     m_envelope->setMessage(message);
 
@@ -279,6 +300,19 @@ void MessageView::showMessageNow()
     emit messageChanged();
 }
 
+/** @short Show at least the envelope of a message whose MIME structure cannot be obtained right now */
+void MessageView::showMessageUnavailable()
+{
+    if (!m_unavailableLabel->isHidden())
+        return;
+    m_loadingSpinner->stop();
+    m_envelope->setMessage(message);
+    tags->setTagList(message.data(Imap::Mailbox::RoleMessageFlags).toStringList());
+    m_unavailableLabel->show();
+    m_stack->setCurrentWidget(m_messageWidget);
+    emit messageChanged();
+}
+
 /** @short There's no point in waiting for the message to appear */
 void MessageView::clearWaitingConns()
 {
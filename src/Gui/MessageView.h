@@ -124,6 +124,7 @@ private:
     Imap::Message::Envelope envelope() const;
     QString quoteText() const;
     void showMessageNow();
+    void showMessageUnavailable();
     AbstractPartWidget *bodyWidget() const;
     void unsetPreviousMessage();
     void clearWaitingConns();
@@ -135,6 +136,7 @@ private:
     QBoxLayout *m_msgLayout;
     EnvelopeView *m_envelope;
     ExternalElementsWidget *externalElements;
+    QLabel *m_unavailableLabel;
     TagListWidget *tags;
     QPersistentModelIndex message;
     Cryptography::MessageModel *messageModel;
@@ -967,6 +967,7 @@ CachePage::CachePage(QWidget *parent, QSettings &s): QScrollArea(parent), Ui_Cac
     }
 
     offlineNumberOfDays->setValue(s.value(SettingsNames::cacheOfflineNumberDaysKey, QVariant(30)).toInt());
+    offlinePrefetch->setChecked(s.value(SettingsNames::cacheOfflinePrefetchKey, false).toBool());
 
     val = s.value(SettingsNames::watchedFoldersKey).toString();
     if (val == Common::SettingsNames::watchAll) {
@@ -987,6 +988,7 @@ CachePage::CachePage(QWidget *parent, QSettings &s): QScrollArea(parent), Ui_Cac
 void CachePage::updateWidgets()
 {
     offlineNumberOfDays->setEnabled(offlineXDays->isChecked());
+    offlinePrefetch->setEnabled(!offlineNope->isChecked());
     emit widgetsUpdated();
 }
 
@@ -1002,6 +1004,7 @@ void CachePage::save(QSettings &s)
         s.setValue(SettingsNames::cacheOfflineKey, SettingsNames::cacheOfflineNone);
 
     s.setValue(SettingsNames::cacheOfflineNumberDaysKey, offlineNumberOfDays->value());
+    s.setValue(SettingsNames::cacheOfflinePrefetchKey, offlinePrefetch->isChecked());
 
     if (watchAll->isChecked()) {
         s.setValue(SettingsNames::watchedFoldersKey, SettingsNames::watchAll);
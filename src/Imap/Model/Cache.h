@@ -24,6 +24,7 @@
 #define IMAP_MODEL_CACHE_H
 
 #include <functional>
+#include <QSet>
 #include <QUrl>
 #include "MailboxMetadata.h"
 #include "Imap/Parser/Message.h"
@@ -43,6 +44,9 @@ class AbstractCache
 {
 public:
 
+    /** @short A list of (UID, flags) pairs for bulk updates of message flags */
+    typedef QVector<QPair<uint, QStringList>> MessageFlagsList;
+
     /** @short Helper for retrieving all data about a particular message from the cache */
     struct MessageDataBundle {
         /** @short The UID of the message */
@@ -92,6 +96,10 @@ public:
     virtual bool childMailboxesFresh(const QString &mailbox) const = 0;
     /** @short Update cache info about the state of child mailboxes */
     virtual void setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data) = 0;
+    /** @short Return all mailboxes of the whole hierarchy as saved by setMailboxTreeSnapshot(), or an empty list */
+    virtual QList<MailboxMetadata> mailboxTreeSnapshot() const = 0;
+    /** @short Remember the complete mailbox hierarchy as obtained from a single recursive LIST */
+    virtual void setMailboxTreeSnapshot(const QList<MailboxMetadata> &mailboxes) = 0;
 
     /** @short Return previous known state of a mailbox */
     virtual SyncState mailboxSyncState(const QString &mailbox) const = 0;
@@ -118,6 +126,12 @@ public:
     virtual QStringList msgFlags(const QString &mailbox, const uint uid) const = 0;
     /** @short Save flags for one message in mailbox */
     virtual void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags) = 0;
+    /** @short Save flags for many messages in a mailbox at once
+
+    This is what the mailbox synchronization uses after a full FLAGS resync; the implementations are free to batch
+    the writes instead of persisting each message separately.
+    */
+    virtual void setMsgFlags(const QString &mailbox, const MessageFlagsList &flags) = 0;
 
     /** @short Return part data or a null QByteArray if none available */
     virtual QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const = 0;
@@ -131,6 +145,23 @@ public:
     /** @short Save information about how messages are threaded */
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading) = 0;
 
+    /** @short Add a piece of decoded text of a message into the full-text index
+
+    The @arg field is one of the LocalSearchField. The headers from the envelope are indexed automatically by the
+    setMessageMetadata(), so this is only needed for the body text.
+    */
+    virtual void indexMessageText(const QString &mailbox, const uint uid, const int field, const QString &text) = 0;
+    /** @short Make sure that the headers of all messages whose metadata are cached are present in the full-text index
+
+    Some caches might hold metadata which were saved before the index existed. Call this before searchIndex() and
+    indexedMessages() in order to get complete results.
+    */
+    virtual void catchUpSearchIndex(const QString &mailbox) = 0;
+    /** @short Return UIDs of messages which contain a word starting with @arg prefix in any of the @arg fields */
+    virtual QSet<uint> searchIndex(const QString &mailbox, const int fields, const QString &prefix) const = 0;
+    /** @short Return UIDs of messages whose headers are present in the full-text index */
+    virtual QSet<uint> indexedMessages(const QString &mailbox) const = 0;
+
     /** @short How many days is it OK not to mark entries as accessed? */
     virtual void setRenewalThreshold(const int days) = 0;
 
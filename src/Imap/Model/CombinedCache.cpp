@@ -24,16 +24,45 @@
 #include "DiskPartCache.h"
 #include "SQLCache.h"
 
+namespace {
+
+/** @short How many messages shall have their metadata and flags kept in memory */
+const int hotMessagesLimit = 10000;
+/** @short Number of mailboxes whose sync state is kept in memory */
+const int hotMailboxesLimit = 100;
+/** @short Total size of all message parts which are kept in memory, in bytes */
+const int hotPartsLimit = 8 * 1024 * 1024;
+/** @short Message parts bigger than this are never kept in memory */
+const int hotPartMaxSize = 64 * 1024;
+
+}
+
 namespace Imap
 {
 namespace Mailbox
 {
 
+CombinedCache::HotTierStatistics::HotTierStatistics()
+    : metadataHits(0)
+    , metadataMisses(0)
+    , flagsHits(0)
+    , flagsMisses(0)
+    , syncStateHits(0)
+    , syncStateMisses(0)
+    , partHits(0)
+    , partMisses(0)
+{
+}
+
 CombinedCache::CombinedCache(const QString &name, const QString &cacheDir)
     : name(name)
     , cacheDir(cacheDir)
     , sqlCache(new SQLCache())
     , diskPartCache(new DiskPartCache(cacheDir))
+    , hotMetadata(hotMessagesLimit)
+    , hotFlags(hotMessagesLimit)
+    , hotSyncState(hotMailboxesLimit)
+    , hotParts(hotPartsLimit)
 {
     sqlCache->setErrorHandler([this](const QString &e) { this->m_errorHandler(e); });
     diskPartCache->setErrorHandler([this](const QString &e) { this->m_errorHandler(e); });
@@ -63,18 +92,37 @@ void CombinedCache::setChildMailboxes(const QString &mailbox, const QList<Mailbo
     sqlCache->setChildMailboxes(mailbox, data);
 }
 
+QList<MailboxMetadata> CombinedCache::mailboxTreeSnapshot() const
+{
+    return sqlCache->mailboxTreeSnapshot();
+}
+
+void CombinedCache::setMailboxTreeSnapshot(const QList<MailboxMetadata> &mailboxes)
+{
+    sqlCache->setMailboxTreeSnapshot(mailboxes);
+}
+
 SyncState CombinedCache::mailboxSyncState(const QString &mailbox) const
 {
-    return sqlCache->mailboxSyncState(mailbox);
+    if (SyncState *hot = hotSyncState.object(mailbox)) {
+        ++m_hotTierStats.syncStateHits;
+        return *hot;
+    }
+    ++m_hotTierStats.syncStateMisses;
+    SyncState res = sqlCache->mailboxSyncState(mailbox);
+    hotSyncState.insert(mailbox, new SyncState(res));
+    return res;
 }
 
 void CombinedCache::setMailboxSyncState(const QString &mailbox, const SyncState &state)
 {
     sqlCache->setMailboxSyncState(mailbox, state);
+    hotSyncState.insert(mailbox, new SyncState(state));
 }
 
 Imap::Uids CombinedCache::uidMapping(const QString &mailbox) const
 {
+    // The SQL cache keeps the mappings in memory on its own because it needs them for logging the changes
     return sqlCache->uidMapping(mailbox);
 }
 
@@ -92,39 +140,94 @@ void CombinedCache::clearAllMessages(const QString &mailbox)
 {
     sqlCache->clearAllMessages(mailbox);
     diskPartCache->clearAllMessages(mailbox);
+    forgetOrphanedBlobs();
+    ++m_mailboxGenerations[mailbox];
 }
 
 void CombinedCache::clearMessage(const QString mailbox, const uint uid)
 {
     sqlCache->clearMessage(mailbox, uid);
     diskPartCache->clearMessage(mailbox, uid);
+    forgetOrphanedBlobs();
+    const HotMessageKey key = hotKey(mailbox, uid);
+    hotMetadata.remove(key);
+    hotFlags.remove(key);
+    hotParts.remove(key);
 }
 
 QStringList CombinedCache::msgFlags(const QString &mailbox, const uint uid) const
 {
-    return sqlCache->msgFlags(mailbox, uid);
+    const HotMessageKey key = hotKey(mailbox, uid);
+    if (QStringList *hot = hotFlags.object(key)) {
+        ++m_hotTierStats.flagsHits;
+        return *hot;
+    }
+    ++m_hotTierStats.flagsMisses;
+    QStringList res = sqlCache->msgFlags(mailbox, uid);
+    hotFlags.insert(key, new QStringList(res));
+    return res;
 }
 
 void CombinedCache::setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags)
 {
     sqlCache->setMsgFlags(mailbox, uid, flags);
+    hotFlags.insert(hotKey(mailbox, uid), new QStringList(flags));
+}
+
+void CombinedCache::setMsgFlags(const QString &mailbox, const MessageFlagsList &flags)
+{
+    sqlCache->setMsgFlags(mailbox, flags);
+    for (const auto &item : flags) {
+        // Only refresh what is already hot; a bulk resync shall not evict everything else from the hot tier
+        const HotMessageKey key = hotKey(mailbox, item.first);
+        if (hotFlags.contains(key))
+            hotFlags.insert(key, new QStringList(item.second));
+    }
 }
 
 AbstractCache::MessageDataBundle CombinedCache::messageMetadata(const QString &mailbox, const uint uid) const
 {
-    return sqlCache->messageMetadata(mailbox, uid);
+    const HotMessageKey key = hotKey(mailbox, uid);
+    if (MessageDataBundle *hot = hotMetadata.object(key)) {
+        ++m_hotTierStats.metadataHits;
+        return *hot;
+    }
+    ++m_hotTierStats.metadataMisses;
+    MessageDataBundle res = sqlCache->messageMetadata(mailbox, uid);
+    hotMetadata.insert(key, new MessageDataBundle(res));
+    return res;
 }
 
 void CombinedCache::setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata)
 {
     sqlCache->setMessageMetadata(mailbox, uid, metadata);
+    hotMetadata.insert(hotKey(mailbox, uid), new MessageDataBundle(metadata));
 }
 
 QByteArray CombinedCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
 {
+    const HotMessageKey key = hotKey(mailbox, uid);
+    if (HotParts *hot = hotParts.object(key)) {
+        auto it = hot->constFind(partId);
+        if (it != hot->constEnd()) {
+            ++m_hotTierStats.partHits;
+            return *it;
+        }
+    }
+    ++m_hotTierStats.partMisses;
+
     QByteArray res = sqlCache->messagePart(mailbox, uid, partId);
     if (res.isEmpty()) {
-        res = diskPartCache->messagePart(mailbox, uid, partId);
+        QByteArray hash = sqlCache->messagePartHash(mailbox, uid, partId);
+        if (hash.isEmpty()) {
+            // Parts which were saved before the switch to content-addressed storage
+            res = diskPartCache->messagePart(mailbox, uid, partId);
+        } else {
+            res = diskPartCache->partBlob(hash);
+        }
+    }
+    if (!res.isEmpty() && res.size() <= hotPartMaxSize) {
+        rememberHotPart(key, partId, &res);
     }
     return res;
 }
@@ -134,14 +237,58 @@ void CombinedCache::setMsgPart(const QString &mailbox, const uint uid, const QBy
     if (data.size() < 1024 * 1024) {
         sqlCache->setMsgPart(mailbox, uid, partId, data);
     } else {
-        diskPartCache->setMsgPart(mailbox, uid, partId, data);
+        // The SQL cache only keeps track of the references, the data go to a file which is shared by all identical parts
+        QByteArray hash = SQLCache::contentHash(data);
+        sqlCache->setMsgPartReference(mailbox, uid, partId, hash);
+        if (!diskPartCache->hasPartBlob(hash)) {
+            diskPartCache->setPartBlob(hash, data);
+        }
     }
+    forgetOrphanedBlobs();
+
+    rememberHotPart(hotKey(mailbox, uid), partId, !data.isEmpty() && data.size() <= hotPartMaxSize ? &data : nullptr);
 }
 
 void CombinedCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
 {
     sqlCache->forgetMessagePart(mailbox, uid, partId);
     diskPartCache->forgetMessagePart(mailbox, uid, partId);
+    forgetOrphanedBlobs();
+    rememberHotPart(hotKey(mailbox, uid), partId, nullptr);
+}
+
+/** @short Remove the on-disk blobs which the SQL cache no longer refers to */
+void CombinedCache::forgetOrphanedBlobs()
+{
+    Q_FOREACH(const QByteArray &hash, sqlCache->takeOrphanedPartBlobs()) {
+        diskPartCache->forgetPartBlob(hash);
+    }
+}
+
+CombinedCache::HotMessageKey CombinedCache::hotKey(const QString &mailbox, const uint uid) const
+{
+    return HotMessageKey(mailbox, m_mailboxGenerations.value(mailbox), uid);
+}
+
+/** @short Keep the @arg data of a message part in memory, or forget about them if there are none */
+void CombinedCache::rememberHotPart(const HotMessageKey &key, const QByteArray &partId, const QByteArray *data) const
+{
+    HotParts parts;
+    if (HotParts *hot = hotParts.object(key))
+        parts = *hot;
+    if (data)
+        parts[partId] = *data;
+    else if (!parts.remove(partId))
+        return;
+
+    if (parts.isEmpty()) {
+        hotParts.remove(key);
+        return;
+    }
+    int cost = 0;
+    for (auto it = parts.constBegin(); it != parts.constEnd(); ++it)
+        cost += it->size();
+    hotParts.insert(key, new HotParts(parts), cost);
 }
 
 QVector<Imap::Responses::ThreadingNode> CombinedCache::messageThreading(const QString &mailbox)
@@ -154,10 +301,35 @@ void CombinedCache::setMessageThreading(const QString &mailbox, const QVector<Im
     sqlCache->setMessageThreading(mailbox, threading);
 }
 
+void CombinedCache::indexMessageText(const QString &mailbox, const uint uid, const int field, const QString &text)
+{
+    sqlCache->indexMessageText(mailbox, uid, field, text);
+}
+
+void CombinedCache::catchUpSearchIndex(const QString &mailbox)
+{
+    sqlCache->catchUpSearchIndex(mailbox);
+}
+
+QSet<uint> CombinedCache::searchIndex(const QString &mailbox, const int fields, const QString &prefix) const
+{
+    return sqlCache->searchIndex(mailbox, fields, prefix);
+}
+
+QSet<uint> CombinedCache::indexedMessages(const QString &mailbox) const
+{
+    return sqlCache->indexedMessages(mailbox);
+}
+
 void CombinedCache::setRenewalThreshold(const int days)
 {
     sqlCache->setRenewalThreshold(days);
 }
 
+CombinedCache::HotTierStatistics CombinedCache::hotTierStatistics() const
+{
+    return m_hotTierStats;
+}
+
 }
 }
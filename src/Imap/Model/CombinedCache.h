@@ -24,6 +24,7 @@
 #define IMAP_MODEL_COMBINEDCACHE_H
 
 #include <memory>
+#include <QCache>
 #include "Cache.h"
 
 namespace Imap
@@ -41,11 +42,14 @@ class DiskPartCache;
 This cache servers as a thin wrapper around the SQLCache. It uses
 the SQL facilities for most of the actual caching, but changes to
 a file-based cache when items are bigger than a certain threshold.
-
-In future, this should be extended with an in-memory cache (but
-only after the MemoryCache rework) which should only speed-up certain
-operations. This will likely be implemented when we will switch from
-storing the actual data in the various TreeItem* instances.
+Message parts are content-addressed, so identical data which appear
+in several messages or mailboxes are only stored once.
+
+Frequently accessed items (message metadata, flags, sync state and
+small message parts) are also kept in a bounded in-memory LRU tier in
+front of the SQL cache. The UID mappings are not duplicated there; the
+SQL cache keeps them in memory by itself. All writes go through to the lower
+tiers immediately, so the in-memory copies can be dropped at any time.
 */
 class CombinedCache : public AbstractCache
 {
@@ -63,6 +67,8 @@ public:
     QList<MailboxMetadata> childMailboxes(const QString &mailbox) const override;
     bool childMailboxesFresh(const QString &mailbox) const override;
     void setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data) override;
+    QList<MailboxMetadata> mailboxTreeSnapshot() const override;
+    void setMailboxTreeSnapshot(const QList<MailboxMetadata> &mailboxes) override;
 
     SyncState mailboxSyncState(const QString &mailbox) const override;
     void setMailboxSyncState(const QString &mailbox, const SyncState &state) override;
@@ -79,6 +85,7 @@ public:
 
     QStringList msgFlags(const QString &mailbox, const uint uid) const override;
     void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags) override;
+    void setMsgFlags(const QString &mailbox, const MessageFlagsList &flags) override;
 
     QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const override;
     void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data) override;
@@ -87,12 +94,63 @@ public:
     QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox) override;
     void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading) override;
 
+    void indexMessageText(const QString &mailbox, const uint uid, const int field, const QString &text) override;
+    void catchUpSearchIndex(const QString &mailbox) override;
+    QSet<uint> searchIndex(const QString &mailbox, const int fields, const QString &prefix) const override;
+    QSet<uint> indexedMessages(const QString &mailbox) const override;
+
     void setRenewalThreshold(const int days) override;
 
     /** @short Open a connection to the cache */
     bool open();
 
+    /** @short Counters of the in-memory tier, useful for tuning its size */
+    struct HotTierStatistics {
+        quint64 metadataHits;
+        quint64 metadataMisses;
+        quint64 flagsHits;
+        quint64 flagsMisses;
+        quint64 syncStateHits;
+        quint64 syncStateMisses;
+        quint64 partHits;
+        quint64 partMisses;
+
+        HotTierStatistics();
+    };
+
+    HotTierStatistics hotTierStatistics() const;
+
 private:
+    /** @short Identification of a message in the in-memory tier
+
+    The generation is bumped when all messages of a mailbox are forgotten, so that the stale entries simply age out
+    instead of having to be looked up.
+    */
+    struct HotMessageKey {
+        QString mailbox;
+        uint generation;
+        uint uid;
+
+        HotMessageKey(const QString &mailbox, const uint generation, const uint uid):
+            mailbox(mailbox), generation(generation), uid(uid) {}
+
+        friend bool operator==(const HotMessageKey &a, const HotMessageKey &b)
+        {
+            return a.uid == b.uid && a.generation == b.generation && a.mailbox == b.mailbox;
+        }
+
+        friend uint qHash(const HotMessageKey &key, uint seed = 0)
+        {
+            return qHash(key.mailbox, seed) ^ qHash(key.uid, seed) ^ key.generation;
+        }
+    };
+
+    typedef QHash<QByteArray, QByteArray> HotParts;
+
+    void forgetOrphanedBlobs();
+    HotMessageKey hotKey(const QString &mailbox, const uint uid) const;
+    void rememberHotPart(const HotMessageKey &key, const QByteArray &partId, const QByteArray *data) const;
+
     /** @short Name of the DB connection */
     QString name;
     /** @short Directory to serve as a cache root */
@@ -101,6 +159,16 @@ private:
     std::unique_ptr<SQLCache> sqlCache;
     /** @short Cache for bigger message parts */
     std::unique_ptr<DiskPartCache> diskPartCache;
+
+    mutable QCache<HotMessageKey, MessageDataBundle> hotMetadata;
+    mutable QCache<HotMessageKey, QStringList> hotFlags;
+    mutable QCache<QString, SyncState> hotSyncState;
+    /** @short Small message parts, grouped by message so that forgetting a message is cheap */
+    mutable QCache<HotMessageKey, HotParts> hotParts;
+    mutable HotTierStatistics m_hotTierStats;
+    /** @short How many times were all messages of a mailbox forgotten */
+    QHash<QString, uint> m_mailboxGenerations;
+
 };
 
 }
@@ -126,6 +126,40 @@ void DiskPartCache::forgetMessagePart(const QString &mailbox, const uint uid, co
     QFile(fileForPart(mailbox, uid, partId)).remove();
 }
 
+QByteArray DiskPartCache::partBlob(const QByteArray &hash) const
+{
+    QFile buf(fileForBlob(hash));
+    if (! buf.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return qUncompress(buf.readAll());
+}
+
+bool DiskPartCache::hasPartBlob(const QByteArray &hash) const
+{
+    return QFile::exists(fileForBlob(hash));
+}
+
+void DiskPartCache::setPartBlob(const QByteArray &hash, const QByteArray &data)
+{
+    QString myPath = cacheDir + QLatin1String("blobs");
+    QDir dir(myPath);
+    dir.mkpath(myPath);
+    QString fileName(fileForBlob(hash));
+    QFile buf(fileName);
+    if (! buf.open(QIODevice::WriteOnly)) {
+        m_errorHandler(QObject::tr("Couldn't save the blob %1 into file %2: %3 (%4)").arg(
+                           QString::fromUtf8(hash.toHex()), fileName, buf.errorString(), fileErrorToString(buf.error())));
+        return;
+    }
+    buf.write(qCompress(data));
+}
+
+void DiskPartCache::forgetPartBlob(const QByteArray &hash)
+{
+    QFile(fileForBlob(hash)).remove();
+}
+
 QString DiskPartCache::dirForMailbox(const QString &mailbox) const
 {
     return cacheDir + QString::fromUtf8(mailbox.toUtf8().toBase64());
@@ -136,6 +170,15 @@ QString DiskPartCache::fileForPart(const QString &mailbox, const uint uid, const
     return QStringLiteral("%1/%2_%3.cache").arg(dirForMailbox(mailbox), QString::number(uid), QString::fromUtf8(partId));
 }
 
+/** @short Content-addressed blobs live in a directory of their own
+
+The per-mailbox directories are named after base64-encoded mailbox names, so there's no risk of a clash.
+*/
+QString DiskPartCache::fileForBlob(const QByteArray &hash) const
+{
+    return QStringLiteral("%1blobs/%2.cache").arg(cacheDir, QString::fromUtf8(hash.toHex()));
+}
+
 void DiskPartCache::setErrorHandler(const std::function<void(const QString &)> &handler)
 {
     m_errorHandler = handler;
@@ -55,6 +55,15 @@ public:
     void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data);
     void forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId);
 
+    /** @short Return data of a content-addressed blob, or a null QByteArray if not found */
+    QByteArray partBlob(const QByteArray &hash) const;
+    /** @short Is there a content-addressed blob with the given @arg hash? */
+    bool hasPartBlob(const QByteArray &hash) const;
+    /** @short Store data of a content-addressed blob */
+    void setPartBlob(const QByteArray &hash, const QByteArray &data);
+    /** @short Remove a content-addressed blob which is no longer referenced */
+    void forgetPartBlob(const QByteArray &hash);
+
     /** @short Inform about runtime failures */
     void setErrorHandler(const std::function<void(const QString &)> &handler);
 
@@ -64,6 +73,8 @@ private:
 
     QString fileForPart(const QString &mailbox, const uint uid, const QByteArray &partId) const;
 
+    QString fileForBlob(const QByteArray &hash) const;
+
     /** @short The root directory for all caching */
     QString cacheDir;
 
@@ -23,6 +23,7 @@
 #include "ImapAccess.h"
 #include <QDir>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QSslKey>
 #include <QSettings>
 #include "Common/MetaTypes.h"
@@ -44,6 +45,7 @@
 #include "Imap/Model/VisibleTasksModel.h"
 #include "Imap/Network/MsgPartNetAccessManager.h"
 #include "Streams/SocketFactory.h"
+#include "Streams/TlsSessionCache.h"
 #include "UiUtils/PasswordWatcher.h"
 
 namespace Imap {
@@ -54,7 +56,7 @@ ImapAccess::ImapAccess(QObject *parent, QSettings *settings, Plugins::PluginMana
     m_pluginManager(pluginManager), m_passwordWatcher(0), m_port(0),
     m_connectionMethod(Common::ConnectionMethod::Invalid),
     m_sslInfoIcon(UiUtils::Formatting::IconType::NoIcon),
-    m_accountName(accountName)
+    m_accountName(accountName), m_tlsSessionCache(std::make_shared<Streams::TlsSessionCache>())
 {
     Imap::migrateSettings(m_settings);
     reloadConfiguration();
@@ -294,10 +296,12 @@ void ImapAccess::doConnect()
         factory.reset(new Streams::TlsAbleSocketFactory(server(), port()));
         factory->setStartTlsRequired(m_connectionMethod == Common::ConnectionMethod::NetStartTls);
         factory->setProxySettings(proxySettings, QStringLiteral("imap"));
+        factory->setTlsSessionCache(m_tlsSessionCache);
         break;
     case Common::ConnectionMethod::NetDedicatedTls:
         factory.reset(new Streams::SslSocketFactory(server(), port()));
         factory->setProxySettings(proxySettings, QStringLiteral("imap"));
+        factory->setTlsSessionCache(m_tlsSessionCache);
         break;
     case Common::ConnectionMethod::Process:
         QStringList args = m_settings->value(Common::SettingsNames::imapProcessKey).toString().split(QLatin1Char(' '));
@@ -309,6 +313,7 @@ void ImapAccess::doConnect()
         factory.reset(new Streams::ProcessSocketFactory(appName, args));
         break;
     }
+    factory->setCompressionLevel(qBound(-1, m_settings->value(Common::SettingsNames::imapCompressionLevel, -1).toInt(), 9));
 
     bool shouldUsePersistentCache =
             m_settings->value(Common::SettingsNames::cacheOfflineKey).toString() != Common::SettingsNames::cacheOfflineNone;
@@ -330,7 +335,31 @@ void ImapAccess::doConnect()
         }
     }
 
+    if (shouldUsePersistentCache && m_settings->value(Common::SettingsNames::imapSslPersistSession, false).toBool()) {
+        // Allow resuming the TLS session even after a restart
+        const QString sessionFileName = m_cacheDir + QLatin1String("tls-session");
+        QFile sessionFile(sessionFileName);
+        if (m_tlsSessionCache->serialize().isEmpty() && sessionFile.open(QIODevice::ReadOnly)) {
+            m_tlsSessionCache->deserialize(sessionFile.readAll());
+        }
+        // The cache is shared with the socket factories, so it might outlive us. The handler is owned by the cache, though.
+        Streams::TlsSessionCache *tlsSessionCache = m_tlsSessionCache.get();
+        m_tlsSessionCache->setChangeHandler([tlsSessionCache, sessionFileName]() {
+            QSaveFile f(sessionFileName);
+            // The session ticket is as good as a password for resuming the TLS session
+            if (!f.open(QIODevice::WriteOnly) || !f.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner)
+                    || f.write(tlsSessionCache->serialize()) < 0 || !f.commit()) {
+                qDebug() << "Cannot save the TLS session into" << sessionFileName;
+            }
+        });
+    } else {
+        m_tlsSessionCache->setChangeHandler(nullptr);
+    }
+
     std::shared_ptr<Imap::Mailbox::AbstractCache> cache;
+    // Zero days mean everything
+    int offlineDays = 0;
+    bool offlineCacheOpened = false;
 
     if (!shouldUsePersistentCache) {
         cache.reset(new Imap::Mailbox::MemoryCache());
@@ -341,6 +370,7 @@ void ImapAccess::doConnect()
             // Error message was already shown by the cacheError() slot
             cache.reset(new Imap::Mailbox::MemoryCache());
         } else {
+            offlineCacheOpened = true;
             if (m_settings->value(Common::SettingsNames::cacheOfflineKey).toString() == Common::SettingsNames::cacheOfflineAll) {
                 cache->setRenewalThreshold(0);
             } else {
@@ -350,6 +380,7 @@ void ImapAccess::doConnect()
                 if (!ok)
                     num = defaultCacheLifetime;
                 cache->setRenewalThreshold(num);
+                offlineDays = num;
             }
         }
     }
@@ -359,7 +390,13 @@ void ImapAccess::doConnect()
     m_imapModel->setCapabilitiesBlacklist(m_settings->value(Common::SettingsNames::imapBlacklistedCapabilities).toStringList());
     m_imapModel->setProperty("trojita-imap-id-no-versions", !m_settings->value(Common::SettingsNames::interopRevealVersions, true).toBool());
     m_imapModel->setProperty("trojita-imap-idle-renewal", m_settings->value(Common::SettingsNames::imapIdleRenewal).toUInt() * 60 * 1000);
+    m_imapModel->setProperty("trojita-imap-defer-bodystructure", true);
+    m_imapModel->setProperty("trojita-imap-list-recursive", m_settings->value(Common::SettingsNames::imapListRecursive, false).toBool());
     m_imapModel->setNumberRefreshInterval(numberRefreshInterval());
+    m_imapModel->setBackgroundSync(backgroundSyncConnections(),
+                                   m_settings->value(Common::SettingsNames::imapBackgroundSyncMailboxes).toStringList());
+    m_imapModel->setOfflinePrefetch(offlineCacheOpened && m_settings->value(Common::SettingsNames::cacheOfflinePrefetchKey, false).toBool(),
+                                    offlineDays);
     connect(m_imapModel, &Mailbox::Model::alertReceived, this, &ImapAccess::alertReceived);
     connect(m_imapModel, &Mailbox::Model::imapError, this, &ImapAccess::imapError);
     connect(m_imapModel, &Mailbox::Model::networkError, this, &ImapAccess::networkError);
@@ -408,6 +445,7 @@ void ImapAccess::doConnect()
     m_threadingMsgListModel = new Imap::Mailbox::ThreadingMsgListModel(this);
     m_threadingMsgListModel->setObjectName(QStringLiteral("threadingMsgListModel-%1").arg(m_accountName));
     m_threadingMsgListModel->setSourceModel(m_msgListModel);
+    m_threadingMsgListModel->setPreferLocalThreading(m_settings->value(Common::SettingsNames::imapThreadingLocal, false).toBool());
     emit modelsChanged();
 }
 
@@ -527,6 +565,8 @@ void ImapAccess::setSslPolicy(bool accept)
 void ImapAccess::forgetSslCertificate()
 {
     m_settings->remove(Common::SettingsNames::imapSslPemPubKey);
+    m_tlsSessionCache->clear();
+    QFile::remove(m_cacheDir + QLatin1String("tls-session"));
 }
 
 QString ImapAccess::sslInfoTitle() const
@@ -561,6 +601,7 @@ connecting to a completely different server since the last time.
 */
 void ImapAccess::nukeCache()
 {
+    m_tlsSessionCache->clear();
     Imap::removeRecursively(m_cacheDir);
 }
 
@@ -592,6 +633,20 @@ void ImapAccess::setNumberRefreshInterval(const int interval)
         m_imapModel->setNumberRefreshInterval(interval);
 }
 
+int ImapAccess::backgroundSyncConnections() const
+{
+    return qBound(0, m_settings->value(Common::SettingsNames::imapBackgroundSyncConnections, QVariant(0)).toInt(), 3);
+}
+
+void ImapAccess::setBackgroundSyncConnections(const int connections)
+{
+    m_settings->setValue(Common::SettingsNames::imapBackgroundSyncConnections, connections);
+    if (m_imapModel)
+        m_imapModel->setBackgroundSync(backgroundSyncConnections(),
+                                       m_settings->value(Common::SettingsNames::imapBackgroundSyncMailboxes).toStringList());
+    emit backgroundSyncConnectionsChanged();
+}
+
 QString ImapAccess::accountName() const
 {
     return m_accountName;
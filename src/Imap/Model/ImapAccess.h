@@ -23,6 +23,7 @@
 #ifndef TROJITA_IMAPACCESS_H
 #define TROJITA_IMAPACCESS_H
 
+#include <memory>
 #include <QObject>
 #include <QSslError>
 
@@ -39,6 +40,10 @@ namespace Plugins {
 class PluginManager;
 }
 
+namespace Streams {
+class TlsSessionCache;
+}
+
 namespace UiUtils {
 class PasswordWatcher;
 }
@@ -77,6 +82,7 @@ class ImapAccess : public QObject
     Q_PROPERTY(QString sslInfoTitle READ sslInfoTitle NOTIFY checkSslPolicy)
     Q_PROPERTY(QString sslInfoMessage READ sslInfoMessage NOTIFY checkSslPolicy)
     Q_PROPERTY(int numberRefreshInterval READ numberRefreshInterval WRITE setNumberRefreshInterval NOTIFY numberRefreshIntervalChanged)
+    Q_PROPERTY(int backgroundSyncConnections READ backgroundSyncConnections WRITE setBackgroundSyncConnections NOTIFY backgroundSyncConnectionsChanged)
     Q_ENUMS(Imap::ImapAccess::ConnectionMethod)
 
 public:
@@ -105,6 +111,8 @@ public:
     void setSslMode(const QString &sslMode);
     int numberRefreshInterval() const;
     void setNumberRefreshInterval(const int interval);
+    int backgroundSyncConnections() const;
+    void setBackgroundSyncConnections(const int connections);
 
     QString accountName() const;
 
@@ -142,6 +150,7 @@ signals:
     void checkSslPolicy();
     void cacheError(const QString &message);
     void numberRefreshIntervalChanged();
+    void backgroundSyncConnectionsChanged();
 
 public slots:
     void alertReceived(const QString &message);
@@ -184,6 +193,8 @@ private:
 
     QString m_accountName;
     QString m_cacheDir;
+    /** @short TLS session which is shared by all connections of this account, even across reconnects */
+    std::shared_ptr<Streams::TlsSessionCache> m_tlsSessionCache;
 };
 
 }
@@ -137,6 +137,14 @@ enum {
     The returned value might be a bit fuzzy.
     */
     RoleMessageHasAttachments,
+    /** @short Is the MIME structure of the message known already?
+
+    When the BODYSTRUCTURE is deferred, a message might be fetched without its structure being available. Asking for this
+    role requests the structure.
+    */
+    RoleMessageHasBodyStructure,
+    /** @short The MIME structure of the message is not known and cannot be obtained now, perhaps because we're offline */
+    RoleMessageBodyStructureUnavailable,
 
     /** @short Contents of a message part */
     RolePartData,
@@ -175,6 +183,8 @@ enum {
     RolePartForceFetchFromCache,
     /** @short Pointer to the internal buffer */
     RolePartBufferPtr,
+    /** @short Number of raw bytes which have arrived so far for a part that is being downloaded in chunks */
+    RolePartBytesFetched,
 
     /** @short QModelIndex of the message a part is associated to */
     RolePartMessageIndex,
@@ -0,0 +1,338 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalSearch.h"
+#include "Imap/Parser/Message.h"
+
+namespace {
+
+/** @short Longer words are truncated so that a silly base64 blob does not blow up the index */
+const int maxSearchTokenLength = 40;
+
+bool addressesContain(const QStringMatcher &matcher, const QList<Imap::Message::MailAddress> &addresses)
+{
+    Q_FOREACH(const Imap::Message::MailAddress &address, addresses) {
+        if (matcher.indexIn(address.name) != -1 || matcher.indexIn(address.mailbox) != -1 || matcher.indexIn(address.host) != -1)
+            return true;
+        if (matcher.pattern().contains(QLatin1Char('@'))
+                && matcher.indexIn(address.mailbox + QLatin1Char('@') + address.host) != -1)
+            return true;
+    }
+    return false;
+}
+
+QString addressSearchText(const QList<Imap::Message::MailAddress> &addresses)
+{
+    QStringList res;
+    Q_FOREACH(const Imap::Message::MailAddress &address, addresses) {
+        res << address.name << address.mailbox << address.host;
+    }
+    return res.join(QLatin1Char(' '));
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+QStringList searchTokens(const QString &text)
+{
+    QStringList res;
+    QSet<QString> seen;
+    const QString folded = text.toCaseFolded();
+    int start = -1;
+    for (int i = 0; i <= folded.size(); ++i) {
+        const bool isWordChar = i < folded.size() && folded[i].isLetterOrNumber();
+        if (isWordChar) {
+            if (start == -1)
+                start = i;
+            continue;
+        }
+        if (start != -1) {
+            const QString word = folded.mid(start, qMin(i - start, maxSearchTokenLength));
+            if (!seen.contains(word)) {
+                seen.insert(word);
+                res << word;
+            }
+            start = -1;
+        }
+    }
+    return res;
+}
+
+QVector<QPair<int, QString>> envelopeSearchText(const Imap::Message::Envelope &envelope)
+{
+    QVector<QPair<int, QString>> res;
+    res << qMakePair<int, QString>(SEARCH_IN_SUBJECT, envelope.subject)
+        << qMakePair<int, QString>(SEARCH_IN_FROM, addressSearchText(envelope.from))
+        << qMakePair<int, QString>(SEARCH_IN_TO, addressSearchText(envelope.to))
+        << qMakePair<int, QString>(SEARCH_IN_CC, addressSearchText(envelope.cc))
+        << qMakePair<int, QString>(SEARCH_IN_BCC, addressSearchText(envelope.bcc));
+    return res;
+}
+
+LocalSearchQuery::LocalSearchQuery(): m_root(-1)
+{
+}
+
+int LocalSearchQuery::addNode(const Node &node)
+{
+    m_nodes << node;
+    return m_nodes.size() - 1;
+}
+
+/** @short Parse one search key starting at @arg pos, return its node ID or -1 on error */
+int LocalSearchQuery::parseKey(const QStringList &conditions, int &pos)
+{
+    if (pos >= conditions.size())
+        return -1;
+    const QString key = conditions[pos++].toUpper();
+    Node node;
+
+    if (key == QLatin1String("FUZZY")) {
+        // The local matching is fuzzy enough on its own
+        return parseKey(conditions, pos);
+    } else if (key == QLatin1String("ALL")) {
+        node.kind = Node::ALL;
+        return addNode(node);
+    } else if (key == QLatin1String("NOT")) {
+        const int operand = parseKey(conditions, pos);
+        if (operand == -1)
+            return -1;
+        node.kind = Node::NOT;
+        node.operands << operand;
+        return addNode(node);
+    } else if (key == QLatin1String("OR")) {
+        const int first = parseKey(conditions, pos);
+        if (first == -1)
+            return -1;
+        const int second = parseKey(conditions, pos);
+        if (second == -1)
+            return -1;
+        node.kind = Node::OR;
+        node.operands << first << second;
+        return addNode(node);
+    }
+
+    static const QHash<QString, int> textKeys = {
+        {QStringLiteral("SUBJECT"), SEARCH_IN_SUBJECT},
+        {QStringLiteral("FROM"), SEARCH_IN_FROM},
+        {QStringLiteral("TO"), SEARCH_IN_TO},
+        {QStringLiteral("CC"), SEARCH_IN_CC},
+        {QStringLiteral("BCC"), SEARCH_IN_BCC},
+        {QStringLiteral("BODY"), SEARCH_IN_BODY},
+        {QStringLiteral("TEXT"), SEARCH_IN_EVERYTHING},
+    };
+    auto textIt = textKeys.constFind(key);
+    if (textIt != textKeys.constEnd()) {
+        if (pos >= conditions.size())
+            return -1;
+        node.kind = Node::TEXT;
+        node.fields = *textIt;
+        node.words = searchTokens(conditions[pos++]);
+        return addNode(node);
+    }
+
+    static const QHash<QString, QPair<QString, bool>> flagKeys = {
+        {QStringLiteral("SEEN"), qMakePair(QStringLiteral("\\Seen"), true)},
+        {QStringLiteral("UNSEEN"), qMakePair(QStringLiteral("\\Seen"), false)},
+        {QStringLiteral("FLAGGED"), qMakePair(QStringLiteral("\\Flagged"), true)},
+        {QStringLiteral("UNFLAGGED"), qMakePair(QStringLiteral("\\Flagged"), false)},
+        {QStringLiteral("ANSWERED"), qMakePair(QStringLiteral("\\Answered"), true)},
+        {QStringLiteral("UNANSWERED"), qMakePair(QStringLiteral("\\Answered"), false)},
+        {QStringLiteral("DELETED"), qMakePair(QStringLiteral("\\Deleted"), true)},
+        {QStringLiteral("UNDELETED"), qMakePair(QStringLiteral("\\Deleted"), false)},
+        {QStringLiteral("DRAFT"), qMakePair(QStringLiteral("\\Draft"), true)},
+        {QStringLiteral("UNDRAFT"), qMakePair(QStringLiteral("\\Draft"), false)},
+    };
+    QString flag;
+    bool isSet = true;
+    auto flagIt = flagKeys.constFind(key);
+    if (flagIt != flagKeys.constEnd()) {
+        flag = flagIt->first;
+        isSet = flagIt->second;
+    } else if (key == QLatin1String("KEYWORD") || key == QLatin1String("UNKEYWORD")) {
+        if (pos >= conditions.size())
+            return -1;
+        flag = conditions[pos++];
+        isSet = key == QLatin1String("KEYWORD");
+    } else {
+        // Something which needs the server, or a raw search string
+        return -1;
+    }
+
+    node.kind = Node::FLAG;
+    node.flag = flag;
+    int id = addNode(node);
+    if (!isSet) {
+        Node negation;
+        negation.kind = Node::NOT;
+        negation.operands << id;
+        id = addNode(negation);
+    }
+    return id;
+}
+
+bool LocalSearchQuery::parse(const QStringList &conditions)
+{
+    m_nodes.clear();
+    m_root = -1;
+    Node conjunction;
+    conjunction.kind = Node::AND;
+    int pos = 0;
+    while (pos < conditions.size()) {
+        const int id = parseKey(conditions, pos);
+        if (id == -1) {
+            m_nodes.clear();
+            return false;
+        }
+        conjunction.operands << id;
+    }
+    if (conjunction.operands.isEmpty())
+        return false;
+    m_root = conjunction.operands.size() == 1 ? conjunction.operands.first() : addNode(conjunction);
+    return true;
+}
+
+bool LocalSearchQuery::needsBodies() const
+{
+    Q_FOREACH(const Node &node, m_nodes) {
+        if (node.kind == Node::TEXT && (node.fields & SEARCH_IN_BODY))
+            return true;
+    }
+    return false;
+}
+
+QSet<uint> LocalSearchQuery::evaluate(const QSet<uint> &allUids, const TermLookup &lookupTerm, const FlagLookup &lookupFlag) const
+{
+    if (m_root == -1)
+        return QSet<uint>();
+    return evaluateNode(m_root, allUids, lookupTerm, lookupFlag);
+}
+
+QSet<uint> LocalSearchQuery::evaluateNode(const int id, const QSet<uint> &allUids, const TermLookup &lookupTerm,
+                                          const FlagLookup &lookupFlag) const
+{
+    const Node &node = m_nodes[id];
+    QSet<uint> res;
+    switch (node.kind) {
+    case Node::ALL:
+        return allUids;
+    case Node::TEXT:
+        // An empty string is a substring of everything
+        res = allUids;
+        Q_FOREACH(const QString &word, node.words) {
+            res.intersect(lookupTerm(node.fields, word));
+            if (res.isEmpty())
+                break;
+        }
+        return res;
+    case Node::FLAG:
+        return lookupFlag(node.flag).intersect(allUids);
+    case Node::NOT:
+        res = allUids;
+        return res.subtract(evaluateNode(node.operands[0], allUids, lookupTerm, lookupFlag));
+    case Node::OR:
+        res = evaluateNode(node.operands[0], allUids, lookupTerm, lookupFlag);
+        return res.unite(evaluateNode(node.operands[1], allUids, lookupTerm, lookupFlag));
+    case Node::AND:
+        res = allUids;
+        for (const int operand : node.operands) {
+            res.intersect(evaluateNode(operand, allUids, lookupTerm, lookupFlag));
+            if (res.isEmpty())
+                break;
+        }
+        return res;
+    }
+    Q_ASSERT(false);
+    return res;
+}
+
+QuickFilter::QuickFilter(): m_fields(0)
+{
+    m_matcher.setCaseSensitivity(Qt::CaseInsensitive);
+}
+
+bool QuickFilter::setConditions(const QStringList &conditions)
+{
+    static const QHash<QString, int> keys = {
+        {QStringLiteral("SUBJECT"), SEARCH_IN_SUBJECT},
+        {QStringLiteral("FROM"), SEARCH_IN_FROM},
+        {QStringLiteral("TO"), SEARCH_IN_TO},
+        {QStringLiteral("CC"), SEARCH_IN_CC},
+        {QStringLiteral("BCC"), SEARCH_IN_BCC},
+        {QStringLiteral("BODY"), SEARCH_IN_BODY},
+    };
+
+    m_fields = 0;
+    QString needle;
+    bool haveNeedle = false;
+    for (int i = 0; i < conditions.size(); ++i) {
+        const QString key = conditions[i].toUpper();
+        if (key == QLatin1String("OR") || key == QLatin1String("FUZZY"))
+            continue;
+        auto it = keys.constFind(key);
+        if (it == keys.constEnd() || i + 1 >= conditions.size())
+            return false;
+        const QString &value = conditions[++i];
+        if (haveNeedle && value != needle)
+            return false;
+        needle = value;
+        haveNeedle = true;
+        m_fields |= *it;
+    }
+    if (!haveNeedle)
+        return false;
+    m_matcher.setPattern(needle);
+    return true;
+}
+
+bool QuickFilter::canExclude() const
+{
+    // The bodies are not in memory, so a message whose headers don't match might still match on its body
+    return m_fields && !(m_fields & SEARCH_IN_BODY);
+}
+
+bool QuickFilter::isNarrowerThan(const QuickFilter &other) const
+{
+    return m_fields == other.m_fields && m_matcher.pattern().contains(other.m_matcher.pattern(), Qt::CaseInsensitive);
+}
+
+bool QuickFilter::matches(const Imap::Message::Envelope &envelope) const
+{
+    if ((m_fields & SEARCH_IN_SUBJECT) && m_matcher.indexIn(envelope.subject) != -1)
+        return true;
+    if ((m_fields & SEARCH_IN_FROM) && addressesContain(m_matcher, envelope.from))
+        return true;
+    if ((m_fields & SEARCH_IN_TO) && addressesContain(m_matcher, envelope.to))
+        return true;
+    if ((m_fields & SEARCH_IN_CC) && addressesContain(m_matcher, envelope.cc))
+        return true;
+    if ((m_fields & SEARCH_IN_BCC) && addressesContain(m_matcher, envelope.bcc))
+        return true;
+    return false;
+}
+
+}
+}
@@ -0,0 +1,144 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALSEARCH_H
+#define IMAP_MODEL_LOCALSEARCH_H
+
+#include <functional>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+#include <QStringMatcher>
+#include <QVector>
+
+namespace Imap
+{
+
+namespace Message
+{
+class Envelope;
+}
+
+namespace Mailbox
+{
+
+/** @short Which part of a message a word in the full-text index comes from */
+typedef enum {
+    SEARCH_IN_SUBJECT = 1 << 0,
+    SEARCH_IN_FROM = 1 << 1,
+    SEARCH_IN_TO = 1 << 2,
+    SEARCH_IN_CC = 1 << 3,
+    SEARCH_IN_BCC = 1 << 4,
+    SEARCH_IN_BODY = 1 << 5,
+    SEARCH_IN_HEADERS = SEARCH_IN_SUBJECT | SEARCH_IN_FROM | SEARCH_IN_TO | SEARCH_IN_CC | SEARCH_IN_BCC,
+    SEARCH_IN_EVERYTHING = SEARCH_IN_HEADERS | SEARCH_IN_BODY
+} LocalSearchField;
+
+/** @short Split the text into case-folded words for the full-text index */
+QStringList searchTokens(const QString &text);
+
+/** @short Return the searchable pieces of text from the envelope along with the LocalSearchField they belong to */
+QVector<QPair<int, QString>> envelopeSearchText(const Imap::Message::Envelope &envelope);
+
+/** @short A SEARCH expression which can be evaluated against the local full-text index
+
+Only a subset of the RFC 3501 SEARCH keys is supported: the text-based ones, the common flags, and the NOT and OR operators.
+The textual keys are matched on a word level, i.e. each word of the searched string has to be a prefix of some word in the
+message. That is a bit more relaxed than a substring match when the search string has several words, and a bit stricter when
+it starts in the middle of a word.
+*/
+class LocalSearchQuery
+{
+public:
+    /** @short Look up messages with a word starting with the given prefix in any of the LocalSearchField */
+    typedef std::function<QSet<uint>(const int fields, const QString &prefix)> TermLookup;
+    /** @short Look up messages which have the given flag set */
+    typedef std::function<QSet<uint>(const QString &flag)> FlagLookup;
+
+    LocalSearchQuery();
+
+    /** @short Parse the search conditions as passed to ThreadingMsgListModel, return false when they cannot be evaluated locally */
+    bool parse(const QStringList &conditions);
+
+    /** @short Does this query look at the message bodies? */
+    bool needsBodies() const;
+
+    QSet<uint> evaluate(const QSet<uint> &allUids, const TermLookup &lookupTerm, const FlagLookup &lookupFlag) const;
+
+private:
+    struct Node {
+        typedef enum {
+            ALL,
+            TEXT,
+            FLAG,
+            NOT,
+            OR,
+            AND
+        } Kind;
+        Kind kind;
+        int fields;
+        QStringList words;
+        QString flag;
+        QVector<int> operands;
+
+        Node(): kind(ALL), fields(0) {}
+    };
+
+    int parseKey(const QStringList &conditions, int &pos);
+    int addNode(const Node &node);
+    QSet<uint> evaluateNode(const int id, const QSet<uint> &allUids, const TermLookup &lookupTerm, const FlagLookup &lookupFlag) const;
+
+    QVector<Node> m_nodes;
+    int m_root;
+};
+
+/** @short Case-insensitive substring matching of the envelopes which are already loaded in memory
+
+This only understands the conditions built by the quick search box, i.e. the same string searched for in several headers.
+It is meant for a provisional answer while the server is evaluating the real SEARCH, so it never looks at anything
+which is not already in memory.
+*/
+class QuickFilter
+{
+public:
+    QuickFilter();
+
+    /** @short Extract the searched string and the headers from the conditions, return false if they are something else */
+    bool setConditions(const QStringList &conditions);
+
+    /** @short Is it possible to tell from the envelope alone that a message does not match? */
+    bool canExclude() const;
+
+    /** @short Will everything which matches this filter also match the @arg other one? */
+    bool isNarrowerThan(const QuickFilter &other) const;
+
+    bool matches(const Imap::Message::Envelope &envelope) const;
+
+private:
+    QStringMatcher m_matcher;
+    int m_fields;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_LOCALSEARCH_H
@@ -0,0 +1,184 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <QDateTime>
+#include <QRegularExpression>
+#include <QThreadPool>
+#include "LocalSort.h"
+#include "Imap/Parser/Message.h"
+
+namespace {
+
+/** @short RFC 5957's display form of the first address in the list */
+QString displayAddress(const QList<Imap::Message::MailAddress> &addresses)
+{
+    if (addresses.isEmpty())
+        return QString();
+    const auto &address = addresses.first();
+    if (!address.name.isEmpty())
+        return address.name;
+    return address.mailbox + QLatin1Char('@') + address.host;
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Extract the RFC 5256 "base subject"
+
+This follows the algorithm from RFC 5256, section 2.1, except for the decoding of RFC 2047 words which has already been
+performed by the time the envelope is parsed.
+*/
+QString baseSubject(const QString &subject)
+{
+    static const QRegularExpression trailer(QStringLiteral("(\\s|\\(fwd\\))+$"), QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression leader(QStringLiteral("^(\\[[^\\[\\]]*\\]\\s*)*(re|fwd?)\\s*(\\[[^\\[\\]]*\\])?\\s*:\\s*"),
+                                           QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression blob(QStringLiteral("^\\[[^\\[\\]]*\\]\\s*"));
+    static const QRegularExpression fwdWrapper(QStringLiteral("^\\[fwd:(.*)\\]$"), QRegularExpression::CaseInsensitiveOption);
+
+    QString res = subject.simplified();
+    while (true) {
+        // (2) remove all trailing "(fwd)" and whitespace
+        res.remove(trailer);
+
+        // (3) and (4): remove the subj-leader and subj-blob repeatedly
+        while (true) {
+            const int previousSize = res.size();
+            res.remove(leader);
+            auto match = blob.match(res);
+            if (match.hasMatch() && match.capturedLength() < res.size())
+                res.remove(0, match.capturedLength());
+            if (res.size() == previousSize)
+                break;
+        }
+
+        // (6) unwrap a "[fwd: ...]"
+        auto match = fwdWrapper.match(res);
+        if (!match.hasMatch())
+            break;
+        res = match.captured(1).trimmed();
+    }
+    return res;
+}
+
+void fillLocalSortKey(LocalSortKey &key, const LocalSortCriterium criterium, const Imap::Message::Envelope &envelope,
+                      const QDateTime &internalDate, const quint64 size)
+{
+    switch (criterium) {
+    case LOCAL_SORT_ARRIVAL:
+        key.number = internalDate.isValid() ? internalDate.toMSecsSinceEpoch() : 0;
+        break;
+    case LOCAL_SORT_CC:
+        key.text = displayAddress(envelope.cc).toCaseFolded();
+        break;
+    case LOCAL_SORT_DATE:
+        // RFC 5256 says that the INTERNALDATE shall be used when the Date header is missing or unparsable
+        if (envelope.date.isValid()) {
+            key.number = envelope.date.toMSecsSinceEpoch();
+        } else {
+            key.number = internalDate.isValid() ? internalDate.toMSecsSinceEpoch() : 0;
+        }
+        break;
+    case LOCAL_SORT_FROM:
+        key.text = displayAddress(envelope.from).toCaseFolded();
+        break;
+    case LOCAL_SORT_SIZE:
+        key.number = size;
+        break;
+    case LOCAL_SORT_SUBJECT:
+        key.text = baseSubject(envelope.subject).toCaseFolded();
+        break;
+    case LOCAL_SORT_TO:
+        key.text = displayAddress(envelope.to).toCaseFolded();
+        break;
+    }
+}
+
+bool isTextualLocalSort(const LocalSortCriterium criterium)
+{
+    switch (criterium) {
+    case LOCAL_SORT_CC:
+    case LOCAL_SORT_FROM:
+    case LOCAL_SORT_SUBJECT:
+    case LOCAL_SORT_TO:
+        return true;
+    case LOCAL_SORT_ARRIVAL:
+    case LOCAL_SORT_DATE:
+    case LOCAL_SORT_SIZE:
+        return false;
+    }
+    return false;
+}
+
+bool localSortLessThan(const LocalSortKey &a, const LocalSortKey &b, const bool textual)
+{
+    if (textual) {
+        // The keys are case-folded already, so this is RFC 5051's i;unicode-casemap
+        int res = QString::compare(a.text, b.text, Qt::CaseSensitive);
+        if (res != 0)
+            return res < 0;
+    } else if (a.number != b.number) {
+        return a.number < b.number;
+    }
+    return a.seq < b.seq;
+}
+
+Imap::Uids sortLocalKeys(QVector<LocalSortKey> &keys, const bool textual)
+{
+    std::sort(keys.begin(), keys.end(), [textual](const LocalSortKey &a, const LocalSortKey &b) {
+        return localSortLessThan(a, b, textual);
+    });
+    Imap::Uids res;
+    res.reserve(keys.size());
+    for (const auto &key : keys) {
+        res << key.uid;
+    }
+    return res;
+}
+
+LocalSortJob::LocalSortJob(const QVector<LocalSortKey> &keys, const bool textual):
+    m_keys(keys), m_textual(textual)
+{
+    // We will delete ourselves from the main thread
+    setAutoDelete(false);
+}
+
+void LocalSortJob::start()
+{
+    QThreadPool::globalInstance()->start(this);
+}
+
+void LocalSortJob::run()
+{
+    auto uids = sortLocalKeys(m_keys, m_textual);
+    // These get delivered through a queued connection because this object lives in the main thread
+    emit sortingAvailable(uids, m_keys);
+    deleteLater();
+}
+
+}
+}
@@ -0,0 +1,117 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALSORT_H
+#define IMAP_MODEL_LOCALSORT_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QVector>
+#include "Imap/Parser/Uids.h"
+
+class QDateTime;
+
+namespace Imap
+{
+
+namespace Message
+{
+class Envelope;
+}
+
+namespace Mailbox
+{
+
+/** @short Sort key of one message for the client-side sorting
+
+Depending on the sorting criteria, either the text or the number is used. Ties are broken by the position of the message in
+the mailbox, as mandated by RFC 5256.
+*/
+struct LocalSortKey {
+    uint uid;
+    /** @short Offset of the message in the mailbox */
+    int seq;
+    /** @short Case-folded textual key, used for sorting by subject or by an address */
+    QString text;
+    /** @short Numeric key, used for sorting by a timestamp or by size */
+    qint64 number;
+
+    LocalSortKey(): uid(0), seq(0), number(0) {}
+};
+
+/** @short Which part of the message is used for sorting */
+typedef enum {
+    LOCAL_SORT_ARRIVAL,
+    LOCAL_SORT_CC,
+    LOCAL_SORT_DATE,
+    LOCAL_SORT_FROM,
+    LOCAL_SORT_SIZE,
+    LOCAL_SORT_SUBJECT,
+    LOCAL_SORT_TO
+} LocalSortCriterium;
+
+/** @short Extract the RFC 5256 "base subject" */
+QString baseSubject(const QString &subject);
+
+/** @short Fill the key of the message for the given sorting criteria */
+void fillLocalSortKey(LocalSortKey &key, const LocalSortCriterium criterium, const Imap::Message::Envelope &envelope,
+                      const QDateTime &internalDate, const quint64 size);
+
+/** @short Are the keys for this criterium compared as text? */
+bool isTextualLocalSort(const LocalSortCriterium criterium);
+
+/** @short Does the @arg a go before the @arg b? */
+bool localSortLessThan(const LocalSortKey &a, const LocalSortKey &b, const bool textual);
+
+/** @short Sort the keys in place and return the UIDs in the resulting order */
+Imap::Uids sortLocalKeys(QVector<LocalSortKey> &keys, const bool textual);
+
+/** @short Sort a big list of keys on a thread from the global thread pool
+
+The object deletes itself once the sorting has finished and the result was announced via the sortingAvailable() signal.
+*/
+class LocalSortJob : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    LocalSortJob(const QVector<LocalSortKey> &keys, const bool textual);
+
+    /** @short Queue the sorting into the global thread pool */
+    void start();
+
+    void run() override;
+
+signals:
+    /** @short The sorting has finished; both arguments are in the sorted order */
+    void sortingAvailable(const Imap::Uids &uids, const QVector<Imap::Mailbox::LocalSortKey> &keys);
+
+private:
+    QVector<LocalSortKey> m_keys;
+    bool m_textual;
+};
+
+}
+}
+
+Q_DECLARE_METATYPE(QVector<Imap::Mailbox::LocalSortKey>)
+
+#endif // IMAP_MODEL_LOCALSORT_H
@@ -0,0 +1,242 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <limits>
+#include "LocalThreading.h"
+
+namespace {
+
+/** @short Normalize a Message-ID so that different spellings of the same ID compare equal */
+QByteArray normalizedId(const QByteArray &messageId)
+{
+    QByteArray res = messageId.trimmed();
+    if (res.startsWith('<'))
+        res.remove(0, 1);
+    if (res.endsWith('>'))
+        res.chop(1);
+    return res;
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+int LocalThreading::newContainer()
+{
+    m_containers.append(Container());
+    return m_containers.size() - 1;
+}
+
+int LocalThreading::containerFor(const QByteArray &messageId)
+{
+    auto it = m_byMessageId.constFind(messageId);
+    if (it != m_byMessageId.constEnd())
+        return *it;
+    const int id = newContainer();
+    m_byMessageId[messageId] = id;
+    return id;
+}
+
+/** @short Is the @arg ancestor equal to @arg node or one of its parents? */
+bool LocalThreading::isAncestor(const int ancestor, int node) const
+{
+    while (node != -1) {
+        if (node == ancestor)
+            return true;
+        node = m_containers[node].parent;
+    }
+    return false;
+}
+
+void LocalThreading::unlink(const int child)
+{
+    const int parent = m_containers[child].parent;
+    if (parent == -1)
+        return;
+    m_containers[parent].children.removeOne(child);
+    m_containers[child].parent = -1;
+}
+
+void LocalThreading::link(const int parent, const int child)
+{
+    Q_ASSERT(!isAncestor(child, parent));
+    unlink(child);
+    m_containers[child].parent = parent;
+    m_containers[parent].children.append(child);
+}
+
+void LocalThreading::addMessage(const uint uid, const QByteArray &messageId, const QList<QByteArray> &references,
+                                const QDateTime &date)
+{
+    Q_ASSERT(uid);
+    Q_ASSERT(!m_byUid.contains(uid));
+
+    // Step 1A: find or create the container for this message
+    const QByteArray id = normalizedId(messageId);
+    int message;
+    if (id.isEmpty()) {
+        message = newContainer();
+    } else {
+        message = containerFor(id);
+        if (m_containers[message].uid) {
+            // A duplicate Message-ID; don't let it steal the place of the original message
+            message = newContainer();
+        }
+    }
+    m_containers[message].uid = uid;
+    m_containers[message].date = date.isValid() ? date.toMSecsSinceEpoch() : 0;
+    m_byUid[uid] = message;
+
+    // Step 1B: link the referenced messages together, without overriding the links which are already there
+    int previous = -1;
+    Q_FOREACH(const QByteArray &reference, references) {
+        const QByteArray refId = normalizedId(reference);
+        if (refId.isEmpty() || refId == id)
+            continue;
+        const int current = containerFor(refId);
+        if (previous != -1 && m_containers[current].parent == -1 && !isAncestor(current, previous))
+            link(previous, current);
+        previous = current;
+    }
+
+    // Step 1C: the last reference is the parent of this message
+    if (previous != -1 && !isAncestor(message, previous)) {
+        link(previous, message);
+    } else {
+        unlink(message);
+    }
+}
+
+void LocalThreading::removeMessage(const uint uid)
+{
+    auto it = m_byUid.find(uid);
+    if (it == m_byUid.end())
+        return;
+    m_containers[*it].uid = 0;
+    m_byUid.erase(it);
+}
+
+bool LocalThreading::contains(const uint uid) const
+{
+    return m_byUid.contains(uid);
+}
+
+QList<uint> LocalThreading::uids() const
+{
+    return m_byUid.keys();
+}
+
+void LocalThreading::clear()
+{
+    m_containers.clear();
+    m_byMessageId.clear();
+    m_byUid.clear();
+}
+
+/** @short Determine the date by which the container gets sorted among its siblings
+
+A placeholder has no date of its own, so it is sorted by the date of its earliest child as mandated by RFC 5256.
+Containers with no messages at all end up last; they are pruned anyway.
+*/
+qint64 LocalThreading::sortingDate(const int id, QVector<qint64> &dates) const
+{
+    qint64 &res = dates[id];
+    if (res != std::numeric_limits<qint64>::min())
+        return res;
+    const Container &container = m_containers[id];
+    if (container.uid) {
+        res = container.date;
+    } else {
+        res = std::numeric_limits<qint64>::max();
+        for (const int child : container.children) {
+            res = qMin(res, sortingDate(child, dates));
+        }
+    }
+    return res;
+}
+
+void LocalThreading::sortByDate(QVector<int> &containers, QVector<qint64> &dates) const
+{
+    for (const int id : containers) {
+        sortingDate(id, dates);
+    }
+    std::stable_sort(containers.begin(), containers.end(), [this, &dates](const int a, const int b) {
+        if (dates[a] != dates[b])
+            return dates[a] < dates[b];
+        return m_containers[a].uid < m_containers[b].uid;
+    });
+}
+
+/** @short Convert the container to the ThreadingNode, pruning the empty containers on the fly (JWZ's step 4) */
+void LocalThreading::appendNodes(const int id, QVector<Imap::Responses::ThreadingNode> &out, const bool isRoot,
+                                 QVector<qint64> &dates) const
+{
+    const Container &container = m_containers[id];
+    QVector<int> children = container.children;
+    sortByDate(children, dates);
+
+    if (container.uid) {
+        Imap::Responses::ThreadingNode node(container.uid);
+        for (const int child : children) {
+            appendNodes(child, node.children, false, dates);
+        }
+        out.append(node);
+        return;
+    }
+
+    // A placeholder: its children get promoted to its parent. At the top level, that only happens when there is
+    // a single child; otherwise we would be breaking up a thread.
+    QVector<Imap::Responses::ThreadingNode> promoted;
+    for (const int child : children) {
+        appendNodes(child, promoted, false, dates);
+    }
+    if (isRoot && promoted.size() > 1) {
+        out.append(Imap::Responses::ThreadingNode(0, promoted));
+    } else {
+        out += promoted;
+    }
+}
+
+QVector<Imap::Responses::ThreadingNode> LocalThreading::threading() const
+{
+    QVector<int> roots;
+    for (int i = 0; i < m_containers.size(); ++i) {
+        if (m_containers[i].parent == -1)
+            roots.append(i);
+    }
+    // The minimal value marks a date which has not been determined yet
+    QVector<qint64> dates(m_containers.size(), std::numeric_limits<qint64>::min());
+    sortByDate(roots, dates);
+    QVector<Imap::Responses::ThreadingNode> res;
+    res.reserve(roots.size());
+    for (const int root : roots) {
+        appendNodes(root, res, true, dates);
+    }
+    return res;
+}
+
+}
+}
@@ -0,0 +1,94 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALTHREADING_H
+#define IMAP_MODEL_LOCALTHREADING_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include "Imap/Parser/ThreadingNode.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Client-side threading of messages through their Message-ID and References headers
+
+This is an implementation of the algorithm by Jamie Zawinski, as described at https://www.jwz.org/doc/threading.html
+and in RFC 5256's REFERENCES. Similar to the THREAD=REFS extension, messages are not grouped by their subject and the
+siblings are ordered by their date.
+
+Messages can be added one by one as they arrive; the threading() can be asked for at any time.
+*/
+class LocalThreading
+{
+public:
+    /** @short Put a message into the threads
+
+    The @arg references shall contain the References header, or the In-Reply-To if the former is not available.
+    Each UID can only be added once; use removeMessage() to get rid of the old data first.
+    */
+    void addMessage(const uint uid, const QByteArray &messageId, const QList<QByteArray> &references, const QDateTime &date);
+    /** @short The message is no longer present in the mailbox, but it stays in the thread as a placeholder */
+    void removeMessage(const uint uid);
+    bool contains(const uint uid) const;
+    /** @short UIDs of all messages which were added and not removed since then */
+    QList<uint> uids() const;
+    void clear();
+
+    /** @short Return the threads in the same format as the THREAD response */
+    QVector<Imap::Responses::ThreadingNode> threading() const;
+
+private:
+    /** @short A node in the JWZ's id_table */
+    struct Container {
+        /** @short UID of the message, or zero for a placeholder of a message we have not seen */
+        uint uid;
+        int parent;
+        QVector<int> children;
+        qint64 date;
+
+        Container(): uid(0), parent(-1), date(0) {}
+    };
+
+    int containerFor(const QByteArray &messageId);
+    int newContainer();
+    bool isAncestor(const int ancestor, int node) const;
+    void link(const int parent, const int child);
+    void unlink(const int child);
+    void appendNodes(const int id, QVector<Imap::Responses::ThreadingNode> &out, const bool isRoot,
+                     QVector<qint64> &dates) const;
+    qint64 sortingDate(const int id, QVector<qint64> &dates) const;
+    void sortByDate(QVector<int> &containers, QVector<qint64> &dates) const;
+
+    /** @short All containers; they refer to each other by their index in this vector */
+    QVector<Container> m_containers;
+    QHash<QByteArray, int> m_byMessageId;
+    QHash<uint, int> m_byUid;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_LOCALTHREADING_H
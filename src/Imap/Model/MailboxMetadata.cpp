@@ -30,6 +30,7 @@ namespace Mailbox
 
 SyncState::SyncState():
     m_exists(0), m_recent(0), m_unSeenCount(0), m_unSeenOffset(0), m_uidNext(0), m_uidValidity(0), m_highestModSeq(0),
+    m_flagsResyncCursor(0),
     m_hasExists(false), m_hasRecent(false), m_hasUnSeenCount(false), m_hasUnSeenOffset(false),
     m_hasUidNext(false), m_hasUidValidity(false), m_hasHighestModSeq(false), m_hasFlags(false),
     m_hasPermanentFlags(false)
@@ -155,11 +156,21 @@ void SyncState::setHighestModSeq(const quint64 highestModSeq)
     m_hasHighestModSeq = true;
 }
 
+uint SyncState::flagsResyncCursor() const
+{
+    return m_flagsResyncCursor;
+}
+
+void SyncState::setFlagsResyncCursor(const uint uid)
+{
+    m_flagsResyncCursor = uid;
+}
+
 bool SyncState::completelyEqualTo(const SyncState &other) const
 {
     return m_exists == other.m_exists && m_recent == other.m_recent && m_unSeenCount == other.m_unSeenCount &&
             m_unSeenOffset == other.m_unSeenOffset && m_uidNext == other.m_uidNext && m_uidValidity == other.m_uidValidity &&
-            m_highestModSeq == other.m_highestModSeq && m_flags == other.m_flags && m_permanentFlags == other.m_permanentFlags &&
+            m_highestModSeq == other.m_highestModSeq && m_flagsResyncCursor == other.m_flagsResyncCursor && m_flags == other.m_flags && m_permanentFlags == other.m_permanentFlags &&
             m_hasExists == other.m_hasExists && m_hasRecent == other.m_hasRecent && m_hasUnSeenCount == other.m_hasUnSeenCount &&
             m_hasUnSeenOffset == other.m_hasUnSeenOffset && m_hasUidNext == other.m_hasUidNext &&
             m_hasUidValidity == other.m_hasUidValidity && m_hasHighestModSeq == other.m_hasHighestModSeq &&
@@ -208,6 +219,8 @@ QDebug operator<<(QDebug dbg, const Imap::Mailbox::SyncState &state)
         dbg << state.permanentFlags();
     else
         dbg << "n/a";
+    if (state.m_flagsResyncCursor)
+        dbg << "FLAGS-resync-cursor" << state.m_flagsResyncCursor;
     return dbg;
 }
 
@@ -234,13 +247,18 @@ QDataStream &operator>>(QDataStream &stream, Imap::Mailbox::SyncState &ss)
     stream >> i64; ss.setHighestModSeq(i64);
     stream >> i; ss.setUnSeenCount(i);
     stream >> i; ss.setUnSeenOffset(i);
+    // Older versions did not save this one
+    if (!stream.atEnd()) {
+        stream >> i; ss.setFlagsResyncCursor(i);
+    }
     return stream;
 }
 
 QDataStream &operator<<(QDataStream &stream, const Imap::Mailbox::SyncState &ss)
 {
     return stream << ss.exists() << ss.flags() << ss.permanentFlags() <<
-           ss.recent() << ss.uidNext() << ss.uidValidity() << ss.highestModSeq() << ss.unSeenCount() << ss.unSeenOffset();
+           ss.recent() << ss.uidNext() << ss.uidValidity() << ss.highestModSeq() << ss.unSeenCount() << ss.unSeenOffset() <<
+           ss.flagsResyncCursor();
 }
 
 QDataStream &operator>>(QDataStream &stream, Imap::Mailbox::MailboxMetadata &mm)
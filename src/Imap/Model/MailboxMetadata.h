@@ -56,6 +56,7 @@ class SyncState
 {
     uint m_exists, m_recent, m_unSeenCount, m_unSeenOffset, m_uidNext, m_uidValidity;
     quint64 m_highestModSeq;
+    uint m_flagsResyncCursor;
     QStringList m_flags, m_permanentFlags;
 
     bool m_hasExists, m_hasRecent, m_hasUnSeenCount, m_hasUnSeenOffset, m_hasUidNext, m_hasUidValidity,
@@ -73,6 +74,8 @@ public:
     quint64 highestModSeq() const;
     QStringList flags() const;
     QStringList permanentFlags() const;
+    /** @short UID where the background refresh of FLAGS shall continue, or zero if there's nothing left over */
+    uint flagsResyncCursor() const;
 
     void setExists(const uint exists);
     void setRecent(const uint recent);
@@ -83,6 +86,7 @@ public:
     void setHighestModSeq(const quint64 highestModSeq);
     void setFlags(const QStringList &flags);
     void setPermanentFlags(const QStringList &permanentFlags);
+    void setFlagsResyncCursor(const uint uid);
 
     /** @short Return true if the record contains all items needed to display message numbers
 
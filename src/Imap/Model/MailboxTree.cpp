@@ -21,6 +21,7 @@
 */
 
 #include <algorithm>
+#include <QRegularExpression>
 #include <QTextStream>
 #include "Common/FindWithUnknown.h"
 #include "Common/InvokeMethod.h"
@@ -30,6 +31,7 @@
 #include "Imap/Tasks/KeepMailboxOpenTask.h"
 #include "UiUtils/Formatting.h"
 #include "ItemRoles.h"
+#include "LocalSearch.h"
 #include "MailboxTree.h"
 #include "Model.h"
 #include "SpecialFlagNames.h"
@@ -41,6 +43,45 @@ namespace Imap
 namespace Mailbox
 {
 
+/** @short Put the decoded text of a textual body part into the full-text index */
+static void indexPartText(Model *const model, const QString &mailbox, const uint uid, const TreeItemPart *part,
+                          const QByteArray &data)
+{
+    if (!part->mimeType().startsWith("text/"))
+        return;
+    QString text = Imap::decodeByteArray(data, part->charset());
+    if (part->mimeType() == "text/html") {
+        static const QRegularExpression tag(QStringLiteral("<[^>]*>"));
+        text.replace(tag, QStringLiteral(" "));
+    }
+    model->cache()->indexMessageText(mailbox, uid, SEARCH_IN_BODY, text);
+}
+
+/** @short Extract the lowercase "type/subtype" from a Content-Type header in a snippet of RFC 5322 headers */
+static QByteArray contentTypeFromHeaders(const QByteArray &rawHeaders)
+{
+    QByteArray value;
+    bool inContentType = false;
+    Q_FOREACH(const QByteArray &line, rawHeaders.split('\n')) {
+        if (inContentType) {
+            if (line.startsWith(' ') || line.startsWith('\t')) {
+                // a folded continuation line
+                value += line;
+                continue;
+            }
+            break;
+        }
+        if (line.size() > 13 && line.left(13).toLower() == "content-type:") {
+            value = line.mid(13);
+            inContentType = true;
+        }
+    }
+    const int semicolon = value.indexOf(';');
+    if (semicolon != -1)
+        value.truncate(semicolon);
+    return value.trimmed().toLower();
+}
+
 TreeItem::TreeItem(TreeItem *parent): m_parent(parent)
 {
     // These just have to be present in the context of TreeItem, otherwise they couldn't access the protected members
@@ -310,7 +351,8 @@ TreeItemChildrenList TreeItemMailbox::setChildren(const TreeItemChildrenList &it
 void TreeItemMailbox::handleFetchResponse(Model *const model,
         const Responses::Fetch &response,
         QList<TreeItemPart *> &changedParts,
-        TreeItemMessage *&changedMessage, bool usingQresync)
+        TreeItemMessage *&changedMessage, bool usingQresync,
+        AbstractCache::MessageFlagsList *deferredFlags)
 {
     TreeItemMsgList *list = static_cast<TreeItemMsgList *>(m_children[0]);
 
@@ -422,7 +464,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
             message->data()->setEnvelope(static_cast<const Responses::RespData<Message::Envelope>&>(*(it.value())).data);
             changedMessage = message;
         } else if (it.key() == "BODYSTRUCTURE") {
-            if (message->data()->gotRemeberedBodyStructure() || message->fetched()) {
+            if (message->data()->gotRemeberedBodyStructure() || !message->m_children.isEmpty()) {
                 // The message structure is already known, so we are free to ignore it
             } else {
                 // We had no idea about the structure of the message
@@ -442,6 +484,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
                 model->beginInsertRows(messageIdx, 0, newChildren.size() - 1);
                 message->setChildren(newChildren);
                 model->endInsertRows();
+                changedMessage = message;
             }
         } else if (it.key() == "x-trojita-bodystructure") {
             // do nothing here, it's been already taken care of from the BODYSTRUCTURE handler
@@ -453,13 +496,23 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
             message->processAdditionalHeaders(model, rawHeaders);
             changedMessage = message;
         } else if (it.key().startsWith("BODY[") || it.key().startsWith("BINARY[")) {
-            if (it.key()[ it.key().size() - 1 ] != ']')
+            qint64 origin = -1;
+            if (it.key().startsWith("BODY[") && it.key().endsWith('>')) {
+                // A chunk of a part which is being downloaded piece by piece, BODY[...]<origin>
+                bool ok;
+                origin = it.key().mid(it.key().lastIndexOf('<') + 1).chopped(1).toLongLong(&ok);
+                if (!ok || origin < 0)
+                    throw UnknownMessageIndex("Can't parse the origin of a BODY[]<> chunk", response);
+            } else if (it.key()[ it.key().size() - 1 ] != ']') {
                 throw UnknownMessageIndex("Can't parse such BODY[]/BINARY[]", response);
+            }
             TreeItemPart *part = partIdToPtr(model, message, it.key());
             if (! part)
                 throw UnknownMessageIndex("Got BODY[]/BINARY[] fetch that did not resolve to any known part", response);
             const QByteArray &data = static_cast<const Responses::RespData<QByteArray>&>(*(it.value())).data;
-            if (it.key().startsWith("BODY[")) {
+            if (origin != -1) {
+                handlePartChunk(model, message, part, origin, data, changedParts);
+            } else if (it.key().startsWith("BODY[")) {
 
                 // Check whether we are supposed to be loading the raw, undecoded part as well.
                 // The check has to be done via a direct pointer access to m_partRaw to make sure that it does not
@@ -481,22 +534,27 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
                     // got to decode the part data by hand
                     Imap::decodeContentTransferEncoding(data, part->transferEncoding(), part->dataPtr());
                     part->setFetchStatus(DONE);
-                    changedParts.append(part);
                     if (message->uid()
                             && model->cache()->messagePart(mailbox(), message->uid(), part->partId() + ".X-RAW").isNull()) {
                         // Do not store the data into cache if the raw data are already there
                         model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
                     }
+                    if (message->uid())
+                        indexPartText(model, mailbox(), message->uid(), part, part->m_data);
+                    if (!message->uid() || !part->releasePrefetchedData())
+                        changedParts.append(part);
                 }
 
             } else {
                 // A BINARY FETCH item is already decoded for us, yay
                 part->m_data = data;
                 part->setFetchStatus(DONE);
-                changedParts.append(part);
                 if (message->uid()) {
                     model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
+                    indexPartText(model, mailbox(), message->uid(), part, part->m_data);
                 }
+                if (!message->uid() || !part->releasePrefetchedData())
+                    changedParts.append(part);
             }
         } else if (it.key() == "INTERNALDATE") {
             message->data()->setInternalDate(static_cast<const Responses::RespData<QDateTime>&>(*(it.value())).data);
@@ -505,27 +563,83 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
         }
     }
     if (message->uid()) {
-        if (message->data()->isComplete() && model->cache()->messageMetadata(mailbox(), message->uid()).uid == 0) {
-             model->cache()->setMessageMetadata(
-                         mailbox(), message->uid(),
-                         Imap::Mailbox::AbstractCache::MessageDataBundle(
-                             message->uid(),
-                             message->data()->envelope(),
-                             message->data()->internalDate(),
-                             message->data()->size(),
-                             message->data()->rememberedBodyStructure(),
-                             message->data()->hdrReferences(),
-                             message->data()->hdrListPost(),
-                             message->data()->hdrListPostNo()
-                         ));
-             message->setFetchStatus(DONE);
+        MessageDataPayload *data = message->data();
+        if (data->isListComplete() && (data->gotRemeberedBodyStructure() || model->deferBodyStructure())) {
+            // With a deferred BODYSTRUCTURE, the message can be shown in the list already. The metadata get cached with
+            // an empty structure which is filled in once the structure arrives.
+            auto cached = model->cache()->messageMetadata(mailbox(), message->uid());
+            if (cached.uid == 0 || (data->gotRemeberedBodyStructure() && cached.serializedBodyStructure.isEmpty())) {
+                model->cache()->setMessageMetadata(
+                            mailbox(), message->uid(),
+                            Imap::Mailbox::AbstractCache::MessageDataBundle(
+                                message->uid(),
+                                data->envelope(),
+                                data->internalDate(),
+                                data->size(),
+                                data->rememberedBodyStructure(),
+                                data->hdrReferences(),
+                                data->hdrListPost(),
+                                data->hdrListPostNo()
+                            ));
+            }
+            message->setFetchStatus(DONE);
         }
         if (updatedFlags) {
-            model->cache()->setMsgFlags(mailbox(), message->uid(), message->m_flags);
+            if (deferredFlags) {
+                deferredFlags->append(qMakePair(message->uid(), message->m_flags));
+            } else {
+                model->cache()->setMsgFlags(mailbox(), message->uid(), message->m_flags);
+            }
         }
     }
 }
 
+/** @short Process one BODY[...]<origin> chunk of a part which is being downloaded piece by piece
+
+Each chunk is stored into the cache on its own so that an interrupted download can be resumed. A chunk which is
+shorter than what we have asked for means that the whole part has arrived, at which point the complete data replace
+the chunks in the cache.
+*/
+void TreeItemMailbox::handlePartChunk(Model *const model, TreeItemMessage *message, TreeItemPart *part, const qint64 origin,
+                                      const QByteArray &data, QList<TreeItemPart *> &changedParts)
+{
+    if (!part->loading() || !part->m_partialFetch || part->m_partialFetch->rawBytes != origin) {
+        qDebug() << "Ignoring an unexpected chunk of part" << part->partId() << "of UID" << message->uid()
+                 << "at offset" << origin;
+        return;
+    }
+
+    PartialPartFetch *progress = part->m_partialFetch.get();
+    if (!data.isEmpty()) {
+        if (message->uid()) {
+            model->cache()->setMsgPart(mailbox(), message->uid(), part->partialChunkId(origin), data);
+            progress->cachedChunks << origin;
+        }
+        part->appendPartialData(data);
+    }
+    changedParts.append(part);
+
+    if (data.size() >= model->partialFetchChunkSize()) {
+        // There might be more data
+        model->askForMsgPartChunk(part);
+        return;
+    }
+
+    // The raw data are not kept around, so a pending request for the raw part is left to its own FETCH
+    part->finishPartialData();
+    part->setFetchStatus(DONE);
+    if (message->uid()) {
+        model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
+        Q_FOREACH(const qint64 offset, progress->cachedChunks) {
+            model->cache()->forgetMessagePart(mailbox(), message->uid(), part->partialChunkId(offset));
+        }
+        indexPartText(model, mailbox(), message->uid(), part, part->m_data);
+    }
+    part->m_partialFetch.reset();
+    if (message->uid())
+        part->releasePrefetchedData();
+}
+
 /** @short Save the sync state and the UID mapping into the cache
 
 Please note that FLAGS are still being updated "asynchronously", i.e. immediately when an update arrives. The motivation
@@ -752,15 +866,17 @@ void TreeItemMailbox::handleExists(Model *const model, const Responses::NumberRe
 
 TreeItemPart *TreeItemMailbox::partIdToPtr(Model *const model, TreeItemMessage *message, const QByteArray &msgId)
 {
+    // The partial range, as in BODY.PEEK[1]<0.1024> or BODY[1]<0>, does not matter for finding the part
+    const int sectionEnd = msgId.lastIndexOf(']') + 1;
     QByteArray partIdentification;
     if (msgId.startsWith("BODY[")) {
-        partIdentification = msgId.mid(5, msgId.size() - 6);
+        partIdentification = msgId.mid(5, sectionEnd - 6);
     } else if (msgId.startsWith("BODY.PEEK[")) {
-        partIdentification = msgId.mid(10, msgId.size() - 11);
+        partIdentification = msgId.mid(10, sectionEnd - 11);
     } else if (msgId.startsWith("BINARY.PEEK[")) {
-        partIdentification = msgId.mid(12, msgId.size() - 13);
+        partIdentification = msgId.mid(12, sectionEnd - 13);
     } else if (msgId.startsWith("BINARY[")) {
-        partIdentification = msgId.mid(7, msgId.size() - 8);
+        partIdentification = msgId.mid(7, sectionEnd - 8);
     } else {
         throw UnknownMessageIndex(QByteArray("Fetch identifier doesn't start with reasonable prefix: " + msgId).constData());
     }
@@ -967,12 +1083,20 @@ MessageDataPayload::MessageDataPayload()
     , m_gotBodystructure(false)
     , m_gotHdrReferences(false)
     , m_gotHdrListPost(false)
+    , m_bodyStructureRequested(false)
+    , m_bodyStructureUnavailable(false)
 {
 }
 
 bool MessageDataPayload::isComplete() const
 {
-    return m_gotEnvelope && m_gotInternalDate && m_gotSize && m_gotBodystructure;
+    return isListComplete() && m_gotBodystructure;
+}
+
+/** @short Is everything which is needed for showing this message in a list available? */
+bool MessageDataPayload::isListComplete() const
+{
+    return m_gotEnvelope && m_gotInternalDate && m_gotSize;
 }
 
 bool MessageDataPayload::gotEnvelope() const
@@ -1082,6 +1206,41 @@ bool MessageDataPayload::gotRemeberedBodyStructure() const
     return m_gotBodystructure;
 }
 
+/** @short MIME type of the message from its Content-Type header, if known
+
+This is only a hint which is used until the real BODYSTRUCTURE arrives.
+*/
+const QByteArray &MessageDataPayload::hdrContentType() const
+{
+    return m_hdrContentType;
+}
+
+void MessageDataPayload::setHdrContentType(const QByteArray &contentType)
+{
+    m_hdrContentType = contentType;
+}
+
+bool MessageDataPayload::bodyStructureRequested() const
+{
+    return m_bodyStructureRequested;
+}
+
+void MessageDataPayload::setBodyStructureRequested(const bool requested)
+{
+    m_bodyStructureRequested = requested;
+}
+
+/** @short The BODYSTRUCTURE was deferred, it is not in the cache and we could not ask for it */
+bool MessageDataPayload::bodyStructureUnavailable() const
+{
+    return m_bodyStructureUnavailable;
+}
+
+void MessageDataPayload::setBodyStructureUnavailable(const bool unavailable)
+{
+    m_bodyStructureUnavailable = unavailable;
+}
+
 TreeItemPart *MessageDataPayload::partHeader() const
 {
     return m_partHeader.get();
@@ -1104,7 +1263,7 @@ void MessageDataPayload::setPartText(std::unique_ptr<TreeItemPart> part)
 
 
 TreeItemMessage::TreeItemMessage(TreeItem *parent):
-    TreeItem(parent), m_offset(-1), m_uid(0), m_data(0), m_flagsHandled(false), m_wasUnread(false)
+    TreeItem(parent), m_offset(-1), m_uid(0), m_data(0), m_flagsHandled(false), m_wasUnread(false), m_flagsStale(false)
 {
 }
 
@@ -1142,7 +1301,10 @@ void TreeItemMessage::fetch(Model *const model)
 unsigned int TreeItemMessage::rowCount(Model *const model)
 {
     if (!data()->gotRemeberedBodyStructure()) {
-        fetch(model);
+        if (fetched())
+            model->askForMsgBodyStructure(this);
+        else
+            fetch(model);
     }
     return m_children.size();
 }
@@ -1273,10 +1435,24 @@ QVariant TreeItemMessage::data(Model *const model, int role)
         }
     }
 
+    if (m_flagsStale) {
+        // This message is apparently being shown, so its FLAGS shall be refreshed before the rest of the mailbox
+        m_flagsStale = false;
+        model->askForMsgFlags(this);
+    }
+
     // Any other roles will result in fetching the data; however, we won't exit if the data isn't available yet
     fetch(model);
 
     switch (role) {
+    case RoleMessageHasBodyStructure:
+        if (fetched() && !data()->gotRemeberedBodyStructure())
+            model->askForMsgBodyStructure(this);
+        return data()->gotRemeberedBodyStructure();
+    case RoleMessageBodyStructureUnavailable:
+        if (fetched() && !data()->gotRemeberedBodyStructure())
+            model->askForMsgBodyStructure(this);
+        return !data()->gotRemeberedBodyStructure() && data()->bodyStructureUnavailable();
     case Qt::DisplayRole:
         if (loading()) {
             return QStringLiteral("[loading UID %1...]").arg(QString::number(uid()));
@@ -1458,6 +1634,7 @@ void TreeItemMessage::setFlags(TreeItemMsgList *list, const QStringList &flags)
     // wasSeen is used to determine if the message was marked as read before this operation
     bool wasSeen = isMarkedAsRead();
     m_flags = flags;
+    m_flagsStale = false;
     if (list->m_numberFetchingStatus == DONE) {
         bool isSeen = isMarkedAsRead();
         if (m_flagsHandled) {
@@ -1507,6 +1684,10 @@ void TreeItemMessage::processAdditionalHeaders(Model *model, const QByteArray &r
     // This is because we absolutely want to support incremental header arrival.
     if (parser.listPostNo)
         data()->setHdrListPostNo(true);
+
+    const QByteArray contentType = contentTypeFromHeaders(rawHeaders);
+    if (!contentType.isEmpty())
+        data()->setHdrContentType(contentType);
 }
 
 bool TreeItemMessage::hasAttachments(Model *const model)
@@ -1516,6 +1697,12 @@ bool TreeItemMessage::hasAttachments(Model *const model)
     if (!fetched())
         return false;
 
+    if (!data()->gotRemeberedBodyStructure()) {
+        // The BODYSTRUCTURE was deferred; guess from the Content-Type until it arrives
+        model->askForMsgBodyStructure(this);
+        return data()->hdrContentType() == "multipart/mixed";
+    }
+
     if (m_children.isEmpty()) {
         // strange, but why not, I guess
         return false;
@@ -1571,6 +1758,7 @@ TreeItemPart::TreeItemPart(TreeItem *parent, const QByteArray &mimeType)
     , m_partMime(nullptr)
     , m_partRaw(nullptr)
     , m_binaryCTEFailed(false)
+    , m_prefetchOnly(false)
 {
 }
 
@@ -1581,6 +1769,7 @@ TreeItemPart::TreeItemPart(TreeItem *parent)
     , m_partMime(nullptr)
     , m_partRaw(nullptr)
     , m_binaryCTEFailed(false)
+    , m_prefetchOnly(false)
 {
 }
 
@@ -1615,6 +1804,9 @@ TreeItemChildrenList TreeItemPart::setChildren(const TreeItemChildrenList &items
 
 void TreeItemPart::fetch(Model *const model)
 {
+    // Somebody is interested in the data, so they shall stay in memory once they arrive
+    m_prefetchOnly = false;
+
     if (fetched() || loading() || isUnavailable())
         return;
 
@@ -1629,6 +1821,28 @@ void TreeItemPart::fetch(Model *const model)
     model->askForMsgPart(this);
 }
 
+void TreeItemPart::prefetch(Model *const model)
+{
+    if (fetched() || loading() || isUnavailable() || isTopLevelMultiPart())
+        return;
+
+    m_prefetchOnly = true;
+    setFetchStatus(LOADING);
+    model->askForMsgPart(this);
+    // It might have been in the cache already
+    releasePrefetchedData();
+}
+
+bool TreeItemPart::releasePrefetchedData()
+{
+    if (!m_prefetchOnly || !fetched())
+        return false;
+    m_prefetchOnly = false;
+    m_data.clear();
+    setFetchStatus(NONE);
+    return true;
+}
+
 void TreeItemPart::fetchFromCache(Model *const model)
 {
     if (fetched() || loading() || isUnavailable())
@@ -1696,6 +1910,8 @@ QVariant TreeItemPart::data(Model *const model, int role)
         return QVariant();
     case RolePartBufferPtr:
         return QVariant::fromValue(dataPtr());
+    case RolePartBytesFetched:
+        return m_partialFetch ? QVariant::fromValue<quint64>(m_partialFetch->rawBytes) : QVariant();
     case RolePartBodyFldParam:
         return QVariant::fromValue(m_bodyFldParam);
     case RoleIMAPRelativeUrl:
@@ -1820,6 +2036,52 @@ QByteArray *TreeItemPart::dataPtr()
     return &m_data;
 }
 
+QByteArray TreeItemPart::partialChunkId(const qint64 offset) const
+{
+    return partId() + ".X-CHUNK-" + QByteArray::number(offset);
+}
+
+void TreeItemPart::appendPartialData(const QByteArray &chunk)
+{
+    Q_ASSERT(m_partialFetch);
+    m_partialFetch->rawBytes += chunk.size();
+    QByteArray &pending = m_partialFetch->pending;
+    pending.append(chunk);
+
+    // Both quoted-printable and base64 can be decoded line by line, but a line might be split among chunks.
+    // For base64, we also must not split a quadruple of encoded characters in case the lines are weirdly wrapped.
+    const bool lineBased = m_transferEncoding == "quoted-printable" || m_transferEncoding == "base64";
+    const int end = lineBased ? pending.lastIndexOf('\n') + 1 : pending.size();
+    if (end <= 0)
+        return;
+    if (m_transferEncoding == "base64") {
+        int encodedChars = 0;
+        for (int i = 0; i < end; ++i) {
+            if (pending[i] != '\r' && pending[i] != '\n' && pending[i] != ' ' && pending[i] != '\t')
+                ++encodedChars;
+        }
+        if (encodedChars % 4)
+            return;
+    }
+
+    QByteArray decoded;
+    Imap::decodeContentTransferEncoding(pending.left(end), m_transferEncoding, &decoded);
+    m_data.append(decoded);
+    pending.remove(0, end);
+}
+
+void TreeItemPart::finishPartialData()
+{
+    Q_ASSERT(m_partialFetch);
+    QByteArray &pending = m_partialFetch->pending;
+    if (!pending.isEmpty()) {
+        QByteArray decoded;
+        Imap::decodeContentTransferEncoding(pending, m_transferEncoding, &decoded);
+        m_data.append(decoded);
+        pending.clear();
+    }
+}
+
 unsigned int TreeItemPart::columnCount()
 {
     if (isTopLevelMultiPart()) {
@@ -1869,6 +2131,8 @@ void TreeItemPart::silentlyReleaseMemoryRecursive()
         m_partRaw = 0;
     }
     m_data.clear();
+    m_partialFetch.reset();
+    m_prefetchOnly = false;
     setFetchStatus(NONE);
     qDeleteAll(m_children);
     m_children.clear();
@@ -28,8 +28,10 @@
 #include <QModelIndex>
 #include <QPointer>
 #include <QString>
+#include <QVector>
 #include "../Parser/Response.h"
 #include "../Parser/Message.h"
+#include "Cache.h"
 #include "MailboxMetadata.h"
 
 namespace Imap
@@ -142,6 +144,7 @@ class TreeItemMailbox: public TreeItem
     friend class KeepMailboxOpenTask; // needs access to maintainingTask
     friend class SubscribeUnsubscribeTask; // needs access to m_metadata.flags
     friend class FetchMsgPartTask; // needs access to partIdToPtr()
+    friend class OfflinePrefetcher; // needs access to maintainingTask
     static QLatin1String flagNoInferiors;
     static QLatin1String flagHasNoChildren;
     static QLatin1String flagHasChildren;
@@ -180,12 +183,16 @@ public:
 
       If \a changedPart is not null, it will be updated to point to the message
       part whose content got fetched.
+
+      If \a deferredFlags is not null, updated flags are appended to it instead of being saved into the cache
+      right away. The caller is responsible for storing them in bulk later on.
     */
     void handleFetchResponse(Model *const model,
                              const Responses::Fetch &response,
                              QList<TreeItemPart *> &changedParts,
                              TreeItemMessage *&changedMessage,
-                             bool usingQresync);
+                             bool usingQresync,
+                             AbstractCache::MessageFlagsList *deferredFlags = nullptr);
     void rescanForChildMailboxes(Model *const model);
     void handleExpunge(Model *const model, const Responses::NumberResponse &resp);
     void handleExists(Model *const model, const Responses::NumberResponse &resp);
@@ -196,6 +203,8 @@ public:
 
 private:
     TreeItemPart *partIdToPtr(Model *model, TreeItemMessage *message, const QByteArray &msgId);
+    void handlePartChunk(Model *const model, TreeItemMessage *message, TreeItemPart *part, const qint64 origin,
+                         const QByteArray &data, QList<TreeItemPart *> &changedParts);
 
     /** @short ImapTask which is currently responsible for well-being of this mailbox */
     QPointer<KeepMailboxOpenTask> maintainingTask;
@@ -250,6 +259,12 @@ public:
     void setHdrListPostNo(const bool hdrListPostNo);
     const QByteArray &rememberedBodyStructure() const;
     void setRememberedBodyStructure(const QByteArray &blob);
+    const QByteArray &hdrContentType() const;
+    void setHdrContentType(const QByteArray &contentType);
+    bool bodyStructureRequested() const;
+    void setBodyStructureRequested(const bool requested);
+    bool bodyStructureUnavailable() const;
+    void setBodyStructureUnavailable(const bool unavailable);
 
     TreeItemPart *partHeader() const;
     void setPartHeader(std::unique_ptr<TreeItemPart> part);
@@ -257,6 +272,7 @@ public:
     void setPartText(std::unique_ptr<TreeItemPart> part);
 
     bool isComplete() const;
+    bool isListComplete() const;
 
     bool gotEnvelope() const;
     bool gotInternalDate() const;
@@ -272,6 +288,7 @@ private:
     QList<QByteArray> m_hdrReferences;
     QList<QUrl> m_hdrListPost;
     QByteArray m_rememberedBodyStructure;
+    QByteArray m_hdrContentType;
     bool m_hdrListPostNo;
     std::unique_ptr<TreeItemPart> m_partHeader;
     std::unique_ptr<TreeItemPart> m_partText;
@@ -282,6 +299,8 @@ private:
     bool m_gotBodystructure : 1;
     bool m_gotHdrReferences : 1;
     bool m_gotHdrListPost : 1;
+    bool m_bodyStructureRequested : 1;
+    bool m_bodyStructureUnavailable : 1;
 };
 
 class TreeItemMessage: public TreeItem
@@ -292,6 +311,7 @@ class TreeItemMessage: public TreeItem
     friend class Model;
     friend class ObtainSynchronizedMailboxTask; // needs access to m_offset
     friend class KeepMailboxOpenTask; // needs access to m_offset
+    friend class FetchMsgMetadataTask; // needs access to m_data
     friend class ThreadingMsgListModel; // needs access to m_flags
     friend class UpdateFlagsTask; // needs access to m_flags
     friend class UpdateFlagsOfAllMessagesTask; // needs access to m_flags
@@ -301,6 +321,8 @@ class TreeItemMessage: public TreeItem
     QStringList m_flags;
     bool m_flagsHandled;
     bool m_wasUnread;
+    /** @short The FLAGS come from the cache and a background refresh for them is still pending */
+    bool m_flagsStale;
     /** @short Set FLAGS and maintain the unread message counter */
     void setFlags(TreeItemMsgList *list, const QStringList &flags);
     void processAdditionalHeaders(Model *model, const QByteArray &rawHeaders);
@@ -341,12 +363,24 @@ public:
     static QVariantList addresListToQVariant(const QList<Imap::Message::MailAddress> &addressList);
 };
 
+/** @short Progress of a message part which is being downloaded in several BODY[]<offset.length> chunks */
+struct PartialPartFetch {
+    /** @short How many bytes of raw data, i.e. before undoing the Content-Transfer-Encoding, have arrived so far */
+    qint64 rawBytes;
+    /** @short The tail of the raw data which could not be decoded into the part's buffer yet */
+    QByteArray pending;
+    /** @short Offsets of the chunks which are stored in the cache */
+    QVector<qint64> cachedChunks;
+
+    PartialPartFetch(): rawBytes(0) {}
+};
+
 class TreeItemPart: public TreeItem
 {
     void operator=(const TreeItem &);  // don't implement
     friend class TreeItemMailbox; // needs access to m_data
     friend class Model; // dtto
-    friend class FetchMsgPartTask; // needs m_binaryCTEFailed
+    friend class FetchMsgPartTask; // needs m_binaryCTEFailed and m_partialFetch
     QByteArray m_mimeType;
     QByteArray m_charset;
     QByteArray m_contentFormat;
@@ -362,6 +396,12 @@ class TreeItemPart: public TreeItem
     mutable TreeItemPart *m_partMime;
     mutable TreeItemPart *m_partRaw;
     bool m_binaryCTEFailed;
+    /** @short The data are only being downloaded for the cache, nobody wants to see them now */
+    bool m_prefetchOnly;
+    std::unique_ptr<PartialPartFetch> m_partialFetch;
+
+    /** @short Forget the data if they were only downloaded for the cache, and say whether that was the case */
+    bool releasePrefetchedData();
 public:
     TreeItemPart(TreeItem *parent, const QByteArray &mimeType);
     ~TreeItemPart();
@@ -372,6 +412,11 @@ public:
 
     virtual void fetchFromCache(Model *const model);
     void fetch(Model *const model) override;
+    /** @short Make sure that the data end up in the cache without keeping them in memory
+
+    A regular fetch() which comes in the meanwhile makes the data stay around as usual.
+    */
+    void prefetch(Model *const model);
     unsigned int rowCount(Model *const model) override;
     unsigned int columnCount() override;
     QVariant data(Model *const model, int role) override;
@@ -399,6 +444,16 @@ public:
         Imap::Network::MsgPartNetworkReply.
      */
     QByteArray *dataPtr();
+    /** @short Cache key under which the chunk starting at @arg offset of a partially fetched part is stored */
+    QByteArray partialChunkId(const qint64 offset) const;
+    /** @short Add another chunk of raw data of a part which is being fetched piece by piece
+
+    As much of the data as can be safely decoded without seeing the rest of the part is decoded and appended to
+    the part's buffer right away. Only the undecoded remainder of the raw data is kept around.
+    */
+    void appendPartialData(const QByteArray &chunk);
+    /** @short All chunks have arrived, decode whatever is left */
+    void finishPartialData();
     QByteArray mimeType() const { return m_mimeType; }
     QByteArray charset() const { return m_charset; }
     void setCharset(const QByteArray &ch) { m_charset = ch; }
@@ -23,6 +23,7 @@
 #include "MemoryCache.h"
 #include <QDebug>
 #include <QFile>
+#include "LocalSearch.h"
 
 //#define CACHE_DEBUG
 
@@ -49,6 +50,16 @@ void MemoryCache::setChildMailboxes(const QString &mailbox, const QList<MailboxM
     mailboxes[mailbox] = data;
 }
 
+QList<MailboxMetadata> MemoryCache::mailboxTreeSnapshot() const
+{
+    return mailboxTree;
+}
+
+void MemoryCache::setMailboxTreeSnapshot(const QList<MailboxMetadata> &mailboxes)
+{
+    mailboxTree = mailboxes;
+}
+
 SyncState MemoryCache::mailboxSyncState(const QString &mailbox) const
 {
     return syncState[mailbox];
@@ -87,6 +98,7 @@ void MemoryCache::clearAllMessages(const QString &mailbox)
     msgMetadata.remove(mailbox);
     parts.remove(mailbox);
     threads.remove(mailbox);
+    searchTerms.remove(mailbox);
 }
 
 void MemoryCache::clearMessage(const QString mailbox, const uint uid)
@@ -100,6 +112,17 @@ void MemoryCache::clearMessage(const QString mailbox, const uint uid)
         msgMetadata[mailbox].remove(uid);
     if (parts.contains(mailbox))
         parts[mailbox].remove(uid);
+    if (searchTerms.contains(mailbox)) {
+        auto &terms = searchTerms[mailbox];
+        for (auto it = terms.begin(); it != terms.end(); ) {
+            it->remove(uid);
+            if (it->isEmpty()) {
+                it = terms.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
 }
 
 void MemoryCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
@@ -127,6 +150,17 @@ void MemoryCache::setMsgFlags(const QString &mailbox, uint uid, const QStringLis
     flags[mailbox][uid] = newFlags;
 }
 
+void MemoryCache::setMsgFlags(const QString &mailbox, const MessageFlagsList &newFlags)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "set FLAGS for" << newFlags.size() << "messages in" << mailbox;
+#endif
+    auto &mailboxFlags = flags[mailbox];
+    for (const auto &item : newFlags) {
+        mailboxFlags[item.first] = item.second;
+    }
+}
+
 QStringList MemoryCache::msgFlags(const QString &mailbox, const uint uid) const
 {
     return flags[mailbox][uid];
@@ -140,6 +174,9 @@ Imap::Uids MemoryCache::uidMapping(const QString &mailbox) const
 void MemoryCache::setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata)
 {
     msgMetadata[mailbox][uid] = metadata;
+    for (const auto &item : envelopeSearchText(metadata.envelope)) {
+        indexMessageText(mailbox, uid, item.first, item.second);
+    }
 }
 
 MemoryCache::MessageDataBundle MemoryCache::messageMetadata(const QString &mailbox, const uint uid) const
@@ -175,6 +212,47 @@ void MemoryCache::setMessageThreading(const QString &mailbox, const QVector<Imap
     threads[mailbox] = threading;
 }
 
+void MemoryCache::indexMessageText(const QString &mailbox, const uint uid, const int field, const QString &text)
+{
+    auto &terms = searchTerms[mailbox];
+    Q_FOREACH(const QString &word, searchTokens(text)) {
+        terms[word][uid] |= field;
+    }
+}
+
+void MemoryCache::catchUpSearchIndex(const QString &mailbox)
+{
+    // The headers are indexed as soon as the metadata arrive
+    Q_UNUSED(mailbox);
+}
+
+QSet<uint> MemoryCache::searchIndex(const QString &mailbox, const int fields, const QString &prefix) const
+{
+    QSet<uint> res;
+    const auto terms = searchTerms.constFind(mailbox);
+    if (terms == searchTerms.constEnd())
+        return res;
+    for (auto it = terms->lowerBound(prefix); it != terms->constEnd() && it.key().startsWith(prefix); ++it) {
+        for (auto uidIt = it->constBegin(); uidIt != it->constEnd(); ++uidIt) {
+            if (*uidIt & fields)
+                res.insert(uidIt.key());
+        }
+    }
+    return res;
+}
+
+QSet<uint> MemoryCache::indexedMessages(const QString &mailbox) const
+{
+    QSet<uint> res;
+    const auto messages = msgMetadata.constFind(mailbox);
+    if (messages == msgMetadata.constEnd())
+        return res;
+    for (auto it = messages->constBegin(); it != messages->constEnd(); ++it) {
+        res.insert(it.key());
+    }
+    return res;
+}
+
 void MemoryCache::setRenewalThreshold(const int days)
 {
     Q_UNUSED(days);
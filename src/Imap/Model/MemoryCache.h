@@ -45,6 +45,8 @@ public:
     QList<MailboxMetadata> childMailboxes(const QString &mailbox) const override;
     bool childMailboxesFresh(const QString &mailbox) const override;
     void setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data) override;
+    QList<MailboxMetadata> mailboxTreeSnapshot() const override;
+    void setMailboxTreeSnapshot(const QList<MailboxMetadata> &mailboxes) override;
 
     SyncState mailboxSyncState(const QString &mailbox) const override;
     void setMailboxSyncState(const QString &mailbox, const SyncState &state) override;
@@ -61,6 +63,7 @@ public:
 
     QStringList msgFlags(const QString &mailbox, const uint uid) const override;
     void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &newFlags) override;
+    void setMsgFlags(const QString &mailbox, const MessageFlagsList &newFlags) override;
 
     QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const override;
     void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data) override;
@@ -69,16 +72,24 @@ public:
     QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox) override;
     void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading) override;
 
+    void indexMessageText(const QString &mailbox, const uint uid, const int field, const QString &text) override;
+    void catchUpSearchIndex(const QString &mailbox) override;
+    QSet<uint> searchIndex(const QString &mailbox, const int fields, const QString &prefix) const override;
+    QSet<uint> indexedMessages(const QString &mailbox) const override;
+
     void setRenewalThreshold(const int days) override;
 
 private:
     QMap<QString, QList<MailboxMetadata> > mailboxes;
+    QList<MailboxMetadata> mailboxTree;
     QMap<QString, SyncState> syncState;
     QMap<QString, Imap::Uids> seqToUid;
     QMap<QString, QMap<uint,QStringList> > flags;
     QMap<QString, QMap<uint, MessageDataBundle> > msgMetadata;
     QMap<QString, QMap<uint, QMap<QByteArray, QByteArray> > > parts;
     QMap<QString, QVector<Imap::Responses::ThreadingNode> > threads;
+    /** @short The full-text index: mailbox -> word -> UID -> LocalSearchField */
+    QMap<QString, QMap<QString, QHash<uint, int> > > searchTerms;
 };
 
 }
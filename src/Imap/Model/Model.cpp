@@ -25,12 +25,14 @@
 #include <QAuthenticator>
 #include <QCoreApplication>
 #include <QDebug>
+#include <QSet>
 #include "Model.h"
 #include "Common/FindWithUnknown.h"
 #include "Common/InvokeMethod.h"
 #include "Imap/Encoders.h"
 #include "Imap/Model/ItemRoles.h"
 #include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/OfflinePrefetcher.h"
 #include "Imap/Model/SpecialFlagNames.h"
 #include "Imap/Model/TaskPresentationModel.h"
 #include "Imap/Model/Utils.h"
@@ -65,6 +67,16 @@ bool MailboxNamesEqual(const TreeItem *const a, const TreeItem *const b)
     return mailboxA->mailbox() == mailboxB->mailbox();
 }
 
+/** @short Compare two mailbox names, with the special-case "INBOX" always sorted as the first one */
+bool mailboxNameLessThan(const QString &a, const QString &b)
+{
+    if (a == QLatin1String("INBOX"))
+        return b != QLatin1String("INBOX");
+    if (b == QLatin1String("INBOX"))
+        return false;
+    return a.compare(b, Qt::CaseInsensitive) < 0;
+}
+
 /** @short Mailbox name comparator to be used when sorting mailbox names
 
 The special-case mailbox name, the "INBOX", is always sorted as the first one.
@@ -74,11 +86,47 @@ bool MailboxNameComparator(const TreeItem *const a, const TreeItem *const b)
     const TreeItemMailbox *const mailboxA = dynamic_cast<const TreeItemMailbox *const>(a);
     const TreeItemMailbox *const mailboxB = dynamic_cast<const TreeItemMailbox *const>(b);
 
-    if (mailboxA->mailbox() == QLatin1String("INBOX"))
-        return mailboxB->mailbox() != QLatin1String("INBOX");
-    if (mailboxB->mailbox() == QLatin1String("INBOX"))
-        return false;
-    return mailboxA->mailbox().compare(mailboxB->mailbox(), Qt::CaseInsensitive) < 0;
+    return mailboxNameLessThan(mailboxA->mailbox(), mailboxB->mailbox());
+}
+
+bool MailboxMetadataComparator(const MailboxMetadata &a, const MailboxMetadata &b)
+{
+    return mailboxNameLessThan(a.mailbox, b.mailbox);
+}
+
+/** @short Arrange a flat list of all mailboxes into lists of children, indexed by the name of their parent
+
+Top-level mailboxes are stored under a null QString. RFC 3501 allows a server to list a mailbox without its parent, so
+any such missing parents are made up as non-selectable mailboxes.
+*/
+QHash<QString, QList<MailboxMetadata>> mailboxTreeByParent(const QList<MailboxMetadata> &mailboxes)
+{
+    QHash<QString, QList<MailboxMetadata>> tree;
+    QSet<QString> known;
+    QList<MailboxMetadata> pending;
+    Q_FOREACH(const MailboxMetadata &metadata, mailboxes) {
+        if (!known.contains(metadata.mailbox)) {
+            known.insert(metadata.mailbox);
+            pending << metadata;
+        }
+    }
+    for (int i = 0; i < pending.size(); ++i) {
+        const MailboxMetadata metadata = pending[i];
+        QString parentName;
+        const int pos = metadata.separator.isEmpty() ? -1 : metadata.mailbox.lastIndexOf(metadata.separator);
+        if (pos > 0) {
+            parentName = metadata.mailbox.left(pos);
+            if (!known.contains(parentName)) {
+                known.insert(parentName);
+                pending << MailboxMetadata(parentName, metadata.separator,
+                                           QStringList() << QStringLiteral("\\NOSELECT") << TreeItemMailbox::flagHasChildren);
+            }
+        }
+        tree[parentName] << metadata;
+    }
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+        std::sort(it->begin(), it->end(), MailboxMetadataComparator);
+    return tree;
 }
 
 bool uidComparator(const TreeItem *const item, const uint uid)
@@ -95,6 +143,9 @@ bool messageHasUidZero(const TreeItem *const item)
     return message->uid() == 0;
 }
 
+/** @short How many recently opened mailboxes are considered for the background synchronization */
+const int recentMailboxesLimit = 10;
+
 }
 
 namespace Imap
@@ -112,6 +163,8 @@ Model::Model(QObject *parent, std::shared_ptr<AbstractCache> cache, SocketFactor
     , m_netPolicy(NETWORK_OFFLINE)
     , m_taskModel(nullptr)
     , m_hasImapPassword(PasswordAvailability::NOT_REQUESTED)
+    , m_backgroundSyncConnections(0)
+    , m_offlinePrefetcher(nullptr)
 {
     m_startTls = m_socketFactory->startTlsRequired();
 
@@ -135,7 +188,16 @@ Model::Model(QObject *parent, std::shared_ptr<AbstractCache> cache, SocketFactor
     m_periodicMailboxNumbersRefresh = new QTimer(this);
     // polling every five minutes
     m_periodicMailboxNumbersRefresh->setInterval(5 * 60 * 1000);
-    connect(m_periodicMailboxNumbersRefresh, &QTimer::timeout, this, &Model::invalidateAllMessageCounts);
+    connect(m_periodicMailboxNumbersRefresh, &QTimer::timeout, this, &Model::slotPeriodicMailboxNumbersRefresh);
+
+    m_backgroundSyncTimer = new QTimer(this);
+    m_backgroundSyncTimer->setSingleShot(true);
+    connect(m_backgroundSyncTimer, &QTimer::timeout, this, &Model::slotBackgroundSync);
+    // A connection got authenticated or some mailbox got synced, so there might be something to do
+    connect(this, &Model::connectionStateChanged, this, &Model::scheduleBackgroundSync);
+    connect(this, &Model::mailboxSyncingProgress, this, &Model::scheduleBackgroundSync);
+    // The queued mailboxes can only be found once they are listed
+    connect(this, &QAbstractItemModel::rowsInserted, this, &Model::scheduleBackgroundSync);
 }
 
 Model::~Model()
@@ -311,6 +373,12 @@ void Model::handleState(Imap::Parser *ptr, const Imap::Responses::State *const r
             if (resp->respCode == NONE) {
                 // This one probably should not be logged at all; dovecot sends these reponses to keep NATted connections alive
                 break;
+            } else if (resp->respCode == NOTIFICATIONOVERFLOW) {
+                // The server has stopped sending notifications, so we are on our own again
+                logTrace(ptr->parserId(), Common::LOG_OTHER, QString(), QStringLiteral("NOTIFY overflow, reverting to polling"));
+                accessParser(ptr).notifyActive = false;
+                invalidateAllMessageCounts();
+                break;
             } else {
                 logTrace(ptr->parserId(), Common::LOG_OTHER, QString(), QStringLiteral("Warning: unhandled untagged OK with a response code"));
                 break;
@@ -384,6 +452,27 @@ void Model::finalizeList(Parser *parser, TreeItemMailbox *mailboxPtr)
     replaceChildMailboxes(mailboxPtr, mailboxes);
 }
 
+/** @short Process the result of a LIST of the whole mailbox hierarchy */
+void Model::finalizeRecursiveList(Parser *parser)
+{
+    QList<MailboxMetadata> mailboxes;
+    QList<Responses::List> &listResponses = accessParser(parser).listResponses;
+    Q_FOREACH(const Responses::List &resp, listResponses) {
+        if (resp.mailbox.isEmpty() || (!resp.separator.isEmpty() && resp.mailbox.endsWith(resp.separator))) {
+            // rubbish, ignore
+            continue;
+        }
+        MailboxMetadata metadata(resp.mailbox, resp.separator, QStringList());
+        Q_FOREACH(const QString &flag, resp.flags)
+            metadata.flags << flag.toUpper();
+        mailboxes << metadata;
+    }
+    listResponses.clear();
+
+    cache()->setMailboxTreeSnapshot(mailboxes);
+    mergeMailboxTree(m_mailboxes, mailboxTreeByParent(mailboxes), false);
+}
+
 void Model::finalizeIncrementalList(Parser *parser, const QString &parentMailboxName)
 {
     TreeItemMailbox *parentMbox = findParentMailboxByName(parentMailboxName);
@@ -429,6 +518,7 @@ void Model::finalizeIncrementalList(Parser *parser, const QString &parentMailbox
         beginInsertRows(parentIdx, (*it)->row(), (*it)->row());
     parentMbox->m_children.insert(it, mailboxes[0]);
     endInsertRows();
+    addToMailboxTreeSnapshot(static_cast<TreeItemMailbox *>(mailboxes[0])->mailboxMetadata());
 }
 
 void Model::replaceChildMailboxes(TreeItemMailbox *mailboxPtr, const TreeItemChildrenList &mailboxes)
@@ -492,6 +582,133 @@ void Model::replaceChildMailboxes(TreeItemMailbox *mailboxPtr, const TreeItemChi
     emit dataChanged(parent, parent);
 }
 
+/** @short Bring the child mailboxes of @arg mailboxPtr in sync with the @arg tree, recursively
+
+In contrast to replaceChildMailboxes(), this only touches what has actually changed, so that refreshing a huge tree
+in the background does not collapse the views, nor does it throw away the state of the mailboxes.
+*/
+void Model::mergeMailboxTree(TreeItemMailbox *mailboxPtr, const QHash<QString, QList<MailboxMetadata>> &tree, const bool fromCache)
+{
+    const QList<MailboxMetadata> wanted = tree.value(mailboxPtr->mailbox());
+    const QModelIndex parent = mailboxPtr == m_mailboxes ? QModelIndex() : mailboxPtr->toIndex(this);
+
+    // The first child is the list of messages
+    int row = 1;
+    auto it = wanted.constBegin();
+    while (it != wanted.constEnd() || row < mailboxPtr->m_children.size()) {
+        TreeItemMailbox *existing = row < mailboxPtr->m_children.size() ?
+                    static_cast<TreeItemMailbox *>(mailboxPtr->m_children[row]) : nullptr;
+        if (existing && it != wanted.constEnd() && existing->mailbox() == it->mailbox) {
+            if (existing->mailboxMetadata() != *it) {
+                existing->m_metadata = *it;
+                const QModelIndex idx = existing->toIndex(this);
+                emit dataChanged(idx, idx);
+            }
+            // A LIST which is already in flight for this one will replace its children anyway
+            if (!existing->loading())
+                mergeMailboxTree(existing, tree, fromCache);
+            ++it;
+            ++row;
+        } else if (existing && (it == wanted.constEnd() || mailboxNameLessThan(existing->mailbox(), it->mailbox))) {
+            // This mailbox is gone
+            beginRemoveRows(parent, row, row);
+            mailboxPtr->m_children.erase(mailboxPtr->m_children.begin() + row);
+            endRemoveRows();
+            delete existing;
+        } else {
+            TreeItemMailbox *mailbox = buildMailboxSubtree(mailboxPtr, *it, tree, fromCache);
+            beginInsertRows(parent, row, row);
+            mailboxPtr->m_children.insert(mailboxPtr->m_children.begin() + row, mailbox);
+            endInsertRows();
+            ++it;
+            ++row;
+        }
+    }
+
+    if (!mailboxPtr->fetched()) {
+        mailboxPtr->setFetchStatus(TreeItem::DONE);
+        emit dataChanged(parent, parent);
+    }
+}
+
+/** @short Create a new mailbox along with all of its child mailboxes as described by the @arg tree */
+TreeItemMailbox *Model::buildMailboxSubtree(TreeItem *parent, const MailboxMetadata &metadata,
+                                            const QHash<QString, QList<MailboxMetadata>> &tree, const bool fromCache)
+{
+    TreeItemMailbox *mailbox = fromCache ? mailboxFromCache(parent, metadata) : TreeItemMailbox::fromMetadata(parent, metadata);
+    TreeItemChildrenList children;
+    Q_FOREACH(const MailboxMetadata &child, tree.value(metadata.mailbox))
+        children << buildMailboxSubtree(mailbox, child, tree, fromCache);
+    // This also marks the list of child mailboxes as known, even if it's empty
+    mailbox->setChildren(children);
+    return mailbox;
+}
+
+/** @short Create a mailbox item and restore the message counts which were known the last time */
+TreeItemMailbox *Model::mailboxFromCache(TreeItem *parent, const MailboxMetadata &metadata)
+{
+    TreeItemMailbox *mailbox = TreeItemMailbox::fromMetadata(parent, metadata);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+    Imap::Mailbox::SyncState syncState = cache()->mailboxSyncState(mailbox->mailbox());
+    if (syncState.isUsableForNumbers()) {
+        list->m_unreadMessageCount = syncState.unSeenCount();
+        list->m_totalMessageCount = syncState.exists();
+        list->m_recentMessageCount = syncState.recent();
+        list->m_numberFetchingStatus = TreeItem::LOADING;
+    } else {
+        list->m_numberFetchingStatus = TreeItem::UNAVAILABLE;
+    }
+    return mailbox;
+}
+
+/** @short Put a newly created mailbox into the cached snapshot of the whole mailbox tree
+
+Nothing happens when no snapshot has been saved yet, i.e. when the recursive LIST is not in use.
+*/
+void Model::addToMailboxTreeSnapshot(const MailboxMetadata &metadata)
+{
+    QList<MailboxMetadata> snapshot = cache()->mailboxTreeSnapshot();
+    if (snapshot.isEmpty())
+        return;
+    for (auto it = snapshot.begin(); it != snapshot.end(); /* nothing */) {
+        if (it->mailbox == metadata.mailbox)
+            it = snapshot.erase(it);
+        else
+            ++it;
+    }
+    snapshot << metadata;
+    cache()->setMailboxTreeSnapshot(snapshot);
+}
+
+/** @short Remove a deleted mailbox along with all of its children from the cached snapshot of the whole mailbox tree */
+void Model::removeFromMailboxTreeSnapshot(const QString &mailbox)
+{
+    QList<MailboxMetadata> snapshot = cache()->mailboxTreeSnapshot();
+    if (snapshot.isEmpty())
+        return;
+    bool changed = false;
+    for (auto it = snapshot.begin(); it != snapshot.end(); /* nothing */) {
+        if (it->mailbox == mailbox || (!it->separator.isEmpty() && it->mailbox.startsWith(mailbox + it->separator))) {
+            it = snapshot.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+    if (changed)
+        cache()->setMailboxTreeSnapshot(snapshot);
+}
+
+/** @short Shall the whole mailbox hierarchy be obtained through a single LIST "" "*"?
+
+The whole tree is then also saved as one snapshot in the cache, and restored from it on startup.
+*/
+bool Model::recursiveMailboxListing() const
+{
+    return property("trojita-imap-list-recursive").toBool();
+}
+
 void Model::emitMessageCountChanged(TreeItemMailbox *const mailbox)
 {
     TreeItemMsgList *list = static_cast<TreeItemMsgList *>(mailbox->m_children[0]);
@@ -573,7 +790,13 @@ void Model::handleStatus(Imap::Parser *ptr, const Imap::Responses::Status *const
         updateCache |= list->m_recentMessageCount != static_cast<const int>(it.value());
         list->m_recentMessageCount = it.value();
     }
-    list->m_numberFetchingStatus = TreeItem::DONE;
+    if (accessParser(ptr).notifyActive && !resp->states.contains(Imap::Responses::Status::UNSEEN) && !mailbox->maintainingTask) {
+        // A notification about new or expunged messages does not necessarily say anything about the unread ones.
+        // Let's have it refreshed through a regular STATUS once someone is interested in it.
+        list->m_numberFetchingStatus = TreeItem::NONE;
+    } else {
+        list->m_numberFetchingStatus = TreeItem::DONE;
+    }
     emitMessageCountChanged(mailbox);
 
     if (updateCache) {
@@ -774,24 +997,20 @@ void Model::askForMessagesInMailbox(const QModelIndex &index)
 
 void Model::askForChildrenOfMailbox(TreeItemMailbox *item, bool forceReload)
 {
-    if (!forceReload && cache()->childMailboxesFresh(item->mailbox())) {
+    const bool recursive = item == m_mailboxes && recursiveMailboxListing();
+    QList<MailboxMetadata> snapshot;
+    if (recursive && !forceReload)
+        snapshot = cache()->mailboxTreeSnapshot();
+
+    if (!snapshot.isEmpty()) {
+        // The whole tree is known from the last time; the LIST below will only bring in the changes
+        mergeMailboxTree(m_mailboxes, mailboxTreeByParent(snapshot), true);
+    } else if (!recursive && !forceReload && cache()->childMailboxesFresh(item->mailbox())) {
         // The permanent cache contains relevant data
         QList<MailboxMetadata> metadata = cache()->childMailboxes(item->mailbox());
         TreeItemChildrenList mailboxes;
         for (QList<MailboxMetadata>::const_iterator it = metadata.constBegin(); it != metadata.constEnd(); ++it) {
-            TreeItemMailbox *mailbox = TreeItemMailbox::fromMetadata(item, *it);
-            TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(mailbox->m_children[0]);
-            Q_ASSERT(list);
-            Imap::Mailbox::SyncState syncState = cache()->mailboxSyncState(mailbox->mailbox());
-            if (syncState.isUsableForNumbers()) {
-                list->m_unreadMessageCount = syncState.unSeenCount();
-                list->m_totalMessageCount = syncState.exists();
-                list->m_recentMessageCount = syncState.recent();
-                list->m_numberFetchingStatus = TreeItem::LOADING;
-            } else {
-                list->m_numberFetchingStatus = TreeItem::UNAVAILABLE;
-            }
-            mailboxes << mailbox;
+            mailboxes << mailboxFromCache(item, *it);
         }
         TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(item);
         Q_ASSERT(mailboxPtr);
@@ -903,35 +1122,42 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
         AbstractCache::MessageDataBundle data = cache()->messageMetadata(mailboxPtr->mailbox(), item->uid());
         if (data.uid == item->uid()) {
             item->data()->setEnvelope(data.envelope);
+            item->data()->setInternalDate(data.internalDate);
             item->data()->setSize(data.size);
             item->data()->setHdrReferences(data.hdrReferences);
             item->data()->setHdrListPost(data.hdrListPost);
             item->data()->setHdrListPostNo(data.hdrListPostNo);
-            QDataStream stream(&data.serializedBodyStructure, QIODevice::ReadOnly);
-            stream.setVersion(QDataStream::Qt_4_6);
-            QVariantList unserialized;
-            stream >> unserialized;
-            QSharedPointer<Message::AbstractMessage> abstractMessage;
-            try {
-                abstractMessage = Message::AbstractMessage::fromList(unserialized, QByteArray(), 0);
-            } catch (Imap::ParserException &e) {
-                qDebug() << "Error when parsing cached BODYSTRUCTURE" << e.what();
-            }
-            if (! abstractMessage) {
-                item->setFetchStatus(TreeItem::UNAVAILABLE);
+            if (data.serializedBodyStructure.isEmpty()) {
+                // Only the metadata for the message list were cached, the BODYSTRUCTURE will be asked for on demand
+                item->setFetchStatus(TreeItem::DONE);
             } else {
-                auto newChildren = abstractMessage->createTreeItems(item);
-                if (item->m_children.isEmpty()) {
-                    TreeItemChildrenList oldChildren = item->setChildren(newChildren);
-                    Q_ASSERT(oldChildren.size() == 0);
+                item->data()->setRememberedBodyStructure(data.serializedBodyStructure);
+                QDataStream stream(&data.serializedBodyStructure, QIODevice::ReadOnly);
+                stream.setVersion(QDataStream::Qt_4_6);
+                QVariantList unserialized;
+                stream >> unserialized;
+                QSharedPointer<Message::AbstractMessage> abstractMessage;
+                try {
+                    abstractMessage = Message::AbstractMessage::fromList(unserialized, QByteArray(), 0);
+                } catch (Imap::ParserException &e) {
+                    qDebug() << "Error when parsing cached BODYSTRUCTURE" << e.what();
+                }
+                if (! abstractMessage) {
+                    item->setFetchStatus(TreeItem::UNAVAILABLE);
                 } else {
-                    // The following assert guards against that crazy signal emitting we had when various askFor*()
-                    // functions were not delayed. If it gets hit, it means that someone tried to call this function
-                    // on an item which was already loaded.
-                    Q_ASSERT(item->m_children.isEmpty());
-                    item->setChildren(newChildren);
+                    auto newChildren = abstractMessage->createTreeItems(item);
+                    if (item->m_children.isEmpty()) {
+                        TreeItemChildrenList oldChildren = item->setChildren(newChildren);
+                        Q_ASSERT(oldChildren.size() == 0);
+                    } else {
+                        // The following assert guards against that crazy signal emitting we had when various askFor*()
+                        // functions were not delayed. If it gets hit, it means that someone tried to call this function
+                        // on an item which was already loaded.
+                        Q_ASSERT(item->m_children.isEmpty());
+                        item->setChildren(newChildren);
+                    }
+                    item->setFetchStatus(TreeItem::DONE);
                 }
-                item->setFetchStatus(TreeItem::DONE);
             }
         }
     }
@@ -978,6 +1204,65 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     EMIT_LATER(this, dataChanged, Q_ARG(QModelIndex, item->toIndex(this)), Q_ARG(QModelIndex, item->toIndex(this)));
 }
 
+/** @short Somebody wants to look inside a message whose BODYSTRUCTURE was deferred
+
+The rest of the metadata are already known at this point, see deferBodyStructure().
+*/
+void Model::askForMsgBodyStructure(TreeItemMessage *item)
+{
+    if (!item->uid() || item->data()->gotRemeberedBodyStructure() || item->data()->bodyStructureRequested())
+        return;
+
+    if (networkPolicy() == NETWORK_OFFLINE) {
+        // The list metadata were cached without the BODYSTRUCTURE, so there's nothing to wait for until we go online
+        if (!item->data()->bodyStructureUnavailable()) {
+            item->data()->setBodyStructureUnavailable(true);
+            QModelIndex idx = item->toIndex(this);
+            emit dataChanged(idx, idx);
+        }
+        return;
+    }
+
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(item->parent());
+    Q_ASSERT(list);
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(list->parent());
+    Q_ASSERT(mailboxPtr);
+
+    item->data()->setBodyStructureUnavailable(false);
+    item->data()->setBodyStructureRequested(true);
+    findTaskResponsibleFor(mailboxPtr)->requestBodyStructureDownload(item->uid());
+}
+
+/** @short Shall the message list get populated without waiting for the BODYSTRUCTURE?
+
+The BODYSTRUCTURE is usually the biggest item of the message metadata, yet nobody needs it unless the message is
+opened or its attachment indicator is shown. When this is enabled, the initial fetch only asks for what is needed for
+the message list, and the structure is fetched on demand by askForMsgBodyStructure().
+*/
+bool Model::deferBodyStructure() const
+{
+    return property("trojita-imap-defer-bodystructure").toBool();
+}
+
+/** @short The FLAGS of this message are only known from the cache, and someone is looking at them right now
+
+The background refresh of FLAGS which was queued by the mailbox sync shall continue around this message.
+*/
+void Model::askForMsgFlags(TreeItemMessage *item)
+{
+    if (networkPolicy() == NETWORK_OFFLINE || !item->uid())
+        return;
+
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(item->parent());
+    Q_ASSERT(list);
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(list->parent());
+    Q_ASSERT(mailboxPtr);
+
+    // Only the task which queued the refresh knows about it; there's no point in opening the mailbox just for this
+    if (mailboxPtr->maintainingTask)
+        mailboxPtr->maintainingTask->prioritizeFlagsResync(item->uid());
+}
+
 void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
 {
     Q_ASSERT(item->message());   // TreeItemMessage
@@ -1031,6 +1316,27 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
         if (item->accessFetchStatus() != TreeItem::DONE)
             item->setFetchStatus(TreeItem::UNAVAILABLE);
     } else if (! onlyFromCache) {
+        bool ok;
+        quint64 partialFetchThreshold = property("trojita-imap-partial-fetch-threshold").toULongLong(&ok);
+        if (!ok)
+            partialFetchThreshold = 4 * 1024 * 1024;
+        if (!isSpecialRawPart && partialFetchThreshold && item->octets() >= partialFetchThreshold) {
+            // Big parts are downloaded in chunks. Whatever has been stored by a previous, interrupted attempt
+            // is picked up from the cache so that we only have to ask for the rest.
+            item->m_partialFetch.reset(new PartialPartFetch());
+            item->m_data.clear();
+            Q_FOREVER {
+                const qint64 offset = item->m_partialFetch->rawBytes;
+                const QByteArray &chunk = cache()->messagePart(mailboxPtr->mailbox(), uid, item->partialChunkId(offset));
+                if (chunk.isEmpty())
+                    break;
+                item->m_partialFetch->cachedChunks << offset;
+                item->appendPartialData(chunk);
+            }
+            askForMsgPartChunk(item);
+            return;
+        }
+
         KeepMailboxOpenTask *keepTask = findTaskResponsibleFor(mailboxPtr);
         TreeItemPart::PartFetchingMode fetchingMode = TreeItemPart::FETCH_PART_IMAP;
         if (!isSpecialRawPart && keepTask->parser && accessParser(keepTask->parser).capabilitiesFresh &&
@@ -1044,6 +1350,27 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
     }
 }
 
+void Model::askForMsgPartChunk(TreeItemPart *item)
+{
+    Q_ASSERT(item->m_partialFetch);
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(item->message()->parent()->parent());
+    Q_ASSERT(mailboxPtr);
+
+    const int chunkSize = partialFetchChunkSize();
+    QByteArray partId = item->partIdForFetch(TreeItemPart::FETCH_PART_IMAP) + '<'
+            + QByteArray::number(item->m_partialFetch->rawBytes) + '.' + QByteArray::number(chunkSize) + '>';
+    findTaskResponsibleFor(mailboxPtr)->requestPartDownload(item->message()->m_uid, partId, chunkSize);
+}
+
+int Model::partialFetchChunkSize() const
+{
+    bool ok;
+    int chunkSize = property("trojita-imap-partial-fetch-chunk-size").toInt(&ok);
+    if (!ok || chunkSize <= 0)
+        chunkSize = 1024 * 1024;
+    return chunkSize;
+}
+
 void Model::resyncMailbox(const QModelIndex &mbox)
 {
     findTaskResponsibleFor(mbox)->resynchronizeMailbox();
@@ -1087,6 +1414,11 @@ void Model::setNetworkPolicy(const NetworkPolicy policy)
     case NETWORK_ONLINE:
         m_netPolicy = NETWORK_ONLINE;
         m_periodicMailboxNumbersRefresh->start();
+        if (m_backgroundSyncConnections > 0) {
+            m_backgroundSyncQueue = m_backgroundSyncMailboxes + m_recentMailboxes;
+            m_backgroundSyncQueue.removeDuplicates();
+            scheduleBackgroundSync();
+        }
         emit networkPolicyChanged();
         emit networkPolicyOnline();
         break;
@@ -1171,7 +1503,18 @@ void Model::switchToMailbox(const QModelIndex &mbox)
     if (m_netPolicy == NETWORK_OFFLINE)
         return;
 
-    findTaskResponsibleFor(mbox);
+    KeepMailboxOpenTask *task = findTaskResponsibleFor(mbox);
+
+    const QString name = mbox.data(RoleMailboxName).toString();
+    m_recentMailboxes.removeOne(name);
+    m_recentMailboxes.prepend(name);
+    while (m_recentMailboxes.size() > recentMailboxesLimit)
+        m_recentMailboxes.removeLast();
+
+    if (accessParser(task->parser).backgroundSync) {
+        // The user is using it now, so don't move it to another mailbox behind their back
+        scheduleBackgroundSync();
+    }
 }
 
 void Model::updateCapabilities(Parser *parser, const QStringList capabilities)
@@ -1570,12 +1913,17 @@ KeepMailboxOpenTask *Model::findTaskResponsibleFor(TreeItemMailbox *mailboxPtr)
         // stealing it from some mailbox, but there's no other way.
         Q_ASSERT(!m_parsers.isEmpty());
 
-        for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
-            if (it->connState == CONN_STATE_LOGOUT) {
-                // this one is not usable
-                continue;
+        // Connections used for the background synchronization are only taken when there's nothing else
+        for (const bool allowBackground : {false, true}) {
+            for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+                if (it->connState == CONN_STATE_LOGOUT) {
+                    // this one is not usable
+                    continue;
+                }
+                if (it->backgroundSync && !allowBackground)
+                    continue;
+                return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), it.key());
             }
-            return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), it.key());
         }
         // At this point, we have no other choice than to create a new connection
         return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), 0);
@@ -1932,6 +2280,119 @@ void Model::invalidateAllMessageCounts()
     }
 }
 
+void Model::slotPeriodicMailboxNumbersRefresh()
+{
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (it->notifyActive)
+            return;
+    }
+    invalidateAllMessageCounts();
+}
+
+void Model::setBackgroundSync(const int connections, const QStringList &mailboxes)
+{
+    m_backgroundSyncConnections = connections;
+    m_backgroundSyncMailboxes = mailboxes;
+    m_backgroundSyncQueue = m_backgroundSyncMailboxes + m_recentMailboxes;
+    m_backgroundSyncQueue.removeDuplicates();
+    scheduleBackgroundSync();
+}
+
+void Model::setOfflinePrefetch(const bool enabled, const int days)
+{
+    if (!enabled) {
+        delete m_offlinePrefetcher;
+        m_offlinePrefetcher = nullptr;
+        return;
+    }
+    if (!m_offlinePrefetcher)
+        m_offlinePrefetcher = new OfflinePrefetcher(this);
+    m_offlinePrefetcher->start(QStringList() << QStringLiteral("INBOX") << m_backgroundSyncMailboxes, days);
+}
+
+void Model::scheduleBackgroundSync()
+{
+    // A steady stream of LIST responses or sync progress shall not postpone the sync forever
+    if (m_backgroundSyncConnections <= 0 || m_backgroundSyncTimer->isActive())
+        return;
+
+    bool ok;
+    int delay = property("trojita-imap-background-sync-delay").toInt(&ok);
+    if (!ok)
+        delay = 1000; // give the interactive stuff a head start
+    m_backgroundSyncTimer->start(delay);
+}
+
+void Model::slotBackgroundSync()
+{
+    if (m_netPolicy != NETWORK_ONLINE || m_backgroundSyncConnections <= 0 || m_backgroundSyncQueue.isEmpty())
+        return;
+
+    bool ok;
+    int limitActiveTasks = property("trojita-imap-limit-active-tasks").toInt(&ok);
+    if (!ok)
+        limitActiveTasks = 100;
+
+    // The mailbox which the user is looking at shall stay where it is
+    TreeItemMailbox *current = m_recentMailboxes.isEmpty() ? nullptr : findMailboxByName(m_recentMailboxes.first());
+    Parser *currentParser = current && current->maintainingTask ? current->maintainingTask->parser : nullptr;
+
+    bool authenticated = false;
+    int backgroundConnections = 0;
+    QList<Parser *> freeParsers;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (it->connState == CONN_STATE_LOGOUT)
+            continue;
+        if (!it->backgroundSync) {
+            authenticated |= it->connState >= CONN_STATE_AUTHENTICATED;
+            continue;
+        }
+        ++backgroundConnections;
+        if (it.key() == currentParser || it->activeTasks.size() >= limitActiveTasks)
+            continue;
+        if (it->maintainingTask && !it->maintainingTask->isMailboxSynchronized())
+            continue;
+        if (m_offlinePrefetcher && m_offlinePrefetcher->isBusyWith(it->maintainingTask))
+            continue;
+        freeParsers << it.key();
+    }
+
+    // Extra connections would ask for the password on their own, so wait until the main one is known to work
+    if (!authenticated)
+        return;
+
+    auto nextMailbox = [this]() -> TreeItemMailbox * {
+        for (auto it = m_backgroundSyncQueue.begin(); it != m_backgroundSyncQueue.end(); /* nothing */) {
+            TreeItemMailbox *mailbox = findMailboxByName(*it);
+            if (!mailbox) {
+                // Not listed yet, let's try again later
+                ++it;
+                continue;
+            }
+            it = m_backgroundSyncQueue.erase(it);
+            if (mailbox->isSelectable() && !mailbox->maintainingTask)
+                return mailbox;
+        }
+        return nullptr;
+    };
+
+    Q_FOREACH(Parser *parser, freeParsers) {
+        TreeItemMailbox *mailbox = nextMailbox();
+        if (!mailbox)
+            return;
+        m_taskFactory->createKeepMailboxOpenTask(this, mailbox->toIndex(this), parser);
+    }
+
+    while (backgroundConnections < qMin(m_backgroundSyncConnections, m_maxParsers - 1)) {
+        TreeItemMailbox *mailbox = nextMailbox();
+        if (!mailbox)
+            return;
+        KeepMailboxOpenTask *task = m_taskFactory->createKeepMailboxOpenTask(this, mailbox->toIndex(this), 0);
+        accessParser(task->parser).backgroundSync = true;
+        ++backgroundConnections;
+    }
+}
+
 AppendTask *Model::appendIntoMailbox(const QString &mailbox, const QByteArray &rawMessageData, const QStringList &flags,
                                      const QDateTime &timestamp)
 {
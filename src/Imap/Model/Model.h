@@ -78,6 +78,7 @@ class SystemNetworkWatcher;
 
 class ImapTask;
 class KeepMailboxOpenTask;
+class OfflinePrefetcher;
 class TaskPresentationModel;
 template <typename SourceModel> class SubtreeClassSpecificItem;
 typedef std::unique_ptr<Streams::SocketFactory> SocketFactoryPtr;
@@ -289,6 +290,19 @@ public:
 
     void setNumberRefreshInterval(const int interval);
 
+    /** @short Keep up to @arg connections extra connections busy with resynchronizing mailboxes in the background
+
+    The @arg mailboxes are synchronized first, followed by those which were recently opened by the user. Their sync state
+    ends up in the cache, so that opening them later is just a quick incremental resync. Zero connections disable this.
+    */
+    void setBackgroundSync(const int connections, const QStringList &mailboxes);
+
+    /** @short Download messages from the last @arg days days for offline use in the background
+
+    This covers the INBOX and the mailboxes which are synchronized in the background. Zero days mean all messages.
+    */
+    void setOfflinePrefetch(const bool enabled, const int days);
+
 public slots:
     /** @short Ask for an updated list of mailboxes on the server */
     void reloadMailboxList();
@@ -332,6 +346,14 @@ private slots:
 
     void setImapAuthError(const QString &error);
 
+    /** @short Time to refresh the message counts, unless the server pushes them to us already */
+    void slotPeriodicMailboxNumbersRefresh();
+
+    /** @short Make sure that the background sync runs soon, unless it is scheduled already */
+    void scheduleBackgroundSync();
+    /** @short Hand the queued mailboxes to the background connections which are not busy */
+    void slotBackgroundSync();
+
 signals:
     /** @short This signal is emitted then the server sent us an ALERT response code */
     void alertReceived(const QString &message);
@@ -460,6 +482,7 @@ private:
     friend class Fake_ListChildMailboxesTask;
     friend class Fake_OpenConnectionTask;
     friend class NoopTask;
+    friend class NotifyTask;
     friend class ThreadTask;
     friend class UnSelectTask;
     friend class OfflineConnectionTask;
@@ -473,6 +496,7 @@ private:
     friend class DummyNetworkWatcher; // needs access to the network policy manipulation
     friend class SystemNetworkWatcher; // needs access to the network policy manipulation
     friend class NetworkWatcher; // needs access to the network policy manipulation
+    friend class OfflinePrefetcher; // needs access to the ParserState, the tasks and the background sync
 
     friend class ::FakeCapabilitiesInjector; // for injecting fake capabilities
     friend class ::ImapModelIdleTest; // needs access to findTaskResponsibleFor() for IDLE testing
@@ -490,13 +514,30 @@ private:
     typedef enum {PRELOAD_PER_POLICY, PRELOAD_DISABLED} PreloadingMode;
 
     void askForMsgMetadata(TreeItemMessage *item, PreloadingMode preloadMode);
+    /** @short Queue download of the BODYSTRUCTURE which was not fetched along with the rest of the message metadata */
+    void askForMsgBodyStructure(TreeItemMessage *item);
+    /** @short Should the BODYSTRUCTURE be left out from the initial metadata fetch? */
+    bool deferBodyStructure() const;
     void askForMsgPart(TreeItemPart *item, bool onlyFromCache=false);
+    /** @short Queue download of the next BODY[...]<offset.length> chunk of a part which is fetched piece by piece */
+    void askForMsgPartChunk(TreeItemPart *item);
+    /** @short How many bytes to ask for in one chunk of a big message part */
+    int partialFetchChunkSize() const;
+    void askForMsgFlags(TreeItemMessage *item);
 
     void finalizeList(Parser *parser, TreeItemMailbox *const mailboxPtr);
     void finalizeIncrementalList(Parser *parser, const QString &parentMailboxName);
+    void finalizeRecursiveList(Parser *parser);
     void genericHandleFetch(TreeItemMailbox *mailbox, const Imap::Responses::Fetch *const resp);
 
     void replaceChildMailboxes(TreeItemMailbox *mailboxPtr, const TreeItemChildrenList &mailboxes);
+    void mergeMailboxTree(TreeItemMailbox *mailboxPtr, const QHash<QString, QList<MailboxMetadata>> &tree, const bool fromCache);
+    TreeItemMailbox *buildMailboxSubtree(TreeItem *parent, const MailboxMetadata &metadata,
+                                         const QHash<QString, QList<MailboxMetadata>> &tree, const bool fromCache);
+    TreeItemMailbox *mailboxFromCache(TreeItem *parent, const MailboxMetadata &metadata);
+    bool recursiveMailboxListing() const;
+    void addToMailboxTreeSnapshot(const MailboxMetadata &metadata);
+    void removeFromMailboxTreeSnapshot(const QString &mailbox);
     void updateCapabilities(Parser *parser, const QStringList capabilities);
 
     TreeItem *translatePtr(const QModelIndex &index) const;
@@ -579,6 +620,17 @@ private:
 
     QTimer *m_periodicMailboxNumbersRefresh;
 
+    /** @short How many extra connections can be used for synchronizing mailboxes in the background */
+    int m_backgroundSyncConnections;
+    /** @short Mailboxes which the user wants to have synchronized in the background */
+    QStringList m_backgroundSyncMailboxes;
+    /** @short Mailboxes which the user has opened recently, the latest one first */
+    QStringList m_recentMailboxes;
+    /** @short Mailboxes which are still waiting for their background synchronization */
+    QStringList m_backgroundSyncQueue;
+    QTimer *m_backgroundSyncTimer;
+    OfflinePrefetcher *m_offlinePrefetcher;
+
     QStringList m_capabilitiesBlacklist;
 
 protected slots:
@@ -0,0 +1,273 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <QDate>
+#include <QLocale>
+#include <QTimer>
+#include "OfflinePrefetcher.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Model/TaskFactory.h"
+#include "Imap/Tasks/KeepMailboxOpenTask.h"
+#include "Imap/Tasks/SortTask.h"
+
+namespace Imap {
+namespace Mailbox {
+
+OfflinePrefetcher::OfflinePrefetcher(Model *model)
+    : QObject(model)
+    , m_model(model)
+    , m_days(0)
+{
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    bool ok;
+    int interval = m_model->property("trojita-imap-prefetch-interval").toInt(&ok);
+    if (!ok)
+        interval = 2000;
+    m_timer->setInterval(interval);
+    connect(m_timer, &QTimer::timeout, this, &OfflinePrefetcher::slotNextStep);
+    connect(m_model, &Model::networkPolicyOnline, this, &OfflinePrefetcher::slotNetworkOnline);
+}
+
+void OfflinePrefetcher::start(const QStringList &mailboxes, const int days)
+{
+    m_mailboxes = mailboxes;
+    m_mailboxes.removeDuplicates();
+    m_days = days;
+    m_queue = m_mailboxes;
+    if (!m_mailbox.isEmpty())
+        m_queue.removeOne(m_mailbox);
+    m_timer->start();
+}
+
+void OfflinePrefetcher::slotNetworkOnline()
+{
+    // Whatever has arrived in the meanwhile should be looked at, too
+    if (m_mailbox.isEmpty() && m_queue.isEmpty())
+        m_queue = m_mailboxes;
+    m_timer->start();
+}
+
+bool OfflinePrefetcher::isBusyWith(const KeepMailboxOpenTask *task) const
+{
+    if (m_mailbox.isEmpty())
+        return false;
+    TreeItemMailbox *mailbox = m_model->findMailboxByName(m_mailbox);
+    return mailbox && mailbox->maintainingTask.data() == task;
+}
+
+/** @short Is any of the regular connections doing something, i.e. is the user waiting for some data? */
+bool OfflinePrefetcher::foregroundBusy() const
+{
+    for (auto it = m_model->m_parsers.constBegin(); it != m_model->m_parsers.constEnd(); ++it) {
+        if (it->backgroundSync || it->connState == CONN_STATE_LOGOUT)
+            continue;
+        if (it->connState < CONN_STATE_AUTHENTICATED)
+            return true;
+        Q_FOREACH(ImapTask *task, it->activeTasks) {
+            if (task == it->maintainingTask.data())
+                continue;
+            SortTask *sortTask = qobject_cast<SortTask *>(task);
+            if (sortTask && sortTask->isJustUpdatingNow())
+                continue;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** @short Find a mailbox which can be prefetched right now, or return nullptr */
+TreeItemMailbox *OfflinePrefetcher::pickNextMailbox()
+{
+    for (auto it = m_queue.begin(); it != m_queue.end(); /* nothing */) {
+        TreeItemMailbox *mailbox = m_model->findMailboxByName(*it);
+        if (mailbox && !mailbox->isSelectable()) {
+            it = m_queue.erase(it);
+            continue;
+        }
+        if (!mailbox || !mailbox->maintainingTask) {
+            if (m_model->m_backgroundSyncConnections <= 0) {
+                // Nobody is going to open this one; the user will get it prefetched when they visit it
+                it = m_queue.erase(it);
+                continue;
+            }
+            // Let the background synchronization open the mailbox and check again later
+            if (!m_model->m_backgroundSyncQueue.contains(*it)) {
+                m_model->m_backgroundSyncQueue << *it;
+                m_model->scheduleBackgroundSync();
+            }
+            ++it;
+            continue;
+        }
+        if (!mailbox->maintainingTask->isMailboxSynchronized()) {
+            ++it;
+            continue;
+        }
+        m_queue.erase(it);
+        return mailbox;
+    }
+    return nullptr;
+}
+
+void OfflinePrefetcher::slotNextStep()
+{
+    if (m_model->networkPolicy() != NETWORK_ONLINE)
+        return;
+
+    if (foregroundBusy()) {
+        m_timer->start();
+        return;
+    }
+
+    if (m_mailbox.isEmpty()) {
+        TreeItemMailbox *mailbox = pickNextMailbox();
+        if (!mailbox) {
+            if (!m_queue.isEmpty())
+                m_timer->start();
+            return;
+        }
+        m_mailbox = mailbox->mailbox();
+        QStringList searchConditions;
+        if (m_days > 0) {
+            searchConditions << QLatin1String("SINCE ")
+                                + QLocale(QLocale::C).toString(QDate::currentDate().addDays(-m_days), QStringLiteral("d-MMM-yyyy"));
+        }
+        m_searchTask = m_model->m_taskFactory->createSortTask(m_model, mailbox->toIndex(m_model), searchConditions, QStringList());
+        connect(m_searchTask.data(), &SortTask::sortingAvailable, this, &OfflinePrefetcher::slotSearchDone);
+        connect(m_searchTask.data(), &SortTask::sortingFailed, this, &OfflinePrefetcher::slotSearchFailed);
+        // Keep an eye on it, the task might die without telling us anything
+        m_timer->start();
+        return;
+    }
+
+    if (m_searchTask) {
+        m_timer->start();
+        return;
+    }
+
+    TreeItemMailbox *mailbox = m_model->findMailboxByName(m_mailbox);
+    if (!mailbox || !mailbox->maintainingTask) {
+        // The connection went elsewhere, the rest will be done next time
+        finishMailbox();
+        return;
+    }
+
+    // The metadata of the previous batch might have arrived, so their text parts can be requested now
+    const auto waiting = m_model->findMessagesByUids(mailbox, m_waitingUids);
+    m_waitingUids.clear();
+    Q_FOREACH(TreeItemMessage *message, waiting) {
+        if (message->fetched() && message->data(m_model, RoleMessageHasBodyStructure).toBool()) {
+            prefetchTextParts(message);
+        } else if (message->loading() || message->fetched()) {
+            // A fetched message might still be waiting for its deferred BODYSTRUCTURE
+            m_waitingUids << message->uid();
+        }
+    }
+    if (!m_waitingUids.isEmpty()) {
+        m_timer->start();
+        return;
+    }
+
+    if (m_pendingUids.isEmpty()) {
+        finishMailbox();
+        return;
+    }
+
+    bool ok;
+    int batchSize = m_model->property("trojita-imap-prefetch-batch").toInt(&ok);
+    if (!ok || batchSize <= 0)
+        batchSize = 20;
+    // Newest messages first
+    Imap::Uids batch = m_pendingUids.mid(qMax(0, m_pendingUids.size() - batchSize));
+    m_pendingUids.resize(m_pendingUids.size() - batch.size());
+    Q_FOREACH(TreeItemMessage *message, m_model->findMessagesByUids(mailbox, batch)) {
+        if (message->fetched()) {
+            if (message->data(m_model, RoleMessageHasBodyStructure).toBool())
+                prefetchTextParts(message);
+            else
+                m_waitingUids << message->uid();
+        } else {
+            if (!message->loading()) {
+                message->setFetchStatus(TreeItem::LOADING);
+                m_model->askForMsgMetadata(message, Model::PRELOAD_DISABLED);
+            }
+            if (!message->fetched())
+                m_waitingUids << message->uid();
+        }
+    }
+    m_timer->start();
+}
+
+void OfflinePrefetcher::slotSearchDone(const Imap::Uids &uids)
+{
+    SortTask *task = qobject_cast<SortTask *>(sender());
+    Q_ASSERT(task);
+    disconnect(task, nullptr, this, nullptr);
+    if (task->isPersistent()) {
+        // We only need the current state, not the updates
+        task->cancelSortingUpdates();
+    }
+    m_searchTask = nullptr;
+    m_pendingUids = uids;
+    std::sort(m_pendingUids.begin(), m_pendingUids.end());
+    m_waitingUids.clear();
+    m_timer->start();
+}
+
+void OfflinePrefetcher::slotSearchFailed()
+{
+    m_searchTask = nullptr;
+    finishMailbox();
+}
+
+/** @short Request the textual leaf parts below @arg item */
+void OfflinePrefetcher::prefetchTextParts(TreeItem *item)
+{
+    const int rows = item->rowCount(m_model);
+    for (int i = 0; i < rows; ++i) {
+        TreeItemPart *part = dynamic_cast<TreeItemPart *>(item->child(i, m_model));
+        if (!part)
+            continue;
+        if (part->rowCount(m_model)) {
+            prefetchTextParts(part);
+        } else if (part->mimeType().startsWith("text/")) {
+            // This goes through the cache first, and the downloaded data do not stay in memory
+            part->prefetch(m_model);
+        }
+    }
+}
+
+void OfflinePrefetcher::finishMailbox()
+{
+    m_mailbox.clear();
+    m_pendingUids.clear();
+    m_waitingUids.clear();
+    // The connection is free to move on
+    m_model->scheduleBackgroundSync();
+    m_timer->start();
+}
+
+}
+}
@@ -0,0 +1,95 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TROJITA_IMAP_OFFLINEPREFETCHER_H
+#define TROJITA_IMAP_OFFLINEPREFETCHER_H
+
+#include <QPointer>
+#include <QStringList>
+#include "Imap/Parser/Uids.h"
+
+class QTimer;
+
+namespace Imap {
+namespace Mailbox {
+
+class KeepMailboxOpenTask;
+class Model;
+class SortTask;
+class TreeItem;
+class TreeItemMailbox;
+
+/** @short Download recent messages in the background so that they are available offline
+
+The mailboxes are processed one after another. At first, a UID SEARCH SINCE finds the messages which are covered by the
+offline caching policy. Their metadata and their textual parts are then requested in small batches, newest messages
+first. Everything goes through the Model, so whatever is in the cache already is not downloaded again.
+
+The prefetching only happens on connections which already have the respective mailbox open. With extra connections for
+background synchronization, these are what the mailboxes end up on; otherwise, only the mailbox which the user has open
+gets prefetched. Work pauses while the network is not fully online and whenever a regular connection is busy with
+something else, i.e. when the user is waiting for some data.
+*/
+class OfflinePrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit OfflinePrefetcher(Model *model);
+
+    /** @short Prefetch messages from the last @arg days days in the @arg mailboxes, zero days mean all messages */
+    void start(const QStringList &mailboxes, const int days);
+
+    /** @short Is the @arg task's connection needed for prefetching right now? */
+    bool isBusyWith(const KeepMailboxOpenTask *task) const;
+
+private slots:
+    void slotNextStep();
+    void slotSearchDone(const Imap::Uids &uids);
+    void slotSearchFailed();
+    void slotNetworkOnline();
+
+private:
+    bool foregroundBusy() const;
+    TreeItemMailbox *pickNextMailbox();
+    void prefetchTextParts(TreeItem *item);
+    void finishMailbox();
+
+    Model *m_model;
+    QTimer *m_timer;
+    /** @short All mailboxes which are supposed to be prefetched */
+    QStringList m_mailboxes;
+    /** @short Mailboxes which are still waiting for their turn */
+    QStringList m_queue;
+    int m_days;
+    /** @short The mailbox which is being prefetched right now */
+    QString m_mailbox;
+    QPointer<SortTask> m_searchTask;
+    /** @short Messages which have not been looked at yet, sorted by UID */
+    Imap::Uids m_pendingUids;
+    /** @short Messages whose metadata were requested, but have not arrived yet */
+    Imap::Uids m_waitingUids;
+};
+
+}
+}
+
+#endif
@@ -49,6 +49,10 @@ struct ParserState {
     QStringList capabilities;
     /** @short Is the @arg capabilities usable? */
     bool capabilitiesFresh;
+    /** @short Does the server push changes of other mailboxes through the NOTIFY extension? */
+    bool notifyActive;
+    /** @short Is this an extra connection for synchronizing mailboxes in the background? */
+    bool backgroundSync;
     /** @short LIST responses which were not processed yet */
     QList<Responses::List> listResponses;
 
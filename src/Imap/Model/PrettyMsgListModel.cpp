@@ -188,13 +188,13 @@ bool PrettyMsgListModel::filterAcceptsRow(int source_row, const QModelIndex &sou
     if (!m_hideRead)
         return true;
 
-    QModelIndex source_index = sourceModel()->index(source_row, 0, source_parent);
-
-    for (QModelIndex test = source_index; test.isValid(); test = test.parent())
-        if (test.data(RoleThreadRootWithUnreadMessages).toBool() || test.data(RoleMessageWasUnread).toBool())
-            return true;
+    // A child is only ever looked at when its parent got accepted, and the test below can only become more permissive
+    // when walking deeper into the tree, so there's no point in checking anything but the thread roots.
+    if (source_parent.isValid())
+        return true;
 
-    return false;
+    QModelIndex source_index = sourceModel()->index(source_row, 0, source_parent);
+    return source_index.data(RoleThreadRootWithUnreadMessages).toBool() || source_index.data(RoleMessageWasUnread).toBool();
 }
 
 
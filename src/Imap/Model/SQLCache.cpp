@@ -21,16 +21,171 @@
 */
 
 #include "SQLCache.h"
+#include <algorithm>
+#include <iterator>
+#include <QCryptographicHash>
 #include <QSqlError>
 #include <QSqlRecord>
 #include <QTimer>
 #include "Common/SqlTransactionAutoAborter.h"
+#include "LocalSearch.h"
 
 //#define CACHE_DEBUG
 
 namespace
 {
 static int streamVersion = QDataStream::Qt_4_6;
+
+/** @short Maximal number of changes which can pile up in the uid_mapping_log before a new snapshot is written */
+const int uidMappingLogMaxEntries = 256;
+/** @short The uid_mapping_log is always allowed to grow up to this many bytes before compaction is attempted */
+const int uidMappingLogMinBytes = 4096;
+/** @short Total number of UIDs in the mappings which are kept in memory for computing the changes to be logged
+
+A mapping which does not fit has to be rebuilt from its snapshot and log upon each change, so this shall accommodate
+even a huge INBOX with a million messages along with a few smaller mailboxes. Each UID takes four bytes.
+*/
+const int uidMappingMemoryLimit = 2 * 1024 * 1024;
+
+void appendVarint(QByteArray &out, quint32 value)
+{
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+bool readVarint(const QByteArray &in, int &pos, quint32 &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (pos >= in.size())
+            return false;
+        const quint8 byte = static_cast<quint8>(in[pos++]);
+        value |= static_cast<quint32>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/** @short Append the number of UIDs, followed by the differences between adjacent items, as varints
+
+The UIDs in a mailbox are mostly dense, so the differences usually fit into a single byte.
+*/
+void appendUidDeltas(QByteArray &out, const Imap::Uids &uids)
+{
+    appendVarint(out, uids.size());
+    uint previous = 0;
+    for (const uint uid : uids) {
+        appendVarint(out, uid - previous);
+        previous = uid;
+    }
+}
+
+bool readUidDeltas(const QByteArray &in, int &pos, Imap::Uids &uids)
+{
+    quint32 count;
+    // Each item occupies at least one byte, so the size cannot be bigger than that
+    if (!readVarint(in, pos, count) || count > static_cast<quint32>(in.size() - pos))
+        return false;
+    uids.resize(count);
+    uint previous = 0;
+    for (quint32 i = 0; i < count; ++i) {
+        quint32 delta;
+        if (!readVarint(in, pos, delta))
+            return false;
+        previous += delta;
+        uids[i] = previous;
+    }
+    return true;
+}
+
+bool isStrictlyAscending(const Imap::Uids &uids)
+{
+    return std::adjacent_find(uids.constBegin(), uids.constEnd(), [](const uint a, const uint b) { return a >= b; })
+            == uids.constEnd();
+}
+
+QByteArray encodeUidSnapshot(const Imap::Uids &uids)
+{
+    QByteArray buf;
+    appendUidDeltas(buf, uids);
+    return qCompress(buf);
+}
+
+/** @short Encode message flags as a bitset over the list of flag names which are known in a mailbox
+
+Flags which are not in the @arg knownNames yet are appended to that list.
+*/
+QByteArray encodeFlagBits(const QStringList &flags, QStringList &knownNames)
+{
+    QByteArray bits;
+    for (const auto &flag : flags) {
+        int bit = knownNames.indexOf(flag);
+        if (bit == -1) {
+            bit = knownNames.size();
+            knownNames << flag;
+        }
+        if (bits.size() <= bit / 8)
+            bits.append(QByteArray(bit / 8 - bits.size() + 1, '\0'));
+        bits[bit / 8] = static_cast<char>(bits[bit / 8] | (1 << (bit % 8)));
+    }
+    return bits;
+}
+
+QStringList decodeFlagBits(const QByteArray &bits, const QStringList &knownNames, bool *ok)
+{
+    QStringList res;
+    *ok = true;
+    for (int i = 0; i < bits.size(); ++i) {
+        const quint8 byte = static_cast<quint8>(bits[i]);
+        for (int j = 0; j < 8; ++j) {
+            if (!(byte & (1 << j)))
+                continue;
+            const int bit = i * 8 + j;
+            if (bit >= knownNames.size()) {
+                *ok = false;
+                continue;
+            }
+            res << knownNames[bit];
+        }
+    }
+    return res;
+}
+
+/** @short How many messages get their cached headers indexed at once by SQLCache::catchUpSearchIndex() */
+const int searchIndexCatchUpBatch = 200;
+
+/** @short How many rows get converted at once when upgrading the layout of the DB */
+const int migrationBatchSize = 1000;
+
+/** @short The search_terms row with this field only records that the message has been indexed */
+const int searchIndexedMarker = 0;
+
+/** @short Append the words of the @arg text to the columns of a batch insert into the search_terms */
+void appendSearchTerms(QVariantList &mailboxFields, QVariantList &termFields, QVariantList &fieldFields, QVariantList &uidFields,
+                       const qint64 id, const uint uid, const int field, const QString &text)
+{
+    Q_FOREACH(const QString &word, Imap::Mailbox::searchTokens(text)) {
+        mailboxFields << id;
+        termFields << word;
+        fieldFields << field;
+        uidFields << uid;
+    }
+}
+
+/** @short Append a row which marks the message as indexed, even if it has no words at all, to a batch insert into the search_terms */
+void appendIndexedMarker(QVariantList &mailboxFields, QVariantList &termFields, QVariantList &fieldFields, QVariantList &uidFields,
+                         const qint64 id, const uint uid)
+{
+    mailboxFields << id;
+    // The term is NOT NULL, so this cannot be a null QString
+    termFields << QString(QLatin1String(""));
+    fieldFields << searchIndexedMarker;
+    uidFields << uid;
+}
 }
 
 namespace Imap
@@ -61,6 +216,7 @@ QDate SQLCache::accessingThresholdDate = QDate(2012, 11, 1);
 
 SQLCache::SQLCache()
     : inTransaction(false)
+    , m_uidMappings(uidMappingMemoryLimit)
     , m_updateAccessIfOlder(0)
 {
 }
@@ -88,7 +244,10 @@ SQLCache::~SQLCache()
     db.close();
 }
 
-#define TROJITA_SQL_CACHE_CREATE_THREADING \
+// Layouts of the historic tables, as they were introduced by the respective schema versions. These are only used when
+// upgrading an old DB step by step.
+
+#define TROJITA_SQL_CACHE_CREATE_THREADING_V2 \
 if ( ! q.exec( QLatin1String("CREATE TABLE msg_threading ( " \
                              "mailbox STRING NOT NULL PRIMARY KEY, " \
                              "threading BINARY" \
@@ -97,7 +256,7 @@ if ( ! q.exec( QLatin1String("CREATE TABLE msg_threading ( " \
     return false; \
 }
 
-#define TROJITA_SQL_CACHE_CREATE_SYNC_STATE \
+#define TROJITA_SQL_CACHE_CREATE_SYNC_STATE_V4 \
 if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
                              "mailbox STRING NOT NULL PRIMARY KEY, " \
                              "sync_state BINARY " \
@@ -106,7 +265,7 @@ if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
     return false; \
 }
 
-#define TROJITA_SQL_CACHE_CREATE_MSG_METADATA \
+#define TROJITA_SQL_CACHE_CREATE_MSG_METADATA_V7 \
     if (! q.exec(QLatin1String("CREATE TABLE msg_metadata (" \
                                "mailbox STRING NOT NULL, " \
                                "uid INT NOT NULL, " \
@@ -118,6 +277,143 @@ if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
         return false; \
     }
 
+// The current layout; the per-message and per-mailbox tables refer to the mailboxes through their numeric ID
+
+#define TROJITA_SQL_CACHE_CREATE_MAILBOXES \
+    if (! q.exec(QLatin1String("CREATE TABLE mailboxes (" \
+                               "id INTEGER PRIMARY KEY, " \
+                               "name STRING NOT NULL UNIQUE" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table mailboxes"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_THREADING \
+    if (! q.exec(QLatin1String("CREATE TABLE msg_threading (" \
+                               "mailbox_id INTEGER NOT NULL PRIMARY KEY, " \
+                               "threading BINARY" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table msg_threading"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_SYNC_STATE \
+    if (! q.exec(QLatin1String("CREATE TABLE mailbox_sync_state (" \
+                               "mailbox_id INTEGER NOT NULL PRIMARY KEY, " \
+                               "sync_state BINARY" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table mailbox_sync_state"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_UID_MAPPING \
+    if (! q.exec(QLatin1String("CREATE TABLE uid_mapping (" \
+                               "mailbox_id INTEGER NOT NULL PRIMARY KEY, " \
+                               "mapping BINARY" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table uid_mapping"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_UID_MAPPING_LOG \
+    if (! q.exec(QLatin1String("CREATE TABLE uid_mapping_log (" \
+                               "id INTEGER PRIMARY KEY, " \
+                               "mailbox_id INTEGER NOT NULL, " \
+                               "change BINARY" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table uid_mapping_log"), q); \
+        return false; \
+    } \
+    if (! q.exec(QLatin1String("CREATE INDEX uid_mapping_log_mailbox ON uid_mapping_log (mailbox_id)"))) { \
+        emitError(QObject::tr("Can't create index uid_mapping_log_mailbox"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_MSG_METADATA \
+    if (! q.exec(QLatin1String("CREATE TABLE msg_metadata (" \
+                               "mailbox_id INTEGER NOT NULL, " \
+                               "uid INT NOT NULL, " \
+                               "data BINARY, " \
+                               "lastAccessDate INT, " \
+                               "PRIMARY KEY (mailbox_id, uid)" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table msg_metadata"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_FLAGS \
+    if (! q.exec(QLatin1String("CREATE TABLE flags (" \
+                               "mailbox_id INTEGER NOT NULL, " \
+                               "uid INT NOT NULL, " \
+                               "flags BINARY, " \
+                               "PRIMARY KEY (mailbox_id, uid)" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table flags"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_FLAG_NAMES \
+    if (! q.exec(QLatin1String("CREATE TABLE flag_names (" \
+                               "mailbox_id INTEGER NOT NULL, " \
+                               "bit INT NOT NULL, " \
+                               "name STRING NOT NULL, " \
+                               "PRIMARY KEY (mailbox_id, bit)" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table flag_names"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_PARTS \
+    if (! q.exec(QLatin1String("CREATE TABLE parts (" \
+                               "mailbox_id INTEGER NOT NULL, " \
+                               "uid INT NOT NULL, " \
+                               "part_id BINARY, " \
+                               "hash BINARY NOT NULL, " \
+                               "PRIMARY KEY (mailbox_id, uid, part_id)" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table parts"), q); \
+        return false; \
+    } \
+    if (! q.exec(QLatin1String("CREATE INDEX parts_hash ON parts (hash)"))) { \
+        emitError(QObject::tr("Can't create index parts_hash"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_PART_BLOBS \
+    if (! q.exec(QLatin1String("CREATE TABLE part_blobs (" \
+                               "hash BINARY NOT NULL PRIMARY KEY, " \
+                               "refcount INT NOT NULL, " \
+                               "data BINARY" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table part_blobs"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_SEARCH_TERMS \
+    if (! q.exec(QLatin1String("CREATE TABLE search_terms (" \
+                               "mailbox_id INTEGER NOT NULL, " \
+                               "term STRING NOT NULL, " \
+                               "field INT NOT NULL, " \
+                               "uid INT NOT NULL, " \
+                               "PRIMARY KEY (mailbox_id, term, field, uid)" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table search_terms"), q); \
+        return false; \
+    } \
+    if (! q.exec(QLatin1String("CREATE INDEX search_terms_uid ON search_terms (mailbox_id, uid)"))) { \
+        emitError(QObject::tr("Can't create index search_terms_uid"), q); \
+        return false; \
+    }
+
+#define TROJITA_SQL_CACHE_CREATE_MAILBOX_TREE \
+    if (! q.exec(QLatin1String("CREATE TABLE mailbox_tree (" \
+                               "id INT NOT NULL PRIMARY KEY, " \
+                               "data BINARY" \
+                               ")"))) { \
+        emitError(QObject::tr("Can't create table mailbox_tree"), q); \
+        return false; \
+    }
+
 bool SQLCache::open(const QString &name, const QString &fileName)
 {
 #ifdef CACHE_DEBUG
@@ -155,8 +451,10 @@ bool SQLCache::open(const QString &name, const QString &fileName)
     }
 
     uint version = q.value(0).toUInt();
+    // The upgrade steps use their own queries, and SQLite won't drop tables while a statement is still active
+    q.finish();
     if (version == 1) {
-        TROJITA_SQL_CACHE_CREATE_THREADING
+        TROJITA_SQL_CACHE_CREATE_THREADING_V2
         version = 2;
         if (! q.exec(QStringLiteral("UPDATE trojita SET version = 2;"))) {
             emitError(QObject::tr("Failed to update cache DB scheme from v1 to v2"), q);
@@ -171,7 +469,7 @@ bool SQLCache::open(const QString &name, const QString &fileName)
             emitError(QObject::tr("Failed to drop old table mailbox_sync_state"));
             return false;
         }
-        TROJITA_SQL_CACHE_CREATE_SYNC_STATE;
+        TROJITA_SQL_CACHE_CREATE_SYNC_STATE_V4;
         version = 4;
         if (! q.exec(QStringLiteral("UPDATE trojita SET version = 4;"))) {
             emitError(QObject::tr("Failed to update cache DB scheme from v2/v3 to v4"), q);
@@ -190,7 +488,7 @@ bool SQLCache::open(const QString &name, const QString &fileName)
             emitError(QObject::tr("Failed to drop old table msg_metadata"));
             return false;
         }
-        TROJITA_SQL_CACHE_CREATE_MSG_METADATA;
+        TROJITA_SQL_CACHE_CREATE_MSG_METADATA_V7;
         version = 7;
         if (! q.exec(QStringLiteral("UPDATE trojita SET version = 7;"))) {
             emitError(QObject::tr("Failed to update cache DB scheme from v4/v5/v6 to v7"), q);
@@ -198,7 +496,28 @@ bool SQLCache::open(const QString &name, const QString &fileName)
         }
     }
 
-    if (version != 7) {
+    if (version == 7) {
+        // V8 has reworked most of the layout in one go. Each change is a separate step which can be followed on its own.
+        if (!upgradeToContentAddressedParts())
+            return false;
+        if (!upgradeToMailboxIds())
+            return false;
+        if (!upgradeToUidMappingLog())
+            return false;
+        if (!upgradeToFlagBits())
+            return false;
+        if (!upgradeToSearchIndex())
+            return false;
+        if (!upgradeToMailboxTreeSnapshot())
+            return false;
+        version = 8;
+        if (! q.exec(QStringLiteral("UPDATE trojita SET version = 8;"))) {
+            emitError(QObject::tr("Failed to update cache DB scheme from v7 to v8"), q);
+            return false;
+        }
+    }
+
+    if (version != 8) {
         emitError(QObject::tr("Unknown version of sqlite cache"));
         return false;
     }
@@ -215,6 +534,219 @@ bool SQLCache::open(const QString &name, const QString &fileName)
     return true;
 }
 
+/** @short V8: message parts are content-addressed
+
+The (mailbox, uid, part_id) tuple only refers to a hash of the actual data, which are kept in a reference-counted table.
+The old parts are simply dropped.
+*/
+bool SQLCache::upgradeToContentAddressedParts()
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QStringLiteral("DROP TABLE parts;"))) {
+        emitError(QObject::tr("Failed to drop old table parts"), q);
+        return false;
+    }
+    TROJITA_SQL_CACHE_CREATE_PARTS;
+    TROJITA_SQL_CACHE_CREATE_PART_BLOBS;
+    return true;
+}
+
+/** @short V8: mailboxes are referred to through a numeric ID instead of repeating the full mailbox name in each row
+
+All mailboxes which the old tables know about get their IDs here, so this has to run before the other steps which convert
+per-mailbox data. The threading, sync state and metadata only change how they refer to their mailbox, so they are copied
+verbatim.
+*/
+bool SQLCache::upgradeToMailboxIds()
+{
+    QSqlQuery q(QString(), db);
+    TROJITA_SQL_CACHE_CREATE_MAILBOXES;
+    if (!q.exec(QStringLiteral("INSERT INTO mailboxes (name) "
+                               "SELECT mailbox FROM mailbox_sync_state UNION SELECT mailbox FROM uid_mapping "
+                               "UNION SELECT mailbox FROM msg_metadata UNION SELECT mailbox FROM flags "
+                               "UNION SELECT mailbox FROM msg_threading"))) {
+        emitError(QObject::tr("Failed to populate table mailboxes"), q);
+        return false;
+    }
+
+    const QStringList copiedTables = {
+        QStringLiteral("msg_threading"), QStringLiteral("mailbox_sync_state"), QStringLiteral("msg_metadata"),
+    };
+    const QStringList copiedColumns = {
+        QStringLiteral("threading"), QStringLiteral("sync_state"), QStringLiteral("uid, data, lastAccessDate"),
+    };
+    for (const auto &table: copiedTables) {
+        if (!q.exec(QStringLiteral("ALTER TABLE %1 RENAME TO %1_v7").arg(table))) {
+            emitError(QObject::tr("Failed to rename old table %1").arg(table), q);
+            return false;
+        }
+    }
+    TROJITA_SQL_CACHE_CREATE_THREADING;
+    TROJITA_SQL_CACHE_CREATE_SYNC_STATE;
+    TROJITA_SQL_CACHE_CREATE_MSG_METADATA;
+    for (int i = 0; i < copiedTables.size(); ++i) {
+        if (!q.exec(QStringLiteral("INSERT INTO %1 (mailbox_id, %2) SELECT mailboxes.id, %2 FROM %1_v7 "
+                                   "INNER JOIN mailboxes ON mailboxes.name = %1_v7.mailbox").arg(copiedTables[i], copiedColumns[i]))) {
+            emitError(QObject::tr("Failed to migrate data of table %1").arg(copiedTables[i]), q);
+            return false;
+        }
+        if (!q.exec(QStringLiteral("DROP TABLE %1_v7").arg(copiedTables[i]))) {
+            emitError(QObject::tr("Failed to drop old table %1").arg(copiedTables[i]), q);
+            return false;
+        }
+    }
+    return true;
+}
+
+/** @short V8: the UID mapping is a delta-encoded snapshot, followed by an append-only log of changes */
+bool SQLCache::upgradeToUidMappingLog()
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QStringLiteral("ALTER TABLE uid_mapping RENAME TO uid_mapping_v7"))) {
+        emitError(QObject::tr("Failed to rename old table uid_mapping"), q);
+        return false;
+    }
+    TROJITA_SQL_CACHE_CREATE_UID_MAPPING;
+    TROJITA_SQL_CACHE_CREATE_UID_MAPPING_LOG;
+
+    QSqlQuery update(QString(), db);
+    if (!q.exec(QStringLiteral("SELECT mailboxes.id, mapping FROM uid_mapping_v7 "
+                               "INNER JOIN mailboxes ON mailboxes.name = uid_mapping_v7.mailbox"))) {
+        emitError(QObject::tr("Failed to read the old UID mapping"), q);
+        return false;
+    }
+    if (!update.prepare(QStringLiteral("INSERT INTO uid_mapping (mailbox_id, mapping) VALUES (?, ?)"))) {
+        emitError(QObject::tr("Failed to prepare the UID mapping conversion"), update);
+        return false;
+    }
+    while (q.next()) {
+        Imap::Uids uids;
+        QDataStream stream(qUncompress(q.value(1).toByteArray()));
+        stream.setVersion(streamVersion);
+        stream >> uids;
+        if (stream.status() != QDataStream::Ok) {
+            // Not worth failing the whole upgrade; the mailbox will simply get synced from scratch
+            emitError(QObject::tr("Corrupt UID mapping of mailbox #%1, not converting it").arg(q.value(0).toLongLong()));
+            continue;
+        }
+        update.bindValue(0, q.value(0));
+        update.bindValue(1, encodeUidSnapshot(uids));
+        if (!update.exec()) {
+            emitError(QObject::tr("Failed to convert the UID mapping"), update);
+            return false;
+        }
+    }
+
+    if (!q.exec(QStringLiteral("DROP TABLE uid_mapping_v7"))) {
+        emitError(QObject::tr("Failed to drop old table uid_mapping"), q);
+        return false;
+    }
+    return true;
+}
+
+/** @short V8: flags are a bitset whose bits refer to flag names which are interned per mailbox
+
+The flags are converted in batches so that a huge cache does not have to fit into memory.
+*/
+bool SQLCache::upgradeToFlagBits()
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QStringLiteral("ALTER TABLE flags RENAME TO flags_v7"))) {
+        emitError(QObject::tr("Failed to rename old table flags"), q);
+        return false;
+    }
+    TROJITA_SQL_CACHE_CREATE_FLAGS;
+    TROJITA_SQL_CACHE_CREATE_FLAG_NAMES;
+
+    QSqlQuery update(QString(), db);
+    if (!q.exec(QStringLiteral("SELECT mailboxes.id, uid, flags FROM flags_v7 "
+                               "INNER JOIN mailboxes ON mailboxes.name = flags_v7.mailbox"))) {
+        emitError(QObject::tr("Failed to read the old message flags"), q);
+        return false;
+    }
+    if (!update.prepare(QStringLiteral("INSERT INTO flags (mailbox_id, uid, flags) VALUES (?, ?, ?)"))) {
+        emitError(QObject::tr("Failed to prepare the flags conversion"), update);
+        return false;
+    }
+    QHash<qint64, QStringList> flagNames;
+    QVariantList mailboxFields, uidFields, flagsFields;
+    bool hasMore = q.next();
+    while (hasMore) {
+        const qint64 id = q.value(0).toLongLong();
+        QStringList flags;
+        QDataStream stream(q.value(2).toByteArray());
+        stream.setVersion(streamVersion);
+        stream >> flags;
+        if (stream.status() == QDataStream::Ok) {
+            mailboxFields << id;
+            uidFields << q.value(1);
+            flagsFields << encodeFlagBits(flags, flagNames[id]);
+        } else {
+            // The flags will be fetched again
+            emitError(QObject::tr("Corrupt flags of message UID %1 in mailbox #%2, not converting them")
+                      .arg(q.value(1).toUInt()).arg(id));
+        }
+        hasMore = q.next();
+        if (mailboxFields.size() == migrationBatchSize || (!hasMore && !mailboxFields.isEmpty())) {
+            update.bindValue(0, mailboxFields);
+            update.bindValue(1, uidFields);
+            update.bindValue(2, flagsFields);
+            if (!update.execBatch()) {
+                emitError(QObject::tr("Failed to convert the message flags"), update);
+                return false;
+            }
+            mailboxFields.clear();
+            uidFields.clear();
+            flagsFields.clear();
+        }
+    }
+
+    QVariantList nameMailboxFields, bitFields, nameFields;
+    for (auto it = flagNames.constBegin(); it != flagNames.constEnd(); ++it) {
+        for (int bit = 0; bit < it->size(); ++bit) {
+            nameMailboxFields << it.key();
+            bitFields << bit;
+            nameFields << it->at(bit);
+        }
+    }
+    if (!update.prepare(QStringLiteral("INSERT INTO flag_names (mailbox_id, bit, name) VALUES (?, ?, ?)"))) {
+        emitError(QObject::tr("Failed to prepare the flag names conversion"), update);
+        return false;
+    }
+    update.bindValue(0, nameMailboxFields);
+    update.bindValue(1, bitFields);
+    update.bindValue(2, nameFields);
+    if (!update.execBatch()) {
+        emitError(QObject::tr("Failed to store the flag names"), update);
+        return false;
+    }
+
+    if (!q.exec(QStringLiteral("DROP TABLE flags_v7"))) {
+        emitError(QObject::tr("Failed to drop old table flags"), q);
+        return false;
+    }
+    return true;
+}
+
+/** @short V8: there is a full-text index of the message headers
+
+The index starts empty. Messages which are already in the cache get indexed lazily, see catchUpSearchIndex().
+*/
+bool SQLCache::upgradeToSearchIndex()
+{
+    QSqlQuery q(QString(), db);
+    TROJITA_SQL_CACHE_CREATE_SEARCH_TERMS;
+    return true;
+}
+
+/** @short V8: the whole mailbox hierarchy can be stored as a single snapshot */
+bool SQLCache::upgradeToMailboxTreeSnapshot()
+{
+    QSqlQuery q(QString(), db);
+    TROJITA_SQL_CACHE_CREATE_MAILBOX_TREE;
+    return true;
+}
+
 bool SQLCache::createTables()
 {
     QSqlQuery q(QString(), db);
@@ -223,7 +755,7 @@ bool SQLCache::createTables()
         emitError(QObject::tr("Failed to prepare table structures"), q);
         return false;
     }
-    if (! q.exec(QStringLiteral("INSERT INTO trojita ( version ) VALUES ( 6 )"))) {
+    if (! q.exec(QStringLiteral("INSERT INTO trojita ( version ) VALUES ( 8 )"))) {
         emitError(QObject::tr("Can't store version info"), q);
         return false;
     }
@@ -239,37 +771,18 @@ bool SQLCache::createTables()
         return false;
     }
 
-    if (! q.exec(QStringLiteral("CREATE TABLE uid_mapping ( "
-                               "mailbox STRING NOT NULL PRIMARY KEY, "
-                               "mapping BINARY"
-                               " )"))) {
-        emitError(QObject::tr("Can't create table uid_mapping"), q);
-        return false;
-    }
-
+    TROJITA_SQL_CACHE_CREATE_MAILBOXES;
+    TROJITA_SQL_CACHE_CREATE_UID_MAPPING;
+    TROJITA_SQL_CACHE_CREATE_UID_MAPPING_LOG;
     TROJITA_SQL_CACHE_CREATE_MSG_METADATA;
-
-    if (! q.exec(QStringLiteral("CREATE TABLE flags ("
-                               "mailbox STRING NOT NULL, "
-                               "uid INT NOT NULL, "
-                               "flags BINARY, "
-                               "PRIMARY KEY (mailbox, uid)"
-                               ")"))) {
-        emitError(QObject::tr("Can't create table flags"), q);
-    }
-
-    if (! q.exec(QStringLiteral("CREATE TABLE parts ("
-                               "mailbox STRING NOT NULL, "
-                               "uid INT NOT NULL, "
-                               "part_id BINARY, "
-                               "data BINARY, "
-                               "PRIMARY KEY (mailbox, uid, part_id)"
-                               ")"))) {
-        emitError(QObject::tr("Can't create table parts"), q);
-    }
-
+    TROJITA_SQL_CACHE_CREATE_FLAGS;
+    TROJITA_SQL_CACHE_CREATE_FLAG_NAMES;
+    TROJITA_SQL_CACHE_CREATE_PARTS;
+    TROJITA_SQL_CACHE_CREATE_PART_BLOBS;
     TROJITA_SQL_CACHE_CREATE_THREADING;
     TROJITA_SQL_CACHE_CREATE_SYNC_STATE;
+    TROJITA_SQL_CACHE_CREATE_SEARCH_TERMS;
+    TROJITA_SQL_CACHE_CREATE_MAILBOX_TREE;
 
     return true;
 }
@@ -300,140 +813,301 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryMailboxId = QSqlQuery(db);
+    if (! queryMailboxId.prepare(QStringLiteral("SELECT id FROM mailboxes WHERE name = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryMailboxId"), queryMailboxId);
+        return false;
+    }
+
+    queryCreateMailboxId = QSqlQuery(db);
+    if (! queryCreateMailboxId.prepare(QStringLiteral("INSERT INTO mailboxes (name) VALUES (?)"))) {
+        emitError(QObject::tr("Failed to prepare queryCreateMailboxId"), queryCreateMailboxId);
+        return false;
+    }
+
     queryMailboxSyncState = QSqlQuery(db);
-    if (! queryMailboxSyncState.prepare(QStringLiteral("SELECT sync_state FROM mailbox_sync_state WHERE mailbox = ?"))) {
+    if (! queryMailboxSyncState.prepare(QStringLiteral("SELECT sync_state FROM mailbox_sync_state WHERE mailbox_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryMailboxSyncState"), queryMailboxSyncState);
         return false;
     }
 
     querySetMailboxSyncState = QSqlQuery(db);
     if (! querySetMailboxSyncState.prepare(QStringLiteral("INSERT OR REPLACE INTO mailbox_sync_state "
-                                           "( mailbox, sync_state ) "
+                                           "( mailbox_id, sync_state ) "
                                            "VALUES ( ?, ? )"))) {
         emitError(QObject::tr("Failed to prepare querySetMailboxSyncState"), querySetMailboxSyncState);
         return false;
     }
 
     queryUidMapping = QSqlQuery(db);
-    if (! queryUidMapping.prepare(QStringLiteral("SELECT mapping FROM uid_mapping WHERE mailbox = ?"))) {
+    if (! queryUidMapping.prepare(QStringLiteral("SELECT mapping FROM uid_mapping WHERE mailbox_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryUidMapping"), queryUidMapping);
         return false;
     }
 
     querySetUidMapping = QSqlQuery(db);
-    if (! querySetUidMapping.prepare(QStringLiteral("INSERT OR REPLACE INTO uid_mapping (mailbox, mapping) VALUES  ( ?, ? )"))) {
+    if (! querySetUidMapping.prepare(QStringLiteral("INSERT OR REPLACE INTO uid_mapping (mailbox_id, mapping) VALUES  ( ?, ? )"))) {
         emitError(QObject::tr("Failed to prepare querySetUidMapping"), querySetUidMapping);
         return false;
     }
 
     queryClearUidMapping = QSqlQuery(db);
-    if (! queryClearUidMapping.prepare(QStringLiteral("DELETE FROM uid_mapping WHERE mailbox = ?"))) {
+    if (! queryClearUidMapping.prepare(QStringLiteral("DELETE FROM uid_mapping WHERE mailbox_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearUidMapping"), queryClearUidMapping);
         return false;
     }
 
+    queryUidMappingLog = QSqlQuery(db);
+    if (! queryUidMappingLog.prepare(QStringLiteral("SELECT change FROM uid_mapping_log WHERE mailbox_id = ? ORDER BY id"))) {
+        emitError(QObject::tr("Failed to prepare queryUidMappingLog"), queryUidMappingLog);
+        return false;
+    }
+
+    queryAppendUidMappingLog = QSqlQuery(db);
+    if (! queryAppendUidMappingLog.prepare(QStringLiteral("INSERT INTO uid_mapping_log (mailbox_id, change) VALUES (?, ?)"))) {
+        emitError(QObject::tr("Failed to prepare queryAppendUidMappingLog"), queryAppendUidMappingLog);
+        return false;
+    }
+
+    queryClearUidMappingLog = QSqlQuery(db);
+    if (! queryClearUidMappingLog.prepare(QStringLiteral("DELETE FROM uid_mapping_log WHERE mailbox_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryClearUidMappingLog"), queryClearUidMappingLog);
+        return false;
+    }
+
     queryMessageMetadata = QSqlQuery(db);
-    if (! queryMessageMetadata.prepare(QStringLiteral("SELECT data, lastAccessDate FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryMessageMetadata.prepare(QStringLiteral("SELECT data, lastAccessDate FROM msg_metadata WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(QObject::tr("Failed to prepare queryMessageMetadata"), queryMessageMetadata);
         return false;
     }
 
     queryAccessMessageMetadata = QSqlQuery(db);
-    if (!queryAccessMessageMetadata.prepare(QStringLiteral("UPDATE msg_metadata SET lastAccessDate = ? WHERE mailbox = ? AND uid = ?"))) {
+    if (!queryAccessMessageMetadata.prepare(QStringLiteral("UPDATE msg_metadata SET lastAccessDate = ? WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(QObject::tr("Failed to prepare queryAccssMessageMetadata"), queryAccessMessageMetadata);
         return false;
     }
 
     querySetMessageMetadata = QSqlQuery(db);
-    if (! querySetMessageMetadata.prepare(QStringLiteral("INSERT OR REPLACE INTO msg_metadata ( mailbox, uid, data, lastAccessDate ) VALUES ( ?, ?, ?, ? )"))) {
+    if (! querySetMessageMetadata.prepare(QStringLiteral("INSERT OR REPLACE INTO msg_metadata ( mailbox_id, uid, data, lastAccessDate ) VALUES ( ?, ?, ?, ? )"))) {
         emitError(QObject::tr("Failed to prepare querySetMessageMetadata"), querySetMessageMetadata);
         return false;
     }
 
     queryMessageFlags = QSqlQuery(db);
-    if (! queryMessageFlags.prepare(QStringLiteral("SELECT flags FROM flags WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryMessageFlags.prepare(QStringLiteral("SELECT flags FROM flags WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(QObject::tr("Failed to prepare queryMessageFlags"), queryMessageFlags);
         return false;
     }
 
     querySetMessageFlags = QSqlQuery(db);
-    if (! querySetMessageFlags.prepare(QStringLiteral("INSERT OR REPLACE INTO flags ( mailbox, uid, flags ) VALUES ( ?, ?, ? )"))) {
+    if (! querySetMessageFlags.prepare(QStringLiteral("INSERT OR REPLACE INTO flags ( mailbox_id, uid, flags ) VALUES ( ?, ?, ? )"))) {
         emitError(QObject::tr("Failed to prepare querySetMessageFlags"), querySetMessageFlags);
         return false;
     }
 
+    queryFlagNames = QSqlQuery(db);
+    if (! queryFlagNames.prepare(QStringLiteral("SELECT bit, name FROM flag_names WHERE mailbox_id = ? ORDER BY bit"))) {
+        emitError(QObject::tr("Failed to prepare queryFlagNames"), queryFlagNames);
+        return false;
+    }
+
+    queryInsertFlagName = QSqlQuery(db);
+    if (! queryInsertFlagName.prepare(QStringLiteral("INSERT OR REPLACE INTO flag_names ( mailbox_id, bit, name ) VALUES ( ?, ?, ? )"))) {
+        emitError(QObject::tr("Failed to prepare queryInsertFlagName"), queryInsertFlagName);
+        return false;
+    }
+
     queryClearAllMessages1 = QSqlQuery(db);
-    if (! queryClearAllMessages1.prepare(QStringLiteral("DELETE FROM msg_metadata WHERE mailbox = ?"))) {
+    if (! queryClearAllMessages1.prepare(QStringLiteral("DELETE FROM msg_metadata WHERE mailbox_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearAllMessages1"), queryClearAllMessages1);
         return false;
     }
 
     queryClearAllMessages2 = QSqlQuery(db);
-    if (! queryClearAllMessages2.prepare(QStringLiteral("DELETE FROM flags WHERE mailbox = ?"))) {
+    if (! queryClearAllMessages2.prepare(QStringLiteral("DELETE FROM flags WHERE mailbox_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearAllMessages2"), queryClearAllMessages2);
         return false;
     }
 
     queryClearAllMessages3 = QSqlQuery(db);
-    if (! queryClearAllMessages3.prepare(QStringLiteral("DELETE FROM parts WHERE mailbox = ?"))) {
+    if (! queryClearAllMessages3.prepare(QStringLiteral("DELETE FROM parts WHERE mailbox_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearAllMessages3"), queryClearAllMessages3);
         return false;
     }
 
     queryClearAllMessages4 = QSqlQuery(db);
-    if (! queryClearAllMessages4.prepare(QStringLiteral("DELETE FROM msg_threading WHERE mailbox = ?"))) {
+    if (! queryClearAllMessages4.prepare(QStringLiteral("DELETE FROM msg_threading WHERE mailbox_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearAllMessages4"), queryClearAllMessages4);
         return false;
     }
 
+    queryClearAllMessages5 = QSqlQuery(db);
+    if (! queryClearAllMessages5.prepare(QStringLiteral("DELETE FROM flag_names WHERE mailbox_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryClearAllMessages5"), queryClearAllMessages5);
+        return false;
+    }
+
+    queryClearAllMessages6 = QSqlQuery(db);
+    if (! queryClearAllMessages6.prepare(QStringLiteral("DELETE FROM search_terms WHERE mailbox_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryClearAllMessages6"), queryClearAllMessages6);
+        return false;
+    }
+
     queryClearMessage1 = QSqlQuery(db);
-    if (! queryClearMessage1.prepare(QStringLiteral("DELETE FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryClearMessage1.prepare(QStringLiteral("DELETE FROM msg_metadata WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearMessage1"), queryClearMessage1);
         return false;
     }
 
     queryClearMessage2 = QSqlQuery(db);
-    if (! queryClearMessage2.prepare(QStringLiteral("DELETE FROM flags WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryClearMessage2.prepare(QStringLiteral("DELETE FROM flags WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearMessage2"), queryClearMessage2);
         return false;
     }
 
     queryClearMessage3 = QSqlQuery(db);
-    if (! queryClearMessage3.prepare(QStringLiteral("DELETE FROM parts WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryClearMessage3.prepare(QStringLiteral("DELETE FROM parts WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(QObject::tr("Failed to prepare queryClearMessage3"), queryClearMessage3);
         return false;
     }
 
+    queryClearMessage4 = QSqlQuery(db);
+    if (! queryClearMessage4.prepare(QStringLiteral("DELETE FROM search_terms WHERE mailbox_id = ? AND uid = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryClearMessage4"), queryClearMessage4);
+        return false;
+    }
+
     queryMessagePart = QSqlQuery(db);
-    if (! queryMessagePart.prepare(QStringLiteral("SELECT data FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
+    if (! queryMessagePart.prepare(QStringLiteral("SELECT part_blobs.data FROM parts "
+                                                  "INNER JOIN part_blobs ON parts.hash = part_blobs.hash "
+                                                  "WHERE parts.mailbox_id = ? AND parts.uid = ? AND parts.part_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryMessagePart"), queryMessagePart);
         return false;
     }
 
+    queryMessagePartHash = QSqlQuery(db);
+    if (! queryMessagePartHash.prepare(QStringLiteral("SELECT hash FROM parts WHERE mailbox_id = ? AND uid = ? AND part_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryMessagePartHash"), queryMessagePartHash);
+        return false;
+    }
+
     querySetMessagePart = QSqlQuery(db);
-    if (! querySetMessagePart.prepare(QStringLiteral("INSERT OR REPLACE INTO parts ( mailbox, uid, part_id, data ) VALUES (?, ?, ?, ?)"))) {
+    if (! querySetMessagePart.prepare(QStringLiteral("INSERT OR REPLACE INTO parts ( mailbox_id, uid, part_id, hash ) VALUES (?, ?, ?, ?)"))) {
         emitError(QObject::tr("Failed to prepare querySetMessagePart"), querySetMessagePart);
         return false;
     }
 
+    queryReferencePartBlob = QSqlQuery(db);
+    if (! queryReferencePartBlob.prepare(QStringLiteral("UPDATE part_blobs SET refcount = refcount + 1 WHERE hash = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryReferencePartBlob"), queryReferencePartBlob);
+        return false;
+    }
+
+    queryInsertPartBlob = QSqlQuery(db);
+    if (! queryInsertPartBlob.prepare(QStringLiteral("INSERT INTO part_blobs ( hash, refcount, data ) VALUES (?, 1, ?)"))) {
+        emitError(QObject::tr("Failed to prepare queryInsertPartBlob"), queryInsertPartBlob);
+        return false;
+    }
+
+    queryReleasePartBlob = QSqlQuery(db);
+    if (! queryReleasePartBlob.prepare(QStringLiteral("UPDATE part_blobs SET refcount = refcount - 1 WHERE hash = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryReleasePartBlob"), queryReleasePartBlob);
+        return false;
+    }
+
+    queryReleaseMessagePartBlobs = QSqlQuery(db);
+    if (! queryReleaseMessagePartBlobs.prepare(QStringLiteral(
+                                                   "UPDATE part_blobs SET refcount = refcount - "
+                                                   "(SELECT COUNT(*) FROM parts WHERE parts.hash = part_blobs.hash AND parts.mailbox_id = ? AND parts.uid = ?) "
+                                                   "WHERE hash IN (SELECT hash FROM parts WHERE mailbox_id = ? AND uid = ?)"))) {
+        emitError(QObject::tr("Failed to prepare queryReleaseMessagePartBlobs"), queryReleaseMessagePartBlobs);
+        return false;
+    }
+
+    queryReleaseMailboxPartBlobs = QSqlQuery(db);
+    if (! queryReleaseMailboxPartBlobs.prepare(QStringLiteral(
+                                                   "UPDATE part_blobs SET refcount = refcount - "
+                                                   "(SELECT COUNT(*) FROM parts WHERE parts.hash = part_blobs.hash AND parts.mailbox_id = ?) "
+                                                   "WHERE hash IN (SELECT hash FROM parts WHERE mailbox_id = ?)"))) {
+        emitError(QObject::tr("Failed to prepare queryReleaseMailboxPartBlobs"), queryReleaseMailboxPartBlobs);
+        return false;
+    }
+
+    queryOrphanedPartBlobs = QSqlQuery(db);
+    if (! queryOrphanedPartBlobs.prepare(QStringLiteral("SELECT hash FROM part_blobs WHERE refcount <= 0 AND data IS NULL"))) {
+        emitError(QObject::tr("Failed to prepare queryOrphanedPartBlobs"), queryOrphanedPartBlobs);
+        return false;
+    }
+
+    queryPurgePartBlobs = QSqlQuery(db);
+    if (! queryPurgePartBlobs.prepare(QStringLiteral("DELETE FROM part_blobs WHERE refcount <= 0"))) {
+        emitError(QObject::tr("Failed to prepare queryPurgePartBlobs"), queryPurgePartBlobs);
+        return false;
+    }
+
     queryForgetMessagePart = QSqlQuery(db);
-    if (! queryForgetMessagePart.prepare(QStringLiteral("DELETE FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
+    if (! queryForgetMessagePart.prepare(QStringLiteral("DELETE FROM parts WHERE mailbox_id = ? AND uid = ? AND part_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryForgetMessagePart"), queryForgetMessagePart);
         return false;
     }
 
+    queryMailboxTree = QSqlQuery(db);
+    if (! queryMailboxTree.prepare(QStringLiteral("SELECT data FROM mailbox_tree WHERE id = 0"))) {
+        emitError(QObject::tr("Failed to prepare queryMailboxTree"), queryMailboxTree);
+        return false;
+    }
+
+    querySetMailboxTree = QSqlQuery(db);
+    if (! querySetMailboxTree.prepare(QStringLiteral("INSERT OR REPLACE INTO mailbox_tree (id, data) VALUES (0, ?)"))) {
+        emitError(QObject::tr("Failed to prepare querySetMailboxTree"), querySetMailboxTree);
+        return false;
+    }
+
     queryMessageThreading = QSqlQuery(db);
-    if (! queryMessageThreading.prepare(QStringLiteral("SELECT threading FROM msg_threading WHERE mailbox = ?"))) {
+    if (! queryMessageThreading.prepare(QStringLiteral("SELECT threading FROM msg_threading WHERE mailbox_id = ?"))) {
         emitError(QObject::tr("Failed to prepare queryMessageThreading"), queryMessageThreading);
         return false;
     }
 
     querySetMessageThreading = QSqlQuery(db);
-    if (! querySetMessageThreading.prepare(QStringLiteral("INSERT OR REPLACE INTO msg_threading (mailbox, threading) VALUES  ( ?, ? )"))) {
+    if (! querySetMessageThreading.prepare(QStringLiteral("INSERT OR REPLACE INTO msg_threading (mailbox_id, threading) VALUES  ( ?, ? )"))) {
         emitError(QObject::tr("Failed to prepare querySetMessageThreading"), querySetMessageThreading);
         return false;
     }
 
+    queryInsertSearchTerm = QSqlQuery(db);
+    if (! queryInsertSearchTerm.prepare(QStringLiteral("INSERT OR IGNORE INTO search_terms (mailbox_id, term, field, uid) "
+                                                       "VALUES (?, ?, ?, ?)"))) {
+        emitError(QObject::tr("Failed to prepare queryInsertSearchTerm"), queryInsertSearchTerm);
+        return false;
+    }
+
+    querySearchIndex = QSqlQuery(db);
+    if (! querySearchIndex.prepare(QStringLiteral("SELECT DISTINCT uid FROM search_terms "
+                                                  "WHERE mailbox_id = ? AND term >= ? AND term < ? AND (field & ?) != 0"))) {
+        emitError(QObject::tr("Failed to prepare querySearchIndex"), querySearchIndex);
+        return false;
+    }
+
+    queryUnindexedMessages = QSqlQuery(db);
+    if (! queryUnindexedMessages.prepare(QStringLiteral("SELECT uid FROM msg_metadata WHERE mailbox_id = ? AND uid NOT IN "
+                                                        "(SELECT uid FROM search_terms WHERE mailbox_id = ?)"))) {
+        emitError(QObject::tr("Failed to prepare queryUnindexedMessages"), queryUnindexedMessages);
+        return false;
+    }
+
+    queryMessageEnvelope = QSqlQuery(db);
+    if (! queryMessageEnvelope.prepare(QStringLiteral("SELECT data FROM msg_metadata WHERE mailbox_id = ? AND uid = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryMessageEnvelope"), queryMessageEnvelope);
+        return false;
+    }
+
+    queryIndexedMessages = QSqlQuery(db);
+    if (! queryIndexedMessages.prepare(QStringLiteral("SELECT uid FROM msg_metadata WHERE mailbox_id = ?"))) {
+        emitError(QObject::tr("Failed to prepare queryIndexedMessages"), queryIndexedMessages);
+        return false;
+    }
+
 #ifdef CACHE_DEBUG
     qDebug() << "SQLCache::_prepareQueries() succeeded";
 #endif
@@ -522,10 +1196,48 @@ void SQLCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMeta
     }
 }
 
+QList<MailboxMetadata> SQLCache::mailboxTreeSnapshot() const
+{
+    QList<MailboxMetadata> res;
+    if (! queryMailboxTree.exec()) {
+        emitError(QObject::tr("Query queryMailboxTree failed"), queryMailboxTree);
+        return res;
+    }
+    if (queryMailboxTree.first()) {
+        QDataStream stream(qUncompress(queryMailboxTree.value(0).toByteArray()));
+        stream.setVersion(streamVersion);
+        stream >> res;
+        if (stream.status() != QDataStream::Ok) {
+            emitError(QObject::tr("Corrupt data when reading the mailbox tree"));
+            return QList<MailboxMetadata>();
+        }
+    }
+    return res;
+}
+
+void SQLCache::setMailboxTreeSnapshot(const QList<MailboxMetadata> &mailboxes)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Setting mailbox tree snapshot," << mailboxes.size() << "mailboxes";
+#endif
+    touchingDB();
+    QByteArray buf;
+    QDataStream stream(&buf, QIODevice::ReadWrite);
+    stream.setVersion(streamVersion);
+    stream << mailboxes;
+    querySetMailboxTree.bindValue(0, qCompress(buf));
+    if (! querySetMailboxTree.exec()) {
+        emitError(QObject::tr("Query querySetMailboxTree failed"), querySetMailboxTree);
+    }
+}
+
 SyncState SQLCache::mailboxSyncState(const QString &mailbox) const
 {
     SyncState res;
-    queryMailboxSyncState.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return res;
+    queryMailboxSyncState.bindValue(0, id);
     if (! queryMailboxSyncState.exec()) {
         emitError(QObject::tr("Query queryMailboxSyncState failed"), queryMailboxSyncState);
         return res;
@@ -545,7 +1257,10 @@ void SQLCache::setMailboxSyncState(const QString &mailbox, const SyncState &stat
     qDebug() << "Setting sync state for" << mailbox;
 #endif
     touchingDB();
-    querySetMailboxSyncState.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox, true);
+    if (id < 0)
+        return;
+    querySetMailboxSyncState.bindValue(0, id);
     QByteArray buf;
     QDataStream stream(&buf, QIODevice::ReadWrite);
     stream.setVersion(streamVersion);
@@ -559,36 +1274,138 @@ void SQLCache::setMailboxSyncState(const QString &mailbox, const SyncState &stat
 
 Imap::Uids SQLCache::uidMapping(const QString &mailbox) const
 {
-    Imap::Uids res;
-    queryUidMapping.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return Imap::Uids();
+    // "No data present" doesn't necessarily imply a problem -- it simply might not be there yet :)
+    return loadUidMapping(id).uids;
+}
+
+/** @short Return the UID mapping of a given mailbox along with the size of its persistent representation
+
+The mapping is reconstructed from the last snapshot by replaying all changes which were logged since then. Recently used
+mappings are kept in memory, but only up to uidMappingMemoryLimit UIDs in total.
+*/
+SQLCache::UidMappingState SQLCache::loadUidMapping(const qint64 id) const
+{
+    if (UidMappingState *known = m_uidMappings.object(id))
+        return *known;
+
+    UidMappingState state;
+    queryUidMapping.bindValue(0, id);
     if (! queryUidMapping.exec()) {
         emitError(QObject::tr("Query queryUidMapping failed"), queryUidMapping);
-        return res;
+        return state;
     }
     if (queryUidMapping.first()) {
-        QDataStream stream(qUncompress(queryUidMapping.value(0).toByteArray()));
-        stream.setVersion(streamVersion);
-        stream >> res;
-    }
-    // "No data present" doesn't necessarily imply a problem -- it simply might not be there yet :)
-    return res;
+        const QByteArray buf = queryUidMapping.value(0).toByteArray();
+        state.snapshotBytes = buf.size();
+        const QByteArray uncompressed = qUncompress(buf);
+        int pos = 0;
+        if (!readUidDeltas(uncompressed, pos, state.uids)) {
+            emitError(QObject::tr("Corrupt UID mapping snapshot for mailbox #%1").arg(id));
+            state.uids.clear();
+        }
+        queryUidMapping.finish();
+    }
+
+    queryUidMappingLog.bindValue(0, id);
+    if (! queryUidMappingLog.exec()) {
+        emitError(QObject::tr("Query queryUidMappingLog failed"), queryUidMappingLog);
+        return state;
+    }
+    while (queryUidMappingLog.next()) {
+        const QByteArray change = queryUidMappingLog.value(0).toByteArray();
+        int pos = 0;
+        Imap::Uids removed, added;
+        if (!readUidDeltas(change, pos, removed) || !readUidDeltas(change, pos, added)) {
+            emitError(QObject::tr("Corrupt UID mapping log for mailbox #%1").arg(id));
+            state.uids.clear();
+            break;
+        }
+        Imap::Uids kept, merged;
+        kept.reserve(state.uids.size());
+        std::set_difference(state.uids.constBegin(), state.uids.constEnd(), removed.constBegin(), removed.constEnd(),
+                            std::back_inserter(kept));
+        merged.reserve(kept.size() + added.size());
+        std::set_union(kept.constBegin(), kept.constEnd(), added.constBegin(), added.constEnd(), std::back_inserter(merged));
+        state.uids = merged;
+        ++state.logEntries;
+        state.logBytes += change.size();
+    }
+    rememberUidMapping(id, state);
+    return state;
 }
 
+void SQLCache::rememberUidMapping(const qint64 id, const UidMappingState &state) const
+{
+    m_uidMappings.insert(id, new UidMappingState(state), qMax(1, state.uids.size()));
+}
+
+/** @short Save the UID mapping
+
+Only the difference against the previously saved state is appended to the uid_mapping_log. Once the log grows too big
+when compared to the snapshot, a fresh snapshot is written and the log is discarded.
+*/
 void SQLCache::setUidMapping(const QString &mailbox, const Imap::Uids &seqToUid)
 {
 #ifdef CACHE_DEBUG
     qDebug() << "Setting UID mapping for" << mailbox;
 #endif
     touchingDB();
-    querySetUidMapping.bindValue(0, mailboxName(mailbox));
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << seqToUid;
-    querySetUidMapping.bindValue(1, qCompress(buf));
+    const qint64 id = mailboxId(mailbox, true);
+    if (id < 0)
+        return;
+
+    UidMappingState state = loadUidMapping(id);
+    if (state.uids == seqToUid)
+        return;
+
+    // The UIDs are always sorted in a consistent mapping, but let's not break stuff if that isn't the case
+    if (state.logEntries < uidMappingLogMaxEntries && isStrictlyAscending(state.uids) && isStrictlyAscending(seqToUid)) {
+        Imap::Uids removed, added;
+        std::set_difference(state.uids.constBegin(), state.uids.constEnd(), seqToUid.constBegin(), seqToUid.constEnd(),
+                            std::back_inserter(removed));
+        std::set_difference(seqToUid.constBegin(), seqToUid.constEnd(), state.uids.constBegin(), state.uids.constEnd(),
+                            std::back_inserter(added));
+        QByteArray change;
+        appendUidDeltas(change, removed);
+        appendUidDeltas(change, added);
+        if (state.logBytes + change.size() <= qMax(state.snapshotBytes, uidMappingLogMinBytes)) {
+            queryAppendUidMappingLog.bindValue(0, id);
+            queryAppendUidMappingLog.bindValue(1, change);
+            if (! queryAppendUidMappingLog.exec()) {
+                emitError(QObject::tr("Query queryAppendUidMappingLog failed"), queryAppendUidMappingLog);
+                m_uidMappings.remove(id);
+                return;
+            }
+            state.uids = seqToUid;
+            ++state.logEntries;
+            state.logBytes += change.size();
+            rememberUidMapping(id, state);
+            return;
+        }
+    }
+
+    const QByteArray snapshot = encodeUidSnapshot(seqToUid);
+    querySetUidMapping.bindValue(0, id);
+    querySetUidMapping.bindValue(1, snapshot);
     if (! querySetUidMapping.exec()) {
         emitError(QObject::tr("Query querySetUidMapping failed"), querySetUidMapping);
+        m_uidMappings.remove(id);
+        return;
     }
+    queryClearUidMappingLog.bindValue(0, id);
+    if (! queryClearUidMappingLog.exec()) {
+        emitError(QObject::tr("Query queryClearUidMappingLog failed"), queryClearUidMappingLog);
+        m_uidMappings.remove(id);
+        return;
+    }
+    state.uids = seqToUid;
+    state.snapshotBytes = snapshot.size();
+    state.logEntries = 0;
+    state.logBytes = 0;
+    rememberUidMapping(id, state);
 }
 
 void SQLCache::clearUidMapping(const QString &mailbox)
@@ -597,10 +1414,18 @@ void SQLCache::clearUidMapping(const QString &mailbox)
     qDebug() << "Clearing UID mapping for" << mailbox;
 #endif
     touchingDB();
-    queryClearUidMapping.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return;
+    m_uidMappings.remove(id);
+    queryClearUidMapping.bindValue(0, id);
     if (! queryClearUidMapping.exec()) {
         emitError(QObject::tr("Query queryClearUidMapping failed"), queryClearUidMapping);
     }
+    queryClearUidMappingLog.bindValue(0, id);
+    if (! queryClearUidMappingLog.exec()) {
+        emitError(QObject::tr("Query queryClearUidMappingLog failed"), queryClearUidMappingLog);
+    }
 }
 
 void SQLCache::clearAllMessages(const QString &mailbox)
@@ -609,10 +1434,20 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     qDebug() << "Clearing all messages from" << mailbox;
 #endif
     touchingDB();
-    queryClearAllMessages1.bindValue(0, mailboxName(mailbox));
-    queryClearAllMessages2.bindValue(0, mailboxName(mailbox));
-    queryClearAllMessages3.bindValue(0, mailboxName(mailbox));
-    queryClearAllMessages4.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return;
+    queryClearAllMessages1.bindValue(0, id);
+    queryClearAllMessages2.bindValue(0, id);
+    queryClearAllMessages3.bindValue(0, id);
+    queryClearAllMessages4.bindValue(0, id);
+    queryClearAllMessages5.bindValue(0, id);
+    queryClearAllMessages6.bindValue(0, id);
+    queryReleaseMailboxPartBlobs.bindValue(0, id);
+    queryReleaseMailboxPartBlobs.bindValue(1, id);
+    if (! queryReleaseMailboxPartBlobs.exec()) {
+        emitError(QObject::tr("Query queryReleaseMailboxPartBlobs failed"), queryReleaseMailboxPartBlobs);
+    }
     if (! queryClearAllMessages1.exec()) {
         emitError(QObject::tr("Query queryClearAllMessages1 failed"), queryClearAllMessages1);
     }
@@ -625,6 +1460,14 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     if (! queryClearAllMessages4.exec()) {
         emitError(QObject::tr("Query queryClearAllMessages4 failed"), queryClearAllMessages4);
     }
+    if (! queryClearAllMessages5.exec()) {
+        emitError(QObject::tr("Query queryClearAllMessages5 failed"), queryClearAllMessages5);
+    }
+    if (! queryClearAllMessages6.exec()) {
+        emitError(QObject::tr("Query queryClearAllMessages6 failed"), queryClearAllMessages6);
+    }
+    m_flagNames.remove(id);
+    purgeUnreferencedPartBlobs();
     clearUidMapping(mailbox);
 }
 
@@ -634,12 +1477,24 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
     qDebug() << "Clearing message" << uid << "from" << mailbox;
 #endif
     touchingDB();
-    queryClearMessage1.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return;
+    queryClearMessage1.bindValue(0, id);
     queryClearMessage1.bindValue(1, uid);
-    queryClearMessage2.bindValue(0, mailboxName(mailbox));
+    queryClearMessage2.bindValue(0, id);
     queryClearMessage2.bindValue(1, uid);
-    queryClearMessage3.bindValue(0, mailboxName(mailbox));
+    queryClearMessage3.bindValue(0, id);
     queryClearMessage3.bindValue(1, uid);
+    queryClearMessage4.bindValue(0, id);
+    queryClearMessage4.bindValue(1, uid);
+    queryReleaseMessagePartBlobs.bindValue(0, id);
+    queryReleaseMessagePartBlobs.bindValue(1, uid);
+    queryReleaseMessagePartBlobs.bindValue(2, id);
+    queryReleaseMessagePartBlobs.bindValue(3, uid);
+    if (! queryReleaseMessagePartBlobs.exec()) {
+        emitError(QObject::tr("Query queryReleaseMessagePartBlobs failed"), queryReleaseMessagePartBlobs);
+    }
     if (! queryClearMessage1.exec()) {
         emitError(QObject::tr("Query queryClearMessage1 failed"), queryClearMessage1);
     }
@@ -649,48 +1504,122 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
     if (! queryClearMessage3.exec()) {
         emitError(QObject::tr("Query queryClearMessage3 failed"), queryClearMessage3);
     }
+    if (! queryClearMessage4.exec()) {
+        emitError(QObject::tr("Query queryClearMessage4 failed"), queryClearMessage4);
+    }
+    purgeUnreferencedPartBlobs();
 }
 
 QStringList SQLCache::msgFlags(const QString &mailbox, const uint uid) const
 {
     QStringList res;
-    queryMessageFlags.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return res;
+    queryMessageFlags.bindValue(0, id);
     queryMessageFlags.bindValue(1, uid);
     if (! queryMessageFlags.exec()) {
         emitError(QObject::tr("Query queryMessageFlags failed"), queryMessageFlags);
         return res;
     }
     if (queryMessageFlags.first()) {
-        QDataStream stream(queryMessageFlags.value(0).toByteArray());
-        stream.setVersion(streamVersion);
-        stream >> res;
+        const QByteArray bits = queryMessageFlags.value(0).toByteArray();
+        queryMessageFlags.finish();
+        bool ok;
+        res = decodeFlagBits(bits, loadFlagNames(id), &ok);
+        if (!ok) {
+            emitError(QObject::tr("Corrupt flags of message %1 in mailbox %2").arg(QString::number(uid), mailbox));
+        }
     }
     // "Not found" is not an error here
     return res;
 }
 
 void SQLCache::setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags)
+{
+    setMsgFlags(mailbox, MessageFlagsList() << qMakePair(uid, flags));
+}
+
+void SQLCache::setMsgFlags(const QString &mailbox, const MessageFlagsList &flags)
 {
 #ifdef CACHE_DEBUG
-    qDebug() << "Updating flags for" << mailbox << uid;
+    qDebug() << "Updating flags for" << flags.size() << "messages in" << mailbox;
 #endif
+    if (flags.isEmpty())
+        return;
     touchingDB();
-    querySetMessageFlags.bindValue(0, mailboxName(mailbox));
-    querySetMessageFlags.bindValue(1, uid);
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << flags;
-    querySetMessageFlags.bindValue(2, buf);
-    if (! querySetMessageFlags.exec()) {
+    const qint64 id = mailboxId(mailbox, true);
+    if (id < 0)
+        return;
+
+    QStringList &names = loadFlagNames(id);
+    const int knownNames = names.size();
+    QVariantList mailboxFields, uidFields, flagsFields;
+    mailboxFields.reserve(flags.size());
+    uidFields.reserve(flags.size());
+    flagsFields.reserve(flags.size());
+    for (const auto &item : flags) {
+        mailboxFields << id;
+        uidFields << item.first;
+        flagsFields << encodeFlagBits(item.second, names);
+    }
+
+    if (names.size() > knownNames) {
+        QVariantList nameMailboxFields, bitFields, nameFields;
+        for (int bit = knownNames; bit < names.size(); ++bit) {
+            nameMailboxFields << id;
+            bitFields << bit;
+            nameFields << names[bit];
+        }
+        queryInsertFlagName.bindValue(0, nameMailboxFields);
+        queryInsertFlagName.bindValue(1, bitFields);
+        queryInsertFlagName.bindValue(2, nameFields);
+        if (! queryInsertFlagName.execBatch()) {
+            emitError(QObject::tr("Query queryInsertFlagName failed"), queryInsertFlagName);
+            // The bits would refer to names which the DB doesn't know about
+            m_flagNames.remove(id);
+            return;
+        }
+    }
+
+    querySetMessageFlags.bindValue(0, mailboxFields);
+    querySetMessageFlags.bindValue(1, uidFields);
+    querySetMessageFlags.bindValue(2, flagsFields);
+    if (! querySetMessageFlags.execBatch()) {
         emitError(QObject::tr("Query querySetMessageFlags failed"), querySetMessageFlags);
     }
 }
 
+/** @short Make sure that the flag names which are interned for the given mailbox are available in memory */
+QStringList &SQLCache::loadFlagNames(const qint64 id) const
+{
+    auto it = m_flagNames.find(id);
+    if (it != m_flagNames.end())
+        return *it;
+
+    QStringList &names = m_flagNames[id];
+    queryFlagNames.bindValue(0, id);
+    if (! queryFlagNames.exec()) {
+        emitError(QObject::tr("Query queryFlagNames failed"), queryFlagNames);
+        return names;
+    }
+    while (queryFlagNames.next()) {
+        if (queryFlagNames.value(0).toInt() != names.size()) {
+            emitError(QObject::tr("Corrupt flag names for mailbox #%1").arg(id));
+            break;
+        }
+        names << queryFlagNames.value(1).toString();
+    }
+    return names;
+}
+
 AbstractCache::MessageDataBundle SQLCache::messageMetadata(const QString &mailbox, uint uid) const
 {
     AbstractCache::MessageDataBundle res;
-    queryMessageMetadata.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return res;
+    queryMessageMetadata.bindValue(0, id);
     queryMessageMetadata.bindValue(1, uid);
     if (! queryMessageMetadata.exec()) {
         emitError(QObject::tr("Query queryMessageMetadata failed"), queryMessageMetadata);
@@ -708,7 +1637,7 @@ AbstractCache::MessageDataBundle SQLCache::messageMetadata(const QString &mailbo
             int currentDiff = accessingThresholdDate.daysTo(QDate::currentDate());
             if (lastAccessTimestamp < currentDiff - m_updateAccessIfOlder) {
                 queryAccessMessageMetadata.bindValue(0, currentDiff);
-                queryAccessMessageMetadata.bindValue(1, mailboxName(mailbox));
+                queryAccessMessageMetadata.bindValue(1, id);
                 queryAccessMessageMetadata.bindValue(2, uid);
                 if (!queryAccessMessageMetadata.exec()) {
                     emitError(QObject::tr("Query queryAccessMessageMetadata failed"), queryAccessMessageMetadata);
@@ -726,8 +1655,11 @@ void SQLCache::setMessageMetadata(const QString &mailbox, const uint uid, const
     qDebug() << "Setting message metadata for" << uid << mailbox;
 #endif
     touchingDB();
+    const qint64 id = mailboxId(mailbox, true);
+    if (id < 0)
+        return;
     // Order of values: mailbox, uid, data
-    querySetMessageMetadata.bindValue(0, mailboxName(mailbox));
+    querySetMessageMetadata.bindValue(0, id);
     querySetMessageMetadata.bindValue(1, uid);
     QByteArray buf;
     QDataStream stream(&buf, QIODevice::ReadWrite);
@@ -739,12 +1671,28 @@ void SQLCache::setMessageMetadata(const QString &mailbox, const uint uid, const
     if (! querySetMessageMetadata.exec()) {
         emitError(QObject::tr("Query querySetMessageMetadata failed"), querySetMessageMetadata);
     }
+
+    QVariantList mailboxFields, termFields, fieldFields, uidFields;
+    appendIndexedMarker(mailboxFields, termFields, fieldFields, uidFields, id, uid);
+    for (const auto &item : envelopeSearchText(metadata.envelope)) {
+        appendSearchTerms(mailboxFields, termFields, fieldFields, uidFields, id, uid, item.first, item.second);
+    }
+    queryInsertSearchTerm.bindValue(0, mailboxFields);
+    queryInsertSearchTerm.bindValue(1, termFields);
+    queryInsertSearchTerm.bindValue(2, fieldFields);
+    queryInsertSearchTerm.bindValue(3, uidFields);
+    if (! queryInsertSearchTerm.execBatch()) {
+        emitError(QObject::tr("Query queryInsertSearchTerm failed"), queryInsertSearchTerm);
+    }
 }
 
 QByteArray SQLCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
 {
     QByteArray res;
-    queryMessagePart.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return res;
+    queryMessagePart.bindValue(0, id);
     queryMessagePart.bindValue(1, uid);
     queryMessagePart.bindValue(2, partId);
     if (! queryMessagePart.exec()) {
@@ -752,25 +1700,102 @@ QByteArray SQLCache::messagePart(const QString &mailbox, const uint uid, const Q
         return res;
     }
     if (queryMessagePart.first()) {
-        res = qUncompress(queryMessagePart.value(0).toByteArray());
+        // The data are NULL when the blob is stored outside of the DB
+        QByteArray compressed = queryMessagePart.value(0).toByteArray();
+        if (!compressed.isNull())
+            res = qUncompress(compressed);
         queryMessagePart.finish();
     }
     return res;
 }
 
+QByteArray SQLCache::messagePartHash(const QString &mailbox, const uint uid, const QByteArray &partId) const
+{
+    QByteArray res;
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return res;
+    queryMessagePartHash.bindValue(0, id);
+    queryMessagePartHash.bindValue(1, uid);
+    queryMessagePartHash.bindValue(2, partId);
+    if (! queryMessagePartHash.exec()) {
+        emitError(QObject::tr("Query queryMessagePartHash failed"), queryMessagePartHash);
+        return res;
+    }
+    if (queryMessagePartHash.first()) {
+        res = queryMessagePartHash.value(0).toByteArray();
+        queryMessagePartHash.finish();
+    }
+    return res;
+}
+
 void SQLCache::setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data)
 {
 #ifdef CACHE_DEBUG
     qDebug() << "Saving message part" << partId << uid << mailbox;
 #endif
     touchingDB();
-    querySetMessagePart.bindValue(0, mailboxName(mailbox));
+    storePartReference(mailbox, uid, partId, contentHash(data), &data);
+}
+
+void SQLCache::setMsgPartReference(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &hash)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Saving reference to an external message part" << partId << uid << mailbox << hash.toHex();
+#endif
+    touchingDB();
+    storePartReference(mailbox, uid, partId, hash, nullptr);
+}
+
+/** @short Make the (mailbox, uid, partId) point to a blob identified by its @arg hash
+
+If the @arg data is nullptr, the blob itself is not stored within the DB and only its reference count is maintained.
+*/
+void SQLCache::storePartReference(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &hash,
+                                  const QByteArray *data)
+{
+    const qint64 id = mailboxId(mailbox, true);
+    if (id < 0)
+        return;
+    const QByteArray oldHash = messagePartHash(mailbox, uid, partId);
+    if (oldHash == hash) {
+        // We already have exactly this data
+        return;
+    }
+
+    if (!oldHash.isEmpty()) {
+        queryReleasePartBlob.bindValue(0, oldHash);
+        if (! queryReleasePartBlob.exec()) {
+            emitError(QObject::tr("Query queryReleasePartBlob failed"), queryReleasePartBlob);
+        }
+    }
+
+    queryReferencePartBlob.bindValue(0, hash);
+    if (! queryReferencePartBlob.exec()) {
+        emitError(QObject::tr("Query queryReferencePartBlob failed"), queryReferencePartBlob);
+        return;
+    }
+    if (queryReferencePartBlob.numRowsAffected() == 0) {
+        // This is the first reference to these data
+        queryInsertPartBlob.bindValue(0, hash);
+        queryInsertPartBlob.bindValue(1, data ? QVariant(qCompress(*data)) : QVariant(QVariant::ByteArray));
+        if (! queryInsertPartBlob.exec()) {
+            emitError(QObject::tr("Query queryInsertPartBlob failed"), queryInsertPartBlob);
+            return;
+        }
+    }
+
+    querySetMessagePart.bindValue(0, id);
     querySetMessagePart.bindValue(1, uid);
     querySetMessagePart.bindValue(2, partId);
-    querySetMessagePart.bindValue(3, qCompress(data));
+    querySetMessagePart.bindValue(3, hash);
     if (! querySetMessagePart.exec()) {
         emitError(QObject::tr("Query querySetMessagePart failed"), querySetMessagePart);
     }
+
+    if (!oldHash.isEmpty()) {
+        purgeUnreferencedPartBlobs();
+    }
 }
 
 void SQLCache::forgetMessagePart(const QString &mailbox, const uint uid, const QByteArray &partId)
@@ -779,18 +1804,63 @@ void SQLCache::forgetMessagePart(const QString &mailbox, const uint uid, const Q
     qDebug() << "Forgetting message part" << partId << uid << mailbox;
 #endif
     touchingDB();
-    queryForgetMessagePart.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return;
+    const QByteArray hash = messagePartHash(mailbox, uid, partId);
+    if (hash.isEmpty())
+        return;
+    queryForgetMessagePart.bindValue(0, id);
     queryForgetMessagePart.bindValue(1, uid);
     queryForgetMessagePart.bindValue(2, partId);
     if (! queryForgetMessagePart.exec()) {
         emitError(QObject::tr("Query queryForgetMessagePart failed"), queryForgetMessagePart);
+        return;
     }
+    queryReleasePartBlob.bindValue(0, hash);
+    if (! queryReleasePartBlob.exec()) {
+        emitError(QObject::tr("Query queryReleasePartBlob failed"), queryReleasePartBlob);
+    }
+    purgeUnreferencedPartBlobs();
+}
+
+/** @short Remove all blobs which are no longer referenced by any message part
+
+Hashes of the blobs which were stored outside of the DB are remembered so that the caller can remove the actual data.
+*/
+void SQLCache::purgeUnreferencedPartBlobs()
+{
+    if (! queryOrphanedPartBlobs.exec()) {
+        emitError(QObject::tr("Query queryOrphanedPartBlobs failed"), queryOrphanedPartBlobs);
+        return;
+    }
+    while (queryOrphanedPartBlobs.next()) {
+        m_orphanedPartBlobs << queryOrphanedPartBlobs.value(0).toByteArray();
+    }
+    if (! queryPurgePartBlobs.exec()) {
+        emitError(QObject::tr("Query queryPurgePartBlobs failed"), queryPurgePartBlobs);
+    }
+}
+
+QList<QByteArray> SQLCache::takeOrphanedPartBlobs()
+{
+    QList<QByteArray> res;
+    res.swap(m_orphanedPartBlobs);
+    return res;
+}
+
+QByteArray SQLCache::contentHash(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
 }
 
 QVector<Imap::Responses::ThreadingNode> SQLCache::messageThreading(const QString &mailbox)
 {
     QVector<Imap::Responses::ThreadingNode> res;
-    queryMessageThreading.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return res;
+    queryMessageThreading.bindValue(0, id);
     if (! queryMessageThreading.exec()) {
         emitError(QObject::tr("Query queryMessageThreading failed"), queryMessageThreading);
         return res;
@@ -809,7 +1879,10 @@ void SQLCache::setMessageThreading(const QString &mailbox, const QVector<Imap::R
     qDebug() << "Setting threading for" << mailbox;
 #endif
     touchingDB();
-    querySetMessageThreading.bindValue(0, mailboxName(mailbox));
+    const qint64 id = mailboxId(mailbox, true);
+    if (id < 0)
+        return;
+    querySetMessageThreading.bindValue(0, id);
     QByteArray buf;
     QDataStream stream(&buf, QIODevice::ReadWrite);
     stream.setVersion(streamVersion);
@@ -821,6 +1894,122 @@ void SQLCache::setMessageThreading(const QString &mailbox, const QVector<Imap::R
 
 }
 
+void SQLCache::indexMessageText(const QString &mailbox, const uint uid, const int field, const QString &text)
+{
+    touchingDB();
+    const qint64 id = mailboxId(mailbox, true);
+    if (id < 0)
+        return;
+    QVariantList mailboxFields, termFields, fieldFields, uidFields;
+    appendSearchTerms(mailboxFields, termFields, fieldFields, uidFields, id, uid, field, text);
+    if (mailboxFields.isEmpty())
+        return;
+    queryInsertSearchTerm.bindValue(0, mailboxFields);
+    queryInsertSearchTerm.bindValue(1, termFields);
+    queryInsertSearchTerm.bindValue(2, fieldFields);
+    queryInsertSearchTerm.bindValue(3, uidFields);
+    if (! queryInsertSearchTerm.execBatch()) {
+        emitError(QObject::tr("Query queryInsertSearchTerm failed"), queryInsertSearchTerm);
+    }
+}
+
+QSet<uint> SQLCache::searchIndex(const QString &mailbox, const int fields, const QString &prefix) const
+{
+    QSet<uint> res;
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return res;
+    querySearchIndex.bindValue(0, id);
+    querySearchIndex.bindValue(1, prefix);
+    // No valid UTF-8 sequence compares bigger than the highest code point, so this is an upper bound for the prefix search
+    querySearchIndex.bindValue(2, prefix + QString::fromUcs4(U"\U0010FFFF"));
+    querySearchIndex.bindValue(3, fields);
+    if (! querySearchIndex.exec()) {
+        emitError(QObject::tr("Query querySearchIndex failed"), querySearchIndex);
+        return res;
+    }
+    while (querySearchIndex.next()) {
+        res.insert(querySearchIndex.value(0).toUInt());
+    }
+    return res;
+}
+
+QSet<uint> SQLCache::indexedMessages(const QString &mailbox) const
+{
+    QSet<uint> res;
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0)
+        return res;
+    queryIndexedMessages.bindValue(0, id);
+    if (! queryIndexedMessages.exec()) {
+        emitError(QObject::tr("Query queryIndexedMessages failed"), queryIndexedMessages);
+        return res;
+    }
+    while (queryIndexedMessages.next()) {
+        res.insert(queryIndexedMessages.value(0).toUInt());
+    }
+    return res;
+}
+
+/** @short Index the headers of messages which were cached before the full-text index existed
+
+This only happens once per mailbox and session. The work is split into batches so that a huge mailbox does not have to
+be held in memory at once.
+*/
+void SQLCache::catchUpSearchIndex(const QString &mailbox)
+{
+    const qint64 id = mailboxId(mailbox);
+    if (id < 0 || m_searchIndexCaughtUp.contains(id))
+        return;
+    m_searchIndexCaughtUp.insert(id);
+
+    queryUnindexedMessages.bindValue(0, id);
+    queryUnindexedMessages.bindValue(1, id);
+    if (! queryUnindexedMessages.exec()) {
+        emitError(QObject::tr("Query queryUnindexedMessages failed"), queryUnindexedMessages);
+        return;
+    }
+    QVector<uint> uids;
+    while (queryUnindexedMessages.next()) {
+        uids << queryUnindexedMessages.value(0).toUInt();
+    }
+    if (uids.isEmpty())
+        return;
+
+    touchingDB();
+    for (int start = 0; start < uids.size(); start += searchIndexCatchUpBatch) {
+        QVariantList mailboxFields, termFields, fieldFields, uidFields;
+        for (int i = start; i < qMin(start + searchIndexCatchUpBatch, uids.size()); ++i) {
+            queryMessageEnvelope.bindValue(0, id);
+            queryMessageEnvelope.bindValue(1, uids[i]);
+            if (! queryMessageEnvelope.exec()) {
+                emitError(QObject::tr("Query queryMessageEnvelope failed"), queryMessageEnvelope);
+                return;
+            }
+            if (!queryMessageEnvelope.first())
+                continue;
+            Imap::Message::Envelope envelope;
+            QDataStream stream(qUncompress(queryMessageEnvelope.value(0).toByteArray()));
+            stream.setVersion(streamVersion);
+            stream >> envelope;
+            appendIndexedMarker(mailboxFields, termFields, fieldFields, uidFields, id, uids[i]);
+            for (const auto &item : envelopeSearchText(envelope)) {
+                appendSearchTerms(mailboxFields, termFields, fieldFields, uidFields, id, uids[i], item.first, item.second);
+            }
+        }
+        if (mailboxFields.isEmpty())
+            continue;
+        queryInsertSearchTerm.bindValue(0, mailboxFields);
+        queryInsertSearchTerm.bindValue(1, termFields);
+        queryInsertSearchTerm.bindValue(2, fieldFields);
+        queryInsertSearchTerm.bindValue(3, uidFields);
+        if (! queryInsertSearchTerm.execBatch()) {
+            emitError(QObject::tr("Query queryInsertSearchTerm failed"), queryInsertSearchTerm);
+            return;
+        }
+    }
+}
+
 void SQLCache::touchingDB()
 {
     delayedCommit->start();
@@ -850,6 +2039,39 @@ void SQLCache::setRenewalThreshold(const int days)
     m_updateAccessIfOlder = days;
 }
 
+/** @short Return the numeric ID which identifies the mailbox in the per-mailbox and per-message tables
+
+If the mailbox is not known yet and @arg create is set, a new ID is allocated. Otherwise, -1 is returned.
+*/
+qint64 SQLCache::mailboxId(const QString &mailbox, const bool create) const
+{
+    const QString name = mailboxName(mailbox);
+    auto it = m_mailboxIds.constFind(name);
+    if (it != m_mailboxIds.constEnd() && (*it >= 0 || !create)) {
+        return *it;
+    }
+
+    qint64 id = -1;
+    queryMailboxId.bindValue(0, name);
+    if (! queryMailboxId.exec()) {
+        emitError(QObject::tr("Query queryMailboxId failed"), queryMailboxId);
+        return id;
+    }
+    if (queryMailboxId.first()) {
+        id = queryMailboxId.value(0).toLongLong();
+        queryMailboxId.finish();
+    } else if (create) {
+        queryCreateMailboxId.bindValue(0, name);
+        if (! queryCreateMailboxId.exec()) {
+            emitError(QObject::tr("Query queryCreateMailboxId failed"), queryCreateMailboxId);
+            return id;
+        }
+        id = queryCreateMailboxId.lastInsertId().toLongLong();
+    }
+    m_mailboxIds[name] = id;
+    return id;
+}
+
 /** @short Return a proper represenation of the mailbox name to be used in the SQL queries
 
 A null QString is represented as NIL, which makes our cache unhappy.
@@ -24,6 +24,8 @@
 #define IMAP_MODEL_SQLCACHE_H
 
 #include <memory>
+#include <QCache>
+#include <QHash>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include "Cache.h"
@@ -64,8 +66,32 @@ et cetera. In short, the layout of the database is supposed to act as a quick an
 cache and is certainly *not* meant to be accessed by third-party applications. Please, do
 consider it an opaque format.
 
+Message parts are content-addressed; the parts table only maps the (mailbox, uid, part_id)
+to a hash of the data, and the data themselves live in a reference-counted part_blobs table.
+That way, the same attachment which is present in several mailboxes is only stored once.
+
+The mailboxes are only referred to by their numeric ID which is assigned through the
+mailboxes table.
+
+The seq -> UID mapping is saved as a delta-encoded snapshot in the uid_mapping table. Any
+subsequent updates only append the added and removed UIDs to the uid_mapping_log, and the
+snapshot is rewritten once the log grows too big.
+
+Message flags are stored as a bitset. The bits refer to flag names which are interned per
+mailbox in the flag_names table, so that the usual handful of system flags only takes a
+byte or two per message.
+
+The mailbox_tree table holds a single compressed snapshot of the whole mailbox hierarchy, which is what a recursive
+LIST fills. It complements the per-parent child_mailboxes table so that huge hierarchies load in one go.
+
+The search_terms table is an inverted index of the words in the message headers and in the
+text parts, so that the common SEARCH keys can be evaluated without the server. It is keyed
+by the word, so a prefix lookup is a range scan over the primary key. Each indexed message
+also gets a row with an empty term and no field, so that messages without any words are not
+indexed over and over again. Messages which were cached before the index existed are indexed
+lazily by catchUpSearchIndex(), one mailbox at a time.
+
 Some ideas for improvements:
-- Don't store full string mailbox names in each table, use another table for it
 - Merge uid_mapping with mailbox_sync_state, and also msg_metadata with flags
 - Serious embedded users might consider putting the database into a compressed filesystem,
   or using on-the-fly compression via sqlite's VFS subsystem
@@ -80,6 +106,8 @@ public:
     QList<MailboxMetadata> childMailboxes(const QString &mailbox) const override;
     bool childMailboxesFresh(const QString &mailbox) const override;
     void setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data) override;
+    QList<MailboxMetadata> mailboxTreeSnapshot() const override;
+    void setMailboxTreeSnapshot(const QList<MailboxMetadata> &mailboxes) override;
 
     SyncState mailboxSyncState(const QString &mailbox) const override;
     void setMailboxSyncState(const QString &mailbox, const SyncState &state) override;
@@ -96,6 +124,7 @@ public:
 
     QStringList msgFlags(const QString &mailbox, const uint uid) const override;
     void setMsgFlags(const QString &mailbox, const uint uid, const QStringList &flags) override;
+    void setMsgFlags(const QString &mailbox, const MessageFlagsList &flags) override;
 
     QByteArray messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const override;
     void setMsgPart(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &data) override;
@@ -104,9 +133,28 @@ public:
     QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox) override;
     void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading) override;
 
+    void indexMessageText(const QString &mailbox, const uint uid, const int field, const QString &text) override;
+    void catchUpSearchIndex(const QString &mailbox) override;
+    QSet<uint> searchIndex(const QString &mailbox, const int fields, const QString &prefix) const override;
+    QSet<uint> indexedMessages(const QString &mailbox) const override;
+
     /** @short Open a connection to the cache */
     bool open(const QString &name, const QString &fileName);
 
+    /** @short Return the hash of the data of a message part, or a null QByteArray if the part is not known */
+    QByteArray messagePartHash(const QString &mailbox, const uint uid, const QByteArray &partId) const;
+    /** @short Remember that the message part's data are identified by the @arg hash, but don't store them in the DB
+
+    This is used for big parts whose data shall be kept outside of the database. The reference counting is still
+    performed by this class; see takeOrphanedPartBlobs().
+    */
+    void setMsgPartReference(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &hash);
+    /** @short Return hashes of the externally stored blobs which are no longer referenced by any message part */
+    QList<QByteArray> takeOrphanedPartBlobs();
+
+    /** @short Compute the hash which is used for addressing the message parts */
+    static QByteArray contentHash(const QByteArray &data);
+
     void setRenewalThreshold(const int days) override;
 
 private:
@@ -122,13 +170,40 @@ private:
     /** @short Initialize the prepared queries */
     bool prepareQueries();
 
+    // The individual steps of the upgrade from v7 to v8
+    bool upgradeToContentAddressedParts();
+    bool upgradeToMailboxIds();
+    bool upgradeToUidMappingLog();
+    bool upgradeToFlagBits();
+    bool upgradeToSearchIndex();
+    bool upgradeToMailboxTreeSnapshot();
+
     /** @short We're about to touch the DB, so it might be a good time to start a transaction */
     void touchingDB();
 
     /** @short Initialize the database */
     void init();
 
+    void storePartReference(const QString &mailbox, const uint uid, const QByteArray &partId, const QByteArray &hash,
+                            const QByteArray *data);
+    void purgeUnreferencedPartBlobs();
+
     static QString mailboxName(const QString &mailbox);
+    qint64 mailboxId(const QString &mailbox, const bool create = false) const;
+
+    /** @short The last saved UID mapping and the size of its persistent representation */
+    struct UidMappingState {
+        Imap::Uids uids;
+        int snapshotBytes;
+        int logEntries;
+        int logBytes;
+
+        UidMappingState(): snapshotBytes(0), logEntries(0), logBytes(0) {}
+    };
+
+    UidMappingState loadUidMapping(const qint64 id) const;
+    void rememberUidMapping(const qint64 id, const UidMappingState &state) const;
+    QStringList &loadFlagNames(const qint64 id) const;
 
 private slots:
     /** @short We haven't committed for a while */
@@ -144,33 +219,70 @@ private:
     mutable QSqlQuery queryChildMailboxesFresh;
     mutable QSqlQuery queryRemoveChildMailboxes;
     mutable QSqlQuery querySetChildMailboxes;
+    mutable QSqlQuery queryMailboxTree;
+    mutable QSqlQuery querySetMailboxTree;
+    mutable QSqlQuery queryMailboxId;
+    mutable QSqlQuery queryCreateMailboxId;
     mutable QSqlQuery queryMailboxSyncState;
     mutable QSqlQuery querySetMailboxSyncState;
     mutable QSqlQuery queryUidMapping;
     mutable QSqlQuery querySetUidMapping;
     mutable QSqlQuery queryClearUidMapping;
+    mutable QSqlQuery queryUidMappingLog;
+    mutable QSqlQuery queryAppendUidMappingLog;
+    mutable QSqlQuery queryClearUidMappingLog;
     mutable QSqlQuery queryMessageMetadata;
     mutable QSqlQuery queryAccessMessageMetadata;
     mutable QSqlQuery querySetMessageMetadata;
     mutable QSqlQuery queryMessageFlags;
     mutable QSqlQuery querySetMessageFlags;
+    mutable QSqlQuery queryFlagNames;
+    mutable QSqlQuery queryInsertFlagName;
     mutable QSqlQuery queryClearAllMessages1;
     mutable QSqlQuery queryClearAllMessages2;
     mutable QSqlQuery queryClearAllMessages3;
     mutable QSqlQuery queryClearAllMessages4;
+    mutable QSqlQuery queryClearAllMessages5;
+    mutable QSqlQuery queryClearAllMessages6;
     mutable QSqlQuery queryClearMessage1;
     mutable QSqlQuery queryClearMessage2;
     mutable QSqlQuery queryClearMessage3;
+    mutable QSqlQuery queryClearMessage4;
     mutable QSqlQuery queryMessagePart;
+    mutable QSqlQuery queryMessagePartHash;
     mutable QSqlQuery querySetMessagePart;
     mutable QSqlQuery queryForgetMessagePart;
+    mutable QSqlQuery queryReferencePartBlob;
+    mutable QSqlQuery queryInsertPartBlob;
+    mutable QSqlQuery queryReleasePartBlob;
+    mutable QSqlQuery queryReleaseMessagePartBlobs;
+    mutable QSqlQuery queryReleaseMailboxPartBlobs;
+    mutable QSqlQuery queryOrphanedPartBlobs;
+    mutable QSqlQuery queryPurgePartBlobs;
     mutable QSqlQuery queryMessageThreading;
     mutable QSqlQuery querySetMessageThreading;
+    mutable QSqlQuery queryInsertSearchTerm;
+    mutable QSqlQuery querySearchIndex;
+    mutable QSqlQuery queryIndexedMessages;
+    mutable QSqlQuery queryUnindexedMessages;
+    mutable QSqlQuery queryMessageEnvelope;
 
     std::unique_ptr<QTimer> delayedCommit;
     std::unique_ptr<QTimer> tooMuchTimeWithoutCommit;
     bool inTransaction;
 
+    /** @short Numeric IDs of the mailboxes, -1 for those which are not in the DB yet */
+    mutable QHash<QString, qint64> m_mailboxIds;
+    /** @short Recently used UID mappings, indexed by mailbox ID; the cost is the number of UIDs */
+    mutable QCache<qint64, UidMappingState> m_uidMappings;
+    /** @short Names of flags which the bits in the flags table refer to, indexed by mailbox ID */
+    mutable QHash<qint64, QStringList> m_flagNames;
+    /** @short Mailboxes whose cached headers are known to be in the full-text index */
+    QSet<qint64> m_searchIndexCaughtUp;
+
+    /** @short Hashes of blobs stored outside of the DB which are no longer needed */
+    QList<QByteArray> m_orphanedPartBlobs;
+
     /** @short A point in time against which the "last accessed on" data is computed */
     static QDate accessingThresholdDate;
 
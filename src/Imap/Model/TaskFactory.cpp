@@ -46,6 +46,7 @@
 #include "Imap/Tasks/UpdateFlagsOfAllMessagesTask.h"
 #include "Imap/Tasks/ThreadTask.h"
 #include "Imap/Tasks/NoopTask.h"
+#include "Imap/Tasks/NotifyTask.h"
 #include "Imap/Tasks/UnSelectTask.h"
 #include "Imap/Tasks/SortTask.h"
 #include "Imap/Tasks/SubscribeUnsubscribeTask.h"
@@ -96,9 +97,10 @@ ExpungeMailboxTask *TaskFactory::createExpungeMailboxTask(Model *model, const QM
     return new ExpungeMailboxTask(model, mailbox);
 }
 
-FetchMsgMetadataTask *TaskFactory::createFetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids)
+FetchMsgMetadataTask *TaskFactory::createFetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids,
+        const MetadataFetchPhase phase)
 {
-    return new FetchMsgMetadataTask(model, mailbox, uids);
+    return new FetchMsgMetadataTask(model, mailbox, uids, phase);
 }
 
 FetchMsgPartTask *TaskFactory::createFetchMsgPartTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids, const QList<QByteArray> &parts)
@@ -163,14 +165,20 @@ NoopTask *TaskFactory::createNoopTask(Model *model, ImapTask *parentTask)
     return new NoopTask(model, parentTask);
 }
 
+NotifyTask *TaskFactory::createNotifyTask(Model *model, ImapTask *dependingTask)
+{
+    return new NotifyTask(model, dependingTask);
+}
+
 UnSelectTask *TaskFactory::createUnSelectTask(Model *model, ImapTask *parentTask)
 {
     return new UnSelectTask(model, parentTask);
 }
 
-SortTask *TaskFactory::createSortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria)
+SortTask *TaskFactory::createSortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+                                      const QPair<int, int> &partialRange)
 {
-    return new SortTask(model, mailbox, searchConditions, sortCriteria);
+    return new SortTask(model, mailbox, searchConditions, sortCriteria, partialRange);
 }
 
 AppendTask *TaskFactory::createAppendTask(Model *model, const QString &targetMailbox, const QByteArray &rawMessageData,
@@ -26,9 +26,11 @@
 #include <memory>
 #include <QMap>
 #include <QModelIndex>
+#include <QPair>
 #include "CatenateData.h"
 #include "CopyMoveOperation.h"
 #include "FlagsOperation.h"
+#include "MetadataFetchPhase.h"
 #include "SubscribeUnSubscribeOperation.h"
 #include "UidSubmitData.h"
 #include "Imap/Parser/Uids.h"
@@ -59,6 +61,7 @@ class UpdateFlagsTask;
 class UpdateFlagsOfAllMessagesTask;
 class ThreadTask;
 class NoopTask;
+class NotifyTask;
 class UnSelectTask;
 class SortTask;
 class SubscribeUnsubscribeTask;
@@ -80,7 +83,8 @@ public:
     virtual DeleteMailboxTask *createDeleteMailboxTask(Model *model, const QString &mailbox);
     virtual EnableTask *createEnableTask(Model *model, ImapTask *dependingTask, const QList<QByteArray> &extensions);
     virtual ExpungeMailboxTask *createExpungeMailboxTask(Model *model, const QModelIndex &mailbox);
-    virtual FetchMsgMetadataTask *createFetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uid);
+    virtual FetchMsgMetadataTask *createFetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uid,
+            const MetadataFetchPhase phase = METADATA_FULL);
     virtual FetchMsgPartTask *createFetchMsgPartTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids, const QList<QByteArray> &parts);
     virtual GetAnyConnectionTask *createGetAnyConnectionTask(Model *model);
     virtual IdTask *createIdTask(Model *model, ImapTask *dependingTask);
@@ -100,8 +104,10 @@ public:
     virtual ThreadTask *createThreadTask(Model *model, const QModelIndex &mailbox, const QByteArray &algorithm, const QStringList &searchCriteria);
     virtual ThreadTask *createIncrementalThreadTask(Model *model, const QModelIndex &mailbox, const QByteArray &algorithm, const QStringList &searchCriteria);
     virtual NoopTask *createNoopTask(Model *model, ImapTask *parentTask);
+    virtual NotifyTask *createNotifyTask(Model *model, ImapTask *dependingTask);
     virtual UnSelectTask *createUnSelectTask(Model *model, ImapTask *parentTask);
-    virtual SortTask *createSortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria);
+    virtual SortTask *createSortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+                                     const QPair<int, int> &partialRange = qMakePair(0, 0));
     virtual AppendTask *createAppendTask(Model *model, const QString &targetMailbox, const QByteArray &rawMessageData,
                                          const QStringList &flags, const QDateTime &timestamp);
     virtual AppendTask *createAppendTask(Model *model, const QString &targetMailbox, const QList<CatenatePair> &data,
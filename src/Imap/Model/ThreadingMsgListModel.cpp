@@ -23,29 +23,47 @@
 #include "ThreadingMsgListModel.h"
 #include <algorithm>
 #include <QBuffer>
+#include <QDateTime>
 #include <QDebug>
+#include <QTimer>
 #include "Imap/Tasks/SortTask.h"
 #include "Imap/Tasks/ThreadTask.h"
 #include "ItemRoles.h"
+#include "LocalSearch.h"
 #include "MailboxTree.h"
 #include "MsgListModel.h"
 
 namespace {
     /** @short Preallocate a bit more space in the hashmaps for future new arrivals */
     const int headroomForNewmessages = 1000;
+
+    /** @short Mailboxes with at least this many messages are sorted locally in a background thread */
+    const int localSortInBackgroundThreshold = 5000;
+
+    /** @short Mailboxes with more messages than this only get their sort order in windows, RFC 9394's PARTIAL */
+    const int sortPartialThreshold = 2000;
+
+    /** @short How many items of the sort result to ask for at once; enough to fill the view with some margin */
+    const int sortPartialPageSize = 250;
+
+    /** @short Ask for the next window once the view gets this close to the end of the known part of the order */
+    const int sortPartialMargin = 50;
+
+    /** @short Tree updates which need more row operations than this are announced as a layout change instead */
+    const int incrementalTreeUpdateLimit = 100;
 }
 
 namespace {
 using Imap::Mailbox::ThreadNodeInfo;
 
 #if 0
-QByteArray dumpThreadNodeInfo(const QHash<uint,ThreadNodeInfo> &mapping, const uint nodeId, const uint offset)
+QByteArray dumpThreadNodeInfo(const Imap::Mailbox::ThreadNodeArena &mapping, const uint nodeId, const uint offset)
 {
     QByteArray res;
     QByteArray prefix(offset, ' ');
     QTextStream ss(&res);
     Q_ASSERT(mapping.contains(nodeId));
-    const ThreadNodeInfo &node = mapping[nodeId];
+    const ThreadNodeInfo &node = *mapping.constFind(nodeId);
     ss << prefix << "ThreadNodeInfo intId " << node.internalId << " UID " << node.uid << " ptr " << node.ptr <<
           " parentIntId " << node.parent << "\n";
     Q_FOREACH(const uint childId, node.children) {
@@ -66,6 +84,28 @@ void dumpThreading(const QVector<Imap::Responses::ThreadingNode>& thr, const uin
 }
 #endif
 
+/** @short Find the first message in the subtree of a placeholder node
+
+The @arg placeholders is set to the number of placeholders on the way down to that message, including the node itself.
+*/
+template <typename Tree>
+Imap::Mailbox::TreeItem *firstMessageBelow(const Tree &tree, const uint id, int &placeholders)
+{
+    const ThreadNodeInfo *node = tree.constFind(id);
+    Q_ASSERT(node);
+    if (node->ptr) {
+        placeholders = 0;
+        return node->ptr;
+    }
+    Q_FOREACH(const uint childId, node->children) {
+        if (Imap::Mailbox::TreeItem *ptr = firstMessageBelow(tree, childId, placeholders)) {
+            ++placeholders;
+            return ptr;
+        }
+    }
+    return nullptr;
+}
+
 }
 
 namespace Imap
@@ -73,15 +113,117 @@ namespace Imap
 namespace Mailbox
 {
 
+/** @short Remove the node, but keep its slot and the buffer for its children around for a later reuse */
+void ThreadNodeArena::erase(const uint id)
+{
+    if (!contains(id))
+        return;
+    remember(id);
+    ThreadNodeInfo &node = m_nodes[id];
+    node.uid = 0;
+    node.parent = 0;
+    node.ptr = 0;
+    node.offset = 0;
+    node.children.clear();
+    node.unreadInSubtree = 0;
+    node.flagsInSubtree.clear();
+    node.aggregatesValid = false;
+    m_used[id] = false;
+    --m_size;
+}
+
+/** @short Remove all nodes while keeping the memory allocated */
+void ThreadNodeArena::clear()
+{
+    if (!m_size)
+        return;
+    for (int id = 0; id < m_nodes.size(); ++id) {
+        if (m_used[id])
+            erase(id);
+    }
+    Q_ASSERT(m_size == 0);
+}
+
+/** @short IDs of all nodes, in an ascending order */
+QVector<uint> ThreadNodeArena::keys() const
+{
+    QVector<uint> res;
+    res.reserve(m_size);
+    for (int id = 0; id < m_nodes.size(); ++id) {
+        if (m_used[id])
+            res.append(id);
+    }
+    return res;
+}
+
+void ThreadNodeArena::startJournal()
+{
+    Q_ASSERT(!m_journaling);
+    m_journal = ThreadNodeOverlay(this);
+    m_journaling = true;
+}
+
+ThreadNodeOverlay ThreadNodeArena::takeJournal()
+{
+    Q_ASSERT(m_journaling);
+    m_journaling = false;
+    ThreadNodeOverlay res(this);
+    std::swap(res, m_journal);
+    return res;
+}
+
+/** @short Exchange the nodes of the @arg changes with our own ones
+
+Calling this once again with the same @arg changes puts everything back.
+*/
+void ThreadNodeArena::swapChanges(ThreadNodeOverlay &changes)
+{
+    Q_ASSERT(!m_journaling);
+    ThreadNodeOverlay previous(this);
+    for (auto it = changes.m_nodes.begin(); it != changes.m_nodes.end(); ++it) {
+        if (contains(it.key()))
+            previous.m_nodes.insert(it.key(), std::move(m_nodes[it.key()]));
+        else
+            previous.m_missing.insert(it.key());
+        (*this)[it.key()] = std::move(*it);
+    }
+    Q_FOREACH(const uint id, changes.m_missing) {
+        if (contains(id)) {
+            previous.m_nodes.insert(id, std::move(m_nodes[id]));
+            erase(id);
+        } else {
+            previous.m_missing.insert(id);
+        }
+    }
+    std::swap(changes, previous);
+}
+
 ThreadingMsgListModel::ThreadingMsgListModel(QObject *parent):
     QAbstractProxyModel(parent), threadingHelperLastId(0), modelResetInProgress(false), threadingInFlight(false),
     m_shallBeThreading(false), m_filteredBySearch(false), m_sortTask(0), m_sortReverse(false), m_currentSortingCriteria(SORT_NONE),
-    m_searchValidity(RESULT_INVALIDATED)
+    m_searchValidity(RESULT_INVALIDATED), m_sortingLocally(false), m_localSortCriterium(LOCAL_SORT_ARRIVAL),
+    m_preferLocalThreading(false), m_sortPartialReceived(-1), m_sortPartialTotal(-1), m_sortPartialFromEnd(false),
+    m_sortPartialKnownRows(0)
 {
     m_delayedPrune = new QTimer(this);
     m_delayedPrune->setSingleShot(true);
     m_delayedPrune->setInterval(0);
     connect(m_delayedPrune, &QTimer::timeout, this, &ThreadingMsgListModel::delayedPrune);
+
+    m_delayedLocalSortUpdate = new QTimer(this);
+    m_delayedLocalSortUpdate->setSingleShot(true);
+    m_delayedLocalSortUpdate->setInterval(0);
+    connect(m_delayedLocalSortUpdate, &QTimer::timeout, this, &ThreadingMsgListModel::delayedLocalSortUpdate);
+
+    m_delayedSortPage = new QTimer(this);
+    m_delayedSortPage->setSingleShot(true);
+    m_delayedSortPage->setInterval(0);
+    connect(m_delayedSortPage, &QTimer::timeout, this, &ThreadingMsgListModel::askForSortPage);
+
+    m_delayedLocalThreading = new QTimer(this);
+    m_delayedLocalThreading->setSingleShot(true);
+    m_delayedLocalThreading->setInterval(0);
+    connect(m_delayedLocalThreading, &QTimer::timeout, this, &ThreadingMsgListModel::delayedLocalThreading);
 }
 
 void ThreadingMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
@@ -93,6 +235,7 @@ void ThreadingMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
     threadedRootIds.clear();
     m_currentSortResult.clear();
     m_searchValidity = RESULT_INVALIDATED;
+    cancelLocalSort();
 
     if (this->sourceModel()) {
         // there's already something, so take care to disconnect all signals
@@ -136,6 +279,8 @@ void ThreadingMsgListModel::handleDataChanged(const QModelIndex &topLeft, const
     Q_ASSERT(topLeft.parent() == bottomRight.parent());
     Q_ASSERT(topLeft.row() == bottomRight.row());
     QModelIndex translated = mapFromSource(topLeft);
+    if (translated.isValid())
+        invalidateThreadAggregates(translated.internalId());
 
     emit dataChanged(translated, translated.sibling(translated.row(), bottomRight.column()));
 
@@ -167,6 +312,11 @@ void ThreadingMsgListModel::handleDataChanged(const QModelIndex &topLeft, const
             wantThreading();
         }
     }
+
+    if (m_sortingLocally && message->fetched() && m_provisionalLocalSortKeys.contains(message->uid())) {
+        // The real sort key is known now; there might be more of them, so let's batch the updates
+        m_delayedLocalSortUpdate->start();
+    }
 }
 
 QModelIndex ThreadingMsgListModel::index(int row, int column, const QModelIndex &parent) const
@@ -188,12 +338,17 @@ QModelIndex ThreadingMsgListModel::index(int row, int column, const QModelIndex
 
     uint parentId = parent.isValid() ? parent.internalId() : 0;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(parentId);
-    Q_ASSERT(it != threading.constEnd());
+    const ThreadNodeInfo *it = threading.constFind(parentId);
+    Q_ASSERT(it);
 
     if (it->children.size() <= row)
         return QModelIndex();
 
+    if (parentId == 0 && m_sortPartialReceived > 0 && row + sortPartialMargin >= m_sortPartialKnownRows) {
+        // The view is getting close to the messages whose position is not known yet
+        m_delayedSortPage->start();
+    }
+
     return createIndex(row, column, it->children[row]);
 }
 
@@ -208,12 +363,12 @@ QModelIndex ThreadingMsgListModel::parent(const QModelIndex &index) const
     if (index.row() < 0 || index.column() < 0 || index.column() >= MsgListModel::COLUMN_COUNT)
         return QModelIndex();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(index.internalId());
-    if (node == threading.constEnd())
+    const ThreadNodeInfo *node = threading.constFind(index.internalId());
+    if (!node)
         return QModelIndex();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator parentNode = threading.constFind(node->parent);
-    Q_ASSERT(parentNode != threading.constEnd());
+    const ThreadNodeInfo *parentNode = threading.constFind(node->parent);
+    Q_ASSERT(parentNode);
     Q_ASSERT(parentNode->internalId == node->parent);
 
     if (parentNode->internalId == 0)
@@ -227,7 +382,11 @@ bool ThreadingMsgListModel::hasChildren(const QModelIndex &parent) const
     if (parent.isValid() && parent.column() != 0)
         return false;
 
-    return ! threading.isEmpty() && ! threading.value(parent.internalId()).children.isEmpty();
+    if (threading.isEmpty())
+        return false;
+
+    const ThreadNodeInfo *node = threading.constFind(parent.internalId());
+    return node && !node->children.isEmpty();
 }
 
 int ThreadingMsgListModel::rowCount(const QModelIndex &parent) const
@@ -238,7 +397,8 @@ int ThreadingMsgListModel::rowCount(const QModelIndex &parent) const
     if (parent.isValid() && parent.column() != 0)
         return 0;
 
-    return threading.value(parent.internalId()).children.size();
+    const ThreadNodeInfo *node = threading.constFind(parent.internalId());
+    return node ? node->children.size() : 0;
 }
 
 int ThreadingMsgListModel::columnCount(const QModelIndex &parent) const
@@ -260,8 +420,8 @@ QModelIndex ThreadingMsgListModel::mapToSource(const QModelIndex &proxyIndex) co
     Imap::Mailbox::MsgListModel *msgList = qobject_cast<Imap::Mailbox::MsgListModel *>(sourceModel());
     Q_ASSERT(msgList);
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(proxyIndex.internalId());
-    if (node == threading.constEnd())
+    const ThreadNodeInfo *node = threading.constFind(proxyIndex.internalId());
+    if (!node)
         return QModelIndex();
 
     if (node->ptr) {
@@ -285,12 +445,11 @@ QModelIndex ThreadingMsgListModel::mapFromSource(const QModelIndex &sourceIndex)
 
     const uint internalId = *it;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(internalId);
-    if (node == threading.constEnd()) {
+    const ThreadNodeInfo *node = threading.constFind(internalId);
+    if (!node) {
         // The filtering criteria say that this index shall not be visible
         return QModelIndex();
     }
-    Q_ASSERT(node != threading.constEnd());
 
     return createIndex(node->offset, sourceIndex.column(), internalId);
 }
@@ -300,8 +459,8 @@ QVariant ThreadingMsgListModel::data(const QModelIndex &proxyIndex, int role) co
     if (! proxyIndex.isValid() || proxyIndex.model() != this)
         return QVariant();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(proxyIndex.internalId());
-    Q_ASSERT(it != threading.constEnd());
+    const ThreadNodeInfo *it = threading.constFind(proxyIndex.internalId());
+    Q_ASSERT(it);
 
     if (it->ptr) {
         // It's a real item which exists in the underlying model
@@ -339,8 +498,8 @@ Qt::ItemFlags ThreadingMsgListModel::flags(const QModelIndex &index) const
     if (! index.isValid() || index.model() != this)
         return Qt::NoItemFlags;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(index.internalId());
-    Q_ASSERT(it != threading.constEnd());
+    const ThreadNodeInfo *it = threading.constFind(index.internalId());
+    Q_ASSERT(it);
     if (it->ptr && it->uid)
         return Qt::ItemIsSelectable | Qt::ItemIsDragEnabled | Qt::ItemIsEnabled;
 
@@ -365,10 +524,11 @@ void ThreadingMsgListModel::handleRowsAboutToBeRemoved(const QModelIndex &parent
         }
 
         Q_ASSERT(translated.isValid());
-        QHash<uint,ThreadNodeInfo>::iterator it = threading.find(translated.internalId());
-        Q_ASSERT(it != threading.end());
+        ThreadNodeInfo *it = threading.find(translated.internalId());
+        Q_ASSERT(it);
         it->uid = 0;
         it->ptr = 0;
+        invalidateThreadAggregates(translated.internalId());
     }
 }
 
@@ -383,11 +543,9 @@ void ThreadingMsgListModel::handleRowsRemoved(const QModelIndex &parent, int sta
 
 void ThreadingMsgListModel::delayedPrune()
 {
-    emit layoutAboutToBeChanged();
-    updatePersistentIndexesPhase1();
-    pruneTree();
-    updatePersistentIndexesPhase2();
-    emit layoutChanged();
+    updateTree([this]() {
+        pruneTree();
+    });
 }
 
 void ThreadingMsgListModel::handleRowsAboutToBeInserted(const QModelIndex &parent, int start, int end)
@@ -420,10 +578,12 @@ void ThreadingMsgListModel::handleRowsInserted(const QModelIndex &parent, int st
             threadedRootIds.append(node.internalId);
         }
     }
+    invalidateThreadAggregates(0);
     endInsertRows();
 
     if (!m_sortTask || !m_sortTask->isPersistent()) {
         m_currentSortResult.clear();
+        cancelPartialSort();
         if (m_searchValidity == RESULT_FRESH)
             m_searchValidity = RESULT_INVALIDATED;
     }
@@ -446,6 +606,11 @@ void ThreadingMsgListModel::resetMe()
     threadedRootIds.clear();
     m_currentSortResult.clear();
     m_searchValidity = RESULT_INVALIDATED;
+    cancelLocalSort();
+    cancelPartialSort();
+    m_localThreading.clear();
+    m_incompleteLocalThreading.clear();
+    m_delayedLocalThreading->stop();
     endResetModel();
     updateNoThreading();
     modelResetInProgress = false;
@@ -478,9 +643,6 @@ void ThreadingMsgListModel::updateNoThreading()
     threadedRootIds.clear();
 
     int upstreamMessages = sourceModel()->rowCount();
-    QList<uint> allIds;
-    QHash<uint,ThreadNodeInfo> newThreading;
-    QHash<void *,uint> newPtrToInternal;
 
     if (upstreamMessages) {
         // Prefer the direct pointer access instead of going through the MVC API -- similar to how applyThreading() works.
@@ -495,32 +657,25 @@ void ThreadingMsgListModel::updateNoThreading()
         TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(firstMessagePtr->parent());
         Q_ASSERT(list);
 
-        newThreading.reserve(upstreamMessages + headroomForNewmessages);
-        newPtrToInternal.reserve(upstreamMessages + headroomForNewmessages);
+        threading.reserve(upstreamMessages + 1 + headroomForNewmessages);
+        ptrToInternal.reserve(upstreamMessages + headroomForNewmessages);
 
+        threading[0].ptr = 0;
+        threading[0].children.reserve(upstreamMessages + headroomForNewmessages);
         for (int i = 0; i < upstreamMessages; ++i) {
             TreeItemMessage *ptr = static_cast<TreeItemMessage*>(list->m_children[i]);
             Q_ASSERT(ptr);
-            ThreadNodeInfo node;
-            node.internalId = i + 1;
+            ThreadNodeInfo &node = threading[i + 1];
             node.uid = ptr->uid();
             node.ptr = ptr;
             node.offset = i;
-            newThreading[node.internalId] = node;
-            allIds.append(node.internalId);
-            newPtrToInternal[node.ptr] = node.internalId;
+            ptrToInternal[node.ptr] = node.internalId;
             if (!node.uid) {
                 unknownUids << ptr;
             }
+            threading[0].children.append(node.internalId);
         }
-    }
-
-    if (newThreading.size()) {
-        threading = newThreading;
-        ptrToInternal = newPtrToInternal;
-        threading[ 0 ].children = allIds;
-        threading[ 0 ].ptr = 0;
-        threadingHelperLastId = newThreading.size();
+        threadingHelperLastId = upstreamMessages;
         threadedRootIds = threading[0].children;
     }
     updatePersistentIndexesPhase2();
@@ -665,6 +820,12 @@ void ThreadingMsgListModel::askForThreading(const uint firstUnknownUid)
     Q_ASSERT(realModel);
     QModelIndex mailboxIndex = realIndex.parent().parent();
 
+    if (wantsLocalThreading(realModel)) {
+        // New arrivals and their metadata tend to come in bursts, so let's rebuild the threads just once for all of them
+        m_delayedLocalThreading->start();
+        return;
+    }
+
     if (realModel->capabilities().contains(QStringLiteral("THREAD=REFS"))) {
         requestedAlgorithm = "REFS";
     } else if (realModel->capabilities().contains(QStringLiteral("THREAD=REFERENCES"))) {
@@ -723,42 +884,36 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
             findMessagesByUids(static_cast<TreeItemMailbox*>(mailboxIndex.internalPointer()), affectedUids);
     QHash<uint,void *> uidToPtrCache;
 
-
-    emit layoutAboutToBeChanged();
-    updatePersistentIndexesPhase1();
-    for (QList<TreeItemMessage*>::const_iterator it = affectedMessages.constBegin(); it != affectedMessages.constEnd(); ++it) {
-        QHash<void *,uint>::const_iterator ptrMappingIt = ptrToInternal.constFind(*it);
-        Q_ASSERT(ptrMappingIt != ptrToInternal.constEnd());
-        QHash<uint,ThreadNodeInfo>::iterator threadIt = threading.find(*ptrMappingIt);
-        Q_ASSERT(threadIt != threading.end());
-        uidToPtrCache[(*it)->uid()] = threadIt->ptr;
-        threadIt->ptr = 0;
-    }
-    pruneTree();
-    updatePersistentIndexesPhase2();
-    emit layoutChanged();
-
-    // Second phase: for each message whose UID is returned by the server, update the threading data
-    QSet<uint> usedNodes;
-    emit layoutAboutToBeChanged();
-    updatePersistentIndexesPhase1();
-    for (Responses::ESearch::IncrementalThreadingData_t::const_iterator it = data.constBegin(); it != data.constEnd(); ++it) {
-        registerThreading(it->thread, 0, uidToPtrCache, usedNodes);
-        int actualOffset = threading[0].children.size() - 1;
-        int expectedOffsetOfPrevious = threading[0].children.indexOf(it->previousThreadRoot);
-        if (actualOffset == expectedOffsetOfPrevious + 1) {
-            // it's on the correct position, yay!
-        } else {
-            // move the new subthread to a correct place
-            threading[0].children.insert(expectedOffsetOfPrevious + 1, threading[0].children.takeLast());
-            // push the rest (including the new arrival) forward
-            for (int i = expectedOffsetOfPrevious + 1; i < threading[0].children.size(); ++i) {
-                threading[threading[0].children[i]].offset = i;
+    // Both phases work on the tree as a whole, the views only get to see the final difference
+    updateTree([this, &data, &affectedMessages, &uidToPtrCache]() {
+        for (QList<TreeItemMessage*>::const_iterator it = affectedMessages.constBegin(); it != affectedMessages.constEnd(); ++it) {
+            QHash<void *,uint>::const_iterator ptrMappingIt = ptrToInternal.constFind(*it);
+            Q_ASSERT(ptrMappingIt != ptrToInternal.constEnd());
+            ThreadNodeInfo *threadIt = threading.find(*ptrMappingIt);
+            Q_ASSERT(threadIt);
+            uidToPtrCache[(*it)->uid()] = threadIt->ptr;
+            threadIt->ptr = 0;
+        }
+        pruneTree();
+
+        // Second phase: for each message whose UID is returned by the server, update the threading data
+        QVector<bool> usedNodes;
+        for (Responses::ESearch::IncrementalThreadingData_t::const_iterator it = data.constBegin(); it != data.constEnd(); ++it) {
+            registerThreading(it->thread, 0, uidToPtrCache, usedNodes);
+            int actualOffset = threading[0].children.size() - 1;
+            int expectedOffsetOfPrevious = threading[0].children.indexOf(it->previousThreadRoot);
+            if (actualOffset == expectedOffsetOfPrevious + 1) {
+                // it's on the correct position, yay!
+            } else {
+                // move the new subthread to a correct place
+                threading[0].children.insert(expectedOffsetOfPrevious + 1, threading[0].children.takeLast());
+                // push the rest (including the new arrival) forward
+                for (int i = expectedOffsetOfPrevious + 1; i < threading[0].children.size(); ++i) {
+                    threading[threading[0].children[i]].offset = i;
+                }
             }
         }
-    }
-    updatePersistentIndexesPhase2();
-    emit layoutChanged();
+    });
 }
 
 void ThreadingMsgListModel::slotIncrementalThreadingFailed()
@@ -840,12 +995,57 @@ void ThreadingMsgListModel::slotSortingAvailable(const Imap::Uids &uids)
         m_sortTask = 0;
     }
 
+    cancelPartialSort();
     m_currentSortResult = uids;
     if (m_searchValidity == RESULT_ASKED)
         m_searchValidity = RESULT_FRESH;
     wantThreading();
 }
 
+void ThreadingMsgListModel::slotPartialSortingAvailable(const Imap::Uids &uids, const int total)
+{
+    disconnect(m_sortTask.data(), nullptr, this, nullptr);
+    m_sortTask = 0;
+
+    if (m_sortPartialReceived < 0) {
+        // We're no longer interested in a partial result
+        return;
+    }
+
+    if (m_sortPartialReceived == 0) {
+        // The first window replaces whatever we have shown until now
+        m_currentSortResult.clear();
+        m_currentSortResult.reserve(uids.size() + headroomForNewmessages);
+    }
+
+    // An expunge in between the windows shifts the positions, so the same UID might be reported twice
+    QSet<uint> alreadyKnown(m_currentSortResult.constBegin(), m_currentSortResult.constEnd());
+    Imap::Uids window;
+    window.reserve(uids.size());
+    Q_FOREACH(const uint uid, uids) {
+        if (!alreadyKnown.contains(uid))
+            window << uid;
+    }
+    if (m_sortPartialFromEnd) {
+        // The window is counted from the end of the result, but its items are still in the natural order
+        m_currentSortResult = window + m_currentSortResult;
+    } else {
+        m_currentSortResult += window;
+    }
+
+    m_sortPartialReceived += uids.size();
+    if (total >= 0)
+        m_sortPartialTotal = total;
+    if (uids.size() < sortPartialPageSize || (m_sortPartialTotal >= 0 && m_sortPartialReceived >= m_sortPartialTotal)) {
+        // That was the last window, so the order is fully known now
+        cancelPartialSort();
+    }
+
+    if (m_searchValidity == RESULT_ASKED)
+        m_searchValidity = RESULT_FRESH;
+    wantThreading();
+}
+
 void ThreadingMsgListModel::slotSortingFailed()
 {
     disconnect(m_sortTask.data(), &SortTask::sortingAvailable, this, &ThreadingMsgListModel::slotSortingAvailable);
@@ -854,6 +1054,7 @@ void ThreadingMsgListModel::slotSortingFailed()
 
     m_sortTask = 0;
     m_sortReverse = false;
+    cancelPartialSort();
     calculateNullSort();
     applySort();
     emit sortingFailed();
@@ -914,8 +1115,8 @@ void ThreadingMsgListModel::calculateNullSort()
     m_currentSortResult.clear();
     m_currentSortResult.reserve(threadedRootIds.size() + headroomForNewmessages);
     Q_FOREACH(const uint internalId, threadedRootIds) {
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(internalId);
-        if (it == threading.constEnd())
+        const ThreadNodeInfo *it = threading.constFind(internalId);
+        if (!it)
             continue;
         if (it->uid)
             m_currentSortResult.append(it->uid);
@@ -931,10 +1132,19 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
         return;
     }
 
-    emit layoutAboutToBeChanged();
+    // Usually, only a handful of messages change their place, so let's tell the views just about these
+    updateTree([this, &mapping]() {
+        buildThreading(mapping);
+    });
+    if (rowCount())
+        threadedRootIds = threading[0].children;
 
-    updatePersistentIndexesPhase1();
+    // If the sorting was active before, we shall reactivate it now
+    searchSortPreferenceImplementation(m_currentSearchConditions, m_currentSortingCriteria, m_sortReverse ? Qt::DescendingOrder : Qt::AscendingOrder);
+}
 
+void ThreadingMsgListModel::buildThreading(const QVector<Imap::Responses::ThreadingNode> &mapping)
+{
     threading.clear();
     ptrToInternal.clear();
     // Default-construct the root node
@@ -945,7 +1155,7 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
     // for each UID individually (remember, the THREAD response might contain UIDs in crazy order).
     int upstreamMessages = sourceModel()->rowCount();
     QHash<uint,void *> uidToPtrCache;
-    QSet<uint> usedNodes;
+    QVector<bool> usedNodes;
     uidToPtrCache.reserve(upstreamMessages + headroomForNewmessages);
     threading.reserve(upstreamMessages + headroomForNewmessages);
     ptrToInternal.reserve(upstreamMessages + headroomForNewmessages);
@@ -963,52 +1173,44 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
         TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(firstMessagePtr->parent());
         Q_ASSERT(list);
         for (int i = 0; i < upstreamMessages; ++i) {
-            ThreadNodeInfo node;
-            node.uid = dynamic_cast<TreeItemMessage *>(list->m_children[i])->uid();
-            if (! node.uid) {
+            const uint uid = static_cast<TreeItemMessage *>(list->m_children[i])->uid();
+            if (! uid) {
                 throw UnknownMessageIndex("Encountered a message with zero UID when threading. This is a bug in Trojita, sorry.");
             }
 
-            node.internalId = i + 1;
+            // We're creating a new node here
+            Q_ASSERT(!threading.contains(i + 1));
+            ThreadNodeInfo &node = threading[i + 1];
+            node.uid = uid;
             node.ptr = list->m_children[i];
             uidToPtrCache[node.uid] = node.ptr;
             threadingHelperLastId = node.internalId;
-            // We're creating a new node here
-            Q_ASSERT(!threading.contains(node.internalId));
-            threading[ node.internalId ] = node;
             ptrToInternal[ node.ptr ] = node.internalId;
         }
     }
 
     // Mark the root node as always present
-    usedNodes.insert(0);
+    usedNodes.fill(false, threading.idLimit());
+    usedNodes[0] = true;
 
     // Set up parents and find the list of all used nodes
     registerThreading(mapping, 0, uidToPtrCache, usedNodes);
 
     // Now remove all messages which were not referenced in the THREAD response from our mapping
-    QHash<uint,ThreadNodeInfo>::iterator it = threading.begin();
-    while (it != threading.end()) {
-        if (usedNodes.contains(it.key())) {
+    for (uint id = 0; id < threading.idLimit(); ++id) {
+        const ThreadNodeInfo *node = threading.constFind(id);
+        if (!node || (static_cast<int>(id) < usedNodes.size() && usedNodes[id])) {
             // this message should be shown
-            ++it;
-        } else {
-            // this message is not included in the list of messages actually to be shown
-            ptrToInternal.remove(it->ptr);
-            it = threading.erase(it);
+            continue;
         }
+        // this message is not included in the list of messages actually to be shown
+        ptrToInternal.remove(node->ptr);
+        threading.erase(id);
     }
     pruneTree();
-    updatePersistentIndexesPhase2();
-    if (rowCount())
-        threadedRootIds = threading[0].children;
-    emit layoutChanged();
-
-    // If the sorting was active before, we shall reactivate it now
-    searchSortPreferenceImplementation(m_currentSearchConditions, m_currentSortingCriteria, m_sortReverse ? Qt::DescendingOrder : Qt::AscendingOrder);
 }
 
-void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::ThreadingNode> &mapping, uint parentId, const QHash<uint,void *> &uidToPtr, QSet<uint> &usedNodes)
+void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::ThreadingNode> &mapping, uint parentId, const QHash<uint,void *> &uidToPtr, QVector<bool> &usedNodes)
 {
     Q_FOREACH(const Imap::Responses::ThreadingNode &node, mapping) {
         uint nodeId;
@@ -1021,13 +1223,10 @@ void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::Thr
             // We cannot just ignore this node, though, because it might have some children which we would otherwise
             // simply hide.
             // The ptrIt which is initialized by the condition is used in the else branch.
-            ThreadNodeInfo fake;
-            fake.internalId = ++threadingHelperLastId;
-            fake.parent = parentId;
             Q_ASSERT(threading.contains(parentId));
+            nodeId = ++threadingHelperLastId;
             // The child will be registered to the list of parent's children after the if/else branch
-            threading[ fake.internalId ] = fake;
-            nodeId = fake.internalId;
+            threading[nodeId].parent = parentId;
         } else {
             QHash<void *,uint>::const_iterator nodeIt = ptrToInternal.constFind(*ptrIt);
             // The following assert would fail if there was a node with a valid UID, but not in our ptrToInternal mapping.
@@ -1037,10 +1236,13 @@ void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::Thr
             // This is needed for the incremental stuff
             threading[nodeId].ptr = static_cast<TreeItem*>(*ptrIt);
         }
-        threading[nodeId].offset = threading[parentId].children.size();
-        threading[ parentId ].children.append(nodeId);
-        threading[ nodeId ].parent = parentId;
-        usedNodes.insert(nodeId);
+        ThreadNodeInfo &parentNode = threading[parentId];
+        threading[nodeId].offset = parentNode.children.size();
+        threading[nodeId].parent = parentId;
+        parentNode.children.append(nodeId);
+        if (usedNodes.size() <= static_cast<int>(nodeId))
+            usedNodes.resize(nodeId + 1);
+        usedNodes[nodeId] = true;
         registerThreading(node.children, nodeId, uidToPtr, usedNodes);
     }
 }
@@ -1079,8 +1281,8 @@ void ThreadingMsgListModel::updatePersistentIndexesPhase2()
             updatedIndexes.append(QModelIndex());
             continue;
         }
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(*ptrIt);
-        if (it == threading.constEnd()) {
+        const ThreadNodeInfo *it = threading.constFind(*ptrIt);
+        if (!it) {
             // Filtering doesn't accept this index, let's declare it dead
             updatedIndexes.append(QModelIndex());
         } else {
@@ -1093,44 +1295,363 @@ void ThreadingMsgListModel::updatePersistentIndexesPhase2()
     oldPtrs.clear();
 }
 
+/** @short Mark the longest increasing subsequence of the non-negative items; the negative ones are never a part of it */
+static QVector<bool> longestIncreasingSubsequence(const QVector<int> &values)
+{
+    // Indexes of the smallest possible last items of increasing subsequences of length i + 1
+    QVector<int> tails;
+    QVector<int> previous(values.size(), -1);
+    for (int i = 0; i < values.size(); ++i) {
+        if (values[i] < 0)
+            continue;
+        auto pos = std::lower_bound(tails.begin(), tails.end(), values[i], [&values](const int index, const int value) {
+            return values[index] < value;
+        });
+        if (pos != tails.begin())
+            previous[i] = *(pos - 1);
+        if (pos == tails.end())
+            tails.append(i);
+        else
+            *pos = i;
+    }
+    QVector<bool> res(values.size(), false);
+    for (int i = tails.isEmpty() ? -1 : tails.last(); i >= 0; i = previous[i])
+        res[i] = true;
+    return res;
+}
+
+void ThreadingMsgListModel::updateTree(const std::function<void()> &rebuild)
+{
+    // The mapping is implicitly shared, so this is only copied if the rebuild changes it
+    QHash<void *,uint> targetPtrToInternal = ptrToInternal;
+    const uint currentLastId = threadingHelperLastId;
+    std::swap(ptrToInternal, targetPtrToInternal);
+    threading.startJournal();
+    rebuild();
+    ThreadNodeOverlay target = threading.takeJournal();
+    std::swap(ptrToInternal, targetPtrToInternal);
+    // The threading is back to what the views know about, and the target only holds the nodes which the rebuild touched
+    threading.swapChanges(target);
+    const uint targetLastId = threadingHelperLastId;
+    threadingHelperLastId = currentLastId;
+
+    const QSet<uint> changed = changedSubtrees(target);
+    if (changed.isEmpty())
+        return;
+
+    if (threading.isEmpty() || countTreeChanges(target, changed) > incrementalTreeUpdateLimit) {
+        emit layoutAboutToBeChanged();
+        updatePersistentIndexesPhase1();
+        threading.swapChanges(target);
+        std::swap(ptrToInternal, targetPtrToInternal);
+        threadingHelperLastId = targetLastId;
+        invalidateAllThreadAggregates();
+        updatePersistentIndexesPhase2();
+        emit layoutChanged();
+    } else {
+        // Nodes added from now on must not be confused with the new nodes of the target
+        threadingHelperLastId = qMax(currentLastId, targetLastId);
+        morphTree(target, changed);
+    }
+}
+
+QSet<uint> ThreadingMsgListModel::changedSubtrees(const ThreadNodeOverlay &target) const
+{
+    QSet<uint> res;
+    Q_FOREACH(const uint id, target.changedIds()) {
+        const ThreadNodeInfo *node = target.constFind(id);
+        const ThreadNodeInfo *current = threading.constFind(id);
+        if (current && current->ptr == node->ptr && current->children == node->children) {
+            // Just a new offset or stale aggregates, the subtree is still the same
+            continue;
+        }
+        // All ancestors are affected as well
+        uint up = id;
+        while (!res.contains(up)) {
+            res.insert(up);
+            if (!up)
+                break;
+            up = target.constFind(up)->parent;
+        }
+    }
+    return res;
+}
+
+uint ThreadingMsgListModel::currentNodeFor(void *ptr) const
+{
+    if (!ptr)
+        return 0;
+    QHash<void *,uint>::const_iterator it = ptrToInternal.constFind(ptr);
+    if (it == ptrToInternal.constEnd())
+        return 0;
+    // The mapping is not cleaned up eagerly, so it might point to a node which no longer shows this message
+    const ThreadNodeInfo *node = threading.constFind(*it);
+    return node && node->ptr == ptr ? *it : 0;
+}
+
+uint ThreadingMsgListModel::currentNodeFor(const ThreadNodeOverlay &target, const uint targetId) const
+{
+    const ThreadNodeInfo *targetNode = target.constFind(targetId);
+    Q_ASSERT(targetNode);
+    if (targetNode->ptr)
+        return currentNodeFor(targetNode->ptr);
+
+    // The IDs are never reused, so a placeholder which has survived the rebuild is still there under the same ID
+    const ThreadNodeInfo *node = threading.constFind(targetId);
+    if (node && !node->ptr)
+        return targetId;
+
+    // A new placeholder can take the place of an old one which is sitting just as high above the same message
+    int placeholders = 0;
+    TreeItem *first = firstMessageBelow(target, targetId, placeholders);
+    uint id = currentNodeFor(first);
+    for (; id && placeholders; --placeholders) {
+        id = threading.constFind(id)->parent;
+        node = threading.constFind(id);
+        if (!id || node->ptr)
+            return 0;
+    }
+    if (!id)
+        return 0;
+    const ThreadNodeInfo *sameId = target.constFind(id);
+    if (sameId && !sameId->ptr) {
+        // That one is still a placeholder in the target tree as well, so it's taken
+        return 0;
+    }
+    int unused = 0;
+    return firstMessageBelow(threading, id, unused) == first ? id : 0;
+}
+
+int ThreadingMsgListModel::countTreeChanges(const ThreadNodeOverlay &target, const QSet<uint> &changed) const
+{
+    int changes = 0;
+    QSet<uint> matched;
+    QVector<uint> currentParents;
+    // Target IDs of nodes to visit, along with IDs of their current counterparts (or -1 for new nodes)
+    QVector<QPair<uint, qint64>> queue;
+    queue << qMakePair(0u, qint64(0));
+    for (int i = 0; i < queue.size(); ++i) {
+        const ThreadNodeInfo *targetParent = target.constFind(queue[i].first);
+        Q_ASSERT(targetParent);
+        if (queue[i].second >= 0)
+            currentParents << static_cast<uint>(queue[i].second);
+        QVector<int> positions;
+        positions.reserve(targetParent->children.size());
+        Q_FOREACH(const uint childId, targetParent->children) {
+            const uint id = currentNodeFor(target, childId);
+            const ThreadNodeInfo *node = id ? threading.constFind(id) : nullptr;
+            if (node)
+                matched.insert(id);
+            positions << (node && static_cast<qint64>(node->parent) == queue[i].second ? node->offset : -1);
+            if (!node || id != childId || changed.contains(childId)) {
+                // Nothing has changed below the untouched nodes
+                queue << qMakePair(childId, node ? qint64(id) : qint64(-1));
+            }
+        }
+        // Whatever is not a part of the longest sequence which is already in a correct order will have to be touched
+        changes += longestIncreasingSubsequence(positions).count(false);
+    }
+    // Everything else which used to be in the visited parts of the tree is going away
+    Q_FOREACH(const uint parentId, currentParents) {
+        Q_FOREACH(const uint childId, threading.constFind(parentId)->children) {
+            if (!matched.contains(childId))
+                ++changes;
+        }
+    }
+    return changes;
+}
+
+void ThreadingMsgListModel::morphTree(const ThreadNodeOverlay &target, const QSet<uint> &changed)
+{
+    // Nodes from the target tree are processed from the top, so that the parents are always in place before their children.
+    // Once all children of a parent are placed, any leftovers are at the end of its list of children, so these are removed
+    // at the very end when nothing can be moved out of them anymore. Subtrees which the rebuild has not changed are skipped.
+    QVector<uint> queue;
+    QVector<int> wantedCounts;
+    QHash<uint, uint> targetToCurrent;
+    queue << 0;
+    targetToCurrent[0] = 0;
+    for (int i = 0; i < queue.size(); ++i) {
+        const ThreadNodeInfo *targetParent = target.constFind(queue[i]);
+        Q_ASSERT(targetParent);
+        const uint parentId = targetToCurrent[queue[i]];
+        // The untouched nodes of the target are looked up in the current tree, so this has to be a copy
+        const QVector<uint> wanted = targetParent->children;
+        wantedCounts << wanted.size();
+
+        QVector<uint> currentIds;
+        QVector<int> positions;
+        currentIds.reserve(wanted.size());
+        positions.reserve(wanted.size());
+        Q_FOREACH(const uint childId, wanted) {
+            const uint id = currentNodeFor(target, childId);
+            const ThreadNodeInfo *node = id ? threading.constFind(id) : nullptr;
+            currentIds << id;
+            positions << (node && node->parent == parentId ? node->offset : -1);
+        }
+        // These children are already in the right order, so everything else gets moved around them
+        const QVector<bool> stable = longestIncreasingSubsequence(positions);
+
+        for (int row = 0; row < wanted.size(); ++row) {
+            uint id = currentIds[row];
+            if (stable[row]) {
+                // Whatever is in front of this node is either coming later, or shall not be here at all
+                const int offset = threading.constFind(id)->offset;
+                Q_ASSERT(offset >= row);
+                if (offset > row) {
+                    moveThreadNodes(parentId, row, offset - 1, parentId, threading.constFind(parentId)->children.size());
+                }
+            } else if (id) {
+                const ThreadNodeInfo *node = threading.constFind(id);
+                if (node->parent != parentId || node->offset != row) {
+                    moveThreadNodes(node->parent, node->offset, node->offset, parentId, row);
+                }
+            } else {
+                const ThreadNodeInfo *targetNode = target.constFind(wanted[row]);
+                id = insertThreadNode(parentId, row, targetNode->ptr, targetNode->uid);
+            }
+            Q_ASSERT(threading.constFind(parentId)->children[row] == id);
+            if (id != wanted[row] || changed.contains(wanted[row])) {
+                targetToCurrent[wanted[row]] = id;
+                queue << wanted[row];
+            }
+        }
+    }
+
+    for (int i = 0; i < queue.size(); ++i) {
+        const uint parentId = targetToCurrent[queue[i]];
+        const int currentCount = threading.constFind(parentId)->children.size();
+        if (currentCount > wantedCounts[i]) {
+            removeThreadNodes(parentId, wantedCounts[i], currentCount - 1);
+        }
+    }
+}
+
+QModelIndex ThreadingMsgListModel::indexForNode(const uint internalId) const
+{
+    if (!internalId)
+        return QModelIndex();
+    const ThreadNodeInfo *node = threading.constFind(internalId);
+    Q_ASSERT(node);
+    return createIndex(node->offset, 0, internalId);
+}
+
+void ThreadingMsgListModel::renumberThreadChildren(const uint parentId, const int from)
+{
+    const ThreadNodeInfo *parent = threading.constFind(parentId);
+    Q_ASSERT(parent);
+    for (int i = from; i < parent->children.size(); ++i) {
+        ThreadNodeInfo *child = threading.find(parent->children[i]);
+        Q_ASSERT(child);
+        child->offset = i;
+    }
+}
+
+uint ThreadingMsgListModel::insertThreadNode(const uint parentId, const int row, TreeItem *ptr, const uint uid)
+{
+    beginInsertRows(indexForNode(parentId), row, row);
+    const uint id = ++threadingHelperLastId;
+    ThreadNodeInfo &node = threading[id];
+    node.uid = uid;
+    node.ptr = ptr;
+    node.parent = parentId;
+    if (ptr)
+        ptrToInternal[ptr] = id;
+    threading.find(parentId)->children.insert(row, id);
+    renumberThreadChildren(parentId, row);
+    invalidateThreadAggregates(parentId);
+    endInsertRows();
+    return id;
+}
+
+void ThreadingMsgListModel::moveThreadNodes(const uint sourceParentId, const int first, const int last,
+                                            const uint destinationParentId, int destinationRow)
+{
+    if (!beginMoveRows(indexForNode(sourceParentId), first, last, indexForNode(destinationParentId), destinationRow)) {
+        Q_ASSERT(false);
+        return;
+    }
+    ThreadNodeInfo *source = threading.find(sourceParentId);
+    Q_ASSERT(source);
+    const QVector<uint> moved = source->children.mid(first, last - first + 1);
+    source->children.remove(first, moved.size());
+    if (sourceParentId == destinationParentId && destinationRow > first) {
+        // The row number refers to the state before the move
+        destinationRow -= moved.size();
+    }
+    ThreadNodeInfo *destination = threading.find(destinationParentId);
+    Q_ASSERT(destination);
+    destination->children.insert(destinationRow, moved.size(), 0);
+    std::copy(moved.constBegin(), moved.constEnd(), destination->children.begin() + destinationRow);
+    Q_FOREACH(const uint id, moved) {
+        threading.find(id)->parent = destinationParentId;
+    }
+    renumberThreadChildren(sourceParentId, sourceParentId == destinationParentId ? qMin(first, destinationRow) : first);
+    if (sourceParentId != destinationParentId)
+        renumberThreadChildren(destinationParentId, destinationRow);
+    invalidateThreadAggregates(sourceParentId);
+    invalidateThreadAggregates(destinationParentId);
+    endMoveRows();
+}
+
+void ThreadingMsgListModel::removeThreadNodes(const uint parentId, const int first, const int last)
+{
+    beginRemoveRows(indexForNode(parentId), first, last);
+    ThreadNodeInfo *parent = threading.find(parentId);
+    Q_ASSERT(parent);
+    QVector<uint> queue = parent->children.mid(first, last - first + 1);
+    parent->children.remove(first, queue.size());
+    for (int i = 0; i < queue.size(); ++i) {
+        const ThreadNodeInfo *node = threading.constFind(queue[i]);
+        Q_ASSERT(node);
+        queue += node->children;
+        if (node->ptr && ptrToInternal.value(node->ptr) == queue[i])
+            ptrToInternal.remove(node->ptr);
+        threading.erase(queue[i]);
+    }
+    renumberThreadChildren(parentId, first);
+    invalidateThreadAggregates(parentId);
+    endRemoveRows();
+}
+
 void ThreadingMsgListModel::pruneTree()
 {
-    // Our mapping (threading) is completely unsorted, which means that we simply don't have any way of walking the tree from
-    // the top. Instead, we got to work with a random walk, processing nodes in an unspecified order.  If we iterated on the QHash
-    // directly, we'd hit an issue with iterator ordering (basically, we want to be able to say "hey, I don't care at which point
-    // of the iteration I'm right now, the next node to process should be that one, and then we should resume with the rest").
-    QList<uint> pending = threading.keys();
+    // Our mapping (threading) is not sorted by the tree structure, which means that we simply don't have any way of walking the
+    // tree from the top. Instead, we got to work with a random walk, processing nodes in the order of their IDs. We want to be
+    // able to say "hey, I don't care at which point of the iteration I'm right now, the next node to process should be that one,
+    // and then we should resume with the rest", which is why we work on a copy of the list of IDs.
+    QVector<uint> pending = threading.keys();
 
     // These are the parents whose children will have to be renumbered later on
     QSet<uint> parentsForRenumbering;
 
-    for (QList<uint>::iterator id = pending.begin(); id != pending.end(); /* nothing */) {
-        // Convert to the hashmap
-        // The "it" iterator point to the current node in the threading mapping
-        QHash<uint, ThreadNodeInfo>::iterator it = threading.find(*id);
-        if (it == threading.end()) {
+    for (QVector<uint>::iterator id = pending.begin(); id != pending.end(); /* nothing */) {
+        // Only look at the node for now; the journal of updateTree() shall only get the nodes which actually change
+        const ThreadNodeInfo *node = threading.constFind(*id);
+        if (!node) {
             // We've already seen this node, that's due to promoting
             ++id;
             continue;
         }
 
-        if (it->internalId == 0) {
+        if (node->internalId == 0) {
             // A special root item; we should not delete that one :)
             ++id;
             continue;
         }
-        if (it->ptr) {
+        if (node->ptr) {
             // regular and valid message -> skip
             ++id;
         } else {
-            // a fake one
+            // a fake one, so it is going to change
+            ThreadNodeInfo *it = threading.find(*id);
 
             // each node has a parent
-            QHash<uint, ThreadNodeInfo>::iterator parent = threading.find(it->parent);
-            Q_ASSERT(parent != threading.end());
+            ThreadNodeInfo *parent = threading.find(it->parent);
+            Q_ASSERT(parent);
 
             // and the node itself has to be found in its parent's children
-            QList<uint>::iterator childIt = std::find(parent->children.begin(), parent->children.end(), it->internalId);
+            QVector<uint>::iterator childIt = std::find(parent->children.begin(), parent->children.end(), it->internalId);
             Q_ASSERT(childIt != parent->children.end());
             // The offset of this child might no longer be correct, though -- we're postponing the actual deletion until later
 
@@ -1144,18 +1665,18 @@ void ThreadingMsgListModel::pruneTree()
                 if (it->parent == 0) {
                     threadedRootIds.removeOne(it->internalId);
                 }
-                threading.erase(it);
+                threading.erase(it->internalId);
                 ++id;
 
             } else {
                 // This node has some children, so we can't just delete it. Instead of that, we promote its first child
                 // to replace this node.
-                QHash<uint, ThreadNodeInfo>::iterator replaceWith = threading.find(it->children.first());
-                Q_ASSERT(replaceWith != threading.end());
+                ThreadNodeInfo *replaceWith = threading.find(it->children.first());
+                Q_ASSERT(replaceWith);
 
                 // The offsets will, again, be updated later on
                 parentsForRenumbering.insert(it->parent);
-                parentsForRenumbering.insert(replaceWith.key());
+                parentsForRenumbering.insert(replaceWith->internalId);
                 parentsForRenumbering.remove(it->internalId);
 
                 // Replace the node
@@ -1168,26 +1689,26 @@ void ThreadingMsgListModel::pruneTree()
 
                 // Fix parent information of all children of the replacement node
                 for (int i = 0; i < replaceWith->children.size(); ++i) {
-                    QHash<uint, ThreadNodeInfo>::iterator sibling = threading.find(replaceWith->children[i]);
-                    Q_ASSERT(sibling != threading.end());
-                    sibling->parent = replaceWith.key();
+                    ThreadNodeInfo *sibling = threading.find(replaceWith->children[i]);
+                    Q_ASSERT(sibling);
+                    sibling->parent = replaceWith->internalId;
                 }
 
                 if (parent->internalId == 0) {
                     // Update the list of all thread roots
-                    QList<uint>::iterator rootIt = std::find(threadedRootIds.begin(), threadedRootIds.end(), it->internalId);
+                    QVector<uint>::iterator rootIt = std::find(threadedRootIds.begin(), threadedRootIds.end(), it->internalId);
                     if (rootIt != threadedRootIds.end())
                         *rootIt = replaceWith->internalId;
                 }
 
                 // Now that all references are gone, remove the original node
-                threading.erase(it);
+                threading.erase(it->internalId);
 
                 if (!replaceWith->ptr) {
                     // If the just-promoted item is also a fake one, we'll have to visit it as well. This assignment is safe,
                     // because we've already processed the current item and are completely done with it. The worst which can
                     // happen is that we'll visit the same node twice, which is reasonably acceptable.
-                    *id = replaceWith.key();
+                    *id = replaceWith->internalId;
                 }
             }
         }
@@ -1196,14 +1717,16 @@ void ThreadingMsgListModel::pruneTree()
     // Now fix the sequential numbering of all siblings of deleted children
     Q_FOREACH(const auto parentId, parentsForRenumbering) {
         auto parentIt = threading.constFind(parentId);
-        Q_ASSERT(parentIt != threading.constEnd());
+        Q_ASSERT(parentIt);
         int offset = 0;
         for (auto childNumber = parentIt->children.constBegin(); childNumber != parentIt->children.constEnd(); ++childNumber, ++offset) {
-            auto childIt = threading.find(*childNumber);
-            Q_ASSERT(childIt != threading.end());
-            childIt->offset = offset;
+            Q_ASSERT(threading.contains(*childNumber));
+            if (threading.constFind(*childNumber)->offset != offset)
+                threading.find(*childNumber)->offset = offset;
         }
     }
+
+    invalidateAllThreadAggregates();
 }
 
 QStringList ThreadingMsgListModel::supportedCapabilities()
@@ -1228,61 +1751,81 @@ QMimeData *ThreadingMsgListModel::mimeData(const QModelIndexList &indexes) const
     return sourceModel()->mimeData(translated);
 }
 
-template<typename T>
-bool threadForeachCallback(std::function<T(const TreeItemMessage &)> callback, const TreeItemMessage &message)
+const ThreadNodeInfo &ThreadingMsgListModel::threadAggregates(const uint root) const
 {
-    callback(message);
-    return false;
+    const ThreadNodeInfo *rootNode = threading.constFind(root);
+    Q_ASSERT(rootNode);
+    if (rootNode->aggregatesValid)
+        return *rootNode;
+
+    // Visit the stale part of the subtree in a pre-order; going through that list backwards then makes sure
+    // that all children are done before their parent. Valid nodes have their whole subtree valid, too.
+    QVector<uint> stale;
+    stale.append(root);
+    for (int i = 0; i < stale.size(); ++i) {
+        const ThreadNodeInfo *node = threading.constFind(stale[i]);
+        Q_ASSERT(node);
+        Q_FOREACH(const uint childId, node->children) {
+            const ThreadNodeInfo *child = threading.constFind(childId);
+            Q_ASSERT(child);
+            if (!child->aggregatesValid)
+                stale.append(childId);
+        }
+    }
+
+    for (int i = stale.size() - 1; i >= 0; --i) {
+        const ThreadNodeInfo *node = threading.constFind(stale[i]);
+        node->unreadInSubtree = 0;
+        node->flagsInSubtree.clear();
+        if (node->ptr) {
+            // Because of the delayed delete via pruneTree, there could be nodes without a message
+            const TreeItemMessage *message = static_cast<const TreeItemMessage *>(node->ptr);
+            if (!message->isMarkedAsRead())
+                ++node->unreadInSubtree;
+            node->flagsInSubtree = message->m_flags;
+        }
+        Q_FOREACH(const uint childId, node->children) {
+            const ThreadNodeInfo *child = threading.constFind(childId);
+            node->unreadInSubtree += child->unreadInSubtree;
+            node->flagsInSubtree += child->flagsInSubtree;
+        }
+        if (!node->children.isEmpty())
+            node->flagsInSubtree.removeDuplicates();
+        node->aggregatesValid = true;
+    }
+    return *rootNode;
 }
-template<>
-bool threadForeachCallback<const bool>(std::function<const bool(const TreeItemMessage &)> callback, const TreeItemMessage &message)
+
+void ThreadingMsgListModel::invalidateThreadAggregates(uint internalId)
 {
-    return callback(message);
+    while (const ThreadNodeInfo *node = threading.constFind(internalId)) {
+        if (!node->aggregatesValid) {
+            // All ancestors of a stale node are stale as well
+            break;
+        }
+        node->aggregatesValid = false;
+        if (!internalId)
+            break;
+        internalId = node->parent;
+    }
 }
 
-/** @short Execute the provided function once for each message
-
-Returns immediately if the provided function returns `true`.
-*/
-template<typename T>
-void ThreadingMsgListModel::threadForeach(const uint &root, std::function<T(const TreeItemMessage &)> callback) const
-{
-    QList<uint> queue;
-    queue.append(root);
-    while (! queue.isEmpty()) {
-        uint current = queue.takeFirst();
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(current);
-        Q_ASSERT(it != threading.constEnd());
-        if (it->ptr) {
-            // Because of the delayed delete via pruneTree, we can hit a null pointer here
-            TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(it->ptr);
-            Q_ASSERT(message);
-            if (threadForeachCallback(callback, *message))
-                return;
-        }
-        queue.append(it->children);
+void ThreadingMsgListModel::invalidateAllThreadAggregates()
+{
+    for (uint id = 0; id < threading.idLimit(); ++id) {
+        if (const ThreadNodeInfo *node = threading.constFind(id))
+            node->aggregatesValid = false;
     }
 }
 
 bool ThreadingMsgListModel::threadContainsUnreadMessages(const uint root) const
 {
-    // FIXME: cache the value somewhere...
-    bool containsUnreadMessages = false;
-    threadForeach<bool>(root, [&containsUnreadMessages](const TreeItemMessage &message) -> bool {
-        return containsUnreadMessages = ! message.isMarkedAsRead();
-    });
-    return containsUnreadMessages;
+    return threadAggregates(root).unreadInSubtree > 0;
 }
 
 QStringList ThreadingMsgListModel::threadAggregatedFlags(const uint root) const
 {
-    // FIXME: cache the value somewhere...
-    QStringList aggregatedFlags;
-    threadForeach<void>(root, [&aggregatedFlags](const TreeItemMessage &message) {
-        aggregatedFlags += message.m_flags;
-    });
-    aggregatedFlags.removeDuplicates();
-    return aggregatedFlags;
+    return threadAggregates(root).flagsInSubtree;
 }
 
 /** @short Pass a debugging message to the real Model, if possible
@@ -1322,6 +1865,15 @@ void ThreadingMsgListModel::setUserWantsThreading(bool enable)
     }
 }
 
+void ThreadingMsgListModel::setPreferLocalThreading(bool enable)
+{
+    if (m_preferLocalThreading == enable)
+        return;
+    m_preferLocalThreading = enable;
+    if (m_shallBeThreading && sourceModel() && sourceModel()->rowCount() && !threadingInFlight)
+        askForThreading();
+}
+
 bool ThreadingMsgListModel::setUserSearchingSortingPreference(const QStringList &searchConditions, const SortCriterium criterium, const Qt::SortOrder order)
 {
     auto changedSearch = (searchConditions != m_currentSearchConditions);
@@ -1352,6 +1904,8 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
     QModelIndex realIndex;
     Model::realTreeItem(someMessage, &realModel, &realIndex);
     QModelIndex mailboxIndex = realIndex.parent().parent();
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
+    const bool sameCriterium = m_currentSortingCriteria == criterium;
 
     bool hasDisplaySort = false;
     bool hasSort = false;
@@ -1387,6 +1941,8 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
         sortOptions << (hasDisplaySort ? QStringLiteral("DISPLAYTO") : QStringLiteral("TO"));
         break;
     case SORT_NONE:
+        cancelLocalSort();
+        cancelPartialSort();
         if (m_sortTask && m_sortTask->isPersistent() &&
                 (m_currentSearchConditions != searchConditions || m_currentSortingCriteria != criterium)) {
             // Any change shall result in us killing that sort task
@@ -1404,6 +1960,12 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
             return true;
         } else if (searchConditions != m_currentSearchConditions || m_searchValidity != RESULT_FRESH) {
             // We have to update our search conditions
+            if (!realModel->isNetworkAvailable()) {
+                if (searchLocally(realModel, mailbox, searchConditions, false))
+                    return true;
+            } else if (!searchLocally(realModel, mailbox, searchConditions, true)) {
+                filterProvisionally(mailbox, searchConditions, sameCriterium);
+            }
             m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions,
                                                                   QStringList());
             connect(m_sortTask.data(), &SortTask::sortingAvailable, this, &ThreadingMsgListModel::slotSortingAvailable);
@@ -1421,36 +1983,425 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
         return true;
     }
 
-    if (!hasSort) {
-        // sorting is completely unsupported
-        return false;
+    if (!hasSort || !realModel->isNetworkAvailable()) {
+        if (!searchConditions.isEmpty()) {
+            // Searching needs the server's help
+            return false;
+        }
+        sortLocally(realModel, mailbox, criterium);
+        return true;
     }
 
     Q_ASSERT(!sortOptions.isEmpty());
 
+    // A window from the start of the order is of no use when showing the end of it, and vice versa
+    const bool partialWindowMismatch = m_sortPartialReceived >= 0 && m_sortPartialFromEnd != m_sortReverse;
+
     if (m_currentSortingCriteria == criterium && m_currentSearchConditions == searchConditions &&
-            m_searchValidity != RESULT_INVALIDATED) {
+            m_searchValidity != RESULT_INVALIDATED && !partialWindowMismatch) {
         applySort();
     } else {
+        const bool provisional = filterProvisionally(mailbox, searchConditions, sameCriterium);
         m_currentSearchConditions = searchConditions;
         m_filteredBySearch = ! searchConditions.isEmpty();
         m_currentSortingCriteria = criterium;
-        calculateNullSort();
-        applySort();
+        cancelLocalSort();
+        cancelPartialSort();
+        if (!provisional) {
+            calculateNullSort();
+            applySort();
+        }
 
         if (m_sortTask && m_sortTask->isPersistent())
             m_sortTask->cancelSortingUpdates();
 
-        m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions, sortOptions);
-        connect(m_sortTask.data(), &SortTask::sortingAvailable, this, &ThreadingMsgListModel::slotSortingAvailable);
-        connect(m_sortTask.data(), &SortTask::sortingFailed, this, &ThreadingMsgListModel::slotSortingFailed);
-        connect(m_sortTask.data(), &SortTask::incrementalSortUpdate, this, &ThreadingMsgListModel::slotSortingIncrementalUpdate);
+        if (searchConditions.isEmpty() && sourceModel()->rowCount() > sortPartialThreshold &&
+                realModel->capabilities().contains(QStringLiteral("ESORT")) &&
+                realModel->capabilities().contains(QStringLiteral("PARTIAL"))) {
+            // Transferring the order of a huge mailbox takes a while; start with what the user can see right now
+            m_sortPartialReceived = 0;
+            m_sortPartialFromEnd = m_sortReverse;
+            m_sortPartialOptions = sortOptions;
+            if (m_sortTask)
+                disconnect(m_sortTask.data(), nullptr, this, nullptr);
+            m_sortTask = 0;
+            askForSortPage();
+        } else {
+            m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions, sortOptions);
+            connect(m_sortTask.data(), &SortTask::sortingAvailable, this, &ThreadingMsgListModel::slotSortingAvailable);
+            connect(m_sortTask.data(), &SortTask::sortingFailed, this, &ThreadingMsgListModel::slotSortingFailed);
+            connect(m_sortTask.data(), &SortTask::incrementalSortUpdate, this, &ThreadingMsgListModel::slotSortingIncrementalUpdate);
+        }
         m_searchValidity = RESULT_ASKED;
     }
 
     return true;
 }
 
+bool ThreadingMsgListModel::searchLocally(const Model *realModel, TreeItemMailbox *mailbox, const QStringList &searchConditions,
+                                          const bool provisional)
+{
+    Q_ASSERT(mailbox);
+    LocalSearchQuery query;
+    if (!query.parse(searchConditions))
+        return false;
+
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+    QSet<uint> allUids;
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        const uint uid = static_cast<TreeItemMessage *>(item)->uid();
+        if (uid)
+            allUids.insert(uid);
+    }
+
+    auto cache = realModel->cache();
+    const QString mailboxName = mailbox->mailbox();
+    cache->catchUpSearchIndex(mailboxName);
+    if (provisional) {
+        // A partial index would hide the messages which it does not know about. The bodies are only available for messages
+        // which were opened, so these are left to the server alone.
+        if (query.needsBodies() || allUids.isEmpty() || !cache->indexedMessages(mailboxName).contains(allUids))
+            return false;
+    }
+
+    const QSet<uint> matching = query.evaluate(allUids, [cache, &mailboxName](const int fields, const QString &prefix) {
+        return cache->searchIndex(mailboxName, fields, prefix);
+    }, [list](const QString &flag) {
+        QSet<uint> res;
+        Q_FOREACH(TreeItem *item, list->m_children) {
+            TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+            if (message->uid() && message->m_flags.contains(flag, Qt::CaseInsensitive))
+                res.insert(message->uid());
+        }
+        return res;
+    });
+
+    if (m_sortTask) {
+        // Whatever the server is doing is not relevant anymore
+        if (m_sortTask->isPersistent())
+            m_sortTask->cancelSortingUpdates();
+        disconnect(m_sortTask.data(), nullptr, this, nullptr);
+        m_sortTask = 0;
+    }
+    cancelPartialSort();
+
+    m_currentSortResult.clear();
+    m_currentSortResult.reserve(matching.size());
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        const uint uid = static_cast<TreeItemMessage *>(item)->uid();
+        if (uid && matching.contains(uid))
+            m_currentSortResult << uid;
+    }
+    logTrace(QStringLiteral("Searched locally%1, %2 of %3 messages match").arg(
+                 provisional ? QStringLiteral(" (provisional)") : QString(),
+                 QString::number(m_currentSortResult.size()), QString::number(allUids.size())));
+    m_currentSearchConditions = searchConditions;
+    m_filteredBySearch = true;
+    m_searchValidity = provisional ? RESULT_ASKED : RESULT_FRESH;
+    applySort();
+    return true;
+}
+
+/** @short Show the messages which might match the search while the server is evaluating it
+
+The messages whose envelopes are already loaded and which do not match the quick search get hidden right away; everything
+else stays visible until the real result arrives. When the user keeps typing, the previous result is narrowed down instead
+of starting from the whole mailbox again.
+*/
+bool ThreadingMsgListModel::filterProvisionally(TreeItemMailbox *mailbox, const QStringList &searchConditions,
+                                                const bool canReusePreviousResult)
+{
+    Q_ASSERT(mailbox);
+    if (m_shallBeThreading) {
+        // A thread might match through any of its messages, not just through its root
+        return false;
+    }
+    QuickFilter filter;
+    if (!filter.setConditions(searchConditions) || !filter.canExclude())
+        return false;
+
+    QuickFilter previous;
+    if (!canReusePreviousResult || !m_filteredBySearch || m_searchValidity != RESULT_FRESH
+            || !previous.setConditions(m_currentSearchConditions) || !filter.isNarrowerThan(previous)) {
+        calculateNullSort();
+    }
+
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+    QSet<uint> excluded;
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+        if (message->uid() && message->fetched() && !filter.matches(message->data()->envelope()))
+            excluded.insert(message->uid());
+    }
+
+    Imap::Uids candidates;
+    candidates.reserve(m_currentSortResult.size());
+    for (const uint uid : m_currentSortResult) {
+        if (!excluded.contains(uid))
+            candidates << uid;
+    }
+    logTrace(QStringLiteral("Provisional search result: %1 messages").arg(candidates.size()));
+    m_currentSortResult = candidates;
+    applySort();
+    return true;
+}
+
+/** @short Build the sort key of a message from whatever is available without talking to the server */
+bool ThreadingMsgListModel::buildLocalSortKey(const Model *realModel, const QString &mailbox, TreeItemMessage *message,
+                                              LocalSortKey &key) const
+{
+    key.uid = message->uid();
+    key.seq = message->m_offset;
+    if (message->fetched()) {
+        const MessageDataPayload *data = message->data();
+        fillLocalSortKey(key, m_localSortCriterium, data->envelope(), data->internalDate(), data->size());
+        return true;
+    }
+    auto metadata = realModel->cache()->messageMetadata(mailbox, key.uid);
+    if (metadata.uid == key.uid) {
+        fillLocalSortKey(key, m_localSortCriterium, metadata.envelope, metadata.internalDate, metadata.size);
+        return true;
+    }
+    return false;
+}
+
+void ThreadingMsgListModel::sortLocally(const Model *realModel, TreeItemMailbox *mailbox, const SortCriterium criterium)
+{
+    Q_ASSERT(mailbox);
+    if (m_sortTask) {
+        // Whatever the server is doing is not relevant anymore
+        if (m_sortTask->isPersistent())
+            m_sortTask->cancelSortingUpdates();
+        disconnect(m_sortTask.data(), nullptr, this, nullptr);
+        m_sortTask = 0;
+    }
+    cancelPartialSort();
+
+    if (m_sortingLocally && m_currentSortingCriteria == criterium && m_currentSearchConditions.isEmpty()) {
+        switch (m_searchValidity) {
+        case RESULT_FRESH:
+            applySort();
+            return;
+        case RESULT_ASKED:
+            // The background job will deliver the result
+            return;
+        case RESULT_INVALIDATED:
+            if (!m_localSortKeys.isEmpty()) {
+                updateLocalSort(realModel, mailbox);
+                return;
+            }
+            break;
+        }
+    }
+
+    cancelLocalSort();
+    m_sortingLocally = true;
+    m_currentSearchConditions.clear();
+    m_filteredBySearch = false;
+    m_currentSortingCriteria = criterium;
+    switch (criterium) {
+    case SORT_NONE:
+        Q_ASSERT(false);
+        break;
+    case SORT_ARRIVAL:
+        m_localSortCriterium = LOCAL_SORT_ARRIVAL;
+        break;
+    case SORT_CC:
+        m_localSortCriterium = LOCAL_SORT_CC;
+        break;
+    case SORT_DATE:
+        m_localSortCriterium = LOCAL_SORT_DATE;
+        break;
+    case SORT_FROM:
+        m_localSortCriterium = LOCAL_SORT_FROM;
+        break;
+    case SORT_SIZE:
+        m_localSortCriterium = LOCAL_SORT_SIZE;
+        break;
+    case SORT_SUBJECT:
+        m_localSortCriterium = LOCAL_SORT_SUBJECT;
+        break;
+    case SORT_TO:
+        m_localSortCriterium = LOCAL_SORT_TO;
+        break;
+    }
+
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+    QVector<LocalSortKey> keys;
+    keys.reserve(list->m_children.size() + headroomForNewmessages);
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+        if (!message->uid())
+            continue;
+        LocalSortKey key;
+        if (!buildLocalSortKey(realModel, mailbox->mailbox(), message, key))
+            m_provisionalLocalSortKeys.insert(key.uid);
+        keys << key;
+    }
+    logTrace(QStringLiteral("Sorting %1 messages locally").arg(keys.size()));
+
+    if (keys.size() < localSortInBackgroundThreshold) {
+        m_currentSortResult = sortLocalKeys(keys, isTextualLocalSort(m_localSortCriterium));
+        m_localSortKeys = keys;
+        m_searchValidity = RESULT_FRESH;
+        applySort();
+        return;
+    }
+
+    // Show something while the sorting runs
+    calculateNullSort();
+    applySort();
+    m_searchValidity = RESULT_ASKED;
+    LocalSortJob *job = new LocalSortJob(keys, isTextualLocalSort(m_localSortCriterium));
+    m_localSortJob = job;
+    connect(job, &LocalSortJob::sortingAvailable, this, [this, job](const Imap::Uids &uids, const QVector<LocalSortKey> &sortedKeys) {
+        slotLocalSortingAvailable(job, uids, sortedKeys);
+    });
+    job->start();
+}
+
+void ThreadingMsgListModel::slotLocalSortingAvailable(LocalSortJob *job, const Imap::Uids &uids, const QVector<LocalSortKey> &keys)
+{
+    if (job != m_localSortJob) {
+        // Somebody has changed their mind in the meanwhile
+        return;
+    }
+    m_localSortJob = nullptr;
+    m_localSortKeys = keys;
+    m_currentSortResult = uids;
+    m_searchValidity = RESULT_FRESH;
+    if (!m_provisionalLocalSortKeys.isEmpty())
+        m_delayedLocalSortUpdate->start();
+    wantThreading();
+}
+
+/** @short Incorporate new arrivals, expunges and the freshly available metadata into the result of the local sort
+
+Only the new or changed messages are placed into the already sorted list; there is no need to sort everything again.
+*/
+void ThreadingMsgListModel::updateLocalSort(const Model *realModel, TreeItemMailbox *mailbox)
+{
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+
+    QHash<uint, TreeItemMessage *> messages;
+    messages.reserve(list->m_children.size());
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+        if (message->uid())
+            messages[message->uid()] = message;
+    }
+
+    QVector<LocalSortKey> kept, added;
+    kept.reserve(messages.size() + headroomForNewmessages);
+    Q_FOREACH(LocalSortKey key, m_localSortKeys) {
+        auto it = messages.find(key.uid);
+        if (it == messages.end()) {
+            // This one is gone
+            m_provisionalLocalSortKeys.remove(key.uid);
+            continue;
+        }
+        TreeItemMessage *message = *it;
+        messages.erase(it);
+        if (m_provisionalLocalSortKeys.contains(key.uid) && message->fetched()) {
+            LocalSortKey fresh;
+            buildLocalSortKey(realModel, mailbox->mailbox(), message, fresh);
+            m_provisionalLocalSortKeys.remove(key.uid);
+            added << fresh;
+            continue;
+        }
+        // The expunges do not change the relative order, so the list stays sorted
+        key.seq = message->m_offset;
+        kept << key;
+    }
+
+    for (auto it = messages.constBegin(); it != messages.constEnd(); ++it) {
+        LocalSortKey key;
+        if (!buildLocalSortKey(realModel, mailbox->mailbox(), *it, key)) {
+            // A new arrival whose metadata are not available yet. It has most likely arrived just now.
+            m_provisionalLocalSortKeys.insert(key.uid);
+            if (m_localSortCriterium == LOCAL_SORT_ARRIVAL || m_localSortCriterium == LOCAL_SORT_DATE)
+                key.number = QDateTime::currentMSecsSinceEpoch();
+        }
+        added << key;
+    }
+
+    const bool textual = isTextualLocalSort(m_localSortCriterium);
+    auto lessThan = [textual](const LocalSortKey &a, const LocalSortKey &b) {
+        return localSortLessThan(a, b, textual);
+    };
+    std::sort(added.begin(), added.end(), lessThan);
+    for (const auto &key : added) {
+        kept.insert(std::upper_bound(kept.begin(), kept.end(), key, lessThan), key);
+    }
+
+    m_localSortKeys = kept;
+    m_currentSortResult.clear();
+    m_currentSortResult.reserve(kept.size() + headroomForNewmessages);
+    for (const auto &key : kept) {
+        m_currentSortResult << key.uid;
+    }
+    m_searchValidity = RESULT_FRESH;
+    applySort();
+}
+
+void ThreadingMsgListModel::cancelLocalSort()
+{
+    m_sortingLocally = false;
+    m_localSortKeys.clear();
+    m_provisionalLocalSortKeys.clear();
+    m_localSortJob = nullptr;
+    m_delayedLocalSortUpdate->stop();
+}
+
+/** @short Ask the server for the next window of the sort order of a huge mailbox */
+void ThreadingMsgListModel::askForSortPage()
+{
+    if (m_sortPartialReceived < 0 || m_sortTask || !sourceModel() || !sourceModel()->rowCount())
+        return;
+
+    const Model *realModel;
+    QModelIndex realIndex;
+    Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+    QModelIndex mailboxIndex = realIndex.parent().parent();
+
+    // IMAP counts from one, and the negative positions are counted from the end of the result
+    const int first = m_sortPartialReceived + 1;
+    const int last = m_sortPartialReceived + sortPartialPageSize;
+    const QPair<int, int> range = m_sortPartialFromEnd ? qMakePair(-first, -last) : qMakePair(first, last);
+    logTrace(QStringLiteral("Asking for the sort order window %1:%2").arg(QString::number(range.first), QString::number(range.second)));
+
+    m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, QStringList(),
+                                                          m_sortPartialOptions, range);
+    connect(m_sortTask.data(), &SortTask::partialSortingAvailable, this, &ThreadingMsgListModel::slotPartialSortingAvailable);
+    connect(m_sortTask.data(), &SortTask::sortingAvailable, this, &ThreadingMsgListModel::slotSortingAvailable);
+    connect(m_sortTask.data(), &SortTask::sortingFailed, this, &ThreadingMsgListModel::slotSortingFailed);
+}
+
+void ThreadingMsgListModel::cancelPartialSort()
+{
+    m_sortPartialReceived = -1;
+    m_sortPartialTotal = -1;
+    m_sortPartialOptions.clear();
+    m_delayedSortPage->stop();
+}
+
+void ThreadingMsgListModel::delayedLocalSortUpdate()
+{
+    if (!m_sortingLocally || m_searchValidity == RESULT_ASKED || !sourceModel() || !sourceModel()->rowCount())
+        return;
+
+    const Model *realModel;
+    QModelIndex realIndex;
+    Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(realIndex.parent().parent().internalPointer()));
+    Q_ASSERT(mailbox);
+    updateLocalSort(realModel, mailbox);
+}
+
 void ThreadingMsgListModel::applySort()
 {
     if (!sourceModel()->rowCount()) {
@@ -1465,50 +2416,59 @@ void ThreadingMsgListModel::applySort()
     TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox*>(static_cast<TreeItem*>(realIndex.parent().parent().internalPointer()));
     Q_ASSERT(mailbox);
 
-    emit layoutAboutToBeChanged();
-    updatePersistentIndexesPhase1();
-    QSet<uint> newlyUnreachable(threading[0].children.begin(), threading[0].children.end());
-    threading[0].children.clear();
-    threading[0].children.reserve(m_currentSortResult.size() + headroomForNewmessages);
-
-    QSet<uint> allRootIds(threadedRootIds.begin(), threadedRootIds.end());
-
-    for (int i = 0; i < m_currentSortResult.size(); ++i) {
-        int offset = m_sortReverse ? m_currentSortResult.size() - 1 - i : i;
-        QList<TreeItemMessage *> messages = const_cast<Model*>(realModel)
-                ->findMessagesByUids(mailbox, Imap::Uids() << m_currentSortResult[offset]);
-        if (messages.isEmpty()) {
-            // wrong UID, weird
-            continue;
-        }
-        Q_ASSERT(messages.size() == 1);
-        QHash<void *,uint>::const_iterator it = ptrToInternal.constFind(messages.front());
-        // else applyThreading() taking care of it
-        if (!threadingInFlight)
-            Q_ASSERT(it != ptrToInternal.constEnd());
-        if (!allRootIds.contains(*it)) {
-            // not a thread root, so don't show it
-            continue;
+    // Typically, just a few threads change their position
+    updateTree([this, realModel, mailbox]() {
+        QSet<uint> newlyUnreachable(threading[0].children.begin(), threading[0].children.end());
+        threading[0].children.clear();
+        threading[0].children.reserve(m_currentSortResult.size() + headroomForNewmessages);
+
+        QSet<uint> allRootIds(threadedRootIds.begin(), threadedRootIds.end());
+
+        for (int i = 0; i < m_currentSortResult.size(); ++i) {
+            int offset = m_sortReverse ? m_currentSortResult.size() - 1 - i : i;
+            QList<TreeItemMessage *> messages = const_cast<Model*>(realModel)
+                    ->findMessagesByUids(mailbox, Imap::Uids() << m_currentSortResult[offset]);
+            if (messages.isEmpty()) {
+                // wrong UID, weird
+                continue;
+            }
+            Q_ASSERT(messages.size() == 1);
+            QHash<void *,uint>::const_iterator it = ptrToInternal.constFind(messages.front());
+            // else applyThreading() taking care of it
+            if (!threadingInFlight)
+                Q_ASSERT(it != ptrToInternal.constEnd());
+            if (!allRootIds.remove(*it)) {
+                // not a thread root (or already shown), so don't show it
+                continue;
+            }
+            threading[*it].offset = threading[0].children.size();
+            threading[0].children.append(*it);
         }
-        threading[*it].offset = threading[0].children.size();
-        threading[0].children.append(*it);
-    }
 
-    // Now remove everything which is no longer reachable from the root of the thread mapping
-    // Start working on the top-level orphans
-    Q_FOREACH(const uint uid, threading[0].children) {
-        newlyUnreachable.remove(uid);
-    }
-    std::vector<uint> queue(newlyUnreachable.constBegin(), newlyUnreachable.constEnd());
-    for (std::vector<uint>::size_type i = 0; i < queue.size(); ++i) {
-        QHash<uint,ThreadNodeInfo>::iterator threadingIt = threading.find(queue[i]);
-        Q_ASSERT(threadingIt != threading.end());
-        queue.insert(queue.end(), threadingIt->children.constBegin(), threadingIt->children.constEnd());
-        threading.erase(threadingIt);
-    }
+        m_sortPartialKnownRows = threading[0].children.size();
+        if (m_sortPartialReceived >= 0) {
+            // Only a window of the order is known; everything else follows in the mailbox order until we learn more
+            Q_FOREACH(const uint internalId, threadedRootIds) {
+                if (!allRootIds.contains(internalId))
+                    continue;
+                threading[internalId].offset = threading[0].children.size();
+                threading[0].children.append(internalId);
+            }
+        }
 
-    updatePersistentIndexesPhase2();
-    emit layoutChanged();
+        // Now remove everything which is no longer reachable from the root of the thread mapping
+        // Start working on the top-level orphans
+        Q_FOREACH(const uint uid, threading[0].children) {
+            newlyUnreachable.remove(uid);
+        }
+        std::vector<uint> queue(newlyUnreachable.constBegin(), newlyUnreachable.constEnd());
+        for (std::vector<uint>::size_type i = 0; i < queue.size(); ++i) {
+            ThreadNodeInfo *threadingIt = threading.find(queue[i]);
+            Q_ASSERT(threadingIt);
+            queue.insert(queue.end(), threadingIt->children.constBegin(), threadingIt->children.constEnd());
+            threading.erase(queue[i]);
+        }
+    });
 }
 
 QStringList ThreadingMsgListModel::currentSearchCondition() const
@@ -1531,5 +2491,114 @@ QModelIndex ThreadingMsgListModel::sibling(int row, int column, const QModelInde
     return index(row, column, idx.parent());
 }
 
+bool ThreadingMsgListModel::wantsLocalThreading(const Model *realModel) const
+{
+    const bool serverCanThread = realModel->capabilities().contains(QStringLiteral("THREAD=REFS"))
+            || realModel->capabilities().contains(QStringLiteral("THREAD=REFERENCES"))
+            || realModel->capabilities().contains(QStringLiteral("THREAD=ORDEREDSUBJECT"));
+    return (!serverCanThread || m_preferLocalThreading || !realModel->isNetworkAvailable()) && !m_filteredBySearch;
+}
+
+void ThreadingMsgListModel::delayedLocalThreading()
+{
+    if (!m_shallBeThreading || !sourceModel() || !sourceModel()->rowCount())
+        return;
+
+    const Imap::Mailbox::Model *realModel = nullptr;
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+    Q_ASSERT(realModel);
+    if (!wantsLocalThreading(realModel)) {
+        // Things have changed in the meanwhile, e.g. a search got activated
+        askForThreading();
+        return;
+    }
+    threadLocally(realModel, dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(realIndex.parent().parent().internalPointer())));
+}
+
+void ThreadingMsgListModel::threadLocally(const Model *realModel, TreeItemMailbox *mailbox)
+{
+    Q_ASSERT(mailbox);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+
+    // A message whose headers were not known on the last run might have got them since then. Its place in the threads
+    // could affect other messages as well, so let's start from scratch in that case.
+    bool mustRebuild = false;
+    Q_FOREACH(const uint uid, m_incompleteLocalThreading) {
+        if (realModel->cache()->messageMetadata(mailbox->mailbox(), uid).uid == uid) {
+            mustRebuild = true;
+            break;
+        }
+    }
+    if (mustRebuild) {
+        m_localThreading.clear();
+        m_incompleteLocalThreading.clear();
+    }
+
+    QSet<uint> present;
+    int added = 0;
+    bool allUidsKnown = true;
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+        const uint uid = message->uid();
+        if (!uid) {
+            allUidsKnown = false;
+            continue;
+        }
+        present.insert(uid);
+        if (m_localThreading.contains(uid) && !m_incompleteLocalThreading.contains(uid))
+            continue;
+
+        QByteArray messageId;
+        QList<QByteArray> references;
+        QDateTime date;
+        bool known = false;
+        if (message->fetched()) {
+            const MessageDataPayload *data = message->data();
+            messageId = data->envelope().messageId;
+            references = data->hdrReferences().isEmpty() ? data->envelope().inReplyTo : data->hdrReferences();
+            date = data->envelope().date.isValid() ? data->envelope().date : data->internalDate();
+            known = true;
+        } else {
+            auto metadata = realModel->cache()->messageMetadata(mailbox->mailbox(), uid);
+            if (metadata.uid == uid) {
+                messageId = metadata.envelope.messageId;
+                references = metadata.hdrReferences.isEmpty() ? metadata.envelope.inReplyTo : metadata.hdrReferences;
+                date = metadata.envelope.date.isValid() ? metadata.envelope.date : metadata.internalDate;
+                known = true;
+            }
+        }
+
+        if (m_localThreading.contains(uid)) {
+            if (!known)
+                continue;
+            m_localThreading.removeMessage(uid);
+        }
+        m_localThreading.addMessage(uid, messageId, references, date);
+        if (known) {
+            m_incompleteLocalThreading.remove(uid);
+        } else {
+            m_incompleteLocalThreading.insert(uid);
+        }
+        ++added;
+    }
+
+    Q_FOREACH(const uint uid, m_localThreading.uids()) {
+        if (!present.contains(uid)) {
+            m_localThreading.removeMessage(uid);
+            m_incompleteLocalThreading.remove(uid);
+        }
+    }
+
+    logTrace(QStringLiteral("Threading %1 messages locally (%2 new)").arg(QString::number(present.size()), QString::number(added)));
+    const auto mapping = m_localThreading.threading();
+    if (allUidsKnown && m_incompleteLocalThreading.isEmpty()) {
+        // A partial tree would be taken at its face value when the mailbox gets opened next time
+        realModel->cache()->setMessageThreading(mailbox->mailbox(), mapping);
+    }
+    applyThreading(mapping);
+}
+
 }
 }
@@ -24,9 +24,13 @@
 #define IMAP_THREADINGMSGLISTMODEL_H
 
 #include <functional>
+#include <vector>
 #include <QAbstractProxyModel>
 #include <QPointer>
 #include <QSet>
+#include <QVector>
+#include "LocalSort.h"
+#include "LocalThreading.h"
 #include "MailboxTree.h"
 #include "Imap/Parser/Response.h"
 
@@ -54,16 +58,172 @@ struct ThreadNodeInfo {
     /** @short internalId of a parent of this message */
     uint parent;
     /** @short List of children of current node */
-    QList<uint> children;
+    QVector<uint> children;
     /** @short Pointer to the TreeItemMessage* of the corresponding message */
     TreeItem *ptr;
     /** @short Position among our parent's children */
     int offset;
-    ThreadNodeInfo(): internalId(0), uid(0), parent(0), ptr(0), offset(0) {}
+    /** @short Number of unread messages in the subtree of this node; only valid if aggregatesValid is set */
+    mutable int unreadInSubtree;
+    /** @short Union of flags of all messages in the subtree of this node; only valid if aggregatesValid is set */
+    mutable QStringList flagsInSubtree;
+    /** @short Are the unreadInSubtree and flagsInSubtree up-to-date?
+
+    Whenever a node has its aggregates valid, so do all of its descendants.
+    */
+    mutable bool aggregatesValid;
+    ThreadNodeInfo(): internalId(0), uid(0), parent(0), ptr(0), offset(0), unreadInSubtree(0), aggregatesValid(false) {}
 };
 
 QDebug operator<<(QDebug debug, const ThreadNodeInfo &node);
 
+class ThreadNodeArena;
+
+/** @short A tree which differs from a ThreadNodeArena in just a few nodes
+
+Only the nodes which differ are stored here; everything else is looked up in the arena.
+*/
+class ThreadNodeOverlay
+{
+public:
+    explicit ThreadNodeOverlay(const ThreadNodeArena *base = nullptr): m_base(base) {}
+
+    /** @short Return the node with the given ID, or nullptr if there's no such node */
+    const ThreadNodeInfo *constFind(const uint id) const;
+
+    /** @short Is the node with this ID stored here instead of coming from the arena? */
+    bool overrides(const uint id) const
+    {
+        return m_nodes.contains(id) || m_missing.contains(id);
+    }
+
+    /** @short IDs of the nodes which exist here and possibly differ from the arena */
+    QList<uint> changedIds() const
+    {
+        return m_nodes.keys();
+    }
+
+    bool isEmpty() const
+    {
+        return m_nodes.isEmpty() && m_missing.isEmpty();
+    }
+
+private:
+    const ThreadNodeArena *m_base;
+    QHash<uint, ThreadNodeInfo> m_nodes;
+    /** @short Nodes which do not exist here, even though the arena might have them */
+    QSet<uint> m_missing;
+
+    friend class ThreadNodeArena;
+};
+
+/** @short Storage of the ThreadNodeInfo nodes, indexed by their internalId
+
+The internal IDs are handed out sequentially, so the nodes live in one contiguous vector instead of a hash table.
+Clearing the arena keeps all of its memory, including the buffers of the lists of children, so that rebuilding
+the threading of a big mailbox does not have to allocate everything once again.
+*/
+class ThreadNodeArena
+{
+public:
+    ThreadNodeArena(): m_size(0), m_journaling(false) {}
+
+    /** @short Return the node with the given ID, or nullptr if there's no such node */
+    ThreadNodeInfo *find(const uint id)
+    {
+        if (!contains(id))
+            return nullptr;
+        remember(id);
+        return &m_nodes[id];
+    }
+
+    /** @short Return the node with the given ID, or nullptr if there's no such node */
+    const ThreadNodeInfo *constFind(const uint id) const
+    {
+        return contains(id) ? &m_nodes[id] : nullptr;
+    }
+
+    /** @short Return the node with the given ID, creating an empty one if it isn't there yet */
+    ThreadNodeInfo &operator[](const uint id)
+    {
+        remember(id);
+        if (static_cast<int>(id) >= m_nodes.size()) {
+            m_nodes.resize(id + 1);
+            m_used.resize(id + 1, false);
+        }
+        if (!m_used[id]) {
+            m_used[id] = true;
+            m_nodes[id].internalId = id;
+            ++m_size;
+        }
+        return m_nodes[id];
+    }
+
+    bool contains(const uint id) const
+    {
+        return static_cast<int>(id) < m_nodes.size() && m_used[id];
+    }
+
+    bool isEmpty() const
+    {
+        return m_size == 0;
+    }
+
+    int size() const
+    {
+        return m_size;
+    }
+
+    /** @short One past the highest ID which this arena has ever stored */
+    uint idLimit() const
+    {
+        return m_nodes.size();
+    }
+
+    void reserve(const int size)
+    {
+        m_nodes.reserve(size);
+        m_used.reserve(size);
+    }
+
+    void erase(const uint id);
+    void clear();
+    QVector<uint> keys() const;
+
+    /** @short Start keeping the original version of each node which gets modified through find(), operator[] or erase() */
+    void startJournal();
+    /** @short Stop the journaling, and return the original versions of all nodes which might have been modified */
+    ThreadNodeOverlay takeJournal();
+    void swapChanges(ThreadNodeOverlay &changes);
+
+private:
+    void remember(const uint id)
+    {
+        if (!m_journaling || m_journal.overrides(id))
+            return;
+        if (contains(id))
+            m_journal.m_nodes.insert(id, m_nodes[id]);
+        else
+            m_journal.m_missing.insert(id);
+    }
+
+    QVector<ThreadNodeInfo> m_nodes;
+    std::vector<bool> m_used;
+    int m_size;
+    bool m_journaling;
+    ThreadNodeOverlay m_journal;
+};
+
+inline const ThreadNodeInfo *ThreadNodeOverlay::constFind(const uint id) const
+{
+    auto it = m_nodes.constFind(id);
+    if (it != m_nodes.constEnd())
+        return &*it;
+    if (m_missing.contains(id) || !m_base)
+        return nullptr;
+    return m_base->constFind(id);
+}
+
 /** @short A model implementing view of the whole IMAP server
 
 The problem with threading is that due to the extremely asynchronous nature of the IMAP Model, we often get informed about indexes
@@ -170,6 +330,9 @@ public slots:
     /** @short SORT response has arrived */
     void slotSortingAvailable(const Imap::Uids &uids);
 
+    /** @short A window of the SORT result of a huge mailbox has arrived */
+    void slotPartialSortingAvailable(const Imap::Uids &uids, const int total);
+
     /** @short SORT has failed */
     void slotSortingFailed();
 
@@ -181,6 +344,9 @@ public slots:
     /** @short Enable or disable threading */
     void setUserWantsThreading(bool enable);
 
+    /** @short Thread the messages locally even when the server supports the THREAD command */
+    void setPreferLocalThreading(bool enable);
+
     Q_INVOKABLE bool setUserSearchingSortingPreference(const QStringList &searchConditions, const SortCriterium criterium,
                                            const Qt::SortOrder order = Qt::AscendingOrder);
 
@@ -188,6 +354,9 @@ public slots:
     void slotIncrementalThreadingFailed();
 
     void delayedPrune();
+    void delayedLocalSortUpdate();
+    void delayedLocalThreading();
+    void askForSortPage();
 
 signals:
     void sortingFailed();
@@ -205,6 +374,31 @@ private:
     void updatePersistentIndexesPhase1();
     void updatePersistentIndexesPhase2();
 
+    /** @short Let the @arg rebuild modify the tree, and tell the views only about what has actually changed
+
+    The @arg rebuild is free to manipulate the threading, ptrToInternal and threadingHelperLastId without emitting any
+    signals. The threading journals the nodes which the rebuild touches, and only the subtrees containing these are
+    compared with what the views know about. The current tree is then morphed into the new one through a series of row
+    insertions, moves and removals. When the trees differ too much, a plain layout change is emitted instead.
+    */
+    void updateTree(const std::function<void()> &rebuild);
+    /** @short IDs of the nodes of the @arg target whose subtree is not the same as in the current tree */
+    QSet<uint> changedSubtrees(const ThreadNodeOverlay &target) const;
+    /** @short How many row operations would it take to turn the current tree into the @arg target */
+    int countTreeChanges(const ThreadNodeOverlay &target, const QSet<uint> &changed) const;
+    /** @short Turn the current tree into the @arg target one row operation at a time */
+    void morphTree(const ThreadNodeOverlay &target, const QSet<uint> &changed);
+    /** @short Return ID of the node which currently shows the message, or zero if there isn't any */
+    uint currentNodeFor(void *ptr) const;
+    /** @short Return ID of the current counterpart of a node of the @arg target tree, or zero if there isn't any */
+    uint currentNodeFor(const ThreadNodeOverlay &target, const uint targetId) const;
+    QModelIndex indexForNode(const uint internalId) const;
+    uint insertThreadNode(const uint parentId, const int row, TreeItem *ptr, const uint uid);
+    void moveThreadNodes(const uint sourceParentId, const int first, const int last, const uint destinationParentId, int destinationRow);
+    void removeThreadNodes(const uint parentId, const int first, const int last);
+    /** @short Fix the offset of all children of the node, starting at the given position */
+    void renumberThreadChildren(const uint parentId, const int from);
+
     /** @short Shall we ask for SORT/SEARCH automatically? */
     typedef enum {
         AUTO_SORT_SEARCH,
@@ -214,9 +408,11 @@ private:
     /** @short Apply cached THREAD response or ask for threading again */
     void wantThreading(const SkipSortSearch skipSortSearch = AUTO_SORT_SEARCH);
 
+    /** @short Build the whole tree from scratch according to a THREAD response */
+    void buildThreading(const QVector<Imap::Responses::ThreadingNode> &mapping);
     /** @short Convert the threading from a THREAD response and apply that threading to this model */
     void registerThreading(const QVector<Imap::Responses::ThreadingNode> &mapping, uint parentId,
-                           const QHash<uint,void *> &uidToPtr, QSet<uint> &usedNodes);
+                           const QHash<uint,void *> &uidToPtr, QVector<bool> &usedNodes);
 
     bool searchSortPreferenceImplementation(const QStringList &searchConditions, const SortCriterium criterium,
                                             const Qt::SortOrder order = Qt::AscendingOrder);
@@ -224,8 +420,12 @@ private:
     /** @short Remove fake messages from the threading tree */
     void pruneTree();
 
-    /** @short Execute the provided function once for each message */
-    template<typename T> void threadForeach(const uint &root, std::function<T(const TreeItemMessage &)> callback) const;
+    /** @short Make sure that the unread count and the flags of the whole subtree of this node are known */
+    const ThreadNodeInfo &threadAggregates(const uint root) const;
+    /** @short The flags of a message have changed, so the aggregates of the node and all of its ancestors are stale */
+    void invalidateThreadAggregates(uint internalId);
+    /** @short The shape of the tree has changed, so all aggregates are stale */
+    void invalidateAllThreadAggregates();
 
     /** @short Check current thread for "unread messages" */
     bool threadContainsUnreadMessages(const uint root) const;
@@ -242,6 +442,33 @@ private:
 
     void calculateNullSort();
 
+    /** @short Sort the messages on our own because the server cannot do that for us */
+    void sortLocally(const Model *realModel, TreeItemMailbox *mailbox, const SortCriterium criterium);
+    /** @short Update the result of a previous sortLocally() after new arrivals or expunges */
+    void updateLocalSort(const Model *realModel, TreeItemMailbox *mailbox);
+    /** @short Forget about the local sorting, e.g. because the server is going to sort for us */
+    void cancelLocalSort();
+    /** @short Stop asking for further windows of the sort order */
+    void cancelPartialSort();
+    bool buildLocalSortKey(const Model *realModel, const QString &mailbox, TreeItemMessage *message, LocalSortKey &key) const;
+    void slotLocalSortingAvailable(LocalSortJob *job, const Imap::Uids &uids, const QVector<LocalSortKey> &keys);
+
+    /** @short Evaluate the search through the cache's full-text index, return false if nothing could be shown
+
+The index only matches prefixes of words while a real SEARCH matches any substring, so a @arg provisional result is shown
+only until the server's answer replaces it. Without the server, the local result is all we have.
+*/
+    bool searchLocally(const Model *realModel, TreeItemMailbox *mailbox, const QStringList &searchConditions,
+                       const bool provisional);
+
+    /** @short Hide messages which certainly do not match the search before the server gets back to us */
+    bool filterProvisionally(TreeItemMailbox *mailbox, const QStringList &searchConditions, const bool canReusePreviousResult);
+
+    /** @short Shall the threading be done by the LocalThreading instead of the THREAD command? */
+    bool wantsLocalThreading(const Model *realModel) const;
+    /** @short Thread the messages through their cached References headers because the server cannot do that for us */
+    void threadLocally(const Model *realModel, TreeItemMailbox *mailbox);
+
     uint findHighestUidInMailbox(TreeItemMsgList *list);
 
     void logTrace(const QString &message);
@@ -257,7 +484,7 @@ private:
 
     This tree is indexed by our internal ID.
     */
-    QHash<uint,ThreadNodeInfo> threading;
+    ThreadNodeArena threading;
 
     /** @short Last assigned internal ID */
     uint threadingHelperLastId;
@@ -295,7 +522,7 @@ private:
     bool m_sortReverse;
 
     /** @short IDs of all thread roots when no sorting or filtering is applied */
-    QList<uint> threadedRootIds;
+    QVector<uint> threadedRootIds;
 
     /** @short Sorting criteria of the current copy of the sort result */
     SortCriterium m_currentSortingCriteria;
@@ -320,6 +547,52 @@ private:
 
     QTimer *m_delayedPrune;
 
+    /** @short Is the m_currentSortResult computed locally rather than by the server? */
+    bool m_sortingLocally;
+
+    /** @short What the local sorting uses as a key */
+    LocalSortCriterium m_localSortCriterium;
+
+    /** @short Keys of all messages, in the same order as the m_currentSortResult of a local sort */
+    QVector<LocalSortKey> m_localSortKeys;
+
+    /** @short UIDs whose keys were only guessed because their metadata were not available yet */
+    QSet<uint> m_provisionalLocalSortKeys;
+
+    /** @short Sorting of a big mailbox which is running in the background */
+    QPointer<LocalSortJob> m_localSortJob;
+
+    QTimer *m_delayedLocalSortUpdate;
+
+    /** @short Shall we use the LocalThreading even if the server can do the threading? */
+    bool m_preferLocalThreading;
+
+    /** @short Client-side threading of the current mailbox */
+    LocalThreading m_localThreading;
+
+    /** @short UIDs which were put into the m_localThreading without their headers being known */
+    QSet<uint> m_incompleteLocalThreading;
+
+    /** @short Rebuild the local threading just once for a batch of updates */
+    QTimer *m_delayedLocalThreading;
+
+    /** @short Number of items of the sort order received through the PARTIAL windows so far, or -1 if we have all of them */
+    int m_sortPartialReceived;
+
+    /** @short Size of the complete sort result as reported by the server, or -1 if not known */
+    int m_sortPartialTotal;
+
+    /** @short Are the PARTIAL windows counted from the end of the sort order? */
+    bool m_sortPartialFromEnd;
+
+    /** @short Sort criteria for asking about further windows */
+    QStringList m_sortPartialOptions;
+
+    /** @short Number of top-level rows whose position is given by the known part of the sort order */
+    int m_sortPartialKnownRows;
+
+    QTimer *m_delayedSortPage;
+
     friend class ::ImapModelThreadingTest; // needs access to wantThreading();
 };
 
@@ -327,4 +600,6 @@ private:
 
 }
 
+Q_DECLARE_TYPEINFO(Imap::Mailbox::ThreadNodeInfo, Q_MOVABLE_TYPE);
+
 #endif /* IMAP_THREADINGMSGLISTMODEL_H */
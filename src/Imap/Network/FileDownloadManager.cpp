@@ -106,6 +106,8 @@ void FileDownloadManager::downloadPart()
     url.setPath(partIndex.data(Imap::Mailbox::RolePartPathToPart).toString());
     request.setUrl(url);
     reply = manager->get(request);
+    connect(reply, &QNetworkReply::readyRead, this, &FileDownloadManager::onPartDataReadyRead);
+    connect(reply, &QNetworkReply::downloadProgress, this, &FileDownloadManager::transferProgress);
     connect(reply, &QNetworkReply::finished, this, &FileDownloadManager::onPartDataTransfered);
     connect(reply, static_cast<void (QNetworkReply::*)(QNetworkReply::NetworkError)>(&QNetworkReply::errorOccurred),
             this, &FileDownloadManager::onReplyTransferError);
@@ -137,13 +139,28 @@ void FileDownloadManager::downloadMessage()
     m_combiner->load();
 }
 
+/** @short Write whatever has arrived so far, big parts are fetched in chunks */
+void FileDownloadManager::onPartDataReadyRead()
+{
+    if (!reply || reply->error() != QNetworkReply::NoError || !reply->bytesAvailable()) {
+        return;
+    }
+    if (!saving.isOpen() && !saving.open(QIODevice::WriteOnly)) {
+        emit transferError(saving.errorString());
+        return;
+    }
+    if (saving.write(reply->readAll()) == -1 || !saving.flush()) {
+        emit transferError(saving.errorString());
+    }
+}
+
 void FileDownloadManager::onPartDataTransfered()
 {
     if (!reply) {
         return;
     }
     if (reply->error() == QNetworkReply::NoError) {
-        if (!saving.open(QIODevice::WriteOnly)) {
+        if (!saving.isOpen() && !saving.open(QIODevice::WriteOnly)) {
             emit transferError(saving.errorString());
             return;
         }
@@ -184,6 +201,11 @@ void FileDownloadManager::onMessageDataTransferred()
 void FileDownloadManager::onReplyTransferError()
 {
     Q_ASSERT(reply);
+    if (saving.isOpen()) {
+        // Do not leave a truncated file behind
+        saving.close();
+        saving.remove();
+    }
     emit transferError(reply->errorString());
 }
 
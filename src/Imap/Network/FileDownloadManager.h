@@ -48,6 +48,7 @@ public:
     FileDownloadManager(QObject *parent, Imap::Network::MsgPartNetAccessManager *manager, const QUrl &url, const QModelIndex &relativeRoot);
     static QString toRealFileName(const QModelIndex &index);
 private slots:
+    void onPartDataReadyRead();
     void onPartDataTransfered();
     void onReplyTransferError();
     void onCombinerTransferError(const QString &message);
@@ -58,6 +59,7 @@ public slots:
     void onMessageDataTransferred();
 signals:
     void transferError(const QString &errorMessage);
+    void transferProgress(qint64 bytesReceived, qint64 bytesTotal);
     void fileNameRequested(QString *fileName);
     void succeeded();
     void cancelled();
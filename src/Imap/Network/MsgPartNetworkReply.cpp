@@ -93,9 +93,29 @@ void MsgPartNetworkReply::slotMyDataChanged()
         return;
     }
 
-    if (!part.data(Mailbox::RoleIsFetched).toBool())
+    if (!part.data(Mailbox::RoleIsFetched).toBool()) {
+        // Big parts are downloaded in chunks; whatever has been decoded so far can be read already
+        QVariant bytesFetched = part.data(Mailbox::RolePartBytesFetched);
+        if (bytesFetched.isValid()) {
+            if (!header(QNetworkRequest::ContentTypeHeader).isValid()) {
+                setContentTypeHeader();
+                emit metaDataChanged();
+            }
+            emit downloadProgress(bytesFetched.toLongLong(), part.data(Mailbox::RolePartOctets).toLongLong());
+            if (bytesAvailable())
+                emit readyRead();
+        }
         return;
+    }
+
+    setContentTypeHeader();
+    setFinished(true);
+    emit readyRead();
+    emit finished();
+}
 
+void MsgPartNetworkReply::setContentTypeHeader()
+{
     MsgPartNetAccessManager *netAccess = qobject_cast<MsgPartNetAccessManager*>(manager());
     Q_ASSERT(netAccess);
     QString mimeType = netAccess->translateToSupportedMimeType(part.data(Mailbox::RolePartMimeType).toString());
@@ -107,9 +127,6 @@ void MsgPartNetworkReply::slotMyDataChanged()
     } else {
         setHeader(QNetworkRequest::ContentTypeHeader, mimeType);
     }
-    setFinished(true);
-    emit readyRead();
-    emit finished();
 }
 
 /** @short QIODevice compatibility */
@@ -49,6 +49,7 @@ protected:
     virtual qint64 readData(char *data, qint64 maxSize);
 private:
     void disconnectBufferIfVanished() const;
+    void setContentTypeHeader();
 
     QPersistentModelIndex part;
     mutable QBuffer buffer;
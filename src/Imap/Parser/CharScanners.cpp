@@ -0,0 +1,142 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <array>
+#include <QtAlgorithms>
+#include "CharScanners.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TROJITA_SCANNERS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+std::array<bool, 256> makeAtomCharTable()
+{
+    std::array<bool, 256> table;
+    for (int i = 0; i < 256; ++i) {
+        // SP, CTL, DEL and everything which is not 7-bit ASCII
+        table[i] = i > 0x20 && i < 0x7f;
+    }
+    for (const char c : {'(', ')', '{' /* explicitly forbidden */, '%', '*' /* list-wildcards */,
+                         '"', '\\' /* quoted-specials */, ']' /* resp-specials */}) {
+        table[static_cast<unsigned char>(c)] = false;
+    }
+    return table;
+}
+
+const std::array<bool, 256> atomChars = makeAtomCharTable();
+
+inline bool isQuotedSpecial(const char c)
+{
+    return c == '"' || c == '\\' || c == '\r' || c == '\n';
+}
+
+}
+
+namespace Imap
+{
+namespace LowLevelParser
+{
+
+const char *skipAtomCharsScalar(const char *begin, const char *end)
+{
+    while (begin != end && atomChars[static_cast<unsigned char>(*begin)])
+        ++begin;
+    return begin;
+}
+
+const char *findQuotedSpecialScalar(const char *begin, const char *end)
+{
+    while (begin != end && !isQuotedSpecial(*begin))
+        ++begin;
+    return begin;
+}
+
+#ifdef TROJITA_SCANNERS_SSE2
+
+// These check 16 bytes at once. SSE2 is always available on x86_64, so there's no need for any runtime dispatching.
+// The tail which doesn't fill a whole vector is handled by the scalar code.
+
+const char *skipAtomChars(const char *begin, const char *end)
+{
+    const __m128i firstPrintable = _mm_set1_epi8(0x21);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i parenOpen = _mm_set1_epi8('(');
+    const __m128i parenClose = _mm_set1_epi8(')');
+    const __m128i curly = _mm_set1_epi8('{');
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i asterisk = _mm_set1_epi8('*');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i bracket = _mm_set1_epi8(']');
+    while (end - begin >= 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+        // The comparison is signed, which means that the 8-bit characters are caught by this as well
+        __m128i stop = _mm_or_si128(_mm_cmplt_epi8(v, firstPrintable), _mm_cmpeq_epi8(v, del));
+        stop = _mm_or_si128(stop, _mm_or_si128(_mm_cmpeq_epi8(v, parenOpen), _mm_cmpeq_epi8(v, parenClose)));
+        stop = _mm_or_si128(stop, _mm_or_si128(_mm_cmpeq_epi8(v, curly), _mm_cmpeq_epi8(v, percent)));
+        stop = _mm_or_si128(stop, _mm_or_si128(_mm_cmpeq_epi8(v, asterisk), _mm_cmpeq_epi8(v, quote)));
+        stop = _mm_or_si128(stop, _mm_or_si128(_mm_cmpeq_epi8(v, backslash), _mm_cmpeq_epi8(v, bracket)));
+        const uint mask = static_cast<uint>(_mm_movemask_epi8(stop));
+        if (mask)
+            return begin + qCountTrailingZeroBits(mask);
+        begin += 16;
+    }
+    return skipAtomCharsScalar(begin, end);
+}
+
+const char *findQuotedSpecial(const char *begin, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - begin >= 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+        const __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                          _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        const uint mask = static_cast<uint>(_mm_movemask_epi8(stop));
+        if (mask)
+            return begin + qCountTrailingZeroBits(mask);
+        begin += 16;
+    }
+    return findQuotedSpecialScalar(begin, end);
+}
+
+#else
+
+const char *skipAtomChars(const char *begin, const char *end)
+{
+    return skipAtomCharsScalar(begin, end);
+}
+
+const char *findQuotedSpecial(const char *begin, const char *end)
+{
+    return findQuotedSpecialScalar(begin, end);
+}
+
+#endif
+
+}
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef IMAP_CHARSCANNERS_H
+#define IMAP_CHARSCANNERS_H
+
+namespace Imap
+{
+namespace LowLevelParser
+{
+
+/** @short Return a pointer to the first character in [begin, end) which cannot be a part of an atom, or end
+
+The atom-chars are the printable ASCII characters except for the atom-specials, list-wildcards, quoted-specials and
+resp-specials, just like RFC 3501 says.
+*/
+const char *skipAtomChars(const char *begin, const char *end);
+
+/** @short Return a pointer to the first quote, backslash, CR or LF in [begin, end), or end */
+const char *findQuotedSpecial(const char *begin, const char *end);
+
+/** @short Plain, byte-by-byte implementation of skipAtomChars(), useful for verifying the optimized one */
+const char *skipAtomCharsScalar(const char *begin, const char *end);
+
+/** @short Plain, byte-by-byte implementation of findQuotedSpecial(), useful for verifying the optimized one */
+const char *findQuotedSpecialScalar(const char *begin, const char *end);
+
+}
+}
+
+#endif
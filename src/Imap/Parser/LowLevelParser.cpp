@@ -30,6 +30,7 @@
 #include <QStringList>
 #include <QVariant>
 #include <QDateTime>
+#include "CharScanners.h"
 #include "LowLevelParser.h"
 #include "../Exceptions.h"
 #include "Imap/Encoders.h"
@@ -116,13 +117,8 @@ QByteArray getAtom(const QByteArray &line, int &start)
     if (start == line.size())
         throw NoData("getAtom: no data", line, start);
 
-    const char *c_str = line.constData();
-    c_str += start;
-    const char * const old_str = c_str;
-
-    while (C_STR_CHECK_FOR_ATOM_CHARS) {
-        ++c_str;
-    }
+    const char * const old_str = line.constData() + start;
+    const char *c_str = skipAtomChars(old_str, line.constData() + line.size());
 
     auto size = c_str - old_str;
     if (!size)
@@ -144,9 +140,7 @@ QByteArray getPossiblyBackslashedAtom(const QByteArray &line, int &start)
     if (*c_str == '\\')
         ++c_str;
 
-    while (C_STR_CHECK_FOR_ATOM_CHARS) {
-        ++c_str;
-    }
+    c_str = skipAtomChars(c_str, line.constData() + line.size());
 
     auto size = c_str - old_str;
     if (!size)
@@ -163,12 +157,24 @@ QPair<QByteArray,ParsedAs> getString(const QByteArray &line, int &start)
     if (line[start] == '"') {
         // quoted string
         ++start;
-        bool escaping = false;
         QByteArray res;
-        bool terminated = false;
-        while (start != line.size() && !terminated) {
-            if (escaping) {
-                escaping = false;
+        const char * const begin = line.constData();
+        const char * const end = begin + line.size();
+        while (true) {
+            // Copy everything up to the next special character at once
+            const char *special = findQuotedSpecial(begin + start, end);
+            res.append(begin + start, special - (begin + start));
+            start = special - begin;
+            if (special == end)
+                throw NoData("getString: unterminated quoted string", line, start);
+            switch (*special) {
+            case '"':
+                ++start;
+                return qMakePair(res, QUOTED);
+            case '\\':
+                ++start;
+                if (start == line.size())
+                    throw NoData("getString: unterminated quoted string", line, start);
                 if (line[start] == '"' || line[start] == '\\') {
                     res.append(line[start]);
                 } else if (line[start] == '(' || line[start] == ')') {
@@ -180,25 +186,12 @@ QPair<QByteArray,ParsedAs> getString(const QByteArray &line, int &start)
                 } else {
                     throw UnexpectedHere("getString: escaping invalid character", line, start);
                 }
-            } else {
-                switch (line[start]) {
-                case '"':
-                    terminated = true;
-                    break;
-                case '\\':
-                    escaping = true;
-                    break;
-                case '\r': case '\n':
-                    throw ParseError("getString: premature end of quoted string", line, start);
-                default:
-                    res.append(line[start]);
-                }
+                ++start;
+                break;
+            default:
+                throw ParseError("getString: premature end of quoted string", line, start);
             }
-            ++start;
         }
-        if (!terminated)
-            throw NoData("getString: unterminated quoted string", line, start);
-        return qMakePair(res, QUOTED);
     } else if (line[start] == '{') {
         // literal
         ++start;
@@ -242,9 +235,7 @@ QPair<QByteArray,ParsedAs> getAString(const QByteArray &line, int &start)
         bool gotRespSpecials = false;
 
         while (true) {
-            while (C_STR_CHECK_FOR_ATOM_CHARS) {
-                ++c_str;
-            }
+            c_str = skipAtomChars(c_str, line.constData() + line.size());
             if (*c_str == ']' /* got to explicitly allow resp-specials again...*/ ) {
                 ++c_str;
                 gotRespSpecials = true;
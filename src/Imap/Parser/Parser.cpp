@@ -568,6 +568,16 @@ CommandHandle Parser::enable(const QList<QByteArray> &extensions)
     return queueCommand(cmd);
 }
 
+CommandHandle Parser::notifySet(const QList<QByteArray> &eventGroups)
+{
+    Commands::Command cmd("NOTIFY");
+    cmd << Commands::PartOfCommand(Commands::ATOM, "SET");
+    Q_FOREACH(const QByteArray &item, eventGroups) {
+        cmd << Commands::PartOfCommand(Commands::ATOM, item);
+    }
+    return queueCommand(cmd);
+}
+
 CommandHandle Parser::genUrlAuth(const QByteArray &url, const QByteArray mechanism)
 {
     Commands::Command cmd("GENURLAUTH");
@@ -675,9 +685,7 @@ void Parser::handleReadyRead()
             break;
         case ReadingNumberOfBytes:
         {
-            QByteArray buf = socket->read(readingBytes);
-            readingBytes -= buf.size();
-            currentLine += buf;
+            readingBytes -= socket->readInto(currentLine, readingBytes);
             if (readingBytes == 0) {
                 // we've read the literal
                 readingMode = ReadingLine;
@@ -693,7 +701,7 @@ void Parser::handleReadyRead()
 void Parser::reallyReadLine()
 {
     try {
-        currentLine += socket->readLine();
+        socket->readLineInto(currentLine);
         if (currentLine.endsWith("}\r\n")) {
             int offset = currentLine.lastIndexOf('{');
             if (offset < oldLiteralPosition)
@@ -707,6 +715,9 @@ void Parser::reallyReadLine()
             oldLiteralPosition = offset;
             readingMode = ReadingNumberOfBytes;
             readingBytes = number;
+            // Make room for the literal at once instead of growing the buffer as its pieces arrive. The server
+            // could announce anything, though, so don't preallocate more than what a sane message part needs.
+            currentLine.reserve(currentLine.size() + qMin(number, 64 * 1024 * 1024) + 2);
         } else if (currentLine.endsWith("\r\n")) {
             // it's complete
             if (startTlsInProgress && currentLine.startsWith(startTlsCommand)) {
@@ -734,6 +745,8 @@ void Parser::executeCommands()
            ! waitingForConnection && ! waitingForEncryption && ! waitingForSslPolicy &&
            ! cmdQueue.empty() && ! startTlsInProgress && !compressDeflateInProgress)
         executeACommand();
+    // Pipelined commands share a single compressed block; the server only needs to see it once we start waiting
+    socket->flush();
 }
 
 void Parser::finishStartTls()
@@ -270,6 +270,12 @@ public slots:
     /** @short ENABLE command, RFC 6151 */
     CommandHandle enable(const QList<QByteArray> &extensions);
 
+    /** @short NOTIFY SET, RFC 5465
+
+    Each item of the @arg eventGroups is a parenthesized list of a mailbox filter and the events to report.
+    */
+    CommandHandle notifySet(const QList<QByteArray> &eventGroups);
+
     /** @short COMPRESS DEFLATE, RFC 4978 */
     CommandHandle compressDeflate();
 
@@ -779,6 +779,41 @@ ESearch::ESearch(const QByteArray &line, int &start): seqOrUids(SEQUENCE)
             }
             incThreadData.push_back(IncrementalThreadingItem_t(previousRoot, node.children));
             LowLevelParser::eatSpaces(line, start);
+        } else if (label == "PARTIAL") {
+            // RFC 9394: PARTIAL (low:high sequence-set-or-NIL)
+
+            if (start >= line.size() - 2)
+                throw NoData("ESEARCH PARTIAL: no data", line, start);
+
+            if (line[start] != '(')
+                throw UnexpectedHere("ESEARCH PARTIAL: missing '('", line, start);
+            ++start;
+
+            const QByteArray range = LowLevelParser::getAtom(line, start);
+            const int colon = range.indexOf(':');
+            if (colon == -1)
+                throw ParseError("ESEARCH PARTIAL: malformed range", line, start);
+            bool okLow, okHigh;
+            const int low = range.left(colon).toInt(&okLow);
+            const int high = range.mid(colon + 1).toInt(&okHigh);
+            if (!okLow || !okHigh || !low || !high || (low < 0) != (high < 0))
+                throw ParseError("ESEARCH PARTIAL: malformed range", line, start);
+            LowLevelParser::eatSpaces(line, start);
+
+            Uids uids;
+            if (line.mid(start, 3).toUpper() == "NIL") {
+                start += 3;
+            } else {
+                uids = LowLevelParser::getSequence(line, start);
+            }
+            LowLevelParser::eatSpaces(line, start);
+
+            if (start >= line.size() - 2 || line[start] != ')')
+                throw UnexpectedHere("ESEARCH PARTIAL: missing ')'", line, start);
+            ++start;
+
+            partialData.push_back(PartialItem_t(low, high, uids));
+            LowLevelParser::eatSpaces(line, start);
         } else {
             // A generic case: be prepapred to accept a (sequence of) numbers
 
@@ -1194,6 +1229,13 @@ QTextStream &ESearch::dump(QTextStream &stream) const
         node.children = it->thread;
         stream << "INCTHREAD " << it->previousThreadRoot << " [THREAD parsed-into-sane-form follows] " << threadDumpHelper(node) << " ";
     }
+    for (PartialData_t::const_iterator it = partialData.constBegin(); it != partialData.constEnd(); ++it) {
+        stream << "PARTIAL (" << it->low << ":" << it->high << " ";
+        Q_FOREACH(const uint num, it->uids) {
+            stream << num << ' ';
+        }
+        stream << ") ";
+    }
     return stream;
 }
 
@@ -1446,7 +1488,8 @@ bool ESearch::eq(const AbstractResponse &other) const
     try {
         const ESearch &s = dynamic_cast<const ESearch &>(other);
         return tag == s.tag && seqOrUids == s.seqOrUids && listData == s.listData &&
-                incrementalContextData == s.incrementalContextData && incThreadData == s.incThreadData;
+                incrementalContextData == s.incrementalContextData && incThreadData == s.incThreadData &&
+                partialData == s.partialData;
     } catch (std::bad_cast &) {
         return false;
     }
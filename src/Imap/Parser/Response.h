@@ -478,6 +478,29 @@ public:
     /** @short The threading information, draft-imap-incthread */
     IncrementalThreadingData_t incThreadData;
 
+    /** @short A window into the result set as returned through the PARTIAL return option of RFC 9394 */
+    struct PartialItem_t {
+        /** @short One-based position of the first item of the window, negative when counting from the end */
+        int low;
+
+        /** @short One-based position of the last item of the window, negative when counting from the end */
+        int high;
+
+        /** @short Matching UIDs within the window, in the order of the full result */
+        Uids uids;
+
+        PartialItem_t(const int low, const int high, const Uids &uids): low(low), high(high), uids(uids) {}
+
+        bool operator==(const PartialItem_t &other) const {
+            return low == other.low && high == other.high && uids == other.uids;
+        }
+    };
+
+    typedef QList<PartialItem_t> PartialData_t;
+
+    /** @short The windows into the result set, RFC 9394 */
+    PartialData_t partialData;
+
     // Other forms of returned data are quite explicitly not supported.
 
     ESearch(const QByteArray &line, int &start);
@@ -487,6 +510,8 @@ public:
         tag(tag), seqOrUids(seqOrUids), incrementalContextData(incrementalContextData) {}
     ESearch(const QByteArray &tag, const SequencesOrUids seqOrUids, const IncrementalThreadingData_t &incThreadData):
         tag(tag), seqOrUids(seqOrUids), incThreadData(incThreadData) {}
+    ESearch(const QByteArray &tag, const SequencesOrUids seqOrUids, const ListData_t &listData, const PartialData_t &partialData):
+        tag(tag), seqOrUids(seqOrUids), listData(listData), partialData(partialData) {}
     QTextStream &dump(QTextStream &stream) const override;
     bool eq(const AbstractResponse &other) const override;
     void plug(Imap::Parser *parser, Imap::Mailbox::Model *model) const override;
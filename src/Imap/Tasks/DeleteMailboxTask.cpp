@@ -92,6 +92,7 @@ bool DeleteMailboxTask::handleStateHelper(const Imap::Responses::State *const re
                     resp->message;
                 log(buf);
             }
+            model->removeFromMailboxTreeSnapshot(mailbox);
             EMIT_LATER(model, mailboxDeletionSucceded, Q_ARG(QString, mailbox));
             _completed();
         } else {
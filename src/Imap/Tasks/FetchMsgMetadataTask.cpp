@@ -32,12 +32,15 @@ namespace Imap
 namespace Mailbox
 {
 
-FetchMsgMetadataTask::FetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids) :
-    ImapTask(model), mailbox(mailbox), uids(uids)
+FetchMsgMetadataTask::FetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids,
+                                           const MetadataFetchPhase phase) :
+    ImapTask(model), mailbox(mailbox), uids(uids), phase(phase)
 {
     Q_ASSERT(!uids.isEmpty());
     conn = model->findTaskResponsibleFor(mailbox);
     conn->addDependentTask(this);
+    if (phase == METADATA_BODYSTRUCTURE)
+        connect(this, &ImapTask::failed, this, &FetchMsgMetadataTask::forgetBodyStructureRequests);
 }
 
 void FetchMsgMetadataTask::perform()
@@ -50,8 +53,23 @@ void FetchMsgMetadataTask::perform()
     Sequence seq = Sequence::fromVector(uids);
 
     // we do not want to use _onlineMessageFetch because it contains UID and FLAGS
-    tag = parser->uidFetch(seq, QList<QByteArray>() << "ENVELOPE" << "INTERNALDATE" <<
-                           "BODYSTRUCTURE" << "RFC822.SIZE" << "BODY.PEEK[HEADER.FIELDS (References List-Post)]");
+    QList<QByteArray> items;
+    switch (phase) {
+    case METADATA_FULL:
+        items << "ENVELOPE" << "INTERNALDATE" << "BODYSTRUCTURE" << "RFC822.SIZE"
+              << "BODY.PEEK[HEADER.FIELDS (References List-Post)]";
+        break;
+    case METADATA_LIST:
+        // The BODYSTRUCTURE is often the biggest item by far, and the message list does not need it. The Content-Type
+        // is a cheap hint for the attachment indicator until the real structure arrives.
+        items << "ENVELOPE" << "INTERNALDATE" << "RFC822.SIZE"
+              << "BODY.PEEK[HEADER.FIELDS (References List-Post Content-Type)]";
+        break;
+    case METADATA_BODYSTRUCTURE:
+        items << "BODYSTRUCTURE";
+        break;
+    }
+    tag = parser->uidFetch(seq, items);
 }
 
 bool FetchMsgMetadataTask::handleFetch(const Imap::Responses::Fetch *const resp)
@@ -96,9 +114,28 @@ QString FetchMsgMetadataTask::debugIdentification() const
                                                 QString::fromUtf8(Sequence::fromVector(uids).toByteArray()));
 }
 
+/** @short The BODYSTRUCTURE won't arrive through this task, so the next one who needs it shall ask again */
+void FetchMsgMetadataTask::forgetBodyStructureRequests()
+{
+    if (!mailbox.isValid())
+        return;
+
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailbox.internalPointer()));
+    Q_ASSERT(mailboxPtr);
+    Q_FOREACH(TreeItemMessage *message, model->findMessagesByUids(mailboxPtr, uids)) {
+        if (!message->data()->gotRemeberedBodyStructure()) {
+            message->data()->setBodyStructureRequested(false);
+            QModelIndex idx = message->toIndex(model);
+            emit model->dataChanged(idx, idx);
+        }
+    }
+}
+
 QVariant FetchMsgMetadataTask::taskData(const int role) const
 {
-    return role == RoleTaskCompactName ? QVariant(tr("Downloading headers")) : QVariant();
+    if (role != RoleTaskCompactName)
+        return QVariant();
+    return phase == METADATA_BODYSTRUCTURE ? QVariant(tr("Downloading message structure")) : QVariant(tr("Downloading headers"));
 }
 
 }
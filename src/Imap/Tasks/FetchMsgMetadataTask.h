@@ -25,6 +25,7 @@
 
 #include <QPersistentModelIndex>
 #include "ImapTask.h"
+#include "Imap/Model/MetadataFetchPhase.h"
 
 namespace Imap
 {
@@ -36,7 +37,7 @@ class FetchMsgMetadataTask : public ImapTask
 {
     Q_OBJECT
 public:
-    FetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids);
+    FetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids, const MetadataFetchPhase phase);
     void perform() override;
 
     bool handleFetch(const Imap::Responses::Fetch *const resp) override;
@@ -45,11 +46,14 @@ public:
     QString debugIdentification() const override;
     QVariant taskData(const int role) const override;
     bool needsMailbox() const override {return true;}
+protected:
+    void forgetBodyStructureRequests();
 private:
     CommandHandle tag;
     ImapTask *conn;
     QPersistentModelIndex mailbox;
     Imap::Uids uids;
+    MetadataFetchPhase phase;
 };
 
 }
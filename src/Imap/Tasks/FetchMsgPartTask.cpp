@@ -147,7 +147,12 @@ void FetchMsgPartTask::markPendingItemsUnavailable()
                 .arg(QString::fromUtf8(partId), QString::number(uid)), Common::LOG_MESSAGES);
             return;
         }
-        if (part->loading()) {
+        if (part->loading() && part->m_partialFetch && partId.endsWith('>')
+                && part->m_partialFetch->rawBytes > partId.mid(partId.lastIndexOf('<') + 1).split('.').first().toLongLong()) {
+            // This chunk has arrived and the part is now waiting for the next one
+            log(QStringLiteral("Fetched chunk %1 for UID %2").arg(QString::fromUtf8(partId), QString::number(uid)),
+                Common::LOG_MESSAGES);
+        } else if (part->loading()) {
             log(QStringLiteral("Received no data for part %1 UID %2").arg(QString::fromUtf8(partId), QString::number(uid)),
                 Common::LOG_MESSAGES);
             markPartUnavailable(part);
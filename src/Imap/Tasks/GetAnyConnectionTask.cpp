@@ -37,14 +37,20 @@ GetAnyConnectionTask::GetAnyConnectionTask(Model *model) :
 {
     QMap<Parser *,ParserState>::iterator it = model->m_parsers.begin();
     while (it != model->m_parsers.end()) {
-        if (it->connState == CONN_STATE_LOGOUT) {
-            // We cannot possibly use this connection
+        if (it->connState == CONN_STATE_LOGOUT || it->backgroundSync) {
+            // We cannot possibly use this connection, or we would rather not
             ++it;
         } else {
             // we've found it
             break;
         }
     }
+    if (it == model->m_parsers.end()) {
+        // A connection for the background synchronization is still better than a completely new one
+        it = model->m_parsers.begin();
+        while (it != model->m_parsers.end() && it->connState == CONN_STATE_LOGOUT)
+            ++it;
+    }
 
     if (it == model->m_parsers.end()) {
         // We're creating a completely new connection
@@ -20,6 +20,7 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <sstream>
 #include "KeepMailboxOpenTask.h"
 #include "Common/InvokeMethod.h"
@@ -46,7 +47,8 @@ namespace Mailbox
 
 KeepMailboxOpenTask::KeepMailboxOpenTask(Model *model, const QModelIndex &mailboxIndex, Parser *oldParser) :
     ImapTask(model), mailboxIndex(mailboxIndex), synchronizeConn(0), shouldExit(false), isRunning(Running::NOT_YET),
-    shouldRunNoop(false), shouldRunIdle(false), idleLauncher(0), unSelectTask(0),
+    shouldRunNoop(false), shouldRunIdle(false), idleLauncher(0), requestedFlagsFocus(0), requestedFlagsResumeAt(0),
+    unSelectTask(0),
     m_skippedStateSynces(0), m_performedStateSynces(0), m_syncingTimer(nullptr)
 {
     Q_ASSERT(mailboxIndex.isValid());
@@ -135,6 +137,11 @@ KeepMailboxOpenTask::KeepMailboxOpenTask(Model *model, const QModelIndex &mailbo
     fetchEnvelopeTimer->setInterval(0); // message metadata is pretty important, hence an immediate fetch
     fetchEnvelopeTimer->setSingleShot(true);
 
+    fetchFlagsTimer = new QTimer(this);
+    connect(fetchFlagsTimer, &QTimer::timeout, this, &KeepMailboxOpenTask::slotFetchRequestedFlags);
+    fetchFlagsTimer->setInterval(0);
+    fetchFlagsTimer->setSingleShot(true);
+
     limitBytesAtOnce = model->property("trojita-imap-limit-fetch-bytes-per-group").toUInt(&ok);
     if (! ok)
         limitBytesAtOnce = 1024 * 1024;
@@ -143,6 +150,10 @@ KeepMailboxOpenTask::KeepMailboxOpenTask(Model *model, const QModelIndex &mailbo
     if (! ok)
         limitMessagesAtOnce = 300;
 
+    limitFlagsAtOnce = model->property("trojita-imap-limit-fetch-flags-per-group").toInt(&ok);
+    if (! ok)
+        limitFlagsAtOnce = 1000;
+
     limitParallelFetchTasks = model->property("trojita-imap-limit-parallel-fetch-tasks").toInt(&ok);
     if (! ok)
         limitParallelFetchTasks = 10;
@@ -208,6 +219,8 @@ void KeepMailboxOpenTask::addDependentTask(ImapTask *task)
         // Before we can die, though, we have to accommodate fetch requests for all envelopes and parts queued so far.
         slotFetchRequestedEnvelopes();
         slotFetchRequestedParts();
+        // The background refresh of FLAGS is not worth keeping us alive; the next sync will take care of that
+        requestedFlags.clear();
 
         if (! hasPendingInternalActions() && (! synchronizeConn || synchronizeConn->isFinished())) {
             QTimer::singleShot(0, this, SLOT(terminate()));
@@ -310,6 +323,7 @@ void KeepMailboxOpenTask::terminate()
     Q_ASSERT(dependingTasksNoMailbox.isEmpty());
     Q_ASSERT(requestedParts.isEmpty());
     Q_ASSERT(requestedEnvelopes.isEmpty());
+    Q_ASSERT(requestedBodyStructures.isEmpty());
     Q_ASSERT(runningTasksForThisMailbox.isEmpty());
     Q_ASSERT(abortableTasks.isEmpty());
     Q_ASSERT(!m_syncingTimer->isActive());
@@ -372,6 +386,7 @@ void KeepMailboxOpenTask::perform()
 
     if (!waitingObtainTasks.isEmpty()) {
         shouldExit = true;
+        requestedFlags.clear();
     }
 
     activateTasks();
@@ -602,6 +617,20 @@ bool KeepMailboxOpenTask::handleStateHelper(const Imap::Responses::State *const
         slotTaskDeleted(0);
         model->m_taskModel->slotTaskMighHaveChanged(this);
         return true;
+    } else if (resp->tag == tagFlagsResync) {
+        tagFlagsResync.clear();
+        if (resp->kind == Responses::OK) {
+            saveFlagsResyncCursor();
+        } else {
+            // Not fatal, these messages just keep showing their cached flags, and the saved cursor stays where it was
+            log(QLatin1String("Background FLAGS refresh failed: ") + resp->message, Common::LOG_MAILBOX_SYNC);
+            requestedFlags.clear();
+            requestedFlagsResumeAt = 0;
+        }
+        // Continue with the next chunk, or resume IDLE when we're done
+        slotTaskDeleted(0);
+        model->m_taskModel->slotTaskMighHaveChanged(this);
+        return true;
     } else if (resp->tag == tagClose) {
         tagClose.clear();
         model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
@@ -767,6 +796,9 @@ void KeepMailboxOpenTask::activateTasks()
         task->perform();
     }
 
+    if (!requestedFlags.isEmpty())
+        fetchFlagsTimer->start();
+
     if (idleLauncher && canRunIdleRightNow())
         idleLauncher->enterIdleLater();
 }
@@ -788,6 +820,37 @@ void KeepMailboxOpenTask::requestEnvelopeDownload(const uint uid)
     }
 }
 
+void KeepMailboxOpenTask::requestBodyStructureDownload(const uint uid)
+{
+    requestedBodyStructures.append(uid);
+    if (!fetchEnvelopeTimer->isActive()) {
+        fetchEnvelopeTimer->start();
+    }
+}
+
+void KeepMailboxOpenTask::requestFlagsResync(const Imap::Uids &uids, const uint resumeAt)
+{
+    requestedFlags += uids;
+    std::sort(requestedFlags.begin(), requestedFlags.end());
+    requestedFlags.erase(std::unique(requestedFlags.begin(), requestedFlags.end()), requestedFlags.end());
+    if (resumeAt)
+        requestedFlagsResumeAt = resumeAt;
+    saveFlagsResyncCursor();
+    if (isRunning == Running::RUNNING && !fetchFlagsTimer->isActive()) {
+        fetchFlagsTimer->start();
+    }
+}
+
+void KeepMailboxOpenTask::prioritizeFlagsResync(const uint uid)
+{
+    if (requestedFlags.isEmpty())
+        return;
+    requestedFlagsFocus = uid;
+    if (isRunning == Running::RUNNING && !fetchFlagsTimer->isActive()) {
+        fetchFlagsTimer->start();
+    }
+}
+
 void KeepMailboxOpenTask::slotFetchRequestedParts()
 {
     // FIXME: abort/die
@@ -823,21 +886,98 @@ void KeepMailboxOpenTask::slotFetchRequestedEnvelopes()
 {
     // FIXME: abort/die
 
-    if (requestedEnvelopes.isEmpty())
+    if (requestedEnvelopes.isEmpty() && requestedBodyStructures.isEmpty())
         return;
 
     breakOrCancelPossibleIdle();
 
-    Imap::Uids fetchNow;
-    if (shouldExit) {
-        fetchNow = requestedEnvelopes;
-        requestedEnvelopes.clear();
-    } else {
-        const int amount = qMin(requestedEnvelopes.size(), limitMessagesAtOnce); // FIXME: add an extra limit?
-        fetchNow = requestedEnvelopes.mid(0, amount);
-        requestedEnvelopes.erase(requestedEnvelopes.begin(), requestedEnvelopes.begin() + amount);
+    auto takeBatch = [this](Imap::Uids &queue) {
+        Imap::Uids fetchNow;
+        if (shouldExit) {
+            fetchNow = queue;
+            queue.clear();
+        } else {
+            const int amount = qMin(queue.size(), limitMessagesAtOnce); // FIXME: add an extra limit?
+            fetchNow = queue.mid(0, amount);
+            queue.erase(queue.begin(), queue.begin() + amount);
+        }
+        return fetchNow;
+    };
+
+    if (!requestedEnvelopes.isEmpty()) {
+        fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(
+                                  model, mailboxIndex, takeBatch(requestedEnvelopes),
+                                  model->deferBodyStructure() ? METADATA_LIST : METADATA_FULL);
+    }
+    if (!requestedBodyStructures.isEmpty()) {
+        fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(
+                                  model, mailboxIndex, takeBatch(requestedBodyStructures), METADATA_BODYSTRUCTURE);
+    }
+}
+
+void KeepMailboxOpenTask::slotFetchRequestedFlags()
+{
+    if (isRunning != Running::RUNNING || shouldExit || requestedFlags.isEmpty() || !tagFlagsResync.isEmpty())
+        return;
+
+    // This is a background activity, so let anything the user is waiting for go first. We'll get called again from
+    // activateTasks() once these finish.
+    if (!dependingTasksForThisMailbox.isEmpty() || !dependingTasksNoMailbox.isEmpty() || !newArrivalsFetch.isEmpty() ||
+            !fetchPartTasks.isEmpty() || !fetchMetadataTasks.isEmpty() || !requestedEnvelopes.isEmpty() ||
+            !requestedBodyStructures.isEmpty() || !requestedParts.isEmpty())
+        return;
+
+    breakOrCancelPossibleIdle();
+
+    // Without a hint, the newest messages go first because that's where the user is most likely looking at. A refresh
+    // which got interrupted the last time continues where it stopped, though, and only then wraps around to the top.
+    int end = requestedFlags.size();
+    if (requestedFlagsResumeAt) {
+        end = std::upper_bound(requestedFlags.begin(), requestedFlags.end(), requestedFlagsResumeAt) - requestedFlags.begin();
+        if (end == 0) {
+            requestedFlagsResumeAt = 0;
+            end = requestedFlags.size();
+        }
+    }
+    if (requestedFlagsFocus) {
+        const int focus = std::lower_bound(requestedFlags.begin(), requestedFlags.end(), requestedFlagsFocus) - requestedFlags.begin();
+        end = qMin(requestedFlags.size(), qMax(focus + limitFlagsAtOnce / 2, qMin(requestedFlags.size(), limitFlagsAtOnce)));
+        requestedFlagsFocus = 0;
+    }
+    const int begin = qMax(0, end - limitFlagsAtOnce);
+    Imap::Uids fetchNow = requestedFlags.mid(begin, end - begin);
+    requestedFlags.erase(requestedFlags.begin() + begin, requestedFlags.begin() + end);
+    tagFlagsResync = parser->uidFetch(Sequence::fromVector(fetchNow), QList<QByteArray>() << "FLAGS");
+    model->m_taskModel->slotTaskMighHaveChanged(this);
+}
+
+void KeepMailboxOpenTask::saveFlagsResyncCursor()
+{
+    if (!mailboxIndex.isValid())
+        return;
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
+    Q_ASSERT(mailbox);
+
+    // That's where the next chunk starts when nobody asks for a particular message
+    uint cursor = 0;
+    if (!requestedFlags.isEmpty()) {
+        cursor = requestedFlags.last();
+        if (requestedFlagsResumeAt) {
+            auto it = std::upper_bound(requestedFlags.begin(), requestedFlags.end(), requestedFlagsResumeAt);
+            if (it != requestedFlags.begin())
+                cursor = *(it - 1);
+        }
+    }
+    mailbox->syncState.setFlagsResyncCursor(cursor);
+
+    if (isRunning == Running::RUNNING) {
+        // The in-memory state might be in the middle of processing some new arrivals, so only the cursor is updated
+        SyncState state = model->cache()->mailboxSyncState(mailbox->mailbox());
+        if (state.isUsableForSyncing() && state.flagsResyncCursor() != cursor) {
+            state.setFlagsResyncCursor(cursor);
+            model->cache()->setMailboxSyncState(mailbox->mailbox(), state);
+        }
     }
-    fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
 }
 
 void KeepMailboxOpenTask::breakOrCancelPossibleIdle()
@@ -972,7 +1112,9 @@ bool KeepMailboxOpenTask::hasPendingInternalActions() const
 {
     bool hasToWaitForIdleTermination = idleLauncher ? idleLauncher->waitingForIdleTaggedTermination() : false;
     return !(dependingTasksForThisMailbox.isEmpty() && dependingTasksNoMailbox.isEmpty() && runningTasksForThisMailbox.isEmpty() &&
-             requestedParts.isEmpty() && requestedEnvelopes.isEmpty() && newArrivalsFetch.isEmpty()) || hasToWaitForIdleTermination;
+             requestedParts.isEmpty() && requestedEnvelopes.isEmpty() && requestedBodyStructures.isEmpty() &&
+             newArrivalsFetch.isEmpty() &&
+             tagFlagsResync.isEmpty()) || hasToWaitForIdleTermination;
 }
 
 /** @short Returns true if this task can be safely terminated
@@ -988,7 +1130,8 @@ bool KeepMailboxOpenTask::isReadyToTerminate() const
 bool KeepMailboxOpenTask::canRunIdleRightNow() const
 {
     bool res = shouldRunIdle && dependingTasksForThisMailbox.isEmpty() &&
-            dependingTasksNoMailbox.isEmpty() && newArrivalsFetch.isEmpty();
+            dependingTasksNoMailbox.isEmpty() && newArrivalsFetch.isEmpty() &&
+            requestedFlags.isEmpty() && tagFlagsResync.isEmpty();
 
     // If there's just one active tasks, it's the "this" one. If there are more of them, let's see if it's just one more
     // and that one more thing is a SortTask which is in the "just updating" mode.
@@ -1120,6 +1263,11 @@ bool KeepMailboxOpenTask::hasItsOwnActivity() const
     return !newArrivalsFetch.isEmpty();
 }
 
+bool KeepMailboxOpenTask::isMailboxSynchronized() const
+{
+    return isRunning == Running::RUNNING && !shouldExit;
+}
+
 /** @short Signal the final termination of this task */
 void KeepMailboxOpenTask::finalizeTermination()
 {
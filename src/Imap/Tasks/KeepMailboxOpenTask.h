@@ -148,6 +148,17 @@ public:
     void requestPartDownload(const uint uid, const QByteArray &partId, const uint estimatedSize);
     /** @short Request a delayed loading of a message envelope */
     void requestEnvelopeDownload(const uint uid);
+    /** @short Request a delayed loading of a BODYSTRUCTURE which was left out when fetching the message metadata */
+    void requestBodyStructureDownload(const uint uid);
+    /** @short Queue a background refresh of FLAGS of the specified messages
+
+    The ObtainSynchronizedMailboxTask uses this when it cannot rely on CONDSTORE and the mailbox is too big to have all
+    of its flags re-fetched before the mailbox can be used. A non-zero @arg resumeAt is the cursor which was saved by an
+    earlier refresh which did not finish; the messages up to that UID go first, the rest is done afterwards.
+    */
+    void requestFlagsResync(const Imap::Uids &uids, const uint resumeAt = 0);
+    /** @short The FLAGS of this message are needed now, so the queued refresh should continue around this UID */
+    void prioritizeFlagsResync(const uint uid);
 
     QVariant taskData(const int role) const override;
 
@@ -159,6 +170,9 @@ public:
 
     bool hasItsOwnActivity() const;
 
+    /** @short Is the mailbox synchronized, and are we going to stay in it for the foreseeable future? */
+    bool isMailboxSynchronized() const;
+
 private slots:
     void slotTaskDeleted(QObject *object);
 
@@ -187,6 +201,10 @@ private slots:
     void slotFetchRequestedParts();
     /** @short Fetch the ENVELOPEs which were queued for later retrieval */
     void slotFetchRequestedEnvelopes();
+    /** @short Refresh the next chunk of FLAGS which were queued via requestFlagsResync() */
+    void slotFetchRequestedFlags();
+    /** @short Remember where the FLAGS refresh shall continue the next time this mailbox gets opened */
+    void saveFlagsResyncCursor();
 
     /** @short Something bad has happened to the connection, and we're no longer in that mailbox */
     void slotUnselected();
@@ -269,6 +287,7 @@ protected:
     QTimer *noopTimer;
     QTimer *fetchPartTimer;
     QTimer *fetchEnvelopeTimer;
+    QTimer *fetchFlagsTimer;
     bool shouldRunNoop;
     bool shouldRunIdle;
     IdleLauncher *idleLauncher;
@@ -278,6 +297,7 @@ protected:
     CommandHandle tagIdle;
     QList<CommandHandle> newArrivalsFetch;
     CommandHandle tagClose;
+    CommandHandle tagFlagsResync;
     friend class IdleLauncher;
     friend class ImapTask; // needs access to slotTaskDeleted()
     friend class ObtainSynchronizedMailboxTask; // needs access to slotUnSelectCompleted()
@@ -296,9 +316,18 @@ protected:
     not enough because of output sorting, threads etc etc.
     */
     Imap::Uids requestedEnvelopes;
+    /** @short UIDs of messages whose BODYSTRUCTURE was deferred and is needed now */
+    Imap::Uids requestedBodyStructures;
+    /** @short UIDs of messages whose FLAGS shall be refreshed in the background, sorted in ascending order */
+    Imap::Uids requestedFlags;
+    /** @short UID around which the next chunk of the FLAGS refresh should be taken, or zero for the newest messages */
+    uint requestedFlagsFocus;
+    /** @short Highest UID where the FLAGS refresh continues from an earlier session, or zero when it goes from the top */
+    uint requestedFlagsResumeAt;
 
     uint limitBytesAtOnce;
     int limitMessagesAtOnce;
+    int limitFlagsAtOnce;
     int limitParallelFetchTasks;
     int limitActiveTasks;
 
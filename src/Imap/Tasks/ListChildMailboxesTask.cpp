@@ -35,7 +35,8 @@ namespace Mailbox
 
 
 ListChildMailboxesTask::ListChildMailboxesTask(Model *model, const QModelIndex &mailbox):
-    ImapTask(model), mailboxIndex(mailbox), mailboxIsRootMailbox(!mailbox.isValid())
+    ImapTask(model), mailboxIndex(mailbox), mailboxIsRootMailbox(!mailbox.isValid()),
+    m_recursive(mailboxIsRootMailbox && model->recursiveMailboxListing())
 {
     Q_ASSERT(!mailbox.isValid() || dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailbox.internalPointer())));
     conn = model->m_taskFactory->createGetAnyConnectionTask(model);
@@ -63,7 +64,9 @@ void ListChildMailboxesTask::perform()
     Q_ASSERT(mailbox);
 
     QString mailboxName = mailbox->mailbox();
-    if (mailboxName.isNull())
+    if (m_recursive)
+        mailboxName = QStringLiteral("*");
+    else if (mailboxName.isNull())
         mailboxName = QStringLiteral("%");
     else
         mailboxName += mailbox->separator() + QLatin1Char('%');
@@ -93,7 +96,10 @@ bool ListChildMailboxesTask::handleStateHelper(const Imap::Responses::State *con
             Q_ASSERT(mailbox);
 
             if (resp->kind == Responses::OK) {
-                model->finalizeList(parser, mailbox);
+                if (m_recursive)
+                    model->finalizeRecursiveList(parser);
+                else
+                    model->finalizeList(parser, mailbox);
                 applyCachedStatus();
                 _completed();
             } else {
@@ -143,6 +149,8 @@ QString ListChildMailboxesTask::debugIdentification() const
 
     TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(model->translatePtr(mailboxIndex)));
     Q_ASSERT(mailbox);
+    if (m_recursive)
+        return QStringLiteral("Listing the whole mailbox hierarchy");
     return QStringLiteral("Listing stuff below mailbox %1").arg(mailbox->mailbox());
 }
 
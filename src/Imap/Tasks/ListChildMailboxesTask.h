@@ -54,6 +54,8 @@ protected:
     ImapTask *conn;
     QPersistentModelIndex mailboxIndex;
     bool mailboxIsRootMailbox;
+    /** @short Obtain all mailboxes through a single LIST "" "*" instead of just one level */
+    bool m_recursive;
     QList<Imap::Responses::Status*> m_pendingStatusResponses;
 };
 
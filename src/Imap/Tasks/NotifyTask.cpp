@@ -0,0 +1,81 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "NotifyTask.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/Model.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+NotifyTask::NotifyTask(Model *model, ImapTask *parentTask) :
+    ImapTask(model)
+{
+    parentTask->addDependentTask(this);
+}
+
+void NotifyTask::perform()
+{
+    parser = parentTask->parser;
+    markAsActiveTask();
+
+    IMAP_TASK_CHECK_ABORT_DIE;
+
+    // The selected mailbox is still kept up-to-date through the usual EXISTS/EXPUNGE/FETCH responses; SELECTED-DELAYED
+    // ensures that these never arrive in the middle of a command which refers to messages by their sequence numbers.
+    // All other mailboxes report their changes through STATUS.
+    const QByteArray events = "(MessageNew MessageExpunge FlagChange)";
+    tag = parser->notifySet(QList<QByteArray>()
+                            << "(SELECTED-DELAYED " + events + ")"
+                            << "(PERSONAL " + events + ")");
+}
+
+bool NotifyTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty())
+        return false;
+
+    if (resp->tag == tag) {
+
+        if (resp->kind == Responses::OK) {
+            model->accessParser(parser).notifyActive = true;
+        } else {
+            // Not a big deal, we'll just keep polling via STATUS
+            log(QLatin1String("NOTIFY failed: ") + resp->message);
+        }
+        _completed();
+        return true;
+    } else {
+        return false;
+    }
+}
+
+QVariant NotifyTask::taskData(const int role) const
+{
+    return role == RoleTaskCompactName ? QVariant(tr("Subscribing to mailbox notifications")) : QVariant();
+}
+
+
+}
+}
@@ -88,6 +88,13 @@ void ObtainSynchronizedMailboxTask::perform()
 
     msgList->setFetchStatus(TreeItem::LOADING);
 
+    // Any BODYSTRUCTURE requests which were queued for the previous connection to this mailbox are gone
+    Q_FOREACH(TreeItem *item, msgList->m_children) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+        if (message->m_data && !message->m_data->gotRemeberedBodyStructure())
+            message->m_data->setBodyStructureRequested(false);
+    }
+
     Q_ASSERT(model->m_parsers.contains(parser));
 
     oldSyncState = model->cache()->mailboxSyncState(mailbox->mailbox());
@@ -193,6 +200,7 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
             TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
             Q_ASSERT(mailbox);
             status = STATE_DONE;
+            flushPendingFlags(mailbox);
             log(QStringLiteral("Flags synchronized"), Common::LOG_MAILBOX_SYNC);
             notifyInterestingMessages(mailbox);
             flagsCmd.clear();
@@ -206,6 +214,8 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
             }
         } else {
             status = STATE_DONE;
+            if (TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex))
+                flushPendingFlags(mailbox);
             _failed(QLatin1String("Flags synchronization failed: ") + resp->message);
             // FIXME: UNSELECT?
         }
@@ -603,6 +613,28 @@ void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
         QMap<QByteArray, quint64> fetchModifier;
         fetchModifier["CHANGEDSINCE"] = oldSyncState.highestModSeq();
         flagsCmd = parser->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QStringLiteral("FLAGS"), fetchModifier);
+    } else if (keepTaskChild && oldSyncState.isUsableForSyncing() &&
+               oldSyncState.uidValidity() == mailbox->syncState.uidValidity() &&
+               list->m_children.size() > keepTaskChild->limitFlagsAtOnce) {
+        // Without CONDSTORE, refreshing all FLAGS of a huge mailbox takes ages. The cached flags are good enough for
+        // a start, so only the newest messages are refreshed now and the rest is left to the KeepMailboxOpenTask.
+        // Messages which have arrived since the last time have no cached flags at all, and therefore always go first.
+        int firstOffset = list->m_children.size() - keepTaskChild->limitFlagsAtOnce;
+        while (firstOffset > 0 && static_cast<TreeItemMessage *>(list->m_children[firstOffset - 1])->uid() >= oldSyncState.uidNext())
+            --firstOffset;
+        if (firstOffset > 0) {
+            Imap::Uids backgroundUids;
+            backgroundUids.reserve(firstOffset);
+            for (int i = 0; i < firstOffset; ++i) {
+                TreeItemMessage *message = static_cast<TreeItemMessage *>(list->m_children[i]);
+                message->m_flagsStale = true;
+                backgroundUids << message->uid();
+            }
+            // If the last refresh did not make it through the whole mailbox, it continues where it stopped
+            keepTaskChild->requestFlagsResync(backgroundUids, oldSyncState.flagsResyncCursor());
+            log(QStringLiteral("Refreshing FLAGS of %1 older messages in the background").arg(firstOffset), Common::LOG_MAILBOX_SYNC);
+        }
+        flagsCmd = parser->fetch(Sequence(firstOffset + 1, mailbox->syncState.exists()), QStringList() << QStringLiteral("FLAGS"));
     } else {
         flagsCmd = parser->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QStringLiteral("FLAGS"));
     }
@@ -610,6 +642,15 @@ void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
     emit model->mailboxSyncingProgress(mailboxIndex, status);
 }
 
+/** @short Save the flags which were received during the FLAGS resync into the cache in one go */
+void ObtainSynchronizedMailboxTask::flushPendingFlags(TreeItemMailbox *mailbox)
+{
+    if (m_pendingFlags.isEmpty())
+        return;
+    model->cache()->setMsgFlags(mailbox->mailbox(), m_pendingFlags);
+    m_pendingFlags.clear();
+}
+
 bool ObtainSynchronizedMailboxTask::handleResponseCodeInsideState(const Imap::Responses::State *const resp)
 {
     if (dieIfInvalidMailbox())
@@ -769,6 +810,8 @@ bool ObtainSynchronizedMailboxTask::handleNumberResponse(const Imap::Responses::
         case STATE_SYNCING_FLAGS:
             // The UID mapping has been already established, but we don't have enough information for
             // an atomic state transition yet
+            // Don't let the deferred flags resurrect the cache entry of a message which is going away
+            flushPendingFlags(mailbox);
             mailbox->handleExpunge(model, *resp);
             // The SyncState and the UID map will be saved later, along with the flags, when this task finishes
             return true;
@@ -846,6 +889,7 @@ bool ObtainSynchronizedMailboxTask::handleVanished(const Imap::Responses::Vanish
     case STATE_SYNCING_UIDS:
     case STATE_SYNCING_FLAGS:
     case STATE_DONE:
+        flushPendingFlags(mailbox);
         mailbox->handleVanished(model, *resp);
         return true;
     }
@@ -991,7 +1035,10 @@ bool ObtainSynchronizedMailboxTask::handleFetch(const Imap::Responses::Fetch *co
     Q_ASSERT(mailbox);
     QList<TreeItemPart *> changedParts;
     TreeItemMessage *changedMessage = 0;
-    mailbox->handleFetchResponse(model, *resp, changedParts, changedMessage, m_usingQresync);
+    // The flags of the whole mailbox are being resynced; save them into the cache in bulk once the FETCH finishes
+    const bool deferFlags = status == STATE_SYNCING_FLAGS && !flagsCmd.isEmpty();
+    mailbox->handleFetchResponse(model, *resp, changedParts, changedMessage, m_usingQresync,
+                                 deferFlags ? &m_pendingFlags : nullptr);
     if (changedMessage) {
         QModelIndex index = changedMessage->toIndex(model);
         emit model->dataChanged(index, index);
@@ -76,6 +76,7 @@ private:
 
     void syncUids(TreeItemMailbox *mailbox, const uint lowestUidToQuery=0);
     void syncFlags(TreeItemMailbox *mailbox);
+    void flushPendingFlags(TreeItemMailbox *mailbox);
     void updateHighestKnownUid(TreeItemMailbox *mailbox, const TreeItemMsgList *list) const;
 
     void notifyInterestingMessages(TreeItemMailbox *mailbox);
@@ -113,6 +114,8 @@ private:
     uint firstUnknownUidOffset;
     SyncState oldSyncState;
     bool m_usingQresync;
+    /** @short Flags received during the FLAGS resync which haven't been saved into the cache yet */
+    AbstractCache::MessageFlagsList m_pendingFlags;
 
     /** @short An UNSELECT task, if active */
     UnSelectTask *unSelectTask;
@@ -37,7 +37,7 @@ namespace Mailbox
 {
 
 OpenConnectionTask::OpenConnectionTask(Model *model) :
-    ImapTask(model)
+    ImapTask(model), m_encrypted(false)
 {
     // Offline mode shall be checked by the caller who decides to create the connection
     Q_ASSERT(model->networkPolicy() != NETWORK_OFFLINE);
@@ -53,7 +53,7 @@ OpenConnectionTask::OpenConnectionTask(Model *model) :
 }
 
 OpenConnectionTask::OpenConnectionTask(Model *model, void *dummy):
-    ImapTask(model)
+    ImapTask(model), m_encrypted(false)
 {
     Q_UNUSED(dummy);
 }
@@ -87,6 +87,8 @@ CONN_STATE_CONNECTED_PRETLS_PRECAPS:
     - calling STARTTLS
  -> CONN_STATE_CONNECTED_PRETLS if caps not known
     - asking for capabilities
+ -> CONN_STATE_LOGIN if caps not known, the connection is already encrypted and the password is available
+    - asking for capabilities and trying to LOGIN at once
  -> CONN_STATE_LOGIN iff capabilities are provided and LOGINDISABLED is not there and configuration doesn't want STARTTLS
     - trying to LOGIN.
  -> CONN_STATE_LOGOUT if the initial greeting asks us to leave
@@ -102,12 +104,16 @@ CONN_STATE_CONNECTED_PRETLS: checks result of the capability command
 CONN_STATE_STARTTLS: checks result of STARTTLS command
  -> CONN_STATE_ESTABLISHED_PRECAPS
     - asking for capabilities
+ -> CONN_STATE_LOGIN if the password is available
+    - asking for capabilities and trying to LOGIN at once
  -> fail
 
 CONN_STATE_ESTABLISHED_PRECAPS: checks for the result of capabilities
  -> CONN_STATE_LOGIN
  -> fail
 
+CONN_STATE_LOGIN: checks result of the LOGIN command and of the CAPABILITY which might have been sent along with it
+
 CONN_STATE_POSTAUTH_PRECAPS: checks result of the capability command
 */
 bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const resp)
@@ -186,6 +192,10 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
             if (!model->accessParser(parser).capabilitiesFresh) {
                 model->changeConnectionState(parser, CONN_STATE_CONNECTED_PRETLS);
                 capabilityCmd = parser->capability();
+                if (m_encrypted && !model->m_startTls) {
+                    // There's no decision to make about STARTTLS, so don't wait for the capabilities with logging in
+                    loginAlongWithCapability();
+                }
             } else {
                 startTlsOrLoginNow();
             }
@@ -274,6 +284,21 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
     case CONN_STATE_LOGIN:
         // Check the result of the LOGIN command
     {
+        if (resp->tag == capabilityCmd) {
+            // This is the CAPABILITY which got pipelined with the LOGIN
+            capabilityCmd.clear();
+            if (!model->accessParser(parser).capabilitiesFresh) {
+                abortConnection(tr("Server error: did not get the required CAPABILITY response."));
+            } else if (resp->kind != OK) {
+                abortConnection(tr("Server error: The CAPABILITY request failed."));
+            } else if (model->accessParser(parser).capabilities.contains(QStringLiteral("LOGINDISABLED"))) {
+                abortConnection(tr("Server error: Capabilities contain LOGINDISABLED even over an encrypted connection"));
+            } else {
+                // These are from before the authentication, which might change them
+                model->accessParser(parser).capabilitiesFresh = false;
+            }
+            return true;
+        }
         if (resp->tag == loginCmd) {
             loginCmd.clear();
             // The LOGIN command is finished
@@ -373,6 +398,19 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
     return false;
 }
 
+/** @short Send LOGIN right after the CAPABILITY if the password is known already
+
+The connection is encrypted at this point, so the credentials are safe even if the server turns out to have LOGINDISABLED.
+Saves one round trip.
+*/
+void OpenConnectionTask::loginAlongWithCapability()
+{
+    if (model->m_hasImapPassword != Model::PasswordAvailability::AVAILABLE)
+        return;
+    model->changeConnectionState(parser, CONN_STATE_LOGIN);
+    askForAuth();
+}
+
 /** @short Either call STARTTLS or go ahead and try to LOGIN */
 void OpenConnectionTask::startTlsOrLoginNow()
 {
@@ -431,6 +469,10 @@ void OpenConnectionTask::onComplete()
             model->m_taskFactory->createEnableTask(model, this, extensions)->perform();
         }
     }
+    // Have the server tell us about changes in other mailboxes instead of polling them
+    if (model->accessParser(parser).capabilities.contains(QStringLiteral("NOTIFY"))) {
+        model->m_taskFactory->createNotifyTask(model, this)->perform();
+    }
 
     // But do terminate this task
     _completed();
@@ -499,6 +541,7 @@ void OpenConnectionTask::sslConnectionPolicyDecided(bool ok)
     switch (model->accessParser(parser).connState) {
     case CONN_STATE_SSL_VERIFYING:
         if (ok) {
+            m_encrypted = true;
             model->changeConnectionState(parser, CONN_STATE_CONNECTED_PRETLS_PRECAPS);
         } else {
             abortConnection(tr("The security state of the SSL connection got rejected"));
@@ -506,9 +549,11 @@ void OpenConnectionTask::sslConnectionPolicyDecided(bool ok)
         break;
     case CONN_STATE_STARTTLS_VERIFYING:
         if (ok) {
+            m_encrypted = true;
             model->changeConnectionState(parser, CONN_STATE_ESTABLISHED_PRECAPS);
             model->accessParser(parser).capabilitiesFresh = false;
             capabilityCmd = parser->capability();
+            loginAlongWithCapability();
         } else {
             abortConnection(tr("The security state of the connection after a STARTTLS operation got rejected"));
         }
@@ -85,11 +85,15 @@ private:
 
     void askForAuth();
 
+    void loginAlongWithCapability();
+
 private:
     CommandHandle startTlsCmd;
     CommandHandle capabilityCmd;
     CommandHandle loginCmd;
     CommandHandle compressCmd;
+    /** @short Has the connection been encrypted already, either via STARTTLS or from the very beginning? */
+    bool m_encrypted;
     QList<QSslCertificate> m_sslChain;
     QList<QSslError> m_sslErrors;
 };
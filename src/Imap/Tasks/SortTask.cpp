@@ -34,8 +34,10 @@ namespace Mailbox
 {
 
 
-SortTask::SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria):
+SortTask::SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+                   const QPair<int, int> &partialRange):
     ImapTask(model), mailboxIndex(mailbox), searchConditions(searchConditions), sortCriteria(sortCriteria),
+    m_partialRange(partialRange), m_partialTotal(-1),
     m_persistentSearch(false), m_firstUntaggedReceived(false), m_firstCommandCompleted(false)
 {
     conn = model->findTaskResponsibleFor(mailbox);
@@ -51,6 +53,13 @@ void SortTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
+    if (m_partialRange.first && (sortCriteria.isEmpty() || !model->accessParser(parser).capabilitiesFresh ||
+                                 !model->accessParser(parser).capabilities.contains(QStringLiteral("ESORT")) ||
+                                 !model->accessParser(parser).capabilities.contains(QStringLiteral("PARTIAL")))) {
+        // The server cannot provide just a window, so we'll get the whole result instead
+        m_partialRange = qMakePair(0, 0);
+    }
+
     if (! mailboxIndex.isValid()) {
         _failed(tr("Mailbox vanished before we could ask for threading info"));
         return;
@@ -87,7 +96,13 @@ void SortTask::perform()
         if (model->accessParser(parser).capabilitiesFresh &&
                 model->accessParser(parser).capabilities.contains(QStringLiteral("ESORT"))) {
             // ESORT's better than regular SORT, if only for its embedded reference to the command tag
-            if (model->accessParser(parser).capabilities.contains(QStringLiteral("CONTEXT=SORT"))) {
+            if (m_partialRange.first && model->accessParser(parser).capabilities.contains(QStringLiteral("PARTIAL"))) {
+                // Just a window of a huge result; there are no updates for these, the caller asks again when needed
+                sortTag = parser->uidESort(sortCriteria, "utf-8", searchConditions,
+                                           QStringList() << QStringLiteral("PARTIAL %1:%2").arg(QString::number(m_partialRange.first),
+                                                                                                QString::number(m_partialRange.second))
+                                           << QStringLiteral("COUNT"));
+            } else if (model->accessParser(parser).capabilities.contains(QStringLiteral("CONTEXT=SORT"))) {
                 // Hurray, this IMAP server supports incremental SORT updates
                 m_persistentSearch = true;
                 sortTag = parser->uidESort(sortCriteria, "utf-8", searchConditions,
@@ -132,7 +147,10 @@ bool SortTask::handleStateHelper(const Imap::Responses::State *const resp)
     if (resp->tag == sortTag) {
         m_firstCommandCompleted = true;
         if (resp->kind == Responses::OK) {
-            emit sortingAvailable(sortResult);
+            if (isPartial())
+                emit partialSortingAvailable(sortResult, m_partialTotal);
+            else
+                emit sortingAvailable(sortResult);
             if (!m_persistentSearch || _aborted) {
                 // This is a one-shot operation, we shall not remain as an active task, listening for further updates
                 _completed();
@@ -189,6 +207,25 @@ bool SortTask::handleESearch(const Responses::ESearch *const resp)
     if (resp->tag != sortTag)
         return false;
 
+    if (isPartial()) {
+        if (resp->seqOrUids != Imap::Responses::ESearch::UIDS) {
+            throw UnexpectedResponseReceived("ESEARCH response to a UID SORT command with matching tag uses "
+                                             "sequence numbers instead of UIDs", *resp);
+        }
+        if (resp->partialData.size() > 1)
+            throw UnexpectedResponseReceived("ESEARCH contains the PARTIAL key too many times", *resp);
+        if (!resp->incrementalContextData.isEmpty())
+            throw UnexpectedResponseReceived("ESEARCH contains incremental responses even though we haven't requested that", *resp);
+
+        // No PARTIAL at all means that nothing matched
+        sortResult = resp->partialData.isEmpty() ? Imap::Uids() : resp->partialData.front().uids;
+        auto countIterator = std::find_if(resp->listData.constBegin(), resp->listData.constEnd(),
+                                          [](const auto &listData) { return listData.first == "COUNT"; });
+        if (countIterator != resp->listData.constEnd() && countIterator->second.size() == 1)
+            m_partialTotal = countIterator->second.front();
+        return true;
+    }
+
     auto allComparator = [](const auto &listData) { return listData.first == "ALL"; };
     auto allIterator = std::find_if(resp->listData.constBegin(), resp->listData.constEnd(), allComparator);
 
@@ -255,6 +292,12 @@ bool SortTask::isPersistent() const
     return m_persistentSearch;
 }
 
+/** @short Return true if this task asks just for a window of the result, not for the whole of it */
+bool SortTask::isPartial() const
+{
+    return m_partialRange.first != 0;
+}
+
 /** @short Return true if this task has already done its job and is now merely listening for further updates */
 bool SortTask::isJustUpdatingNow() const
 {
@@ -23,6 +23,7 @@
 #ifndef IMAP_SORT_TASK_H
 #define IMAP_SORT_TASK_H
 
+#include <QPair>
 #include <QPersistentModelIndex>
 #include "ImapTask.h"
 
@@ -36,7 +37,8 @@ class SortTask : public ImapTask
 {
     Q_OBJECT
 public:
-    SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria);
+    SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+             const QPair<int, int> &partialRange = qMakePair(0, 0));
     void perform() override;
     void abort() override;
 
@@ -48,6 +50,7 @@ public:
     bool needsMailbox() const override {return true;}
 
     bool isPersistent() const;
+    bool isPartial() const;
     bool isJustUpdatingNow() const;
 
     void cancelSortingUpdates();
@@ -62,6 +65,12 @@ signals:
     /** @short An incremental update to the sorting criteria according to CONTEXT=SORT */
     void incrementalSortUpdate(const Imap::Responses::ESearch::IncrementalContextData_t &updates);
 
+    /** @short Just a window of the sort result has arrived, as per RFC 9394's PARTIAL
+
+    The @arg total is the number of items in the complete result, or -1 if the server didn't say.
+    */
+    void partialSortingAvailable(const Imap::Uids &uids, const int total);
+
 protected:
     void _failed(const QString &errorMessage) override;
 private:
@@ -73,6 +82,12 @@ private:
     QStringList sortCriteria;
     Imap::Uids sortResult;
 
+    /** @short The requested window of the result for the PARTIAL return option, or (0, 0) for the whole result */
+    QPair<int, int> m_partialRange;
+
+    /** @short Size of the complete result as reported by the COUNT return option */
+    int m_partialTotal;
+
     /** @short Are we supposed to run in a "persistent mode", ie. keep listening for updates? */
     bool m_persistentSearch;
 
@@ -72,6 +72,7 @@ bool UpdateFlagsOfAllMessagesTask::handleStateHelper(const Imap::Responses::Stat
             TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(mailbox->m_children [0]);
             Q_ASSERT(list);
 
+            AbstractCache::MessageFlagsList changedFlags;
             Q_FOREACH (TreeItem *item, list->m_children) {
                 TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(item);
                 Q_ASSERT(message);
@@ -86,7 +87,7 @@ bool UpdateFlagsOfAllMessagesTask::handleStateHelper(const Imap::Responses::Stat
                 if (!newFlags.contains(flags)) {
                     newFlags << flags;
                     message->setFlags(list, model->normalizeFlags(newFlags));
-                    model->cache()->setMsgFlags(mailbox->mailbox(), message->uid(), newFlags);
+                    changedFlags.append(qMakePair(message->uid(), newFlags));
                     QModelIndex messageIndex = model->createIndex(message->m_offset, 0, message);
 
                     // emitting dataChanged() separately for each message in the mailbox:
@@ -94,6 +95,7 @@ bool UpdateFlagsOfAllMessagesTask::handleStateHelper(const Imap::Responses::Stat
                     model->dataChanged(messageIndex, messageIndex);
                 }
             }
+            model->cache()->setMsgFlags(mailbox->mailbox(), changedFlags);
             model->emitMessageCountChanged(mailbox);
             list->fetchNumbers(model);
             _completed();
@@ -44,13 +44,15 @@ These modifications are released into public domain.
 ****************************************************************************/
 
 #include "rfc1951.h"
+#include "../BufferChain.h"
 
 namespace Streams {
 
-Rfc1951Compressor::Rfc1951Compressor(int chunkSize)
+Rfc1951Compressor::Rfc1951Compressor(int chunkSize, int level)
 {
     _chunkSize = chunkSize;
     _buffer = new char[chunkSize];
+    _pending = false;
 
     /* allocate deflate state */
     _zStream.zalloc = Z_NULL;
@@ -58,7 +60,7 @@ Rfc1951Compressor::Rfc1951Compressor(int chunkSize)
     _zStream.opaque = Z_NULL;
 
     bool ok(deflateInit2(&_zStream,
-                          Z_DEFAULT_COMPRESSION, 
+                          level,
                           Z_DEFLATED, 
                           -(MAX_WBITS-2), // 32KB // MAX_WBITS == 15 (zconf.h) MEM128KB
                           MAX_MEM_LEVEL-2 , // 64KB // MAX_MEM_LEVEL = 9 (zconf.h) MEM256KB
@@ -72,21 +74,41 @@ Rfc1951Compressor::~Rfc1951Compressor()
     deflateEnd(&_zStream);
 }
 
-bool Rfc1951Compressor::write(QIODevice *out, QByteArray *in)
+bool Rfc1951Compressor::write(QIODevice *out, const QByteArray &in)
+{
+    if (in.isEmpty())
+        return true;
+    _zStream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.constData()));
+    _zStream.avail_in = in.size();
+    _pending = true;
+    return deflateInto(out, Z_NO_FLUSH);
+}
+
+bool Rfc1951Compressor::flush(QIODevice *out)
+{
+    // Each sync flush costs an empty stored block, so don't emit them when there's nothing new
+    if (!_pending)
+        return true;
+    _pending = false;
+    _zStream.next_in = Z_NULL;
+    _zStream.avail_in = 0;
+    return deflateInto(out, Z_SYNC_FLUSH);
+}
+
+bool Rfc1951Compressor::deflateInto(QIODevice *out, int flushMode)
 {
-    _zStream.next_in = reinterpret_cast<Bytef*>(in->data());
-    _zStream.avail_in = in->size();
-    
     do {
         _zStream.next_out = reinterpret_cast<Bytef*>(_buffer);
         _zStream.avail_out = _chunkSize;
-        int result = deflate(&_zStream, Z_SYNC_FLUSH);
+        int result = deflate(&_zStream, flushMode);
         if (result != Z_OK &&
             result != Z_STREAM_END &&
             result != Z_BUF_ERROR) {
             return false;
         }
-        out->write(_buffer, _chunkSize - _zStream.avail_out);
+        const qint64 produced = _chunkSize - _zStream.avail_out;
+        if (produced && out->write(_buffer, produced) != produced)
+            return false;
     } while (!_zStream.avail_out);
     return true;
 }
@@ -95,7 +117,6 @@ bool Rfc1951Compressor::write(QIODevice *out, QByteArray *in)
 Rfc1951Decompressor::Rfc1951Decompressor(int chunkSize)
 {
     _chunkSize = chunkSize;
-    _stagingBuffer = new char[_chunkSize];
 
     /* allocate inflate state */
     _zStream.zalloc = Z_NULL;
@@ -110,52 +131,36 @@ Rfc1951Decompressor::Rfc1951Decompressor(int chunkSize)
 Rfc1951Decompressor::~Rfc1951Decompressor()
 {
     inflateEnd(&_zStream);
-    delete[] _stagingBuffer;
 }
 
-bool Rfc1951Decompressor::consume(QIODevice *in)
+bool Rfc1951Decompressor::consume(const QByteArray &in, BufferChain *out)
 {
-    while (in->bytesAvailable()) {
-        _inBuffer = in->read(_chunkSize);
-        _zStream.next_in = reinterpret_cast<Bytef*>(_inBuffer.data());
-        _zStream.avail_in = _inBuffer.size();
-        do {
-            _zStream.next_out = reinterpret_cast<Bytef *>(_stagingBuffer);
-            _zStream.avail_out = _chunkSize;
-            int result = inflate(&_zStream, Z_SYNC_FLUSH);
-            if (result != Z_OK &&
-                result != Z_STREAM_END &&
-                result != Z_BUF_ERROR) {
-                return false;
-            }
-            _output.append(_stagingBuffer, _chunkSize - _zStream.avail_out);
-        } while (_zStream.avail_out == 0);
-    }
+    _zStream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.constData()));
+    _zStream.avail_in = in.size();
+    do {
+        if (_chunk.isEmpty()) {
+            // this is the first round, or the previous buffer was handed over
+            _chunk = QByteArray(_chunkSize, Qt::Uninitialized);
+        }
+        _zStream.next_out = reinterpret_cast<Bytef *>(_chunk.data());
+        _zStream.avail_out = _chunkSize;
+        int result = inflate(&_zStream, Z_SYNC_FLUSH);
+        if (result != Z_OK &&
+            result != Z_STREAM_END &&
+            result != Z_BUF_ERROR) {
+            return false;
+        }
+        const int produced = _chunkSize - _zStream.avail_out;
+        if (produced == _chunkSize) {
+            // A full chunk is queued as-is, without copying
+            out->append(_chunk);
+            _chunk = QByteArray();
+        } else if (produced) {
+            // Small pieces are copied so that the big buffer can be reused for the next round
+            out->append(QByteArray(_chunk.constData(), produced));
+        }
+    } while (_zStream.avail_out == 0);
     return true;
 }
 
-bool Rfc1951Decompressor::canReadLine() const
-{
-    return _output.contains('\n');
-}
-
-QByteArray Rfc1951Decompressor::readLine()
-{
-    int eolPos = _output.indexOf('\n');
-    if (eolPos == -1) {
-        return QByteArray();
-    }
-    
-    QByteArray result = _output.left(eolPos + 1);
-    _output = _output.mid(eolPos + 1);
-    return result;
-}
-
-QByteArray Rfc1951Decompressor::read(qint64 maxSize)
-{
-    QByteArray res = _output.left(maxSize);
-    _output = _output.mid(maxSize);
-    return res;
-}
-
 }
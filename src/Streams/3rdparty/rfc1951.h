@@ -48,6 +48,8 @@
 
 namespace Streams {
 
+class BufferChain;
+
 /* From RFC4978 The IMAP COMPRESS:   
    "When using the zlib library (see [RFC1951]), the functions
    deflateInit2(), deflate(), inflateInit2(), and inflate() suffice to
@@ -64,15 +66,24 @@ namespace Streams {
 class Rfc1951Compressor
 {
 public:
-    explicit Rfc1951Compressor(int chunkSize = 8192);
+    explicit Rfc1951Compressor(int chunkSize = 8192, int level = Z_DEFAULT_COMPRESSION);
     ~Rfc1951Compressor();
 
-    bool write(QIODevice *out, QByteArray *in);
+    /** @short Compress @arg in and pass whatever compressed output is ready to @arg out
+
+    The data are not flushed, i.e. the peer might not be able to decompress them until flush() is called.
+    */
+    bool write(QIODevice *out, const QByteArray &in);
+    /** @short Make everything which was written so far available to the peer */
+    bool flush(QIODevice *out);
 
 private:
+    bool deflateInto(QIODevice *out, int flushMode);
+
     int _chunkSize;
     z_stream _zStream;
     char *_buffer;
+    bool _pending;
 };
 
 class Rfc1951Decompressor
@@ -81,17 +92,13 @@ public:
     explicit Rfc1951Decompressor(int chunkSize = 8192);
     ~Rfc1951Decompressor();
 
-    bool consume(QIODevice *in);
-    bool canReadLine() const;
-    QByteArray readLine();
-    QByteArray read(qint64 maxSize);
+    bool consume(const QByteArray &in, BufferChain *out);
 
 private:
     int _chunkSize;
     z_stream _zStream;
-    QByteArray _inBuffer;
-    char *_stagingBuffer;
-    QByteArray _output;
+    /** @short Output buffer which gets reused unless it was filled and handed over as a whole */
+    QByteArray _chunk;
 };
 
 }
@@ -0,0 +1,109 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BufferChain.h"
+
+namespace Streams {
+
+BufferChain::BufferChain(): m_offset(0), m_size(0)
+{
+}
+
+void BufferChain::append(const QByteArray &chunk)
+{
+    if (chunk.isEmpty())
+        return;
+    m_chunks.push_back(chunk);
+    m_size += chunk.size();
+}
+
+qint64 BufferChain::size() const
+{
+    return m_size;
+}
+
+bool BufferChain::isEmpty() const
+{
+    return m_size == 0;
+}
+
+void BufferChain::clear()
+{
+    m_chunks.clear();
+    m_offset = 0;
+    m_size = 0;
+}
+
+qint64 BufferChain::indexOf(const char c, qint64 from) const
+{
+    if (from < 0)
+        from = 0;
+    if (from >= m_size)
+        return -1;
+
+    // logical position of the beginning of the current chunk
+    qint64 chunkStart = 0;
+    int skip = m_offset;
+    for (const QByteArray &chunk : m_chunks) {
+        const qint64 available = chunk.size() - skip;
+        if (from < chunkStart + available) {
+            const int pos = chunk.indexOf(c, skip + static_cast<int>(qMax<qint64>(0, from - chunkStart)));
+            if (pos != -1)
+                return chunkStart + pos - skip;
+        }
+        chunkStart += available;
+        skip = 0;
+    }
+    return -1;
+}
+
+qint64 BufferChain::takeInto(QByteArray &dest, qint64 maxSize)
+{
+    qint64 taken = 0;
+    while (taken < maxSize && !m_chunks.empty()) {
+        QByteArray &chunk = m_chunks.front();
+        const int n = static_cast<int>(qMin<qint64>(chunk.size() - m_offset, maxSize - taken));
+        if (m_offset == 0 && n == chunk.size() && dest.isEmpty()) {
+            // The whole chunk is wanted, so there's no need to copy anything
+            dest = chunk;
+        } else {
+            dest.append(chunk.constData() + m_offset, n);
+        }
+        taken += n;
+        m_offset += n;
+        if (m_offset == chunk.size()) {
+            m_chunks.pop_front();
+            m_offset = 0;
+        }
+    }
+    m_size -= taken;
+    return taken;
+}
+
+QByteArray BufferChain::take(qint64 maxSize)
+{
+    QByteArray res;
+    takeInto(res, maxSize);
+    return res;
+}
+
+}
@@ -0,0 +1,67 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STREAMS_BUFFERCHAIN_H
+#define STREAMS_BUFFERCHAIN_H
+
+#include <deque>
+#include <QByteArray>
+
+namespace Streams {
+
+/** @short A queue of received data which is kept in the chunks it arrived in
+
+Appending a chunk doesn't copy it, and neither does taking a complete chunk into an empty buffer -- the data are
+implicitly shared in both cases. Only the consumed parts of partially read chunks get copied. This is in contrast
+to a single QByteArray which has to be shifted each time something is removed from its front.
+*/
+class BufferChain
+{
+public:
+    BufferChain();
+
+    void append(const QByteArray &chunk);
+    /** @short Number of bytes which are available for reading */
+    qint64 size() const;
+    bool isEmpty() const;
+    void clear();
+
+    /** @short Return the position of the first @arg c at or after the offset @arg from, or -1 if not found */
+    qint64 indexOf(const char c, qint64 from = 0) const;
+
+    /** @short Remove up to @arg maxSize bytes from the front and append them to @arg dest
+
+    Returns the number of bytes which were moved.
+    */
+    qint64 takeInto(QByteArray &dest, qint64 maxSize);
+    /** @short Remove up to @arg maxSize bytes from the front and return them */
+    QByteArray take(qint64 maxSize);
+
+private:
+    std::deque<QByteArray> m_chunks;
+    /** @short How many bytes at the beginning of the first chunk were consumed already */
+    int m_offset;
+    qint64 m_size;
+};
+
+}
+
+#endif
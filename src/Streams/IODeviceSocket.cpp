@@ -28,6 +28,7 @@
 #include <QSslConfiguration>
 #include <QSslSocket>
 #include <QTimer>
+#include "TlsSessionCache.h"
 #include "TrojitaZlibStatus.h"
 #if TROJITA_COMPRESS_DEFLATE
 #include "3rdparty/rfc1951.h"
@@ -36,7 +37,8 @@
 
 namespace Streams {
 
-IODeviceSocket::IODeviceSocket(QIODevice *device): d(device), m_compressor(0), m_decompressor(0)
+IODeviceSocket::IODeviceSocket(QIODevice *device): d(device), m_scannedForEol(0), m_compressor(0), m_decompressor(0),
+    m_compressionLevel(-1)
 {
     connect(d, &QIODevice::readyRead, this, &IODeviceSocket::handleReadyRead);
     connect(d, &QIODevice::readChannelFinished, this, &IODeviceSocket::handleStateChanged);
@@ -57,40 +59,57 @@ IODeviceSocket::~IODeviceSocket()
 
 bool IODeviceSocket::canReadLine()
 {
-#if TROJITA_COMPRESS_DEFLATE
-    if (m_decompressor) {
-        return m_decompressor->canReadLine();
+    // Don't rescan the same data over and over again when a long line arrives in small pieces
+    if (m_input.indexOf('\n', m_scannedForEol) == -1) {
+        m_scannedForEol = m_input.size();
+        return false;
     }
-#endif
-    return d->canReadLine();
+    return true;
 }
 
 QByteArray IODeviceSocket::read(qint64 maxSize)
 {
-#if TROJITA_COMPRESS_DEFLATE
-    if (m_decompressor) {
-        return m_decompressor->read(maxSize);
-    }
-#endif
-    return d->read(maxSize);
+    QByteArray res;
+    readInto(res, maxSize);
+    return res;
 }
 
 QByteArray IODeviceSocket::readLine(qint64 maxSize)
 {
-#if TROJITA_COMPRESS_DEFLATE
-    if (m_decompressor) {
-        // FIXME: well, we apparently don't respect the maxSize argument...
-        return m_decompressor->readLine();
+    QByteArray res;
+    if (maxSize > 0) {
+        qint64 eol = m_input.indexOf('\n', m_scannedForEol);
+        consumed(m_input.takeInto(res, eol == -1 ? maxSize : qMin(maxSize, eol + 1)));
+    } else {
+        readLineInto(res);
     }
-#endif
-    return d->readLine(maxSize);
+    return res;
+}
+
+qint64 IODeviceSocket::readInto(QByteArray &dest, qint64 maxSize)
+{
+    qint64 bytes = m_input.takeInto(dest, maxSize);
+    consumed(bytes);
+    return bytes;
+}
+
+void IODeviceSocket::readLineInto(QByteArray &dest)
+{
+    qint64 eol = m_input.indexOf('\n', m_scannedForEol);
+    // Just like QIODevice::readLine, return whatever is available when there's no complete line
+    consumed(m_input.takeInto(dest, eol == -1 ? m_input.size() : eol + 1));
+}
+
+void IODeviceSocket::consumed(const qint64 bytes)
+{
+    m_scannedForEol = qMax<qint64>(0, m_scannedForEol - bytes);
 }
 
 qint64 IODeviceSocket::write(const QByteArray &byteArray)
 {
 #if TROJITA_COMPRESS_DEFLATE
     if (m_compressor) {
-        m_compressor->write(d, &const_cast<QByteArray&>(byteArray));
+        m_compressor->write(d, byteArray);
         return byteArray.size();
     }
 #endif
@@ -106,6 +125,9 @@ void IODeviceSocket::startTls()
     if (m_compressor || m_decompressor)
         throw std::invalid_argument("DEFLATE is already active, cannot STARTTLS");
 #endif
+    // Whatever has arrived in cleartext after the STARTTLS response cannot be trusted
+    m_input.clear();
+    m_scannedForEol = 0;
     sock->startClientEncryption();
 }
 
@@ -115,20 +137,42 @@ void IODeviceSocket::startDeflate()
         throw std::invalid_argument("DEFLATE compression is already active");
 
 #if TROJITA_COMPRESS_DEFLATE
-    m_compressor = new Rfc1951Compressor();
+    m_compressor = new Rfc1951Compressor(8192, m_compressionLevel);
     m_decompressor = new Rfc1951Decompressor();
+    // Anything which got buffered after the response to COMPRESS is compressed already
+    QByteArray pending = m_input.take(m_input.size());
+    m_scannedForEol = 0;
+    m_decompressor->consume(pending, &m_input);
 #else
     throw std::invalid_argument("Trojita got built without zlib support");
 #endif
 }
 
+void IODeviceSocket::flush()
+{
+#if TROJITA_COMPRESS_DEFLATE
+    if (m_compressor) {
+        m_compressor->flush(d);
+    }
+#endif
+}
+
+void IODeviceSocket::setCompressionLevel(const int level)
+{
+    m_compressionLevel = level;
+}
+
 void IODeviceSocket::handleReadyRead()
 {
+    QByteArray chunk = d->readAll();
 #if TROJITA_COMPRESS_DEFLATE
     if (m_decompressor) {
-        m_decompressor->consume(d);
-    }
+        m_decompressor->consume(chunk, &m_input);
+    } else
 #endif
+    {
+        m_input.append(chunk);
+    }
     emit readyRead();
 }
 
@@ -239,6 +283,9 @@ SslTlsSocket::SslTlsSocket(QSslSocket *sock, const QString &host, const quint16
     sslConf.setSslOption(QSsl::SslOptionDisableCompression, false);
     sock->setSslConfiguration(sslConf);
 
+    connect(sock, &QSslSocket::encrypted, this, &SslTlsSocket::rememberSession);
+    // TLS 1.3 servers only send their tickets after the handshake
+    connect(sock, &QSslSocket::newSessionTicketReceived, this, &SslTlsSocket::rememberSession);
     connect(sock, &QSslSocket::encrypted, this, &Socket::encrypted);
     connect(sock, &QAbstractSocket::stateChanged, this, &SslTlsSocket::handleStateChanged);
     connect(sock, &QAbstractSocket::errorOccurred, this, &SslTlsSocket::handleSocketError);
@@ -250,6 +297,24 @@ void SslTlsSocket::setProxySettings(const ProxySettings proxySettings, const QSt
     m_protocolTag = protocolTag;
 }
 
+/** @short Offer the last TLS session of this account when connecting, and update it once encrypted */
+void SslTlsSocket::setTlsSessionCache(const std::shared_ptr<TlsSessionCache> &cache)
+{
+    m_tlsSessionCache = cache;
+}
+
+void SslTlsSocket::rememberSession()
+{
+    if (!m_tlsSessionCache)
+        return;
+    QSslSocket *sock = qobject_cast<QSslSocket*>(d);
+    Q_ASSERT(sock);
+    QSslConfiguration sslConf = sock->sslConfiguration();
+    if (!sslConf.sessionTicket().isEmpty()) {
+        m_tlsSessionCache->setTicket(host, port, sslConf.sessionTicket(), sslConf.sessionTicketLifeTimeHint());
+    }
+}
+
 void SslTlsSocket::close()
 {
     QSslSocket *sock = qobject_cast<QSslSocket*>(d);
@@ -387,6 +452,14 @@ void SslTlsSocket::delayedStart()
         break;
     }
 
+    if (m_tlsSessionCache) {
+        // Qt won't hand out the session data unless it's explicitly allowed to do so
+        QSslConfiguration sslConf = sock->sslConfiguration();
+        sslConf.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+        sslConf.setSessionTicket(m_tlsSessionCache->ticket(host, port));
+        sock->setSslConfiguration(sslConf);
+    }
+
     if (startEncrypted)
         sock->connectToHostEncrypted(host, port);
     else
@@ -24,6 +24,7 @@
 
 #include <QProcess>
 #include <QSslSocket>
+#include "BufferChain.h"
 #include "Socket.h"
 #include "SocketFactory.h"
 
@@ -46,19 +47,31 @@ public:
     bool canReadLine() override;
     QByteArray read(qint64 maxSize) override;
     QByteArray readLine(qint64 maxSize = 0) override;
+    qint64 readInto(QByteArray &dest, qint64 maxSize) override;
+    void readLineInto(QByteArray &dest) override;
     qint64 write(const QByteArray &byteArray) override;
     void startTls() override;
     void startDeflate() override;
+    void flush() override;
     bool isDead() override = 0;
+    /** @short Set the zlib compression level (0-9, or -1 for the default) to use once DEFLATE is active */
+    void setCompressionLevel(const int level);
 private slots:
     virtual void handleStateChanged() = 0;
     virtual void delayedStart() = 0;
     virtual void handleReadyRead();
     void emitError();
 protected:
+    void consumed(const qint64 bytes);
+
     QIODevice *d;
+    /** @short Data which were received (and decompressed) already, but not read by the upper layer yet */
+    BufferChain m_input;
+    /** @short Number of bytes at the beginning of m_input which are known not to contain any LF */
+    qint64 m_scannedForEol;
     Rfc1951Compressor *m_compressor;
     Rfc1951Decompressor *m_decompressor;
+    int m_compressionLevel;
     QTimer *delayedDisconnect;
     QString disconnectedMessage;
 };
@@ -92,6 +105,7 @@ public:
     connected() only after it has established proper encryption */
     SslTlsSocket(QSslSocket *sock, const QString &host, const quint16 port, const bool startEncrypted=false);
     void setProxySettings(const Streams::ProxySettings proxySettings, const QString &protocolTag);
+    void setTlsSessionCache(const std::shared_ptr<TlsSessionCache> &cache);
     bool isDead() override;
     QList<QSslCertificate> sslChain() const override;
     QList<QSslError> sslErrors() const override;
@@ -101,12 +115,14 @@ private slots:
     void handleStateChanged() override;
     void handleSocketError(QAbstractSocket::SocketError);
     void delayedStart() override;
+    void rememberSession();
 private:
     bool startEncrypted;
     QString host;
     quint16 port;
     QString m_protocolTag;
     ProxySettings m_proxySettings;
+    std::shared_ptr<TlsSessionCache> m_tlsSessionCache;
 };
 
 };
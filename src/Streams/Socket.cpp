@@ -28,6 +28,22 @@ Socket::~Socket()
 {
 }
 
+qint64 Socket::readInto(QByteArray &dest, qint64 maxSize)
+{
+    QByteArray buf = read(maxSize);
+    dest += buf;
+    return buf.size();
+}
+
+void Socket::readLineInto(QByteArray &dest)
+{
+    dest += readLine();
+}
+
+void Socket::flush()
+{
+}
+
 bool Socket::isConnectingEncryptedSinceStart() const
 {
     return false;
@@ -49,6 +49,15 @@ public:
     /** @short Read a line from the socket (up to the @arg maxSize bytes) */
     virtual QByteArray readLine(qint64 maxSize = 0) = 0;
 
+    /** @short Append at most @arg maxSize bytes to the @arg dest buffer and return how many of them were appended
+
+    Unlike read(), this doesn't have to create a temporary buffer, so it's suitable for big literals.
+    */
+    virtual qint64 readInto(QByteArray &dest, qint64 maxSize);
+
+    /** @short Append a line from the socket to the @arg dest buffer */
+    virtual void readLineInto(QByteArray &dest);
+
     /** @short Write the contents of the @arg byteArray buffer to the socket */
     virtual qint64 write(const QByteArray &byteArray) = 0;
 
@@ -77,6 +86,13 @@ public:
 
     /** @short Start the DEFLATE algorithm on both directions of this stream */
     virtual void startDeflate() = 0;
+
+    /** @short Make sure that everything written so far reaches the peer
+
+    This matters for compressed streams which would otherwise wait for more data. It shall be called whenever the
+    upper layer is done with sending its commands for now.
+    */
+    virtual void flush();
 signals:
     /** @short The socket got disconnected */
     void disconnected(const QString);
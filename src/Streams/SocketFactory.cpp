@@ -26,10 +26,11 @@
 #include <QSslSocket>
 #include "IODeviceSocket.h"
 #include "FakeSocket.h"
+#include "TlsSessionCache.h"
 
 namespace Streams {
 
-SocketFactory::SocketFactory(): m_startTls(false)
+SocketFactory::SocketFactory(): m_startTls(false), m_compressionLevel(-1)
 {
 }
 
@@ -43,6 +44,16 @@ bool SocketFactory::startTlsRequired()
     return m_startTls;
 }
 
+void SocketFactory::setCompressionLevel(const int level)
+{
+    m_compressionLevel = level;
+}
+
+void SocketFactory::setTlsSessionCache(const std::shared_ptr<TlsSessionCache> &cache)
+{
+    m_tlsSessionCache = cache;
+}
+
 ProcessSocketFactory::ProcessSocketFactory(
     const QString &executable, const QStringList &args):
     executable(executable), args(args)
@@ -53,7 +64,9 @@ Socket *ProcessSocketFactory::create()
 {
     // FIXME: this may leak memory if an exception strikes in this function
     // (before we return the pointer)
-    return new ProcessSocket(new QProcess(), executable, args);
+    ProcessSocket *sock = new ProcessSocket(new QProcess(), executable, args);
+    sock->setCompressionLevel(m_compressionLevel);
+    return sock;
 }
 
 void ProcessSocketFactory::setProxySettings(const ProxySettings proxySettings, const QString &protocolTag)
@@ -77,6 +90,8 @@ Socket *SslSocketFactory::create()
     QSslSocket *sslSock = new QSslSocket();
     SslTlsSocket *sock = new SslTlsSocket(sslSock, host, port, true);
     sock->setProxySettings(m_proxySettings, m_protocolTag);
+    sock->setTlsSessionCache(m_tlsSessionCache);
+    sock->setCompressionLevel(m_compressionLevel);
     return sock;
 }
 
@@ -97,6 +112,8 @@ Socket *TlsAbleSocketFactory::create()
     QSslSocket *sslSock = new QSslSocket();
     SslTlsSocket *sock = new SslTlsSocket(sslSock, host, port);
     sock->setProxySettings(m_proxySettings, m_protocolTag);
+    sock->setTlsSessionCache(m_tlsSessionCache);
+    sock->setCompressionLevel(m_compressionLevel);
     return sock;
 }
 
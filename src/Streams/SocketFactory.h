@@ -23,12 +23,15 @@
 #ifndef STREAMS_SOCKETFACTORY_H
 #define STREAMS_SOCKETFACTORY_H
 
+#include <memory>
 #include <QPointer>
 #include <QStringList>
 #include "Socket.h"
 
 namespace Streams {
 
+class TlsSessionCache;
+
 /** @short Specify preference for Proxy Settings */
 enum class ProxySettings
 {
@@ -50,6 +53,13 @@ public:
     virtual void setProxySettings(const Streams::ProxySettings proxySettings, const QString &protocolTag) = 0;
     void setStartTlsRequired(const bool doIt);
     bool startTlsRequired();
+    /** @short Share TLS sessions among all sockets created by this factory */
+    void setTlsSessionCache(const std::shared_ptr<TlsSessionCache> &cache);
+    /** @short Compression level for COMPRESS=DEFLATE, 0-9 or -1 for zlib's default */
+    void setCompressionLevel(const int level);
+protected:
+    std::shared_ptr<TlsSessionCache> m_tlsSessionCache;
+    int m_compressionLevel;
 signals:
     void error(const QString &);
 };
@@ -0,0 +1,113 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDataStream>
+#include "TlsSessionCache.h"
+
+namespace {
+
+/** @short Lifetime of a ticket whose lifetime is not known, in seconds (RFC 5077 recommends a few hours) */
+const int defaultTicketLifetime = 2 * 60 * 60;
+/** @short Never trust a session for longer than this, in seconds (TLS 1.3 caps tickets at seven days) */
+const int maxTicketLifetime = 7 * 24 * 60 * 60;
+
+/** @short Version of the on-disk format */
+const quint32 serializationVersion = 1;
+
+}
+
+namespace Streams {
+
+TlsSessionCache::TlsSessionCache(): m_port(0)
+{
+}
+
+QByteArray TlsSessionCache::ticket(const QString &host, const quint16 port, const QDateTime &now) const
+{
+    if (m_ticket.isEmpty() || host != m_host || port != m_port || !m_expires.isValid() || now >= m_expires)
+        return QByteArray();
+    return m_ticket;
+}
+
+void TlsSessionCache::setTicket(const QString &host, const quint16 port, const QByteArray &ticket, const int lifetimeHint,
+                                const QDateTime &now)
+{
+    if (ticket.isEmpty()) {
+        clear();
+        return;
+    }
+    m_host = host;
+    m_port = port;
+    m_ticket = ticket;
+    m_expires = now.addSecs(lifetimeHint <= 0 ? defaultTicketLifetime : qMin(lifetimeHint, maxTicketLifetime));
+    if (m_changeHandler)
+        m_changeHandler();
+}
+
+void TlsSessionCache::clear()
+{
+    m_host.clear();
+    m_port = 0;
+    m_ticket.clear();
+    m_expires = QDateTime();
+}
+
+void TlsSessionCache::setChangeHandler(const std::function<void()> &handler)
+{
+    m_changeHandler = handler;
+}
+
+QByteArray TlsSessionCache::serialize() const
+{
+    QByteArray res;
+    if (m_ticket.isEmpty())
+        return res;
+    QDataStream stream(&res, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << serializationVersion << m_host << m_port << m_ticket << m_expires;
+    return res;
+}
+
+bool TlsSessionCache::deserialize(const QByteArray &data)
+{
+    clear();
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 version;
+    stream >> version;
+    if (stream.status() != QDataStream::Ok || version != serializationVersion)
+        return false;
+    QString host;
+    quint16 port;
+    QByteArray ticket;
+    QDateTime expires;
+    stream >> host >> port >> ticket >> expires;
+    if (stream.status() != QDataStream::Ok || ticket.isEmpty() || !expires.isValid())
+        return false;
+    m_host = host;
+    m_port = port;
+    m_ticket = ticket;
+    m_expires = expires;
+    return true;
+}
+
+}
@@ -0,0 +1,75 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STREAMS_TLSSESSIONCACHE_H
+#define STREAMS_TLSSESSIONCACHE_H
+
+#include <functional>
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+
+namespace Streams {
+
+/** @short Remember the last TLS session of an account so that the next connection can resume it
+
+Each new connection to the IMAP server has to go through a full TLS handshake unless the client offers a session
+ticket which the server had handed out earlier. The connections of an account share one instance of this class,
+so that a reconnect after a network change or an extra connection for another mailbox only performs an abbreviated
+handshake.
+
+The ticket is bound to the host and port it was obtained from, and it expires according to the lifetime hint
+provided by the server.
+*/
+class TlsSessionCache
+{
+public:
+    TlsSessionCache();
+
+    /** @short Return a ticket usable for connecting to @arg host and @arg port, or a null QByteArray */
+    QByteArray ticket(const QString &host, const quint16 port, const QDateTime &now = QDateTime::currentDateTimeUtc()) const;
+    /** @short Remember a new @arg ticket for the @arg host and @arg port
+
+    The @arg lifetimeHint is in seconds; zero or a negative value means that the server has not provided any.
+    */
+    void setTicket(const QString &host, const quint16 port, const QByteArray &ticket, const int lifetimeHint,
+                   const QDateTime &now = QDateTime::currentDateTimeUtc());
+    void clear();
+
+    /** @short Call @arg handler whenever a new ticket is remembered, e.g. for storing it on disk */
+    void setChangeHandler(const std::function<void()> &handler);
+
+    /** @short Return a representation of the cached session suitable for storing on disk */
+    QByteArray serialize() const;
+    /** @short Restore the cached session from a representation created by serialize() */
+    bool deserialize(const QByteArray &data);
+
+private:
+    QString m_host;
+    quint16 m_port;
+    QByteArray m_ticket;
+    QDateTime m_expires;
+    std::function<void()> m_changeHandler;
+};
+
+}
+
+#endif
@@ -553,4 +553,287 @@ void BodyPartsTest::testBinaryFallback()
     }
 }
 
+/** @short Big parts are fetched in chunks, the chunks are cached and an interrupted download is resumed */
+void BodyPartsTest::testChunkedFetch()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    model->setProperty("trojita-imap-preload-msg-metadata", 0);
+    model->setProperty("trojita-imap-partial-fetch-threshold", 20);
+    model->setProperty("trojita-imap-partial-fetch-chunk-size", 16);
+    helperSyncBNoMessages();
+    cServer("* 2 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 333 FLAGS ())\r\n* 2 FETCH (UID 334 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msgListB), 2);
+
+    const QByteArray bodyStructure = "(\"application\" \"octet-stream\" () NIL NIL \"base64\" 36)";
+    const QByteArray raw = "SGVsbG8g\r\nY2h1bmtl\r\nZCB3b3Js\r\nZCE=\r\n";
+    QCOMPARE(raw.size(), 36);
+
+    QSignalSpy dataChangedSpy(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+    {
+        // The first chunk arrives, the second one fails
+        QModelIndex msg = msgListB.model()->index(0, 0, msgListB);
+        QCOMPARE(model->rowCount(msg), 0);
+        cClient(t.mk("UID FETCH 333 (" FETCH_METADATA_ITEMS ")\r\n"));
+        cServer("* 1 FETCH (UID 333 BODYSTRUCTURE " + bodyStructure + ")\r\n" + t.last("OK fetched\r\n"));
+        QCOMPARE(model->rowCount(msg), 1);
+        QModelIndex part = msg.model()->index(0, 0, msg);
+        QCOMPARE(part.data(RolePartId).toString(), QString("1"));
+        QCOMPARE(part.data(RolePartData).toByteArray(), QByteArray());
+        dataChangedSpy.clear();
+        cClient(t.mk("UID FETCH 333 (BODY.PEEK[1]<0.16>)\r\n"));
+        cServer("* 1 FETCH (UID 333 BODY[1]<0> {16}\r\n" + raw.left(16) + ")\r\n" + t.last("OK fetched\r\n"));
+        QCOMPARE(dataChangedSpy.size(), 1);
+        CHECK_DATACHANGED(0, part);
+        dataChangedSpy.clear();
+        QVERIFY(!part.data(RoleIsFetched).toBool());
+        QVERIFY(!part.data(RoleIsUnavailable).toBool());
+        QCOMPARE(part.data(RolePartBytesFetched).toULongLong(), 16ull);
+        // Only the complete lines are decoded so far
+        QCOMPARE(*part.data(RolePartBufferPtr).value<QByteArray*>(), QByteArray("Hello "));
+        QCOMPARE(model->cache()->messagePart("b", 333, "1.X-CHUNK-0"), raw.left(16));
+        cClient(t.mk("UID FETCH 333 (BODY.PEEK[1]<16.16>)\r\n"));
+        cServer(t.last("NO go away\r\n"));
+        QCOMPARE(dataChangedSpy.size(), 1);
+        CHECK_DATACHANGED(0, part);
+        dataChangedSpy.clear();
+        QVERIFY(part.data(RoleIsUnavailable).toBool());
+        QVERIFY(model->cache()->messagePart("b", 333, "1").isNull());
+        QCOMPARE(model->cache()->messagePart("b", 333, "1.X-CHUNK-0"), raw.left(16));
+        cEmpty();
+    }
+
+    {
+        // Two chunks are in the cache already, so the download continues from where it stopped
+        model->cache()->setMsgPart(QStringLiteral("b"), 334, "1.X-CHUNK-0", raw.left(16));
+        model->cache()->setMsgPart(QStringLiteral("b"), 334, "1.X-CHUNK-16", raw.mid(16, 16));
+        QModelIndex msg = msgListB.model()->index(1, 0, msgListB);
+        QCOMPARE(model->rowCount(msg), 0);
+        cClient(t.mk("UID FETCH 334 (" FETCH_METADATA_ITEMS ")\r\n"));
+        cServer("* 2 FETCH (UID 334 BODYSTRUCTURE " + bodyStructure + ")\r\n" + t.last("OK fetched\r\n"));
+        QCOMPARE(model->rowCount(msg), 1);
+        QModelIndex part = msg.model()->index(0, 0, msg);
+        QCOMPARE(part.data(RolePartData).toByteArray(), QByteArray());
+        QCOMPARE(*part.data(RolePartBufferPtr).value<QByteArray*>(), QByteArray("Hello chunked world"));
+        dataChangedSpy.clear();
+        cClient(t.mk("UID FETCH 334 (BODY.PEEK[1]<32.16>)\r\n"));
+        cServer("* 2 FETCH (UID 334 BODY[1]<32> {4}\r\n" + raw.mid(32) + ")\r\n" + t.last("OK fetched\r\n"));
+        QCOMPARE(dataChangedSpy.size(), 1);
+        CHECK_DATACHANGED(0, part);
+        QVERIFY(part.data(RoleIsFetched).toBool());
+        QVERIFY(!part.data(RolePartBytesFetched).isValid());
+        QCOMPARE(part.data(RolePartData).toByteArray(), QByteArray("Hello chunked world!"));
+        QCOMPARE(model->cache()->messagePart("b", 334, "1"), QByteArray("Hello chunked world!"));
+        QVERIFY(model->cache()->messagePart("b", 334, "1.X-CHUNK-0").isNull());
+        QVERIFY(model->cache()->messagePart("b", 334, "1.X-CHUNK-16").isNull());
+        cEmpty();
+    }
+}
+
+/** @short The message list gets populated without the BODYSTRUCTURE, which is only fetched when needed */
+void BodyPartsTest::testDeferredBodyStructure()
+{
+    model->setProperty("trojita-imap-preload-msg-metadata", 0);
+    model->setProperty("trojita-imap-defer-bodystructure", true);
+    helperSyncBNoMessages();
+    cServer("* 1 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 333 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msgListB), 1);
+
+    // Only what the message list needs is fetched at first
+    QModelIndex msg = msgListB.model()->index(0, 0, msgListB);
+    QCOMPARE(msg.data(RoleMessageSubject), QVariant());
+    cClient(t.mk("UID FETCH 333 (ENVELOPE INTERNALDATE RFC822.SIZE "
+                 "BODY.PEEK[HEADER.FIELDS (References List-Post Content-Type)])\r\n"));
+    cServer("* 1 FETCH (UID 333 RFC822.SIZE 5 INTERNALDATE \"15-Jan-2013 12:17:06 +0000\" "
+            "ENVELOPE (NIL \"s\" NIL NIL NIL NIL NIL NIL NIL NIL) "
+            "BODY[HEADER.FIELDS (References List-Post Content-Type)] "
+            + asLiteral("Content-Type: multipart/mixed;\r\n boundary=x\r\n\r\n") + ")\r\n"
+            + t.last("OK fetched\r\n"));
+    QVERIFY(msg.data(RoleIsFetched).toBool());
+    QCOMPARE(msg.data(RoleMessageSubject).toString(), QStringLiteral("s"));
+    QCOMPARE(msg.data(RoleMessageSize).toUInt(), 5u);
+    cEmpty();
+    // The cache gets what is known so far, with the BODYSTRUCTURE still missing
+    QCOMPARE(model->cache()->messageMetadata(QStringLiteral("b"), 333).uid, 333u);
+    QCOMPARE(model->cache()->messageMetadata(QStringLiteral("b"), 333).envelope.subject, QStringLiteral("s"));
+    QVERIFY(model->cache()->messageMetadata(QStringLiteral("b"), 333).serializedBodyStructure.isEmpty());
+
+    // The attachment indicator makes do with the Content-Type, but it asks for the real structure
+    QVERIFY(msg.data(RoleMessageHasAttachments).toBool());
+    QVERIFY(!msg.data(RoleMessageHasBodyStructure).toBool());
+    QCOMPARE(model->rowCount(msg), 0);
+    cClient(t.mk("UID FETCH 333 (BODYSTRUCTURE)\r\n"));
+    cServer("* 1 FETCH (UID 333 BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL \"7bit\" 5 1))\r\n"
+            + t.last("OK fetched\r\n"));
+    QVERIFY(msg.data(RoleMessageHasBodyStructure).toBool());
+    QCOMPARE(model->rowCount(msg), 1);
+    QVERIFY(!msg.data(RoleMessageHasAttachments).toBool());
+    // The cached entry is complete now
+    QCOMPARE(model->cache()->messageMetadata(QStringLiteral("b"), 333).uid, 333u);
+    QVERIFY(!model->cache()->messageMetadata(QStringLiteral("b"), 333).serializedBodyStructure.isEmpty());
+
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short A failed request for the deferred BODYSTRUCTURE can be repeated */
+void BodyPartsTest::testDeferredBodyStructureFailure()
+{
+    model->setProperty("trojita-imap-preload-msg-metadata", 0);
+    model->setProperty("trojita-imap-defer-bodystructure", true);
+    helperSyncBNoMessages();
+    cServer("* 1 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 333 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QModelIndex msg = msgListB.model()->index(0, 0, msgListB);
+    QCOMPARE(msg.data(RoleMessageSubject), QVariant());
+    cClient(t.mk("UID FETCH 333 (ENVELOPE INTERNALDATE RFC822.SIZE "
+                 "BODY.PEEK[HEADER.FIELDS (References List-Post Content-Type)])\r\n"));
+    cServer("* 1 FETCH (UID 333 RFC822.SIZE 5 INTERNALDATE \"15-Jan-2013 12:17:06 +0000\" "
+            "ENVELOPE (NIL \"s\" NIL NIL NIL NIL NIL NIL NIL NIL) "
+            "BODY[HEADER.FIELDS (References List-Post Content-Type)] \"\")\r\n"
+            + t.last("OK fetched\r\n"));
+    QVERIFY(msg.data(RoleIsFetched).toBool());
+
+    QVERIFY(!msg.data(RoleMessageHasBodyStructure).toBool());
+    cClient(t.mk("UID FETCH 333 (BODYSTRUCTURE)\r\n"));
+    cServer(t.last("NO go away\r\n"));
+    cEmpty();
+
+    // Asking once again means another attempt, the first one will not deliver anything
+    QVERIFY(!msg.data(RoleMessageHasBodyStructure).toBool());
+    cClient(t.mk("UID FETCH 333 (BODYSTRUCTURE)\r\n"));
+    cServer("* 1 FETCH (UID 333 BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL \"7bit\" 5 1))\r\n"
+            + t.last("OK fetched\r\n"));
+    QVERIFY(msg.data(RoleMessageHasBodyStructure).toBool());
+    QCOMPARE(model->rowCount(msg), 1);
+    cEmpty();
+}
+
+/** @short Without a network connection, a deferred BODYSTRUCTURE is reported as unavailable instead of being waited for */
+void BodyPartsTest::testDeferredBodyStructureOffline()
+{
+    model->setProperty("trojita-imap-preload-msg-metadata", 0);
+    model->setProperty("trojita-imap-defer-bodystructure", true);
+    helperSyncBNoMessages();
+    cServer("* 1 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 333 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QModelIndex msg = msgListB.model()->index(0, 0, msgListB);
+    QCOMPARE(msg.data(RoleMessageSubject), QVariant());
+    cClient(t.mk("UID FETCH 333 (ENVELOPE INTERNALDATE RFC822.SIZE "
+                 "BODY.PEEK[HEADER.FIELDS (References List-Post Content-Type)])\r\n"));
+    cServer("* 1 FETCH (UID 333 RFC822.SIZE 5 INTERNALDATE \"15-Jan-2013 12:17:06 +0000\" "
+            "ENVELOPE (NIL \"s\" NIL NIL NIL NIL NIL NIL NIL NIL) "
+            "BODY[HEADER.FIELDS (References List-Post Content-Type)] \"\")\r\n"
+            + t.last("OK fetched\r\n"));
+    QVERIFY(msg.data(RoleIsFetched).toBool());
+    cEmpty();
+
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_OFFLINE);
+    cClient(t.mk("LOGOUT\r\n"));
+    cServer(t.last("OK logged out\r\n") + "* BYE see ya\r\n");
+
+    QSignalSpy dataChangedSpy(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+    QVERIFY(!msg.data(RoleMessageHasBodyStructure).toBool());
+    QVERIFY(msg.data(RoleMessageBodyStructureUnavailable).toBool());
+    QCOMPARE(dataChangedSpy.size(), 1);
+    QCOMPARE(dataChangedSpy[0][0].toModelIndex(), msg);
+    QCOMPARE(model->rowCount(msg), 0);
+    // Asking again does not announce any further change
+    QVERIFY(msg.data(RoleMessageBodyStructureUnavailable).toBool());
+    QCOMPARE(dataChangedSpy.size(), 1);
+    // The envelope is still there for showing at least something
+    QCOMPARE(msg.data(RoleMessageSubject).toString(), QStringLiteral("s"));
+    cEmpty();
+}
+
+/** @short How much does deferring the BODYSTRUCTURE save on the wire?
+
+The structures below are modelled after what real-world servers send for common kinds of mail: a plain text message,
+an HTML newsletter, a message with an attachment and an inline image, and a PGP-signed post to a mailing list.
+*/
+void BodyPartsTest::testDeferredBodyStructureSavings()
+{
+    const QList<QPair<QByteArray, QByteArray>> samples = {
+        qMakePair(QByteArrayLiteral("(\"text\" \"plain\" (\"charset\" \"utf-8\" \"format\" \"flowed\") NIL NIL "
+                                    "\"quoted-printable\" 1834 42 NIL NIL NIL NIL)"),
+                  QByteArrayLiteral("text/plain; charset=utf-8; format=flowed")),
+        qMakePair(QByteArrayLiteral("((\"text\" \"plain\" (\"charset\" \"utf-8\") NIL NIL \"quoted-printable\" 2211 57 "
+                                    "NIL NIL NIL NIL)(\"text\" \"html\" (\"charset\" \"utf-8\") NIL NIL "
+                                    "\"quoted-printable\" 18342 301 NIL NIL NIL NIL) \"alternative\" "
+                                    "(\"boundary\" \"000000000000a1b2c3d4e5f6a7b8\") NIL NIL NIL)"),
+                  QByteArrayLiteral("multipart/alternative; boundary=\"000000000000a1b2c3d4e5f6a7b8\"")),
+        qMakePair(QByteArrayLiteral("(((\"text\" \"plain\" (\"charset\" \"UTF-8\") NIL NIL \"7bit\" 612 18 NIL NIL NIL NIL)"
+                                    "(\"text\" \"html\" (\"charset\" \"UTF-8\") NIL NIL \"quoted-printable\" 4120 82 "
+                                    "NIL NIL NIL NIL) \"alternative\" (\"boundary\" \"----=_Part_1234_5678.1600000000001\") "
+                                    "NIL NIL NIL)(\"application\" \"pdf\" (\"name\" \"Invoice-2020-0042.pdf\") NIL NIL "
+                                    "\"base64\" 187526 NIL (\"attachment\" (\"filename\" \"Invoice-2020-0042.pdf\" "
+                                    "\"size\" \"137042\")) NIL NIL)(\"image\" \"png\" (\"name\" \"image001.png\") "
+                                    "\"<image001.png@01D6A1B2.C3D4E5F0>\" NIL \"base64\" 24310 NIL (\"inline\" "
+                                    "(\"filename\" \"image001.png\" \"size\" \"17762\")) NIL NIL) \"mixed\" "
+                                    "(\"boundary\" \"----=_Part_1233_4321.1600000000000\") NIL NIL NIL)"),
+                  QByteArrayLiteral("multipart/mixed; boundary=\"----=_Part_1233_4321.1600000000000\"")),
+        qMakePair(QByteArrayLiteral("((\"text\" \"plain\" (\"charset\" \"us-ascii\") NIL NIL \"7bit\" 1204 31 NIL NIL NIL "
+                                    "NIL)(\"application\" \"pgp-signature\" (\"name\" \"signature.asc\") NIL "
+                                    "\"OpenPGP digital signature\" \"7bit\" 833 NIL (\"attachment\" "
+                                    "(\"filename\" \"signature.asc\")) NIL NIL) \"signed\" (\"micalg\" \"pgp-sha256\" "
+                                    "\"protocol\" \"application/pgp-signature\" \"boundary\" \"nextPart2416487.kWiHYv1Ol8\") "
+                                    "NIL NIL NIL)"),
+                  QByteArrayLiteral("multipart/signed; micalg=pgp-sha256;\r\n protocol=\"application/pgp-signature\"; "
+                                    "boundary=\"nextPart2416487.kWiHYv1Ol8\"")),
+    };
+    const int count = 20;
+
+    model->setProperty("trojita-imap-preload-msg-metadata", 0);
+    model->setProperty("trojita-imap-defer-bodystructure", true);
+    helperSyncBNoMessages();
+    cServer("* " + QByteArray::number(count) + " EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    QByteArray buf;
+    for (int i = 1; i <= count; ++i)
+        buf += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i) + " FLAGS ())\r\n";
+    cServer(buf + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msgListB), count);
+    for (int i = 0; i < count; ++i)
+        QCOMPARE(msgListB.model()->index(i, 0, msgListB).data(RoleMessageSubject), QVariant());
+    cClient(t.mk("UID FETCH 1:" + QByteArray::number(count) + " (ENVELOPE INTERNALDATE RFC822.SIZE "
+                 "BODY.PEEK[HEADER.FIELDS (References List-Post Content-Type)])\r\n"));
+
+    QByteArray fullResponse, listResponse;
+    for (int i = 1; i <= count; ++i) {
+        const auto &sample = samples[i % samples.size()];
+        const QByteArray num = QByteArray::number(i);
+        const QByteArray common = "* " + num + " FETCH (UID " + num + " RFC822.SIZE " + QByteArray::number(2000 + 397 * i)
+                + " INTERNALDATE \"13-Oct-2020 09:12:45 +0200\" ENVELOPE (\"Tue, 13 Oct 2020 09:12:45 +0200\" "
+                "\"Re: [team] Quarterly report draft, take " + num + "\" ((\"Jan Novak\" NIL \"jan.novak\" \"example.org\")) "
+                "((\"Jan Novak\" NIL \"jan.novak\" \"example.org\")) ((\"Jan Novak\" NIL \"jan.novak\" \"example.org\")) "
+                "((\"Team\" NIL \"team\" \"lists.example.org\")) NIL NIL \"<" + num + ".1600000000@example.org>\" "
+                "\"<" + num + ".1600000042@mail.example.org>\")";
+        const QByteArray headers = "References: <1.1600000000@example.org>\r\n <" + num + ".1600000000@example.org>\r\n"
+                "List-Post: <mailto:team@lists.example.org>\r\n";
+        fullResponse += common + " BODYSTRUCTURE " + sample.first + " BODY[HEADER.FIELDS (References List-Post)] "
+                + asLiteral(headers + "\r\n") + ")\r\n";
+        listResponse += common + " BODY[HEADER.FIELDS (References List-Post Content-Type)] "
+                + asLiteral(headers + "Content-Type: " + sample.second + "\r\n\r\n") + ")\r\n";
+    }
+    cServer(listResponse + t.last("OK fetched\r\n"));
+    for (int i = 0; i < count; ++i) {
+        QModelIndex msg = msgListB.model()->index(i, 0, msgListB);
+        QVERIFY(msg.data(RoleIsFetched).toBool());
+        QCOMPARE(msg.data(RoleMessageSubject).toString(),
+                 QStringLiteral("Re: [team] Quarterly report draft, take %1").arg(i + 1));
+    }
+    cEmpty();
+
+    qDebug() << "Metadata of" << count << "messages:" << fullResponse.size() << "bytes with the BODYSTRUCTURE,"
+             << listResponse.size() << "bytes without it";
+    QVERIFY(listResponse.size() * 5 < fullResponse.size() * 4);
+    QVERIFY(errorSpy->isEmpty());
+}
+
 QTEST_GUILESS_MAIN(BodyPartsTest)
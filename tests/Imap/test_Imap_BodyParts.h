@@ -43,6 +43,13 @@ private slots:
     void testFilenameExtraction_data();
 
     void testBinaryFallback();
+
+    void testChunkedFetch();
+
+    void testDeferredBodyStructure();
+    void testDeferredBodyStructureFailure();
+    void testDeferredBodyStructureOffline();
+    void testDeferredBodyStructureSavings();
 };
 
 #endif
@@ -27,6 +27,7 @@
 #include "test_Imap_LowLevelParser.h"
 
 #include "Imap/Exceptions.h"
+#include "Imap/Parser/CharScanners.h"
 
 typedef QPair<QByteArray,Imap::LowLevelParser::ParsedAs> StringWithKind;
 
@@ -543,6 +544,58 @@ void ImapLowLevelParserTest::testGetRFC2822DateTime_data()
     
 }
 
+void ImapLowLevelParserTest::testCharScanners()
+{
+    using namespace Imap::LowLevelParser;
+
+    // Put each possible byte value at each position of a buffer which spans several vectors
+    QByteArray buf(37, 'a');
+    for (int pos = 0; pos < buf.size(); ++pos) {
+        for (int c = 0; c < 256; ++c) {
+            buf[pos] = static_cast<char>(c);
+            const char *begin = buf.constData();
+            const char *end = begin + buf.size();
+            for (int offset : {0, 1, 15, 16, 17}) {
+                QCOMPARE(skipAtomChars(begin + offset, end) - begin, skipAtomCharsScalar(begin + offset, end) - begin);
+                QCOMPARE(findQuotedSpecial(begin + offset, end) - begin, findQuotedSpecialScalar(begin + offset, end) - begin);
+            }
+        }
+        buf[pos] = 'a';
+    }
+
+    QByteArray atom("UID FETCH");
+    QCOMPARE(skipAtomChars(atom.constData(), atom.constData() + atom.size()) - atom.constData(), 3);
+    QByteArray eightBit("abcdefghijklmnopqrst\xc3\xa1");
+    QCOMPARE(skipAtomChars(eightBit.constData(), eightBit.constData() + eightBit.size()) - eightBit.constData(), 20);
+    QByteArray quoted("this is a rather long \\ quoted string\"");
+    QCOMPARE(findQuotedSpecial(quoted.constData(), quoted.constData() + quoted.size()) - quoted.constData(), 22);
+}
+
+void ImapLowLevelParserTest::benchmarkHeaderFetch()
+{
+    using namespace Imap::LowLevelParser;
+
+    // A response as sent by a real server when the message list is populated for the first time
+    QByteArray line = "(UID 123456 RFC822.SIZE 48213 FLAGS (\\Seen $Forwarded NonJunk) "
+            "INTERNALDATE \"05-Mar-2016 17:52:03 +0100\" "
+            "ENVELOPE (\"Sat, 5 Mar 2016 17:51:58 +0100\" \"Re: [Trojita] Threading of messages in large mailboxes, "
+            "once again\" ((\"Some Contributor\" NIL \"contributor\" \"example.org\")) "
+            "((\"Some Contributor\" NIL \"contributor\" \"example.org\")) "
+            "((\"Some Contributor\" NIL \"contributor\" \"example.org\")) "
+            "((NIL NIL \"trojita\" \"lists.example.org\")) NIL NIL "
+            "\"<56DB0B2E.1060101@example.org>\" \"<2381956.Jc7hzEvHyN@example.net>\") "
+            "BODY[HEADER.FIELDS (REFERENCES LIST-POST)] {161}\r\n"
+            "References: <1656447.qzHhMkE2cF@example.net> <56DB0A4F.1040200@example.org>\r\n"
+            " <2381956.Jc7hzEvHyN@example.net>\r\nList-Post: <mailto:trojita@lists.example.org>\r\n\r\n)\r\n";
+
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i) {
+            int start = 0;
+            getAnything(line, start);
+        }
+    }
+}
+
 QTEST_GUILESS_MAIN( ImapLowLevelParserTest )
 
 namespace QTest {
@@ -46,6 +46,10 @@ private Q_SLOTS:
     /** @short Test Imap::LowLevelParser::getRFC2822DateTime() */
     void testGetRFC2822DateTime();
     void testGetRFC2822DateTime_data();
+    /** @short Compare the vectorized scanners against the plain ones */
+    void testCharScanners();
+    /** @short Speed of parsing a typical response to the initial FETCH of headers */
+    void benchmarkHeaderFetch();
 };
 
 #endif
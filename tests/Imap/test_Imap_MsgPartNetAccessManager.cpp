@@ -21,6 +21,8 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <QSignalSpy>
+#include <QTemporaryDir>
 #include <QTest>
 #include <QNetworkRequest>
 #include <QNetworkReply>
@@ -29,6 +31,7 @@
 #include "test_Imap_MsgPartNetAccessManager.h"
 #include "Imap/Model/ItemRoles.h"
 #include "Imap/Network/MsgPartNetAccessManager.h"
+#include "Imap/Network/FileDownloadManager.h"
 #include "Imap/Network/ForbiddenReply.h"
 #include "Imap/Network/MsgPartNetworkReply.h"
 #include "Streams/FakeSocket.h"
@@ -237,5 +240,120 @@ void ImapMsgPartNetAccessManagerTest::testFetchResultOfflineSingle()
     QCOMPARE(res->error(), QNetworkReply::ContentNotFoundError);
 }
 
+/** @short Both messages contain a single base64-encoded part which is big enough to be fetched in three chunks */
+void ImapMsgPartNetAccessManagerTest::helperChunkedMetadata()
+{
+    model->setProperty("trojita-imap-partial-fetch-threshold", 20);
+    model->setProperty("trojita-imap-partial-fetch-chunk-size", 16);
+    const QByteArray bodyStructure = "(\"application\" \"octet-stream\" () NIL NIL \"base64\" 36)";
+    cServer("* 1 FETCH (UID 1 BODYSTRUCTURE " + bodyStructure + ")\r\n"
+            "* 2 FETCH (UID 2 BODYSTRUCTURE " + bodyStructure + ")\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msg1), 1);
+    QCOMPARE(model->rowCount(msg2), 1);
+}
+
+/** @short The data of a big part can be read as soon as each chunk arrives */
+void ImapMsgPartNetAccessManagerTest::testChunkedReply()
+{
+    helperChunkedMetadata();
+
+    netAccessManager->setModelMessage(msg1);
+    QNetworkRequest req;
+    req.setUrl(QUrl(QStringLiteral("trojita-imap://msg/0")));
+    QNetworkReply *res = netAccessManager->get(req);
+    QVERIFY(qobject_cast<Imap::Network::MsgPartNetworkReply*>(res));
+    QSignalSpy progressSpy(res, SIGNAL(downloadProgress(qint64,qint64)));
+    QSignalSpy readyReadSpy(res, SIGNAL(readyRead()));
+    QSignalSpy finishedSpy(res, SIGNAL(finished()));
+
+    cClient(t.mk("UID FETCH 1 (BODY.PEEK[1]<0.16>)\r\n"));
+    cServer("* 1 FETCH (UID 1 BODY[1]<0> {16}\r\nSGVsbG8g\r\nY2h1bm)\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(res->header(QNetworkRequest::ContentTypeHeader).toString(), QStringLiteral("application/octet-stream"));
+    QVERIFY(!progressSpy.isEmpty());
+    QCOMPARE(progressSpy.last()[0].toLongLong(), 16ll);
+    QCOMPARE(progressSpy.last()[1].toLongLong(), 36ll);
+    QVERIFY(!readyReadSpy.isEmpty());
+    QCOMPARE(res->readAll(), QByteArray("Hello "));
+    QVERIFY(!res->isFinished());
+
+    cClient(t.mk("UID FETCH 1 (BODY.PEEK[1]<16.16>)\r\n"));
+    cServer("* 1 FETCH (UID 1 BODY[1]<16> {16}\r\ntl\r\nZCB3b3Js\r\nZC)\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(progressSpy.last()[0].toLongLong(), 32ll);
+    QCOMPARE(res->readAll(), QByteArray("chunked worl"));
+    QVERIFY(!res->isFinished());
+    QCOMPARE(finishedSpy.size(), 0);
+
+    cClient(t.mk("UID FETCH 1 (BODY.PEEK[1]<32.16>)\r\n"));
+    cServer("* 1 FETCH (UID 1 BODY[1]<32> {4}\r\nE=\r\n)\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(finishedSpy.size(), 1);
+    QVERIFY(res->isFinished());
+    QCOMPARE(res->error(), QNetworkReply::NoError);
+    QCOMPARE(res->readAll(), QByteArray("d!"));
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Big parts are written to the file as they arrive, and a failed download does not leave a truncated file behind */
+void ImapMsgPartNetAccessManagerTest::testChunkedFileDownload()
+{
+    helperChunkedMetadata();
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    {
+        const QString fileName = dir.filePath(QStringLiteral("complete"));
+        netAccessManager->setModelMessage(msg1);
+        Imap::Network::FileDownloadManager downloader(nullptr, netAccessManager, msg1.model()->index(0, 0, msg1));
+        connect(&downloader, &Imap::Network::FileDownloadManager::fileNameRequested, this, [fileName](QString *name) {
+            *name = fileName;
+        });
+        QSignalSpy progressSpy(&downloader, SIGNAL(transferProgress(qint64,qint64)));
+        QSignalSpy succeededSpy(&downloader, SIGNAL(succeeded()));
+        QSignalSpy failedSpy(&downloader, SIGNAL(transferError(QString)));
+        downloader.downloadPart();
+
+        cClient(t.mk("UID FETCH 1 (BODY.PEEK[1]<0.16>)\r\n"));
+        cServer("* 1 FETCH (UID 1 BODY[1]<0> {16}\r\nSGVsbG8g\r\nY2h1bm)\r\n" + t.last("OK fetched\r\n"));
+        QVERIFY(!progressSpy.isEmpty());
+        QCOMPARE(progressSpy.last()[0].toLongLong(), 16ll);
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.readAll(), QByteArray("Hello "));
+        file.close();
+
+        cClient(t.mk("UID FETCH 1 (BODY.PEEK[1]<16.16>)\r\n"));
+        cServer("* 1 FETCH (UID 1 BODY[1]<16> {16}\r\ntl\r\nZCB3b3Js\r\nZC)\r\n" + t.last("OK fetched\r\n"));
+        cClient(t.mk("UID FETCH 1 (BODY.PEEK[1]<32.16>)\r\n"));
+        cServer("* 1 FETCH (UID 1 BODY[1]<32> {4}\r\nE=\r\n)\r\n" + t.last("OK fetched\r\n"));
+        QCOMPARE(succeededSpy.size(), 1);
+        QVERIFY(failedSpy.isEmpty());
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.readAll(), QByteArray("Hello chunked world!"));
+        cEmpty();
+    }
+
+    {
+        const QString fileName = dir.filePath(QStringLiteral("failed"));
+        netAccessManager->setModelMessage(msg2);
+        Imap::Network::FileDownloadManager downloader(nullptr, netAccessManager, msg2.model()->index(0, 0, msg2));
+        connect(&downloader, &Imap::Network::FileDownloadManager::fileNameRequested, this, [fileName](QString *name) {
+            *name = fileName;
+        });
+        QSignalSpy succeededSpy(&downloader, SIGNAL(succeeded()));
+        QSignalSpy failedSpy(&downloader, SIGNAL(transferError(QString)));
+        downloader.downloadPart();
+
+        cClient(t.mk("UID FETCH 2 (BODY.PEEK[1]<0.16>)\r\n"));
+        cServer("* 2 FETCH (UID 2 BODY[1]<0> {16}\r\nSGVsbG8g\r\nY2h1bm)\r\n" + t.last("OK fetched\r\n"));
+        QVERIFY(QFile::exists(fileName));
+        cClient(t.mk("UID FETCH 2 (BODY.PEEK[1]<16.16>)\r\n"));
+        cServer(t.last("NO go away\r\n"));
+        QCOMPARE(failedSpy.size(), 1);
+        QVERIFY(succeededSpy.isEmpty());
+        QVERIFY(!QFile::exists(fileName));
+        cEmpty();
+    }
+}
 
 QTEST_GUILESS_MAIN( ImapMsgPartNetAccessManagerTest )
@@ -38,8 +38,12 @@ private Q_SLOTS:
     void testMessageParts();
     void testMessageParts_data();
     void testFetchResultOfflineSingle();
+    void testChunkedReply();
+    void testChunkedFileDownload();
 
 private:
+    void helperChunkedMetadata();
+
     Imap::Mailbox::DummyNetworkWatcher *networkPolicy;
     Imap::Network::MsgPartNetAccessManager *netAccessManager;
     QPersistentModelIndex msg1, msg2;
@@ -20,6 +20,7 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <QLocale>
 #include "test_Imap_Offline.h"
 #include "Streams/FakeSocket.h"
 #include "Imap/Model/ItemRoles.h"
@@ -30,6 +31,23 @@
 
 using namespace Imap::Mailbox;
 
+/** @short Like cClient, but for an explicitly given socket */
+#define cClientOn(SOCKET, data) \
+{ \
+    TROJITA_CLIENT_LOOP \
+    QVERIFY(SOCKET); \
+    QCOMPARE(QString::fromUtf8(SOCKET->writtenStuff()), QString::fromUtf8(data)); \
+}
+
+/** @short Like cServer, but for an explicitly given socket */
+#define cServerOn(SOCKET, data) \
+{ \
+    QVERIFY(SOCKET); \
+    SOCKET->fakeReading(data); \
+    for (int i = 0; i < 4; ++i) \
+        QCoreApplication::processEvents(); \
+}
+
 void OfflineTest::init()
 {
     LibMailboxSync::init();
@@ -76,4 +94,201 @@ void OfflineTest::testStatusVsExistsCached()
     helperCheckCache();
 }
 
+/** @short Helper: mailbox B is open with two messages whose metadata are not known yet */
+void OfflineTest::helperPrefetchTwoMessagesInB()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    model->setProperty("trojita-imap-prefetch-interval", 0);
+    helperSyncBNoMessages();
+    cServer("* 2 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 1:* (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 333 FLAGS ())\r\n* 2 FETCH (UID 334 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    cEmpty();
+    model->setBackgroundSync(0, QStringList() << QStringLiteral("b"));
+    m_since = QLocale(QLocale::C).toString(QDate::currentDate().addDays(-7), QStringLiteral("d-MMM-yyyy")).toUtf8();
+}
+
+/** @short Recent messages get downloaded in the background */
+void OfflineTest::testPrefetch()
+{
+    helperPrefetchTwoMessagesInB();
+    model->setOfflinePrefetch(true, 7);
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SINCE " + m_since + "\r\n"));
+    cServer("* SEARCH 334\r\n" + t.last("OK searched\r\n"));
+
+    // Only the message which matched gets its metadata and its text parts
+    cClient(t.mk("UID FETCH 334 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 2 FETCH (UID 334 RFC822.SIZE 5 INTERNALDATE \"15-Jan-2013 12:17:06 +0000\" "
+            "ENVELOPE (NIL \"s\" NIL NIL NIL NIL NIL NIL NIL NIL) "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL \"7bit\" 5 1))\r\n"
+            + t.last("OK fetched\r\n"));
+    cClient(t.mk("UID FETCH 334 (BODY.PEEK[1])\r\n"));
+    cServer("* 2 FETCH (UID 334 BODY[1] \"hello\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(model->cache()->messagePart(QStringLiteral("b"), 334, "1"), QByteArray("hello"));
+    QCOMPARE(model->cache()->messageMetadata(QStringLiteral("b"), 333).uid, 0u);
+    for (int i = 0; i < 10; ++i)
+        QCoreApplication::processEvents();
+    cEmpty();
+    justKeepTask();
+
+    // The text went to the cache only, and that's where it comes from when the user opens the message
+    QModelIndex msg = model->index(1, 0, msgListB);
+    QModelIndex part = model->index(0, 0, msg);
+    QVERIFY(part.isValid());
+    QVERIFY(!part.data(RoleIsFetched).toBool());
+    QCOMPARE(part.data(RolePartData).toByteArray(), QByteArray("hello"));
+    QVERIFY(part.data(RoleIsFetched).toBool());
+    cEmpty();
+}
+
+/** @short Nothing gets prefetched while the network is expensive, the work continues once it gets cheap again */
+void OfflineTest::testPrefetchPausedWhenExpensive()
+{
+    helperPrefetchTwoMessagesInB();
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    model->setOfflinePrefetch(true, 7);
+    cEmpty();
+
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_ONLINE);
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SINCE " + m_since + "\r\n"));
+    cServer("* SEARCH 334\r\n" + t.last("OK searched\r\n"));
+    cClient(t.mk("UID FETCH 334 (" FETCH_METADATA_ITEMS ")\r\n"));
+
+    // Going expensive in the middle of a mailbox stops the work before the text parts are asked for
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_EXPENSIVE);
+    cServer("* 2 FETCH (UID 334 RFC822.SIZE 5 INTERNALDATE \"15-Jan-2013 12:17:06 +0000\" "
+            "ENVELOPE (NIL \"s\" NIL NIL NIL NIL NIL NIL NIL NIL) "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL \"7bit\" 5 1))\r\n"
+            + t.last("OK fetched\r\n"));
+    for (int i = 0; i < 10; ++i)
+        QCoreApplication::processEvents();
+    cEmpty();
+    QVERIFY(model->cache()->messagePart(QStringLiteral("b"), 334, "1").isNull());
+
+    LibMailboxSync::setModelNetworkPolicy(model, NETWORK_ONLINE);
+    cClient(t.mk("UID FETCH 334 (BODY.PEEK[1])\r\n"));
+    cServer("* 2 FETCH (UID 334 BODY[1] \"hello\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(model->cache()->messagePart(QStringLiteral("b"), 334, "1"), QByteArray("hello"));
+    cEmpty();
+}
+
+/** @short The prefetching does not compete with what the user is waiting for */
+void OfflineTest::testPrefetchWaitsForForeground()
+{
+    helperPrefetchTwoMessagesInB();
+    model->setProperty("trojita-imap-preload-msg-metadata", 0);
+
+    // The user looks at a message, so there's a task on the main connection
+    QModelIndex msg = model->index(0, 0, msgListB);
+    QCOMPARE(msg.data(RoleMessageSubject).toString(), QString());
+    cClient(t.mk("UID FETCH 333 (" FETCH_METADATA_ITEMS ")\r\n"));
+    model->setOfflinePrefetch(true, 7);
+    for (int i = 0; i < 10; ++i)
+        QCoreApplication::processEvents();
+    cEmpty();
+
+    // Only once that's done does the prefetching start
+    cServer("* 1 FETCH (UID 333 RFC822.SIZE 5 INTERNALDATE \"15-Jan-2013 12:17:06 +0000\" "
+            "ENVELOPE (NIL \"s\" NIL NIL NIL NIL NIL NIL NIL NIL) "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL \"7bit\" 5 1))\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(msg.data(RoleMessageSubject).toString(), QStringLiteral("s"));
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SINCE " + m_since + "\r\n"));
+    cServer("* SEARCH 333\r\n" + t.last("OK searched\r\n"));
+
+    // The metadata are known already, so it's just the text
+    cClient(t.mk("UID FETCH 333 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 333 BODY[1] \"hello\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(model->cache()->messagePart(QStringLiteral("b"), 333, "1"), QByteArray("hello"));
+    cEmpty();
+}
+
+/** @short Favorite and recent mailboxes are synced on an extra connection, leaving the main one alone */
+void OfflineTest::testBackgroundSync()
+{
+    model->setProperty("trojita-imap-background-sync-delay", 0);
+    helperSyncBNoMessages();
+    QPointer<Streams::FakeSocket> mainSocket = SOCK;
+
+    model->setBackgroundSync(1, QStringList() << QStringLiteral("a") << QStringLiteral("c"));
+    TROJITA_CLIENT_LOOP;
+    QPointer<Streams::FakeSocket> bgSocket = SOCK;
+    QVERIFY(bgSocket != mainSocket);
+    QCOMPARE(model->taskModel()->rowCount(), 2);
+    TagGenerator bg;
+
+    cClientOn(bgSocket, bg.mk("SELECT a\r\n"));
+    cServerOn(bgSocket, "* 0 EXISTS\r\n* OK [UIDVALIDITY 666] .\r\n* OK [UIDNEXT 3] .\r\n" + bg.last("OK selected\r\n"));
+    QCOMPARE(model->cache()->mailboxSyncState(QStringLiteral("a")).uidValidity(), 666u);
+
+    // Once that one is done, the same connection moves on to the next mailbox
+    cClientOn(bgSocket, bg.mk("SELECT c\r\n"));
+    cServerOn(bgSocket, "* 0 EXISTS\r\n* OK [UIDVALIDITY 333] .\r\n* OK [UIDNEXT 5] .\r\n" + bg.last("OK selected\r\n"));
+    QCOMPARE(model->cache()->mailboxSyncState(QStringLiteral("c")).uidValidity(), 333u);
+
+    // The recent mailbox is open on the main connection already, so there's nothing left to do
+    cClientOn(bgSocket, "");
+    cClientOn(mainSocket, "");
+    QCOMPARE(model->taskModel()->rowCount(), 2);
+
+    // A new round skips whatever is open already
+    model->setBackgroundSync(1, QStringList() << QStringLiteral("c") << QStringLiteral("d"));
+    cClientOn(bgSocket, bg.mk("SELECT d\r\n"));
+    cServerOn(bgSocket, "* 0 EXISTS\r\n" + bg.last("OK selected\r\n"));
+    cClientOn(bgSocket, "");
+    cClientOn(mainSocket, "");
+
+    // Zero connections disable the whole thing
+    model->setBackgroundSync(0, QStringList() << QStringLiteral("e"));
+    cClientOn(bgSocket, "");
+    cClientOn(mainSocket, "");
+    QCOMPARE(model->taskModel()->rowCount(), 2);
+}
+
+/** @short The queued mailboxes are spread over all background connections, keeping away from the one in use */
+void OfflineTest::testBackgroundSyncRotation()
+{
+    model->setProperty("trojita-imap-background-sync-delay", 0);
+    helperSyncBNoMessages();
+    QPointer<Streams::FakeSocket> mainSocket = SOCK;
+
+    model->setBackgroundSync(1, QStringList() << QStringLiteral("a") << QStringLiteral("c") << QStringLiteral("d"));
+    TROJITA_CLIENT_LOOP;
+    QPointer<Streams::FakeSocket> bgSocket1 = SOCK;
+    TagGenerator bg1;
+    cClientOn(bgSocket1, bg1.mk("SELECT a\r\n"));
+
+    // A second connection is opened while the first one is still busy, and the busy one is left alone
+    model->setBackgroundSync(2, QStringList() << QStringLiteral("c") << QStringLiteral("d"));
+    TROJITA_CLIENT_LOOP;
+    QPointer<Streams::FakeSocket> bgSocket2 = SOCK;
+    QVERIFY(bgSocket2 != bgSocket1);
+    QCOMPARE(model->taskModel()->rowCount(), 3);
+    TagGenerator bg2;
+    cClientOn(bgSocket2, bg2.mk("SELECT c\r\n"));
+    cClientOn(bgSocket1, "");
+
+    // Whichever connection gets free first takes the next mailbox
+    cServerOn(bgSocket1, "* 0 EXISTS\r\n" + bg1.last("OK selected\r\n"));
+    cClientOn(bgSocket1, bg1.mk("SELECT d\r\n"));
+    cClientOn(bgSocket2, "");
+    cServerOn(bgSocket2, "* 0 EXISTS\r\n" + bg2.last("OK selected\r\n"));
+    cServerOn(bgSocket1, "* 0 EXISTS\r\n" + bg1.last("OK selected\r\n"));
+    cClientOn(bgSocket1, "");
+    cClientOn(bgSocket2, "");
+    cClientOn(mainSocket, "");
+
+    // The user opens a mailbox which lives on a background connection, so that one has to stay where it is
+    QModelIndex idxD = model->index(4, 0, QModelIndex());
+    QCOMPARE(idxD.data(RoleMailboxName).toString(), QStringLiteral("d"));
+    model->switchToMailbox(idxD);
+    model->setBackgroundSync(2, QStringList() << QStringLiteral("e"));
+    cClientOn(bgSocket2, bg2.mk("SELECT e\r\n"));
+    cServerOn(bgSocket2, "* 0 EXISTS\r\n" + bg2.last("OK selected\r\n"));
+    cClientOn(bgSocket1, "");
+    cClientOn(bgSocket2, "");
+    cClientOn(mainSocket, "");
+    QCOMPARE(model->taskModel()->rowCount(), 3);
+}
+
 QTEST_GUILESS_MAIN(OfflineTest)
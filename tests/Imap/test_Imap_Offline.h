@@ -34,6 +34,15 @@ class OfflineTest : public LibMailboxSync
 private slots:
     void init();
     void testStatusVsExistsCached();
+    void testPrefetch();
+    void testPrefetchPausedWhenExpensive();
+    void testPrefetchWaitsForForeground();
+    void testBackgroundSync();
+    void testBackgroundSyncRotation();
+
+private:
+    void helperPrefetchTwoMessagesInB();
+    QByteArray m_since;
 };
 
 #endif
@@ -448,6 +448,21 @@ void ImapParserParseTest::testParseUntagged_data()
         << QByteArray("* ESEARCH (TAG \"B01\") UID REMOVEFROM (0 32768)\r\n")
         << QSharedPointer<AbstractResponse>(new ESearch("B01", ESearch::UIDS, incrementalEsearchData));
 
+    ESearch::PartialData_t partialEsearchData;
+    partialEsearchData.push_back(ESearch::PartialItem_t(1, 5, Imap::Uids() << 200 << 250 << 251 << 252 << 300));
+    esearchData.clear();
+    esearchData.push_back(qMakePair<>(QByteArray("COUNT"), Imap::Uids() << 23765));
+    QTest::newRow("esearch-partial-1")
+        << QByteArray("* ESEARCH (TAG \"A01\") UID PARTIAL (1:5 200,250:252,300) COUNT 23765\r\n")
+        << QSharedPointer<AbstractResponse>(new ESearch("A01", ESearch::UIDS, esearchData, partialEsearchData));
+
+    partialEsearchData.clear();
+    partialEsearchData.push_back(ESearch::PartialItem_t(-1, -100, Imap::Uids()));
+    esearchData.clear();
+    QTest::newRow("esearch-partial-nil")
+        << QByteArray("* ESEARCH (TAG \"A02\") UID PARTIAL (-1:-100 NIL)\r\n")
+        << QSharedPointer<AbstractResponse>(new ESearch("A02", ESearch::UIDS, esearchData, partialEsearchData));
+
     Status::stateDataType states;
     states[Status::MESSAGES] = 231;
     states[Status::UIDNEXT] = 44292;
@@ -295,4 +295,139 @@ void ImapModelListChildMailboxesTest::testAutoExpanding()
 }
 
 
+/** @short Obtaining the whole mailbox tree through a single LIST, and refreshing it in place */
+void ImapModelListChildMailboxesTest::testRecursiveListing()
+{
+    using namespace Imap::Mailbox;
+    model->setProperty("trojita-imap-list-recursive", true);
+
+    QCOMPARE(model->rowCount(QModelIndex()), 1);
+    cClient(t.mk("LIST \"\" \"*\"\r\n"));
+    // The parent of "a.b.c" is missing on purpose
+    cServer("* LIST (\\HasChildren) \".\" a\r\n"
+            "* LIST (\\HasNoChildren) \".\" a.b.c\r\n"
+            "* LIST (\\HasNoChildren) \".\" z\r\n"
+            "* LIST (\\HasNoChildren) \".\" INBOX\r\n"
+            + t.last("OK listed\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), 4);
+    QPersistentModelIndex idxInbox = model->index(1, 0, QModelIndex());
+    idxA = model->index(2, 0, QModelIndex());
+    QCOMPARE(idxInbox.data(RoleMailboxName).toString(), QStringLiteral("INBOX"));
+    QCOMPARE(idxA.data(RoleMailboxName).toString(), QStringLiteral("a"));
+    QCOMPARE(model->index(3, 0, QModelIndex()).data(RoleMailboxName).toString(), QStringLiteral("z"));
+
+    // The nested mailboxes are known already, so there's no further LIST
+    QCOMPARE(model->rowCount(idxA), 2);
+    QModelIndex idxAB = model->index(1, 0, idxA);
+    QCOMPARE(idxAB.data(RoleMailboxName).toString(), QStringLiteral("a.b"));
+    QCOMPARE(idxAB.data(RoleMailboxIsSelectable).toBool(), false);
+    QCOMPARE(model->rowCount(idxAB), 2);
+    QModelIndex idxABC = model->index(1, 0, idxAB);
+    QCOMPARE(idxABC.data(RoleMailboxName).toString(), QStringLiteral("a.b.c"));
+    QCOMPARE(model->rowCount(idxABC), 1);
+    QCOMPARE(model->rowCount(idxInbox), 1);
+    cEmpty();
+
+    // Only what the server has sent is remembered
+    QList<MailboxMetadata> snapshot = model->cache()->mailboxTreeSnapshot();
+    QCOMPARE(snapshot.size(), 4);
+    QCOMPARE(snapshot[1].mailbox, QStringLiteral("a.b.c"));
+    QCOMPARE(snapshot[1].flags, QStringList() << QStringLiteral("\\HASNOCHILDREN"));
+
+    // A refresh keeps the items which have not changed
+    model->reloadMailboxList();
+    cClient(t.mk("LIST \"\" \"*\"\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" a\r\n"
+            "* LIST (\\HasNoChildren) \".\" INBOX\r\n"
+            "* LIST (\\HasNoChildren) \".\" b\r\n"
+            "* LIST (\\HasNoChildren) \".\" z\r\n"
+            + t.last("OK listed\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), 5);
+    QVERIFY(idxInbox.isValid());
+    QCOMPARE(idxInbox.row(), 1);
+    QVERIFY(idxA.isValid());
+    QCOMPARE(idxA.row(), 2);
+    QCOMPARE(model->rowCount(idxA), 1);
+    QCOMPARE(model->index(3, 0, QModelIndex()).data(RoleMailboxName).toString(), QStringLiteral("b"));
+    QCOMPARE(model->index(4, 0, QModelIndex()).data(RoleMailboxName).toString(), QStringLiteral("z"));
+    QCOMPARE(model->cache()->mailboxTreeSnapshot().size(), 4);
+    cEmpty();
+}
+
+/** @short The saved tree shows up before the LIST finishes, and it follows the CREATE and DELETE commands */
+void ImapModelListChildMailboxesTest::testRecursiveListingFromSnapshot()
+{
+    using namespace Imap::Mailbox;
+    model->setProperty("trojita-imap-list-recursive", true);
+
+    model->cache()->setMailboxTreeSnapshot(QList<MailboxMetadata>()
+                                           << MailboxMetadata(QStringLiteral("a"), QStringLiteral("."),
+                                                              QStringList() << QStringLiteral("\\HASCHILDREN"))
+                                           << MailboxMetadata(QStringLiteral("a.b"), QStringLiteral("."),
+                                                              QStringList() << QStringLiteral("\\HASNOCHILDREN"))
+                                           << MailboxMetadata(QStringLiteral("z"), QStringLiteral("."),
+                                                              QStringList() << QStringLiteral("\\HASNOCHILDREN"))
+                                           );
+    SyncState s;
+    s.setExists(10);
+    s.setRecent(1);
+    s.setUnSeenCount(2);
+    QVERIFY(s.isUsableForNumbers());
+    model->cache()->setMailboxSyncState(QStringLiteral("z"), s);
+
+    auto snapshotNames = [this]() {
+        QStringList names;
+        Q_FOREACH(const MailboxMetadata &metadata, model->cache()->mailboxTreeSnapshot())
+            names << metadata.mailbox;
+        names.sort();
+        return names;
+    };
+
+    QCOMPARE(model->rowCount(QModelIndex()), 1);
+    cClient(t.mk("LIST \"\" \"*\"\r\n"));
+    auto listResp = t.last("OK listed\r\n");
+
+    // The whole tree is there already, including the message counts which were known the last time
+    QCOMPARE(model->rowCount(QModelIndex()), 3);
+    idxA = model->index(1, 0, QModelIndex());
+    QCOMPARE(idxA.data(RoleMailboxName).toString(), QStringLiteral("a"));
+    QCOMPARE(model->rowCount(idxA), 2);
+    QCOMPARE(model->index(1, 0, idxA).data(RoleMailboxName).toString(), QStringLiteral("a.b"));
+    QPersistentModelIndex idxZ = model->index(2, 0, QModelIndex());
+    QCOMPARE(idxZ.data(RoleMailboxName).toString(), QStringLiteral("z"));
+    QCOMPARE(idxZ.data(RoleTotalMessageCount).toInt(), 10);
+    QCOMPARE(idxZ.data(RoleUnreadMessageCount).toInt(), 2);
+    QCOMPARE(idxA.data(RoleTotalMessageCount), QVariant());
+    cEmpty();
+
+    // The unchanged mailboxes survive the actual LIST
+    cServer("* LIST (\\HasChildren) \".\" a\r\n"
+            "* LIST (\\HasNoChildren) \".\" a.b\r\n"
+            "* LIST (\\HasNoChildren) \".\" z\r\n"
+            + listResp);
+    QCOMPARE(model->rowCount(QModelIndex()), 3);
+    QVERIFY(idxZ.isValid());
+    QCOMPARE(idxZ.data(RoleTotalMessageCount).toInt(), 10);
+    cEmpty();
+
+    model->createMailbox(QStringLiteral("a.new"));
+    cClient(t.mk("CREATE a.new\r\n"));
+    cServer(t.last("OK created\r\n"));
+    cClient(t.mk("LIST \"\" a.new\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" a.new\r\n"
+            + t.last("OK listed\r\n"));
+    QCOMPARE(model->rowCount(idxA), 3);
+    QCOMPARE(snapshotNames(), QStringList() << QStringLiteral("a") << QStringLiteral("a.b")
+             << QStringLiteral("a.new") << QStringLiteral("z"));
+    cEmpty();
+
+    // Deleting a mailbox forgets its children, too
+    model->deleteMailbox(QStringLiteral("a"));
+    cClient(t.mk("DELETE a\r\n"));
+    cServer(t.last("OK deleted\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), 2);
+    QCOMPARE(snapshotNames(), QStringList() << QStringLiteral("z"));
+    cEmpty();
+}
+
 QTEST_GUILESS_MAIN( ImapModelListChildMailboxesTest )
@@ -734,6 +734,104 @@ void ImapModelObtainSynchronizedMailboxTest::testCacheArrivals()
     justKeepTask();
 }
 
+/** @short Without CONDSTORE, FLAGS of a big mailbox are refreshed in chunks, the newest messages first */
+void ImapModelObtainSynchronizedMailboxTest::testCacheProgressiveFlags()
+{
+    model->setProperty("trojita-imap-limit-fetch-flags-per-group", 2);
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(4);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10 << 11;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+    Q_FOREACH(const uint uid, uidMap) {
+        model->cache()->setMsgFlags(QStringLiteral("a"), uid, QStringList() << QStringLiteral("cached"));
+    }
+    QCOMPARE(model->rowCount(msgListA), 0);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer("* 5 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 16] .\r\n");
+    cServer(t.last("OK selected\r\n"));
+    cClient(t.mk("UID SEARCH UID 15:*\r\n"));
+    cServer("* SEARCH 42\r\n");
+    cServer(t.last("OK uids\r\n"));
+    uidMap << 42;
+
+    // Only the most recent messages are needed for declaring the mailbox synced
+    cClient(t.mk("FETCH 4:5 (FLAGS)\r\n"));
+    cServer("* 4 FETCH (FLAGS (d))\r\n"
+            "* 5 FETCH (FLAGS (e))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    QCOMPARE(model->rowCount(msgListA), 5);
+    QCOMPARE(model->cache()->uidMapping("a"), uidMap);
+    QCOMPARE(model->cache()->msgFlags("a", 11), QStringList() << "d");
+    QCOMPARE(model->cache()->msgFlags("a", 42), QStringList() << "e");
+    QCOMPARE(model->cache()->msgFlags("a", 9), QStringList() << "cached");
+
+    QCOMPARE(model->cache()->mailboxSyncState("a").flagsResyncCursor(), 10u);
+
+    // The rest follows in the background, newest first
+    cClient(t.mk("UID FETCH 9:10 (FLAGS)\r\n"));
+    cServer("* 2 FETCH (UID 9 FLAGS (b))\r\n"
+            "* 3 FETCH (UID 10 FLAGS (c))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    QCOMPARE(model->cache()->mailboxSyncState("a").flagsResyncCursor(), 6u);
+    cClient(t.mk("UID FETCH 6 (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 6 FLAGS (a))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    cEmpty();
+    QCOMPARE(model->cache()->mailboxSyncState("a").flagsResyncCursor(), 0u);
+    QCOMPARE(model->cache()->msgFlags("a", 6), QStringList() << "a");
+    QCOMPARE(model->cache()->msgFlags("a", 9), QStringList() << "b");
+    QCOMPARE(model->cache()->msgFlags("a", 10), QStringList() << "c");
+    QCOMPARE(msgListA.model()->index(0, 0, msgListA).data(Imap::Mailbox::RoleMessageFlags).toStringList(), QStringList() << "a");
+    justKeepTask();
+}
+
+/** @short A background FLAGS refresh which did not finish continues where it stopped the last time */
+void ImapModelObtainSynchronizedMailboxTest::testCacheProgressiveFlagsResume()
+{
+    model->setProperty("trojita-imap-limit-fetch-flags-per-group", 2);
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(5);
+    sync.setUidValidity(666);
+    sync.setUidNext(12);
+    sync.setFlagsResyncCursor(7);
+    Imap::Uids uidMap;
+    uidMap << 6 << 7 << 9 << 10 << 11;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+    QCOMPARE(model->rowCount(msgListA), 0);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer("* 5 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 12] .\r\n");
+    cServer(t.last("OK selected\r\n"));
+    cClient(t.mk("FETCH 4:5 (FLAGS)\r\n"));
+    cServer("* 4 FETCH (FLAGS (d))\r\n"
+            "* 5 FETCH (FLAGS (e))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    QCOMPARE(model->rowCount(msgListA), 5);
+    QCOMPARE(model->cache()->mailboxSyncState("a").flagsResyncCursor(), 7u);
+
+    // The messages which were left over the last time go first, and only then the refresh wraps around to the top
+    cClient(t.mk("UID FETCH 6:7 (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 6 FLAGS (a))\r\n"
+            "* 2 FETCH (UID 7 FLAGS (b))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    QCOMPARE(model->cache()->mailboxSyncState("a").flagsResyncCursor(), 9u);
+    cClient(t.mk("UID FETCH 9 (FLAGS)\r\n"));
+    cServer("* 3 FETCH (UID 9 FLAGS (c))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    cEmpty();
+    QCOMPARE(model->cache()->mailboxSyncState("a").flagsResyncCursor(), 0u);
+    QCOMPARE(model->cache()->msgFlags("a", 7), QStringList() << "b");
+    justKeepTask();
+}
+
 void ImapModelObtainSynchronizedMailboxTest::testCacheArrivalRaceDuringUid()
 {
     helperCacheArrivalRaceDuringUid(WITHOUT_ESEARCH);
@@ -60,6 +60,8 @@ private slots:
     void testCacheNoChange();
     void testCacheUidValidity();
     void testCacheArrivals();
+    void testCacheProgressiveFlags();
+    void testCacheProgressiveFlagsResume();
     void testCacheArrivalRaceDuringUid();
     void testCacheArrivalRaceDuringUid_ESearch();
     void testCacheArrivalRaceDuringUid2();
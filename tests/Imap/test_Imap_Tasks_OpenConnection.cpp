@@ -273,6 +273,70 @@ void ImapModelOpenConnectionTest::testOkStartTls()
     QCOMPARE(model->imapAuthError(), QString());
 }
 
+/** @short Test that the CAPABILITY after STARTTLS is pipelined with LOGIN when the password is known already */
+void ImapModelOpenConnectionTest::testPipelinedLoginAfterStartTls()
+{
+    reinit(TlsRequired::Yes);
+    model->setImapUser(QStringLiteral("luzr"));
+    model->setImapPassword(QStringLiteral("sikrit"));
+
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient(t.mk("CAPABILITY\r\n"));
+    cServer("* CAPABILITY imap4rev1 starttls\r\n"
+            + t.last("ok cap\r\n"));
+    cClient(t.mk("STARTTLS\r\n"));
+    cServer(t.last("OK will establish secure layer immediately\r\n"));
+    auto capCmd = t.mk("CAPABILITY\r\n");
+    auto capResp = t.last("OK capability completed\r\n");
+    auto loginCmd = t.mk("LOGIN luzr sikrit\r\n");
+    auto loginResp = t.last("OK [CAPABILITY IMAP4rev1] logged in\r\n");
+
+    // Both commands are on the wire before the server has said anything after the TLS handshake
+    TROJITA_CLIENT_LOOP;
+    const QByteArray written = SOCK->writtenStuff();
+    QCOMPARE(written, QByteArray("[*** STARTTLS ***]" + capCmd + loginCmd));
+    cEmpty();
+    QVERIFY(completedSpy->isEmpty());
+
+    // The reply to CAPABILITY does not trigger another LOGIN
+    cServer("* CAPABILITY IMAP4rev1\r\n" + capResp);
+    cEmpty();
+    QVERIFY(completedSpy->isEmpty());
+    cServer(loginResp);
+    cEmpty();
+    QCOMPARE(completedSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+    QVERIFY(authSpy->isEmpty());
+    QCOMPARE(model->imapAuthError(), QString());
+}
+
+/** @short The capabilities which were sent along with LOGIN are pre-auth ones, so they have to be asked for again */
+void ImapModelOpenConnectionTest::testPipelinedLoginRefreshesCaps()
+{
+    reinit(TlsRequired::Yes);
+    model->setImapUser(QStringLiteral("luzr"));
+    model->setImapPassword(QStringLiteral("sikrit"));
+
+    cEmpty();
+    cServer("* OK [CAPABILITY imap4rev1 starttls] foo\r\n");
+    cClient(t.mk("STARTTLS\r\n"));
+    cServer(t.last("OK will establish secure layer immediately\r\n"));
+    auto capCmd = t.mk("CAPABILITY\r\n");
+    auto capResp = t.last("OK capability completed\r\n");
+    auto loginCmd = t.mk("LOGIN luzr sikrit\r\n");
+    auto loginResp = t.last("OK logged in\r\n");
+    cClient("[*** STARTTLS ***]" + capCmd + loginCmd);
+    cServer("* CAPABILITY IMAP4rev1\r\n" + capResp + loginResp);
+    cClient(t.mk("CAPABILITY\r\n"));
+    QVERIFY(completedSpy->isEmpty());
+    cServer("* CAPABILITY IMAP4rev1\r\n" + t.last("OK capability completed\r\n"));
+    cEmpty();
+    QCOMPARE(completedSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+    QVERIFY(authSpy->isEmpty());
+}
+
 /** @short Test that an untagged CAPABILITY after LOGIN prevents an extra CAPABILITY command */
 void ImapModelOpenConnectionTest::testCapabilityAfterLogin()
 {
@@ -408,6 +472,114 @@ void ImapModelOpenConnectionTest::testCompressDeflateNo()
     QCOMPARE(model->imapAuthError(), QString());
 }
 
+/** @short Servers with NOTIFY get asked to push the changes of mailboxes right after logging in */
+void ImapModelOpenConnectionTest::testNotify()
+{
+    cEmpty();
+    cServer("* OK [capability imap4rev1] hi there\r\n");
+    QVERIFY(completedSpy->isEmpty());
+    cClient(t.mk("LOGIN luzr sikrit\r\n"));
+    QCOMPARE(authSpy->size(), 1);
+    cServer(t.last("OK [CAPABILITY IMAP4rev1 NOTIFY] logged in\r\n"));
+    cClient(t.mk("NOTIFY SET (SELECTED-DELAYED (MessageNew MessageExpunge FlagChange)) "
+                 "(PERSONAL (MessageNew MessageExpunge FlagChange))\r\n"));
+    cServer(t.last("OK notifying\r\n"));
+    cEmpty();
+    QCOMPARE(completedSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+    QCOMPARE(authErrorSpy->size(), 0);
+}
+
+/** @short Helper: log in to a server with NOTIFY which replies with @arg notifyReply, list mailbox "a" and get its counts */
+void ImapModelOpenConnectionTest::helperConnectWithNotify(const QByteArray &notifyReply)
+{
+    cEmpty();
+    cServer("* OK [capability imap4rev1] hi there\r\n");
+    cClient(t.mk("LOGIN luzr sikrit\r\n"));
+    cServer(t.last("OK [CAPABILITY IMAP4rev1 NOTIFY] logged in\r\n"));
+    cClient(t.mk("NOTIFY SET (SELECTED-DELAYED (MessageNew MessageExpunge FlagChange)) "
+                 "(PERSONAL (MessageNew MessageExpunge FlagChange))\r\n"));
+    cServer(t.last(notifyReply));
+    QCOMPARE(completedSpy->size(), 1);
+
+    QCOMPARE(model->rowCount(QModelIndex()), 1);
+    cClient(t.mk("LIST \"\" \"%\"\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" \"a\"\r\n" + t.last("OK listed\r\n"));
+    idxA = model->index(1, 0, QModelIndex());
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleMailboxName).toString(), QStringLiteral("a"));
+    idxA.data(Imap::Mailbox::RoleTotalMessageCount);
+    cClient(t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS a (MESSAGES 10 UNSEEN 2 RECENT 1)\r\n" + t.last("OK status\r\n"));
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 10);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleUnreadMessageCount).toInt(), 2);
+    cEmpty();
+}
+
+/** @short Helper: the periodic refresh of message counts fires; does it ask the server via STATUS? */
+void ImapModelOpenConnectionTest::helperPollStatus(const bool expectStatus)
+{
+    QMetaObject::invokeMethod(model, "slotPeriodicMailboxNumbersRefresh");
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 10);
+    if (expectStatus) {
+        cClient(t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+        cServer("* STATUS a (MESSAGES 10 UNSEEN 2 RECENT 1)\r\n" + t.last("OK status\r\n"));
+    }
+    cEmpty();
+}
+
+/** @short The STATUS responses pushed through NOTIFY update the numbers */
+void ImapModelOpenConnectionTest::testNotifyPushedStatus()
+{
+    helperConnectWithNotify("OK notifying\r\n");
+
+    cServer("* STATUS a (MESSAGES 11 UNSEEN 3 RECENT 0)\r\n");
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 11);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleUnreadMessageCount).toInt(), 3);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleRecentMessageCount).toInt(), 0);
+    cEmpty();
+
+    // A notification without UNSEEN updates what it can, and the unread count gets refreshed once someone looks
+    cServer("* STATUS a (MESSAGES 12 UIDNEXT 20)\r\n");
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 12);
+    cClient(t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS a (MESSAGES 12 UNSEEN 4 RECENT 0)\r\n" + t.last("OK status\r\n"));
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleUnreadMessageCount).toInt(), 4);
+    cEmpty();
+}
+
+/** @short There's no point in polling via STATUS when the server pushes the changes */
+void ImapModelOpenConnectionTest::testNotifySuppressesPolling()
+{
+    helperConnectWithNotify("OK notifying\r\n");
+    helperPollStatus(false);
+    helperPollStatus(false);
+}
+
+/** @short Once the server gives up on sending notifications, the polling is back */
+void ImapModelOpenConnectionTest::testNotifyOverflow()
+{
+    helperConnectWithNotify("OK notifying\r\n");
+    helperPollStatus(false);
+
+    // The counts might be stale by now, so they are refreshed right away
+    cServer("* OK [NOTIFICATIONOVERFLOW] too many changes\r\n");
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 10);
+    cClient(t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS a (MESSAGES 10 UNSEEN 2 RECENT 1)\r\n" + t.last("OK status\r\n"));
+    cEmpty();
+
+    helperPollStatus(true);
+}
+
+/** @short A server which refuses NOTIFY gets polled as usual */
+void ImapModelOpenConnectionTest::testNotifyFailure()
+{
+    helperConnectWithNotify("NO not today\r\n");
+    QVERIFY(failedSpy->isEmpty());
+    helperPollStatus(true);
+    helperPollStatus(true);
+}
+
 /** @short Make sure that as long as the OpenConnectionTask has not finished its job, nothing else will get queued */
 void ImapModelOpenConnectionTest::testOpenConnectionShallBlock()
 {
@@ -52,10 +52,18 @@ private slots:
     void testOkStartTlsForbidden();
     void testOkStartTlsDiscardCaps();
     void testCapabilityAfterLogin();
+    void testPipelinedLoginAfterStartTls();
+    void testPipelinedLoginRefreshesCaps();
 
     void testCompressDeflateOk();
     void testCompressDeflateNo();
 
+    void testNotify();
+    void testNotifyPushedStatus();
+    void testNotifySuppressesPolling();
+    void testNotifyOverflow();
+    void testNotifyFailure();
+
     void testOpenConnectionShallBlock();
 
     void testLoginDelaysOtherTasks();
@@ -85,6 +93,8 @@ private slots:
 protected:
     enum class TlsRequired { No, Yes };
     void reinit(const TlsRequired tlsRequired = TlsRequired::No);
+    void helperConnectWithNotify(const QByteArray &notifyReply);
+    void helperPollStatus(const bool expectStatus);
 
 private:
     QPointer<Imap::Mailbox::OpenConnectionTask> task;
@@ -856,6 +856,248 @@ void ImapModelThreadingTest::testDynamicSorting()
     justKeepTask();
 }
 
+/** @short Sorting without the server's SORT, using the cached envelopes */
+void ImapModelThreadingTest::testLocalSorting()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("QRESYNC"));
+
+    threadingModel->setUserWantsThreading(false);
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    sync.setHighestModSeq(33);
+    sync.setUnSeenCount(3);
+    sync.setRecent(0);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+    const QStringList subjects = {QStringLiteral("Re: [trojita] Fwd: sorting"), QStringLiteral("mail"), QStringLiteral("[Fwd: Qt] (fwd)")};
+    for (int i = 0; i < uidMap.size(); ++i) {
+        Imap::Mailbox::AbstractCache::MessageDataBundle metadata;
+        metadata.uid = uidMap[i];
+        metadata.envelope.subject = subjects[i];
+        metadata.internalDate = QDateTime(QDate(2016, 1, 3 - i), QTime(12, 0));
+        metadata.size = 100 * (i + 1);
+        model->cache()->setMessageMetadata(QStringLiteral("a"), uidMap[i], metadata);
+        model->cache()->setMsgFlags(QStringLiteral("a"), uidMap[i], QStringList());
+    }
+    msgListModel->setMailbox(QStringLiteral("a"));
+    cClient(t.mk("SELECT a (QRESYNC (666 33 (2 9)))\r\n"));
+    cServer("* 3 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 15] .\r\n"
+            "* OK [HIGHESTMODSEQ 33] .\r\n"
+            );
+    cServer(t.last("OK selected\r\n"));
+    cEmpty();
+    checkUidMapFromThreading(uidMap);
+
+    // The base subjects are "sorting", "mail" and "qt"; no SORT command shall be sent
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT));
+    cEmpty();
+    checkUidMapFromThreading(Imap::Uids() << 9 << 10 << 6);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT,
+                                                      Qt::DescendingOrder);
+    cEmpty();
+    checkUidMapFromThreading(Imap::Uids() << 6 << 10 << 9);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_ARRIVAL);
+    cEmpty();
+    checkUidMapFromThreading(Imap::Uids() << 10 << 9 << 6);
+
+    // A new arrival has the most recent INTERNALDATE, so it shall be placed at the end right away
+    cServer("* 4 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 15:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 15 FLAGS ())\r\n" + t.last("ok fetched\r\n"));
+    cEmpty();
+    checkUidMapFromThreading(Imap::Uids() << 10 << 9 << 6 << 15);
+
+    // ...and when it goes away, the rest of the order is preserved
+    cServer("* VANISHED 9\r\n");
+    cEmpty();
+    checkUidMapFromThreading(Imap::Uids() << 10 << 6 << 15);
+
+    QCOMPARE(Imap::Mailbox::baseSubject(QStringLiteral("Re: re: FWD: [list]  hello   world (fwd)")), QStringLiteral("hello world"));
+    QCOMPARE(Imap::Mailbox::baseSubject(QStringLiteral("[list]")), QStringLiteral("[list]"));
+    QCOMPARE(Imap::Mailbox::baseSubject(QStringLiteral("re:")), QString());
+}
+
+/** @short A huge mailbox is sorted locally on a worker thread, with the same result as the server would produce */
+void ImapModelThreadingTest::testLocalSortingInBackground()
+{
+    using namespace Imap::Mailbox;
+    threadingModel->setUserWantsThreading(false);
+    const int count = 6000;
+    initialMessages(count);
+
+    // The subjects are a permutation of the UIDs, so there are no ties
+    QVector<QPair<int, uint>> keys;
+    for (uint uid = 1; uid <= count; ++uid) {
+        const int key = (uid * 2749) % 6007;
+        AbstractCache::MessageDataBundle metadata;
+        metadata.uid = uid;
+        metadata.envelope.subject = QStringLiteral("m%1").arg(key, 5, 10, QLatin1Char('0'));
+        model->cache()->setMessageMetadata(QStringLiteral("a"), uid, metadata);
+        keys << qMakePair(key, uid);
+    }
+    std::sort(keys.begin(), keys.end());
+    Imap::Uids expected;
+    for (const auto &item : keys)
+        expected << item.second;
+
+    // No SORT, so this goes through the local sort, and it is big enough to run in the background
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT));
+    QVERIFY(threadingModel->m_localSortJob);
+    // The mailbox order is shown while the sorting runs
+    QCOMPARE(threadingModel->index(0, 0).data(RoleMessageUid).toUInt(), 1u);
+    QTRY_VERIFY(!threadingModel->m_localSortJob);
+    checkUidMapFromThreading(expected);
+    cEmpty();
+
+    // The server's answer for the same criteria leads to the very same order
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("SORT"));
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_ARRIVAL);
+    cClient(t.mk("UID SORT (ARRIVAL) utf-8 ALL\r\n"));
+    cServer("* SORT " + numListToString(uidMapA) + "\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(uidMapA);
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT);
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* SORT " + numListToString(expected) + "\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(expected);
+    cEmpty();
+}
+
+/** @short Threading through the cached References when the server won't do that for us */
+void ImapModelThreadingTest::testLocalThreading()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("QRESYNC"));
+    threadingModel->setPreferLocalThreading(true);
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    sync.setHighestModSeq(33);
+    sync.setUnSeenCount(3);
+    sync.setRecent(0);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+
+    // 9 refers to 6 via References, 10 via In-Reply-To only; 15 is going to arrive later as a reply to 10
+    auto storeMetadata = [this](const uint uid, const QByteArray &messageId, const QList<QByteArray> &references,
+            const QList<QByteArray> &inReplyTo, const int day) {
+        Imap::Mailbox::AbstractCache::MessageDataBundle metadata;
+        metadata.uid = uid;
+        metadata.envelope.messageId = messageId;
+        metadata.envelope.inReplyTo = inReplyTo;
+        metadata.envelope.date = QDateTime(QDate(2016, 1, day), QTime(12, 0));
+        metadata.hdrReferences = references;
+        model->cache()->setMessageMetadata(QStringLiteral("a"), uid, metadata);
+        model->cache()->setMsgFlags(QStringLiteral("a"), uid, QStringList());
+    };
+    storeMetadata(6, "<a@x>", {}, {}, 1);
+    storeMetadata(9, "<b@x>", {"<a@x>"}, {}, 3);
+    storeMetadata(10, "<c@x>", {}, {"<a@x>"}, 2);
+    storeMetadata(15, "<d@x>", {"<a@x>", "<c@x>"}, {"<c@x>"}, 4);
+
+    msgListModel->setMailbox(QStringLiteral("a"));
+    cClient(t.mk("SELECT a (QRESYNC (666 33 (2 9)))\r\n"));
+    cServer("* 3 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 15] .\r\n"
+            "* OK [HIGHESTMODSEQ 33] .\r\n"
+            );
+    cServer(t.last("OK selected\r\n"));
+    // No THREAD command goes to the server, and the siblings are ordered by their date
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(6 (10)(9))"));
+
+    // A new arrival gets threaded incrementally
+    cServer("* 4 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 15:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 15 FLAGS ())\r\n" + t.last("ok fetched\r\n"));
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(6 (10 15)(9))"));
+    auto cached = model->cache()->messageThreading(QStringLiteral("a"));
+    QCOMPARE(cached.size(), 1);
+    QCOMPARE(cached[0].num, 6u);
+    QCOMPARE(cached[0].children.size(), 2);
+    QCOMPARE(cached[0].children[0].children.size(), 1);
+
+    // Two arrivals at once whose headers are not known yet, so the result is not good enough for the cache
+    cServer("* 6 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 16:* (FLAGS)\r\n"));
+    cServer("* 5 FETCH (UID 16 FLAGS ())\r\n* 6 FETCH (UID 17 FLAGS ())\r\n" + t.last("ok fetched\r\n"));
+    QCOMPARE(threadingModel->rowCount(), 3);
+    cached = model->cache()->messageThreading(QStringLiteral("a"));
+    QCOMPARE(cached.size(), 1);
+    QCOMPARE(cached[0].num, 6u);
+}
+
+/** @short A thread whose root is missing is sorted by the date of its earliest message */
+void ImapModelThreadingTest::testLocalThreadingMissingRoot()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("QRESYNC"));
+    threadingModel->setPreferLocalThreading(true);
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    sync.setHighestModSeq(33);
+    sync.setUnSeenCount(3);
+    sync.setRecent(0);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+
+    // Both 9 and 10 are replies to a message which is not in the mailbox; 6 is older than either of them
+    auto storeMetadata = [this](const uint uid, const QByteArray &messageId, const QList<QByteArray> &references,
+            const int day) {
+        Imap::Mailbox::AbstractCache::MessageDataBundle metadata;
+        metadata.uid = uid;
+        metadata.envelope.messageId = messageId;
+        metadata.envelope.date = QDateTime(QDate(2016, 1, day), QTime(12, 0));
+        metadata.hdrReferences = references;
+        model->cache()->setMessageMetadata(QStringLiteral("a"), uid, metadata);
+        model->cache()->setMsgFlags(QStringLiteral("a"), uid, QStringList());
+    };
+    storeMetadata(6, "<a@x>", {}, 2);
+    storeMetadata(9, "<b@x>", {"<missing@x>"}, 5);
+    storeMetadata(10, "<c@x>", {"<missing@x>"}, 3);
+
+    msgListModel->setMailbox(QStringLiteral("a"));
+    cClient(t.mk("SELECT a (QRESYNC (666 33 (2 9)))\r\n"));
+    cServer("* 3 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 15] .\r\n"
+            "* OK [HIGHESTMODSEQ 33] .\r\n"
+            );
+    cServer(t.last("OK selected\r\n"));
+    cEmpty();
+
+    // The placeholder takes the date of its first child, so it does not jump ahead of the older thread
+    QCOMPARE(threadingModel->rowCount(), 2);
+    QCOMPARE(threadingModel->index(0, 0).data(Imap::Mailbox::RoleMessageUid).toUInt(), 6u);
+    QModelIndex placeholder = threadingModel->index(1, 0);
+    QCOMPARE(placeholder.data(Imap::Mailbox::RoleMessageUid).toUInt(), 0u);
+    QCOMPARE(threadingModel->rowCount(placeholder), 2);
+    QCOMPARE(threadingModel->index(0, 0, placeholder).data(Imap::Mailbox::RoleMessageUid).toUInt(), 10u);
+    QCOMPARE(threadingModel->index(1, 0, placeholder).data(Imap::Mailbox::RoleMessageUid).toUInt(), 9u);
+    QVERIFY(errorSpy->isEmpty());
+}
+
 void ImapModelThreadingTest::testDynamicSortingContext()
 {
     // keep preloading active
@@ -1270,6 +1512,181 @@ QByteArray ImapModelThreadingTest::prepareHugeUntaggedThread(const uint num)
     return response.toUtf8();
 }
 
+/** @short The envelopes which are already loaded are used for filtering before the server answers */
+void ImapModelThreadingTest::testProvisionalSearch()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("QRESYNC"));
+
+    threadingModel->setUserWantsThreading(false);
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    sync.setHighestModSeq(33);
+    sync.setUnSeenCount(3);
+    sync.setRecent(0);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+    Q_FOREACH(const uint uid, uidMap) {
+        model->cache()->setMsgFlags(QStringLiteral("a"), uid, QStringList());
+    }
+    msgListModel->setMailbox(QStringLiteral("a"));
+    cClient(t.mk("SELECT a (QRESYNC (666 33 (2 9)))\r\n"));
+    cServer("* 3 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 15] .\r\n"
+            "* OK [HIGHESTMODSEQ 33] .\r\n"
+            );
+    cServer(t.last("OK selected\r\n"));
+    cEmpty();
+    checkUidMapFromThreading(uidMap);
+
+    // Load envelopes of the first two messages, but not of the last one
+    threadingModel->index(0, 0).data(Imap::Mailbox::RoleMessageSubject);
+    threadingModel->index(1, 0).data(Imap::Mailbox::RoleMessageSubject);
+    cClient(t.mk("UID FETCH 6,9 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(1, 6, QStringLiteral("Foobar")) +
+            helperCreateTrivialEnvelope(2, 9, QStringLiteral("something else")) +
+            t.last("OK fetched\r\n"));
+    cEmpty();
+
+    // UID 9 cannot match, the UID 10 might
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QStringLiteral("SUBJECT") << QStringLiteral("foo"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SUBJECT foo\r\n"));
+    checkUidMapFromThreading(Imap::Uids() << 6 << 10);
+    cServer("* SEARCH 6\r\n" + t.last("OK searched\r\n"));
+    checkUidMapFromThreading(Imap::Uids() << 6);
+
+    // Typing more narrows down the previous result
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QStringLiteral("SUBJECT") << QStringLiteral("foox"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SUBJECT foox\r\n"));
+    checkUidMapFromThreading(Imap::Uids());
+    cServer("* SEARCH\r\n" + t.last("OK searched\r\n"));
+    checkUidMapFromThreading(Imap::Uids());
+    cEmpty();
+}
+
+/** @short The local index only matches word prefixes, so the server has the final say while online */
+void ImapModelThreadingTest::testLocalSearchIsProvisional()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("QRESYNC"));
+
+    threadingModel->setUserWantsThreading(false);
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    sync.setHighestModSeq(33);
+    sync.setUnSeenCount(3);
+    sync.setRecent(0);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState(QStringLiteral("a"), sync);
+    model->cache()->setUidMapping(QStringLiteral("a"), uidMap);
+    Q_FOREACH(const uint uid, uidMap) {
+        model->cache()->setMsgFlags(QStringLiteral("a"), uid, QStringList());
+    }
+    msgListModel->setMailbox(QStringLiteral("a"));
+    cClient(t.mk("SELECT a (QRESYNC (666 33 (2 9)))\r\n"));
+    cServer("* 3 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 15] .\r\n"
+            "* OK [HIGHESTMODSEQ 33] .\r\n"
+            );
+    cServer(t.last("OK selected\r\n"));
+    cEmpty();
+    checkUidMapFromThreading(uidMap);
+
+    // Now the index covers all messages
+    threadingModel->index(0, 0).data(Imap::Mailbox::RoleMessageSubject);
+    threadingModel->index(1, 0).data(Imap::Mailbox::RoleMessageSubject);
+    threadingModel->index(2, 0).data(Imap::Mailbox::RoleMessageSubject);
+    cClient(t.mk("UID FETCH 6,9:10 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(1, 6, QStringLiteral("Foobar")) +
+            helperCreateTrivialEnvelope(2, 9, QStringLiteral("something else")) +
+            helperCreateTrivialEnvelope(3, 10, QStringLiteral("hello world")) +
+            t.last("OK fetched\r\n"));
+    cEmpty();
+
+    // The index knows the word "foobar", so this one is answered right away, but the server is still asked
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QStringLiteral("SUBJECT") << QStringLiteral("foo"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    checkUidMapFromThreading(Imap::Uids() << 6);
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SUBJECT foo\r\n"));
+    cServer("* SEARCH 6\r\n" + t.last("OK searched\r\n"));
+    checkUidMapFromThreading(Imap::Uids() << 6);
+
+    // A substring from the middle of a word is not in the index, so only the server finds it
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QStringLiteral("SUBJECT") << QStringLiteral("ello"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    checkUidMapFromThreading(Imap::Uids());
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SUBJECT ello\r\n"));
+    cServer("* SEARCH 10\r\n" + t.last("OK searched\r\n"));
+    checkUidMapFromThreading(Imap::Uids() << 10);
+    cEmpty();
+}
+
+/** @short Test that a huge mailbox gets its sort order in windows, and only as the user scrolls through it */
+void ImapModelThreadingTest::testPartialSorting()
+{
+    using namespace Imap::Mailbox;
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(3000);
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("QRESYNC"));
+    injector.injectCapability(QStringLiteral("SORT"));
+    injector.injectCapability(QStringLiteral("ESORT"));
+    injector.injectCapability(QStringLiteral("PARTIAL"));
+
+    // The server's idea of the order: the second half of the mailbox goes first
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::AscendingOrder);
+    cClient(t.mk("UID SORT RETURN (PARTIAL 1:250 COUNT) (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID PARTIAL (1:250 1501:1750) COUNT 3000\r\n");
+    cServer(t.last("OK sorted\r\n"));
+    QCOMPARE(threadingModel->rowCount(), 3000);
+    QCOMPARE(threadingModel->index(0, 0).data(RoleMessageUid).toUInt(), 1501u);
+    QCOMPARE(threadingModel->index(100, 0).data(RoleMessageUid).toUInt(), 1601u);
+    cEmpty();
+
+    // Scrolling close to the end of the known window asks for the next one
+    QCOMPARE(threadingModel->index(240, 0).data(RoleMessageUid).toUInt(), 1741u);
+    cClient(t.mk("UID SORT RETURN (PARTIAL 251:500 COUNT) (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID PARTIAL (251:500 1751:2000) COUNT 3000\r\n");
+    cServer(t.last("OK sorted\r\n"));
+    QCOMPARE(threadingModel->rowCount(), 3000);
+    QCOMPARE(threadingModel->index(250, 0).data(RoleMessageUid).toUInt(), 1751u);
+    cEmpty();
+    // The rest of the messages stay in the mailbox order until their position is known
+    QCOMPARE(threadingModel->index(500, 0).data(RoleMessageUid).toUInt(), 1u);
+    cClient(t.mk("UID SORT RETURN (PARTIAL 501:750 COUNT) (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID PARTIAL (501:750 2001:2250) COUNT 3000\r\n");
+    cServer(t.last("OK sorted\r\n"));
+    QCOMPARE(threadingModel->index(500, 0).data(RoleMessageUid).toUInt(), 2001u);
+
+    // The reversed order needs the windows from the end of the result
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::DescendingOrder);
+    cClient(t.mk("UID SORT RETURN (PARTIAL -1:-250 COUNT) (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID PARTIAL (-1:-250 1251:1500) COUNT 3000\r\n");
+    cServer(t.last("OK sorted\r\n"));
+    QCOMPARE(threadingModel->rowCount(), 3000);
+    QCOMPARE(threadingModel->index(0, 0).data(RoleMessageUid).toUInt(), 1500u);
+    QCOMPARE(threadingModel->index(249, 0).data(RoleMessageUid).toUInt(), 1251u);
+    cClient(t.mk("UID SORT RETURN (PARTIAL -251:-500 COUNT) (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID PARTIAL (-251:-500 1001:1250) COUNT 3000\r\n");
+    cServer(t.last("OK sorted\r\n"));
+    QCOMPARE(threadingModel->index(250, 0).data(RoleMessageUid).toUInt(), 1250u);
+    QCOMPARE(threadingModel->index(300, 0).data(RoleMessageUid).toUInt(), 1200u);
+    cEmpty();
+}
+
 void ImapModelThreadingTest::testThreadingPerformance()
 {
 #ifdef ASAN_BUILD
@@ -1294,6 +1711,33 @@ void ImapModelThreadingTest::testThreadingPerformance()
     }
 }
 
+/** @short Benchmark repeated rebuilds of the thread tree of a big mailbox */
+void ImapModelThreadingTest::testThreadingRebuildPerformance()
+{
+#ifdef ASAN_BUILD
+    qDebug() << "ASAN build detected, benchmarking with fewer items";
+    const uint num = 6660;
+#else
+    const uint num = 200000;
+#endif
+    initialMessages(num);
+    QByteArray untaggedThread = prepareHugeUntaggedThread(num);
+    QCOMPARE(SOCK->writtenStuff(), t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    SOCK->fakeReading(untaggedThread + t.last("OK thread\r\n"));
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    const auto mapping = model->cache()->messageThreading(QStringLiteral("a"));
+    QVERIFY(!mapping.isEmpty());
+    QCOMPARE(threadingModel->rowCount(), static_cast<int>(num / 10));
+
+    QBENCHMARK {
+        threadingModel->applyThreading(mapping);
+    }
+    QCOMPARE(threadingModel->rowCount(), static_cast<int>(num / 10));
+}
+
 void ImapModelThreadingTest::testSortingPerformance()
 {
     threadingModel->setUserWantsThreading(false);
@@ -1606,6 +2050,125 @@ void ImapModelThreadingTest::testDataChangedUnknownUid()
     cEmpty();
 }
 
+/** @short Make sure that the per-thread unread status and flags follow the changes of the individual messages */
+void ImapModelThreadingTest::testThreadAggregates()
+{
+    using namespace Imap::Mailbox;
+    initialMessages(4);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer("* THREAD (1 (2)(3))(4)\r\n" + t.last("OK thread\r\n"));
+    cEmpty();
+
+    QPersistentModelIndex root1 = findItem(QStringLiteral("0"));
+    QPersistentModelIndex msg3 = findItem(QStringLiteral("0.1"));
+    QPersistentModelIndex root4 = findItem(QStringLiteral("1"));
+    QCOMPARE(msg3.data(RoleMessageUid).toUInt(), 3u);
+    QCOMPARE(root1.data(RoleThreadRootWithUnreadMessages).toBool(), true);
+    QCOMPARE(root4.data(RoleThreadRootWithUnreadMessages).toBool(), true);
+    QCOMPARE(root1.data(RoleThreadAggregatedFlags).toStringList(), QStringList());
+
+    cServer("* 1 FETCH (FLAGS (\\Seen))\r\n* 2 FETCH (FLAGS (\\Seen))\r\n");
+    QCOMPARE(root1.data(RoleThreadRootWithUnreadMessages).toBool(), true);
+    cServer("* 3 FETCH (FLAGS (\\Seen \\Flagged))\r\n");
+    QCOMPARE(root1.data(RoleThreadRootWithUnreadMessages).toBool(), false);
+    QCOMPARE(root4.data(RoleThreadRootWithUnreadMessages).toBool(), true);
+    auto flags = root1.data(RoleThreadAggregatedFlags).toStringList();
+    flags.sort();
+    QCOMPARE(flags, QStringList() << QStringLiteral("\\Flagged") << QStringLiteral("\\Seen"));
+    QCOMPARE(msg3.data(RoleThreadAggregatedFlags).toStringList(),
+             QStringList() << QStringLiteral("\\Seen") << QStringLiteral("\\Flagged"));
+
+    // A change deep in the thread has to propagate up to the root
+    cServer("* 3 FETCH (FLAGS (\\Seen))\r\n");
+    QCOMPARE(root1.data(RoleThreadAggregatedFlags).toStringList(), QStringList() << QStringLiteral("\\Seen"));
+    cServer("* 2 FETCH (FLAGS ())\r\n");
+    QCOMPARE(root1.data(RoleThreadRootWithUnreadMessages).toBool(), true);
+
+    // Removing the only unread message makes the thread read again
+    cServer("* 2 EXPUNGE\r\n");
+    QCOMPARE(root1.data(RoleThreadRootWithUnreadMessages).toBool(), false);
+    QCOMPARE(root1.data(RoleThreadAggregatedFlags).toStringList(), QStringList() << QStringLiteral("\\Seen"));
+    QCOMPARE(QString::fromUtf8(treeToThreading(QModelIndex())), QStringLiteral("(1 3)(4)"));
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short A new arrival should only move the affected rows around, not relayout the whole model */
+void ImapModelThreadingTest::testTargetedTreeUpdates()
+{
+    initialMessages(3);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer("* THREAD (1)(2)(3)\r\n" + t.last("OK thread\r\n"));
+    cEmpty();
+
+    QPersistentModelIndex msg2 = findItem(QStringLiteral("1"));
+    QCOMPARE(msg2.data(Imap::Mailbox::RoleMessageUid).toUInt(), 2u);
+    QSignalSpy layoutChanged(threadingModel, SIGNAL(layoutChanged()));
+    QSignalSpy rowsMoved(threadingModel, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)));
+
+    cServer("* 4 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 4:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 4 FLAGS ())\r\n" + t.last("OK fetch\r\n"));
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer("* THREAD (1)(3)(2 4)\r\n" + t.last("OK thread\r\n"));
+    cEmpty();
+
+    QCOMPARE(QString::fromUtf8(treeToThreading(QModelIndex())), QStringLiteral("(1)(3)(2 4)"));
+    QCOMPARE(layoutChanged.size(), 0);
+    // The thread root goes to the end, and the new arrival becomes its child
+    QCOMPARE(rowsMoved.size(), 2);
+    QVERIFY(msg2.isValid());
+    QCOMPARE(msg2.row(), 2);
+    QCOMPARE(msg2.data(Imap::Mailbox::RoleMessageUid).toUInt(), 2u);
+    QCOMPARE(threadingModel->rowCount(msg2), 1);
+
+    // Many more threads, each with a reply
+    cServer("* 124 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 5:* (FLAGS)\r\n"));
+    QByteArray buf;
+    for (int uid = 5; uid <= 124; ++uid)
+        buf += "* " + QByteArray::number(uid) + " FETCH (UID " + QByteArray::number(uid) + " FLAGS ())\r\n";
+    cServer(buf + t.last("OK fetch\r\n"));
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    QByteArray threads = "(1)(3)(2 4)";
+    for (int uid = 5; uid <= 124; uid += 2)
+        threads += "(" + QByteArray::number(uid) + " " + QByteArray::number(uid + 1) + ")";
+    cServer("* THREAD " + threads + "\r\n" + t.last("OK thread\r\n"));
+    cEmpty();
+    QCOMPARE(QString::fromUtf8(treeToThreading(QModelIndex())), QString::fromUtf8(threads));
+
+    // The replies get expunged while the sorting is in flight. Until the delayed prune, they stay around as placeholders,
+    // which must not make the new order look like a completely different tree.
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QStringLiteral("SORT"));
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT);
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    layoutChanged.clear();
+    rowsMoved.clear();
+    QSignalSpy rowsRemoved(threadingModel, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QByteArray expunges;
+    for (int uid = 124; uid >= 6; uid -= 2)
+        expunges += "* " + QByteArray::number(uid) + " EXPUNGE\r\n";
+    // Thread 3 goes to the very end
+    QByteArray order = "1 2 4";
+    QByteArray expected = "(1)(2 4)";
+    for (int uid = 5; uid <= 123; uid += 2) {
+        order += " " + QByteArray::number(uid);
+        expected += "(" + QByteArray::number(uid) + ")";
+    }
+    order += " 3";
+    expected += "(3)";
+    cServer(expunges + "* SORT " + order + "\r\n" + t.last("OK sorted\r\n"));
+    cEmpty();
+    QCOMPARE(QString::fromUtf8(treeToThreading(QModelIndex())), QString::fromUtf8(expected));
+    QCOMPARE(layoutChanged.size(), 0);
+    QCOMPARE(rowsMoved.size(), 1);
+    // Each reply is removed on its own, within its thread
+    QCOMPARE(rowsRemoved.size(), 60);
+    QCOMPARE(msg2.row(), 1);
+    QVERIFY(errorSpy->isEmpty());
+}
+
 /** @short Verify parsing of various ESEARCH return results */
 void ImapModelThreadingTest::testESearchResults()
 {
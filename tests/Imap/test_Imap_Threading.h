@@ -39,14 +39,24 @@ private slots:
     void testThreadDeletionsAdditions();
     void testThreadDeletionsAdditions_data();
     void testDynamicSorting();
+    void testLocalSorting();
+    void testLocalSortingInBackground();
+    void testLocalThreading();
+    void testLocalThreadingMissingRoot();
     void testDynamicSortingContext();
     void testDynamicSearch();
+    void testProvisionalSearch();
+    void testLocalSearchIsProvisional();
+    void testPartialSorting();
     void testIncrementalThreading();
     void testRemovingRootWithThreadingInFlight();
     void testMultipleExpunges();
     void testVanishedHierarchyReplacement();
     void testDataChangedUnknownUid();
+    void testThreadAggregates();
+    void testTargetedTreeUpdates();
     void testThreadingPerformance();
+    void testThreadingRebuildPerformance();
     void testSortingPerformance();
     void testSearchingPerformance();
     void testFlatThreadDeletionPerformance();
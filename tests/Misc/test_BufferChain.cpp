@@ -0,0 +1,86 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_BufferChain.h"
+#include "Streams/BufferChain.h"
+
+using namespace Streams;
+
+void BufferChainTest::testIndexOf()
+{
+    BufferChain chain;
+    QCOMPARE(chain.indexOf('\n'), qint64(-1));
+    chain.append("* 1 FETCH");
+    chain.append(QByteArray());
+    chain.append(" (UID 3)\r");
+    chain.append("\n* 2 EXISTS\r\n");
+    QCOMPARE(chain.size(), qint64(31));
+    QCOMPARE(chain.indexOf('\n'), qint64(18));
+    QCOMPARE(chain.indexOf('\n', 18), qint64(18));
+    QCOMPARE(chain.indexOf('\n', 19), qint64(30));
+    QCOMPARE(chain.indexOf('\n', 31), qint64(-1));
+    QCOMPARE(chain.indexOf('x'), qint64(-1));
+
+    // Positions are relative to what is still available
+    QCOMPARE(chain.take(4), QByteArray("* 1 "));
+    QCOMPARE(chain.indexOf('\n'), qint64(14));
+    QCOMPARE(chain.indexOf('*'), qint64(15));
+}
+
+void BufferChainTest::testTakeAcrossChunks()
+{
+    BufferChain chain;
+    chain.append("abc");
+    chain.append("def");
+    chain.append("ghi");
+
+    QByteArray dest("_");
+    QCOMPARE(chain.takeInto(dest, 5), qint64(5));
+    QCOMPARE(dest, QByteArray("_abcde"));
+    QCOMPARE(chain.size(), qint64(4));
+    QCOMPARE(chain.take(100), QByteArray("fghi"));
+    QVERIFY(chain.isEmpty());
+    QCOMPARE(chain.takeInto(dest, 10), qint64(0));
+    QCOMPARE(dest, QByteArray("_abcde"));
+
+    chain.append("xyz");
+    chain.clear();
+    QVERIFY(chain.isEmpty());
+    QCOMPARE(chain.indexOf('x'), qint64(-1));
+}
+
+/** @short Taking a complete chunk into an empty buffer shall not copy the data */
+void BufferChainTest::testTakeWholeChunkShares()
+{
+    QByteArray literal(1024 * 1024, 'x');
+    BufferChain chain;
+    chain.append(literal);
+    chain.append("\r\n");
+
+    QByteArray dest;
+    QCOMPARE(chain.takeInto(dest, literal.size()), qint64(literal.size()));
+    QCOMPARE(dest.constData(), literal.constData());
+    QCOMPARE(chain.take(2), QByteArray("\r\n"));
+}
+
+QTEST_GUILESS_MAIN(BufferChainTest)
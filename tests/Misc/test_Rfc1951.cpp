@@ -0,0 +1,150 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QBuffer>
+#include <QTest>
+#include "test_Rfc1951.h"
+#include "Streams/BufferChain.h"
+#include "Streams/3rdparty/rfc1951.h"
+
+using namespace Streams;
+
+namespace {
+
+/** @short Something which looks like the server's side of the initial sync of a mailbox */
+QByteArray headerFetchTraffic(const int messages)
+{
+    QByteArray res;
+    for (int i = 1; i <= messages; ++i) {
+        res += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i + 1000) + " RFC822.SIZE "
+                + QByteArray::number(i * 37 % 50000) + " FLAGS (\\Seen) ENVELOPE (\"Sat, 5 Mar 2016 17:51:58 +0100\" "
+                "\"Re: a message number " + QByteArray::number(i) + "\" ((\"Some Sender\" NIL \"sender\" \"example.org\")) "
+                "((\"Some Sender\" NIL \"sender\" \"example.org\")) ((\"Some Sender\" NIL \"sender\" \"example.org\")) "
+                "((NIL NIL \"list\" \"lists.example.org\")) NIL NIL NIL \"<" + QByteArray::number(i) + "@example.org>\"))\r\n";
+    }
+    return res;
+}
+
+QByteArray decompressAll(Rfc1951Decompressor &decompressor, const QByteArray &data)
+{
+    BufferChain chain;
+    if (!decompressor.consume(data, &chain))
+        return QByteArray("[decompression failed]");
+    return chain.take(chain.size());
+}
+
+}
+
+void Rfc1951Test::testRoundTrip()
+{
+    QBuffer wire;
+    wire.open(QIODevice::ReadWrite);
+    Rfc1951Compressor compressor;
+    Rfc1951Decompressor decompressor;
+
+    QVERIFY(compressor.write(&wire, "y0 UID FETCH 1:* (FLAGS)\r\n"));
+    QVERIFY(compressor.flush(&wire));
+    QCOMPARE(decompressAll(decompressor, wire.data()), QByteArray("y0 UID FETCH 1:* (FLAGS)\r\n"));
+
+    wire.buffer().clear();
+    wire.seek(0);
+    QVERIFY(compressor.write(&wire, "y1 NOOP\r\n"));
+    QVERIFY(compressor.flush(&wire));
+    QCOMPARE(decompressAll(decompressor, wire.data()), QByteArray("y1 NOOP\r\n"));
+}
+
+/** @short Pipelined commands are compressed together and only flushed once */
+void Rfc1951Test::testFlushAtBoundaries()
+{
+    QBuffer wire;
+    wire.open(QIODevice::ReadWrite);
+    Rfc1951Compressor compressor;
+    Rfc1951Decompressor decompressor;
+
+    QVERIFY(compressor.write(&wire, "y0 NOOP\r\n"));
+    QVERIFY(compressor.write(&wire, "y1 NOOP\r\n"));
+    QVERIFY(compressor.write(&wire, "y2 NOOP\r\n"));
+    // Nothing usable has been produced yet for such a small amount of data
+    QCOMPARE(decompressAll(decompressor, wire.data()), QByteArray());
+    QVERIFY(compressor.flush(&wire));
+    const QByteArray compressed = wire.data();
+    QVERIFY(!compressed.isEmpty());
+
+    Rfc1951Decompressor fresh;
+    QCOMPARE(decompressAll(fresh, compressed), QByteArray("y0 NOOP\r\ny1 NOOP\r\ny2 NOOP\r\n"));
+
+    // A flush without any new data doesn't produce an empty block
+    QVERIFY(compressor.flush(&wire));
+    QCOMPARE(wire.data().size(), compressed.size());
+}
+
+/** @short Data spanning many output chunks, fed to the decompressor in odd pieces */
+void Rfc1951Test::testLargeTransfer()
+{
+    const QByteArray plain = headerFetchTraffic(2000);
+    QBuffer wire;
+    wire.open(QIODevice::ReadWrite);
+    Rfc1951Compressor compressor(8192, 9);
+    QVERIFY(compressor.write(&wire, plain));
+    QVERIFY(compressor.flush(&wire));
+    const QByteArray compressed = wire.data();
+    QVERIFY(compressed.size() * 5 < plain.size());
+
+    Rfc1951Decompressor decompressor;
+    BufferChain chain;
+    for (int pos = 0; pos < compressed.size(); pos += 1337) {
+        QVERIFY(decompressor.consume(compressed.mid(pos, 1337), &chain));
+    }
+    QCOMPARE(chain.size(), qint64(plain.size()));
+    QCOMPARE(chain.take(chain.size()), plain);
+}
+
+void Rfc1951Test::benchmarkCompress()
+{
+    const QByteArray plain = headerFetchTraffic(1000);
+    QBuffer wire;
+    wire.open(QIODevice::ReadWrite);
+    Rfc1951Compressor compressor;
+    QBENCHMARK {
+        wire.seek(0);
+        compressor.write(&wire, plain);
+        compressor.flush(&wire);
+    }
+}
+
+void Rfc1951Test::benchmarkDecompress()
+{
+    const QByteArray plain = headerFetchTraffic(1000);
+    QBuffer wire;
+    wire.open(QIODevice::ReadWrite);
+    Rfc1951Compressor compressor;
+    compressor.write(&wire, plain);
+    compressor.flush(&wire);
+    const QByteArray compressed = wire.data();
+    QBENCHMARK {
+        Rfc1951Decompressor decompressor;
+        BufferChain chain;
+        decompressor.consume(compressed, &chain);
+    }
+}
+
+QTEST_GUILESS_MAIN(Rfc1951Test)
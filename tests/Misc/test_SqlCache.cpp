@@ -20,8 +20,14 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <functional>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
 #include <QTest>
 #include "test_SqlCache.h"
+#include "Imap/Model/CombinedCache.h"
+#include "Imap/Model/LocalSearch.h"
 #include "Imap/Model/SQLCache.h"
 
 Q_DECLARE_METATYPE(QList<Imap::Mailbox::MailboxMetadata>)
@@ -88,4 +94,558 @@ void TestSqlCache::testMailboxOperation()
     QVERIFY(errorLog.empty());
 }
 
+void TestSqlCache::testPartDeduplication()
+{
+    using namespace Imap::Mailbox;
+
+    const QByteArray data("attachment");
+    cache->setMsgPart(QStringLiteral("INBOX"), 1, "2", data);
+    CHECK_CACHE_ERRORS;
+    cache->setMsgPart(QStringLiteral("Sent"), 10, "2", data);
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->messagePart(QStringLiteral("INBOX"), 1, "2"), data);
+    QCOMPARE(cache->messagePart(QStringLiteral("Sent"), 10, "2"), data);
+    QCOMPARE(cache->messagePartHash(QStringLiteral("INBOX"), 1, "2"), SQLCache::contentHash(data));
+    QCOMPARE(cache->messagePartHash(QStringLiteral("Sent"), 10, "2"), SQLCache::contentHash(data));
+    CHECK_CACHE_ERRORS;
+
+    // Removing one copy must not affect the other one
+    cache->forgetMessagePart(QStringLiteral("INBOX"), 1, "2");
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->messagePart(QStringLiteral("INBOX"), 1, "2"), QByteArray());
+    QCOMPARE(cache->messagePartHash(QStringLiteral("INBOX"), 1, "2"), QByteArray());
+    QCOMPARE(cache->messagePart(QStringLiteral("Sent"), 10, "2"), data);
+
+    // Overwriting a part with different data
+    cache->setMsgPart(QStringLiteral("Sent"), 10, "2", QByteArray("something else"));
+    QCOMPARE(cache->messagePart(QStringLiteral("Sent"), 10, "2"), QByteArray("something else"));
+    cache->clearMessage(QStringLiteral("Sent"), 10);
+    QCOMPARE(cache->messagePart(QStringLiteral("Sent"), 10, "2"), QByteArray());
+    CHECK_CACHE_ERRORS;
+
+    // Data stored outside of the DB are still reference-counted
+    const QByteArray hash = SQLCache::contentHash(QByteArray("big attachment"));
+    cache->setMsgPartReference(QStringLiteral("INBOX"), 2, "1", hash);
+    cache->setMsgPartReference(QStringLiteral("archive"), 3, "1", hash);
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->messagePart(QStringLiteral("INBOX"), 2, "1"), QByteArray());
+    QCOMPARE(cache->messagePartHash(QStringLiteral("INBOX"), 2, "1"), hash);
+    cache->clearMessage(QStringLiteral("INBOX"), 2);
+    QVERIFY(cache->takeOrphanedPartBlobs().isEmpty());
+    QCOMPARE(cache->messagePartHash(QStringLiteral("archive"), 3, "1"), hash);
+    cache->clearAllMessages(QStringLiteral("archive"));
+    QCOMPARE(cache->takeOrphanedPartBlobs(), QList<QByteArray>() << hash);
+    QCOMPARE(cache->messagePartHash(QStringLiteral("archive"), 3, "1"), QByteArray());
+
+    QVERIFY(errorLog.empty());
+}
+
+/** @short Make sure that the UID mapping survives being saved as a snapshot and a log of changes */
+void TestSqlCache::testUidMappingLog()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/imap.cache.sqlite");
+
+    Imap::Uids uids;
+    for (uint uid = 1; uid <= 10000; ++uid) {
+        uids << uid * 2;
+    }
+    Imap::Uids small{10, 11, 12};
+
+    {
+        SQLCache writer;
+        writer.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+        QVERIFY(writer.open(QStringLiteral("uidmap-writer"), fileName));
+        writer.setUidMapping(QStringLiteral("INBOX"), uids);
+        writer.setUidMapping(QStringLiteral("small"), small);
+        CHECK_CACHE_ERRORS;
+
+        // new arrivals
+        for (uint uid = 30000; uid < 30100; ++uid) {
+            uids << uid;
+            writer.setUidMapping(QStringLiteral("INBOX"), uids);
+        }
+        // a few expunges
+        uids.remove(0);
+        uids.remove(500, 20);
+        writer.setUidMapping(QStringLiteral("INBOX"), uids);
+        small.remove(1);
+        writer.setUidMapping(QStringLiteral("small"), small);
+        CHECK_CACHE_ERRORS;
+        QCOMPARE(writer.uidMapping(QStringLiteral("INBOX")), uids);
+        QCOMPARE(writer.uidMapping(QStringLiteral("small")), small);
+    }
+
+    SQLCache reader;
+    reader.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+    QVERIFY(reader.open(QStringLiteral("uidmap-reader"), fileName));
+    QCOMPARE(reader.uidMapping(QStringLiteral("INBOX")), uids);
+    QCOMPARE(reader.uidMapping(QStringLiteral("small")), small);
+    QCOMPARE(reader.uidMapping(QStringLiteral("nonexistent")), Imap::Uids());
+
+    // Continue from the replayed state
+    uids << 40000;
+    reader.setUidMapping(QStringLiteral("INBOX"), uids);
+    reader.clearUidMapping(QStringLiteral("small"));
+    QCOMPARE(reader.uidMapping(QStringLiteral("INBOX")), uids);
+    QCOMPARE(reader.uidMapping(QStringLiteral("small")), Imap::Uids());
+
+    // A big INBOX gets its arrivals and expunges logged as well
+    Imap::Uids huge;
+    for (uint uid = 1; uid <= 500000; ++uid) {
+        huge << uid;
+    }
+    reader.setUidMapping(QStringLiteral("huge"), huge);
+    huge << 500005;
+    reader.setUidMapping(QStringLiteral("huge"), huge);
+    huge.remove(10);
+    reader.setUidMapping(QStringLiteral("huge"), huge);
+    QCOMPARE(reader.uidMapping(QStringLiteral("huge")), huge);
+    QCOMPARE(reader.uidMapping(QStringLiteral("INBOX")), uids);
+    QVERIFY(errorLog.empty());
+}
+
+/** @short Flags stored in bulk and through the single-message API are interned into the same per-mailbox bitset */
+void TestSqlCache::testBulkFlags()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/imap.cache.sqlite");
+
+    AbstractCache::MessageFlagsList flags;
+    for (uint uid = 1; uid <= 1000; ++uid) {
+        QStringList item;
+        if (uid % 2)
+            item << QStringLiteral("\\Seen");
+        if (uid % 3 == 0)
+            item << QStringLiteral("\\Answered");
+        if (uid == 500)
+            item << QStringLiteral("$Label%1").arg(uid);
+        flags << qMakePair(uid, item);
+    }
+
+    {
+        SQLCache writer;
+        writer.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+        QVERIFY(writer.open(QStringLiteral("flags-writer"), fileName));
+        writer.setMsgFlags(QStringLiteral("INBOX"), flags);
+        writer.setMsgFlags(QStringLiteral("INBOX"), 1001, QStringList() << QStringLiteral("\\Flagged"));
+        writer.setMsgFlags(QStringLiteral("other"), 1, QStringList() << QStringLiteral("\\Deleted"));
+        CHECK_CACHE_ERRORS;
+        QCOMPARE(writer.msgFlags(QStringLiteral("INBOX"), 3), QStringList() << QStringLiteral("\\Seen") << QStringLiteral("\\Answered"));
+        QCOMPARE(writer.msgFlags(QStringLiteral("INBOX"), 4), QStringList());
+    }
+
+    SQLCache reader;
+    reader.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+    QVERIFY(reader.open(QStringLiteral("flags-reader"), fileName));
+    for (const auto &item : flags) {
+        QStringList stored = reader.msgFlags(QStringLiteral("INBOX"), item.first);
+        QStringList expected = item.second;
+        // The order is not preserved; flags are a set
+        stored.sort();
+        expected.sort();
+        QCOMPARE(stored, expected);
+    }
+    QCOMPARE(reader.msgFlags(QStringLiteral("INBOX"), 1001), QStringList() << QStringLiteral("\\Flagged"));
+    QCOMPARE(reader.msgFlags(QStringLiteral("other"), 1), QStringList() << QStringLiteral("\\Deleted"));
+
+    // Clearing a mailbox also forgets its interned names
+    reader.clearAllMessages(QStringLiteral("INBOX"));
+    QCOMPARE(reader.msgFlags(QStringLiteral("INBOX"), 1), QStringList());
+    reader.setMsgFlags(QStringLiteral("INBOX"), 1, QStringList() << QStringLiteral("\\Draft"));
+    QCOMPARE(reader.msgFlags(QStringLiteral("INBOX"), 1), QStringList() << QStringLiteral("\\Draft"));
+    QVERIFY(errorLog.empty());
+}
+
+void TestSqlCache::testSearchIndex()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    SQLCache cache;
+    cache.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+    QVERIFY(cache.open(QStringLiteral("search-index"), dir.path() + QLatin1String("/imap.cache.sqlite")));
+
+    AbstractCache::MessageDataBundle metadata;
+    metadata.uid = 1;
+    metadata.envelope.subject = QStringLiteral("Quarterly Report: Žluťoučký kůň");
+    metadata.envelope.from << Imap::Message::MailAddress(QStringLiteral("Alice Example"), QString(),
+                                                         QStringLiteral("alice"), QStringLiteral("example.org"));
+    cache.setMessageMetadata(QStringLiteral("INBOX"), 1, metadata);
+    metadata.uid = 2;
+    metadata.envelope.subject = QStringLiteral("re: lunch");
+    metadata.envelope.from.clear();
+    metadata.envelope.to << Imap::Message::MailAddress(QString(), QString(), QStringLiteral("alice"), QStringLiteral("example.org"));
+    cache.setMessageMetadata(QStringLiteral("INBOX"), 2, metadata);
+    cache.indexMessageText(QStringLiteral("INBOX"), 2, SEARCH_IN_BODY, QStringLiteral("See you at the REPORTING meeting"));
+    cache.setMessageMetadata(QStringLiteral("other"), 1, metadata);
+    CHECK_CACHE_ERRORS;
+
+    QCOMPARE(cache.indexedMessages(QStringLiteral("INBOX")), QSet<uint>() << 1 << 2);
+    QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_SUBJECT, QStringLiteral("report")), QSet<uint>() << 1);
+    QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_EVERYTHING, QStringLiteral("report")), QSet<uint>() << 1 << 2);
+    QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_SUBJECT, QStringLiteral("žluť")), QSet<uint>() << 1);
+    QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_FROM, QStringLiteral("alice")), QSet<uint>() << 1);
+    QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_FROM | SEARCH_IN_TO, QStringLiteral("alice")), QSet<uint>() << 1 << 2);
+    QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_EVERYTHING, QStringLiteral("nothing")), QSet<uint>());
+
+    LocalSearchQuery query;
+    QVERIFY(query.parse(QStringList() << QStringLiteral("OR") << QStringLiteral("SUBJECT") << QStringLiteral("quarterly rep")
+                        << QStringLiteral("BODY") << QStringLiteral("meeting") << QStringLiteral("UNSEEN")));
+    QVERIFY(query.needsBodies());
+    const auto lookupTerm = [&cache](const int fields, const QString &prefix) {
+        return cache.searchIndex(QStringLiteral("INBOX"), fields, prefix);
+    };
+    QCOMPARE(query.evaluate(QSet<uint>() << 1 << 2 << 3, lookupTerm, [](const QString &) { return QSet<uint>() << 2; }),
+             QSet<uint>() << 1);
+    QVERIFY(!query.parse(QStringList() << QStringLiteral("SUBJECT hello")));
+    QVERIFY(!query.parse(QStringList() << QStringLiteral("LARGER") << QStringLiteral("1000")));
+
+    cache.clearMessage(QStringLiteral("INBOX"), 2);
+    QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_EVERYTHING, QStringLiteral("alice")), QSet<uint>() << 1);
+    QCOMPARE(cache.searchIndex(QStringLiteral("other"), SEARCH_IN_EVERYTHING, QStringLiteral("lunch")), QSet<uint>() << 1);
+    cache.clearAllMessages(QStringLiteral("INBOX"));
+    QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_EVERYTHING, QStringLiteral("report")), QSet<uint>());
+    QVERIFY(errorLog.empty());
+}
+
+/** @short Messages which are cached but not indexed yet get indexed when somebody searches in their mailbox */
+void TestSqlCache::testLazySearchIndex()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/imap.cache.sqlite");
+    {
+        SQLCache cache;
+        cache.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+        QVERIFY(cache.open(QStringLiteral("lazy-index-1"), fileName));
+        AbstractCache::MessageDataBundle metadata;
+        for (uint uid = 1; uid <= 450; ++uid) {
+            metadata.uid = uid;
+            metadata.envelope.subject = uid == 333 ? QStringLiteral("needle") : QStringLiteral("haystack %1").arg(uid);
+            cache.setMessageMetadata(QStringLiteral("INBOX"), uid, metadata);
+        }
+        metadata.uid = 1;
+        cache.setMessageMetadata(QStringLiteral("other"), 1, metadata);
+        // There's nothing to index in this one
+        metadata.uid = 451;
+        metadata.envelope = Imap::Message::Envelope();
+        cache.setMessageMetadata(QStringLiteral("INBOX"), 451, metadata);
+        CHECK_CACHE_ERRORS;
+    }
+
+    // Run a query over the DB file directly, optionally returning the first column of its first row
+    auto rawQuery = [fileName](const QString &query, int *result) {
+        bool ok = false;
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), QStringLiteral("lazy-index-raw"));
+            db.setDatabaseName(fileName);
+            if (db.open()) {
+                QSqlQuery q(QString(), db);
+                ok = q.exec(query) && (!result || q.first());
+                if (ok && result)
+                    *result = q.value(0).toInt();
+                q.clear();
+                db.close();
+            }
+        }
+        QSqlDatabase::removeDatabase(QStringLiteral("lazy-index-raw"));
+        return ok;
+    };
+    int count = -1;
+
+    // Each message is marked as indexed, including the one without any words
+    QVERIFY(rawQuery(QStringLiteral("SELECT COUNT(*) FROM search_terms WHERE field = 0"), &count));
+    QCOMPARE(count, 452);
+
+    // Pretend that these were cached before the index existed
+    QVERIFY(rawQuery(QStringLiteral("DELETE FROM search_terms"), nullptr));
+
+    {
+        SQLCache cache;
+        cache.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+        QVERIFY(cache.open(QStringLiteral("lazy-index-2"), fileName));
+        cache.catchUpSearchIndex(QStringLiteral("INBOX"));
+        cache.catchUpSearchIndex(QStringLiteral("other"));
+        QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_SUBJECT, QStringLiteral("needle")), QSet<uint>() << 333);
+        QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_SUBJECT, QStringLiteral("haystack")).size(), 449);
+        QCOMPARE(cache.indexedMessages(QStringLiteral("INBOX")).size(), 451);
+        QCOMPARE(cache.searchIndex(QStringLiteral("other"), SEARCH_IN_SUBJECT, QStringLiteral("haystack")), QSet<uint>() << 1);
+        // The markers do not match any search
+        QCOMPARE(cache.searchIndex(QStringLiteral("INBOX"), SEARCH_IN_EVERYTHING, QString(QLatin1String(""))).size(), 450);
+    }
+
+    // The message without words got its marker, so the next session does not have to read it again
+    QVERIFY(rawQuery(QStringLiteral("SELECT COUNT(*) FROM msg_metadata WHERE uid NOT IN (SELECT uid FROM search_terms)"), &count));
+    QCOMPARE(count, 0);
+    QVERIFY(rawQuery(QStringLiteral("SELECT COUNT(*) FROM search_terms WHERE uid = 451"), &count));
+    QCOMPARE(count, 1);
+    QVERIFY(errorLog.empty());
+}
+
+/** @short A cache created by an older version keeps its data after the upgrade of the DB layout */
+void TestSqlCache::testUpgradeFromV7()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/imap.cache.sqlite");
+
+    auto serialize = [](const std::function<void(QDataStream &)> &writer) {
+        QByteArray buf;
+        QDataStream stream(&buf, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_4_6);
+        writer(stream);
+        return buf;
+    };
+
+    // This is how the v7 layout looked like, along with the v7 format of the blobs
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), QStringLiteral("upgrade-v7-raw"));
+        db.setDatabaseName(fileName);
+        QVERIFY(db.open());
+        QSqlQuery q(QString(), db);
+        QVERIFY(q.exec(QStringLiteral("CREATE TABLE trojita ( version STRING NOT NULL )")));
+        QVERIFY(q.exec(QStringLiteral("INSERT INTO trojita ( version ) VALUES ( 7 )")));
+        QVERIFY(q.exec(QStringLiteral("CREATE TABLE child_mailboxes ( mailbox STRING NOT NULL PRIMARY KEY, "
+                                      "parent STRING NOT NULL, separator STRING, flags BINARY)")));
+        QVERIFY(q.exec(QStringLiteral("CREATE TABLE uid_mapping ( mailbox STRING NOT NULL PRIMARY KEY, mapping BINARY )")));
+        QVERIFY(q.exec(QStringLiteral("CREATE TABLE msg_metadata (mailbox STRING NOT NULL, uid INT NOT NULL, data BINARY, "
+                                      "lastAccessDate INT, PRIMARY KEY (mailbox, uid))")));
+        QVERIFY(q.exec(QStringLiteral("CREATE TABLE flags (mailbox STRING NOT NULL, uid INT NOT NULL, flags BINARY, "
+                                      "PRIMARY KEY (mailbox, uid))")));
+        QVERIFY(q.exec(QStringLiteral("CREATE TABLE parts (mailbox STRING NOT NULL, uid INT NOT NULL, part_id BINARY, "
+                                      "data BINARY, PRIMARY KEY (mailbox, uid, part_id))")));
+        QVERIFY(q.exec(QStringLiteral("CREATE TABLE msg_threading ( mailbox STRING NOT NULL PRIMARY KEY, threading BINARY )")));
+        QVERIFY(q.exec(QStringLiteral("CREATE TABLE mailbox_sync_state ( mailbox STRING NOT NULL PRIMARY KEY, "
+                                      "sync_state BINARY )")));
+
+        QVERIFY(q.prepare(QStringLiteral("INSERT INTO child_mailboxes (mailbox, parent, separator, flags) VALUES (?, ?, ?, ?)")));
+        q.addBindValue(QStringLiteral("INBOX"));
+        q.addBindValue(QString());
+        q.addBindValue(QStringLiteral("."));
+        q.addBindValue(serialize([](QDataStream &stream) { stream << QStringList(); }));
+        QVERIFY(q.exec());
+
+        QVERIFY(q.prepare(QStringLiteral("INSERT INTO mailbox_sync_state (mailbox, sync_state) VALUES (?, ?)")));
+        for (const auto &mailbox : {QStringLiteral("INBOX"), QStringLiteral("broken")}) {
+            q.addBindValue(mailbox);
+            // The v7 sync state did not contain the flags resync cursor yet
+            q.addBindValue(serialize([](QDataStream &stream) {
+                stream << 3u << (QStringList() << QStringLiteral("\\Seen")) << QStringList() << 0u << 15u << 666u
+                       << quint64(33) << 1u << 0u;
+            }));
+            QVERIFY(q.exec());
+        }
+
+        QVERIFY(q.prepare(QStringLiteral("INSERT INTO uid_mapping (mailbox, mapping) VALUES (?, ?)")));
+        q.addBindValue(QStringLiteral("INBOX"));
+        q.addBindValue(qCompress(serialize([](QDataStream &stream) { stream << (Imap::Uids() << 6 << 9 << 10); })));
+        QVERIFY(q.exec());
+        // Five UIDs are promised, but none follow
+        q.addBindValue(QStringLiteral("broken"));
+        q.addBindValue(qCompress(serialize([](QDataStream &stream) { stream << 5u; })));
+        QVERIFY(q.exec());
+
+        QVERIFY(q.prepare(QStringLiteral("INSERT INTO msg_metadata (mailbox, uid, data, lastAccessDate) VALUES (?, ?, ?, ?)")));
+        for (const uint uid : {6u, 9u, 10u}) {
+            AbstractCache::MessageDataBundle metadata;
+            metadata.envelope.subject = QStringLiteral("subject %1").arg(uid);
+            metadata.size = 1000 + uid;
+            metadata.hdrReferences << QByteArray("<ref@x>");
+            q.addBindValue(QStringLiteral("INBOX"));
+            q.addBindValue(uid);
+            q.addBindValue(qCompress(serialize([&metadata](QDataStream &stream) {
+                stream << metadata.envelope << metadata.internalDate << metadata.size << metadata.serializedBodyStructure
+                       << metadata.hdrReferences << metadata.hdrListPost << metadata.hdrListPostNo;
+            })));
+            q.addBindValue(100);
+            QVERIFY(q.exec());
+        }
+
+        QVERIFY(q.prepare(QStringLiteral("INSERT INTO flags (mailbox, uid, flags) VALUES (?, ?, ?)")));
+        q.addBindValue(QStringLiteral("INBOX"));
+        q.addBindValue(9);
+        q.addBindValue(serialize([](QDataStream &stream) {
+            stream << (QStringList() << QStringLiteral("\\Seen") << QStringLiteral("\\Answered"));
+        }));
+        QVERIFY(q.exec());
+        q.addBindValue(QStringLiteral("INBOX"));
+        q.addBindValue(10);
+        q.addBindValue(serialize([](QDataStream &stream) { stream << (QStringList() << QStringLiteral("\\Seen")); }));
+        QVERIFY(q.exec());
+        // Two flags are promised, but none follow
+        q.addBindValue(QStringLiteral("INBOX"));
+        q.addBindValue(6);
+        q.addBindValue(serialize([](QDataStream &stream) { stream << 2u; }));
+        QVERIFY(q.exec());
+
+        QVERIFY(q.prepare(QStringLiteral("INSERT INTO parts (mailbox, uid, part_id, data) VALUES (?, ?, ?, ?)")));
+        q.addBindValue(QStringLiteral("INBOX"));
+        q.addBindValue(9);
+        q.addBindValue(QByteArray("1"));
+        q.addBindValue(QByteArray("old part"));
+        QVERIFY(q.exec());
+
+        QVERIFY(q.prepare(QStringLiteral("INSERT INTO msg_threading (mailbox, threading) VALUES (?, ?)")));
+        q.addBindValue(QStringLiteral("INBOX"));
+        QVector<Imap::Responses::ThreadingNode> threading;
+        threading << Imap::Responses::ThreadingNode(6, QVector<Imap::Responses::ThreadingNode>()
+                                                    << Imap::Responses::ThreadingNode(9) << Imap::Responses::ThreadingNode(10));
+        q.addBindValue(qCompress(serialize([&threading](QDataStream &stream) { stream << threading; })));
+        QVERIFY(q.exec());
+
+        q.clear();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(QStringLiteral("upgrade-v7-raw"));
+
+    SQLCache cache;
+    cache.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+    QVERIFY(cache.open(QStringLiteral("upgrade-v7"), fileName));
+    // The corrupt blobs get reported and skipped, everything else is converted
+    QCOMPARE(errorLog.size(), size_t(2));
+    errorLog.clear();
+
+    const QString inbox = QStringLiteral("INBOX");
+    SyncState sync = cache.mailboxSyncState(inbox);
+    QCOMPARE(sync.exists(), 3u);
+    QCOMPARE(sync.flags(), QStringList() << QStringLiteral("\\Seen"));
+    QCOMPARE(sync.uidNext(), 15u);
+    QCOMPARE(sync.uidValidity(), 666u);
+    QCOMPARE(sync.highestModSeq(), quint64(33));
+    QCOMPARE(sync.unSeenCount(), 1u);
+    QCOMPARE(sync.flagsResyncCursor(), 0u);
+    QCOMPARE(cache.mailboxSyncState(QStringLiteral("broken")).uidValidity(), 666u);
+
+    QCOMPARE(cache.uidMapping(inbox), Imap::Uids() << 6 << 9 << 10);
+    QCOMPARE(cache.uidMapping(QStringLiteral("broken")), Imap::Uids());
+
+    QCOMPARE(cache.msgFlags(inbox, 9), QStringList() << QStringLiteral("\\Seen") << QStringLiteral("\\Answered"));
+    QCOMPARE(cache.msgFlags(inbox, 10), QStringList() << QStringLiteral("\\Seen"));
+    QCOMPARE(cache.msgFlags(inbox, 6), QStringList());
+
+    for (const uint uid : {6u, 9u, 10u}) {
+        const auto metadata = cache.messageMetadata(inbox, uid);
+        QCOMPARE(metadata.uid, uid);
+        QCOMPARE(metadata.envelope.subject, QStringLiteral("subject %1").arg(uid));
+        QCOMPARE(metadata.size, quint64(1000 + uid));
+        QCOMPARE(metadata.hdrReferences, QList<QByteArray>() << QByteArray("<ref@x>"));
+    }
+
+    auto cachedThreading = cache.messageThreading(inbox);
+    QCOMPARE(cachedThreading.size(), 1);
+    QCOMPARE(cachedThreading[0].num, 6u);
+    QCOMPARE(cachedThreading[0].children.size(), 2);
+    QCOMPARE(cachedThreading[0].children[1].num, 10u);
+
+    QCOMPARE(cache.childMailboxes(QString()).size(), 1);
+    QCOMPARE(cache.childMailboxes(QString())[0].mailbox, inbox);
+
+    // The old message parts are not worth converting
+    QCOMPARE(cache.messagePart(inbox, 9, "1"), QByteArray());
+
+    // The converted data can be updated as usual
+    cache.setUidMapping(inbox, Imap::Uids() << 6 << 9 << 10 << 11);
+    QCOMPARE(cache.uidMapping(inbox), Imap::Uids() << 6 << 9 << 10 << 11);
+    cache.setMsgFlags(inbox, 11, QStringList() << QStringLiteral("\\Answered"));
+    QCOMPARE(cache.msgFlags(inbox, 11), QStringList() << QStringLiteral("\\Answered"));
+    QVERIFY(errorLog.empty());
+}
+
+/** @short The in-memory tier of the CombinedCache: hits, misses, evictions and forgetting */
+void TestSqlCache::testHotTier()
+{
+    using namespace Imap::Mailbox;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString inbox = QStringLiteral("INBOX");
+    {
+        CombinedCache cache(QStringLiteral("hot-tier-1"), dir.path());
+        cache.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+        QVERIFY(cache.open());
+        AbstractCache::MessageDataBundle metadata;
+        metadata.uid = 1;
+        metadata.envelope.subject = QStringLiteral("hot");
+        cache.setMessageMetadata(inbox, 1, metadata);
+        cache.setMsgFlags(inbox, 1, QStringList() << QStringLiteral("\\Seen"));
+        cache.setMsgPart(inbox, 1, "1", "small part");
+
+        // Writes go through the hot tier, so reading them back is a hit
+        QCOMPARE(cache.messageMetadata(inbox, 1).envelope.subject, QStringLiteral("hot"));
+        QCOMPARE(cache.msgFlags(inbox, 1), QStringList() << QStringLiteral("\\Seen"));
+        QCOMPARE(cache.messagePart(inbox, 1, "1"), QByteArray("small part"));
+        auto stats = cache.hotTierStatistics();
+        QCOMPARE(stats.metadataHits, 1ull);
+        QCOMPARE(stats.metadataMisses, 0ull);
+        QCOMPARE(stats.flagsHits, 1ull);
+        QCOMPARE(stats.flagsMisses, 0ull);
+        QCOMPARE(stats.partHits, 1ull);
+        QCOMPARE(stats.partMisses, 0ull);
+    }
+
+    CombinedCache cache(QStringLiteral("hot-tier-2"), dir.path());
+    cache.setErrorHandler([this](const QString &e) { this->errorLog.push_back(e); });
+    QVERIFY(cache.open());
+
+    // A miss loads the data from the SQL cache and keeps them around
+    QCOMPARE(cache.messageMetadata(inbox, 1).envelope.subject, QStringLiteral("hot"));
+    QCOMPARE(cache.messageMetadata(inbox, 1).envelope.subject, QStringLiteral("hot"));
+    QCOMPARE(cache.messagePart(inbox, 1, "1"), QByteArray("small part"));
+    QCOMPARE(cache.messagePart(inbox, 1, "1"), QByteArray("small part"));
+    QCOMPARE(cache.messagePart(inbox, 1, "2"), QByteArray());
+    auto stats = cache.hotTierStatistics();
+    QCOMPARE(stats.metadataHits, 1ull);
+    QCOMPARE(stats.metadataMisses, 1ull);
+    QCOMPARE(stats.partHits, 1ull);
+    QCOMPARE(stats.partMisses, 2ull);
+
+    // Parts are evicted once their total size goes over the limit, but they are still available from the lower tiers
+    const QByteArray bigPart(64 * 1024, 'x');
+    for (uint uid = 2; uid < 200; ++uid) {
+        cache.setMsgPart(inbox, uid, "1", bigPart);
+    }
+    QCOMPARE(cache.messagePart(inbox, 199, "1"), bigPart);
+    QCOMPARE(cache.hotTierStatistics().partHits, stats.partHits + 1);
+    stats = cache.hotTierStatistics();
+    QCOMPARE(cache.messagePart(inbox, 2, "1"), bigPart);
+    QCOMPARE(cache.hotTierStatistics().partMisses, stats.partMisses + 1);
+    QCOMPARE(cache.messagePart(inbox, 2, "1"), bigPart);
+    QCOMPARE(cache.hotTierStatistics().partHits, stats.partHits + 1);
+
+    // Parts which are too big for the hot tier never get there
+    cache.setMsgPart(inbox, 200, "1", QByteArray(100 * 1024, 'y'));
+    stats = cache.hotTierStatistics();
+    QCOMPARE(cache.messagePart(inbox, 200, "1"), QByteArray(100 * 1024, 'y'));
+    QCOMPARE(cache.hotTierStatistics().partMisses, stats.partMisses + 1);
+
+    cache.clearMessage(inbox, 199);
+    stats = cache.hotTierStatistics();
+    QCOMPARE(cache.messagePart(inbox, 199, "1"), QByteArray());
+    QCOMPARE(cache.hotTierStatistics().partMisses, stats.partMisses + 1);
+
+    // Forgetting the whole mailbox makes the old entries unreachable
+    cache.clearAllMessages(inbox);
+    stats = cache.hotTierStatistics();
+    QCOMPARE(cache.messageMetadata(inbox, 1).uid, 0u);
+    QCOMPARE(cache.msgFlags(inbox, 1), QStringList());
+    QCOMPARE(cache.messagePart(inbox, 2, "1"), QByteArray());
+    QCOMPARE(cache.hotTierStatistics().metadataMisses, stats.metadataMisses + 1);
+    QCOMPARE(cache.hotTierStatistics().flagsMisses, stats.flagsMisses + 1);
+    QCOMPARE(cache.hotTierStatistics().partMisses, stats.partMisses + 1);
+    QCOMPARE(cache.hotTierStatistics().metadataHits, stats.metadataHits);
+    QVERIFY(errorLog.empty());
+}
+
 QTEST_GUILESS_MAIN(TestSqlCache)
@@ -39,6 +39,13 @@ private Q_SLOTS:
     void initTestCase();
     void cleanupTestCase();
     void testMailboxOperation();
+    void testPartDeduplication();
+    void testUidMappingLog();
+    void testBulkFlags();
+    void testSearchIndex();
+    void testLazySearchIndex();
+    void testUpgradeFromV7();
+    void testHotTier();
 
 private:
     std::shared_ptr<Imap::Mailbox::SQLCache> cache;
@@ -0,0 +1,94 @@
+/* Copyright (C) 2006 - 2016 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_TlsSessionCache.h"
+#include "Streams/TlsSessionCache.h"
+
+using namespace Streams;
+
+/** @short The ticket is only offered to the server which has issued it */
+void TlsSessionCacheTest::testLookup()
+{
+    TlsSessionCache cache;
+    QVERIFY(cache.ticket(QStringLiteral("imap.example.org"), 993).isNull());
+
+    int changes = 0;
+    cache.setChangeHandler([&changes]() { ++changes; });
+    cache.setTicket(QStringLiteral("imap.example.org"), 993, "ticket", 3600);
+    QCOMPARE(changes, 1);
+    QCOMPARE(cache.ticket(QStringLiteral("imap.example.org"), 993), QByteArray("ticket"));
+    QVERIFY(cache.ticket(QStringLiteral("imap.example.org"), 143).isNull());
+    QVERIFY(cache.ticket(QStringLiteral("mail.example.org"), 993).isNull());
+
+    cache.setTicket(QStringLiteral("imap.example.org"), 993, "another", 3600);
+    QCOMPARE(changes, 2);
+    QCOMPARE(cache.ticket(QStringLiteral("imap.example.org"), 993), QByteArray("another"));
+
+    cache.clear();
+    QVERIFY(cache.ticket(QStringLiteral("imap.example.org"), 993).isNull());
+}
+
+/** @short Expired tickets are not offered, and a missing lifetime hint falls back to a default */
+void TlsSessionCacheTest::testExpiry()
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    TlsSessionCache cache;
+    cache.setTicket(QStringLiteral("h"), 993, "ticket", 60, now);
+    QCOMPARE(cache.ticket(QStringLiteral("h"), 993, now.addSecs(59)), QByteArray("ticket"));
+    QVERIFY(cache.ticket(QStringLiteral("h"), 993, now.addSecs(60)).isNull());
+
+    cache.setTicket(QStringLiteral("h"), 993, "ticket", -1, now);
+    QCOMPARE(cache.ticket(QStringLiteral("h"), 993, now.addSecs(60 * 60)), QByteArray("ticket"));
+    QVERIFY(cache.ticket(QStringLiteral("h"), 993, now.addDays(1)).isNull());
+
+    // A hint of zero means that the server did not say anything, not that the ticket is expired already
+    cache.setTicket(QStringLiteral("h"), 993, "ticket", 0, now);
+    QCOMPARE(cache.ticket(QStringLiteral("h"), 993, now), QByteArray("ticket"));
+    QCOMPARE(cache.ticket(QStringLiteral("h"), 993, now.addSecs(60 * 60)), QByteArray("ticket"));
+    QVERIFY(cache.ticket(QStringLiteral("h"), 993, now.addDays(1)).isNull());
+
+    // Even if the server says so, a ticket is not trusted for more than a week
+    cache.setTicket(QStringLiteral("h"), 993, "ticket", 30 * 24 * 60 * 60, now);
+    QCOMPARE(cache.ticket(QStringLiteral("h"), 993, now.addDays(6)), QByteArray("ticket"));
+    QVERIFY(cache.ticket(QStringLiteral("h"), 993, now.addDays(8)).isNull());
+}
+
+/** @short The cached session survives a round trip through its on-disk representation */
+void TlsSessionCacheTest::testSerialization()
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    TlsSessionCache cache;
+    QVERIFY(cache.serialize().isEmpty());
+    cache.setTicket(QStringLiteral("imap.example.org"), 993, QByteArray("tick\0et", 7), 3600, now);
+
+    TlsSessionCache restored;
+    QVERIFY(restored.deserialize(cache.serialize()));
+    QCOMPARE(restored.ticket(QStringLiteral("imap.example.org"), 993, now), QByteArray("tick\0et", 7));
+    QVERIFY(restored.ticket(QStringLiteral("imap.example.org"), 993, now.addSecs(3600)).isNull());
+
+    QVERIFY(!restored.deserialize(QByteArray("garbage")));
+    QVERIFY(restored.ticket(QStringLiteral("imap.example.org"), 993, now).isNull());
+    QVERIFY(!restored.deserialize(QByteArray()));
+}
+
+QTEST_GUILESS_MAIN(TlsSessionCacheTest)